@@ -0,0 +1,55 @@
+#!/usr/bin/env python
+"""
+WsgiBoostServer allocation benchmark
+
+Counts C++ heap allocations per hello-world request on a keep-alive connection.
+The module must be built with ``WSGI_BOOST_COUNT_ALLOCATIONS`` environment variable set::
+
+  WSGI_BOOST_COUNT_ALLOCATIONS=1 python setup.py build_ext --inplace
+"""
+
+from __future__ import print_function
+import socket
+import threading
+import time
+import wsgi_boost
+
+REQUESTS = 10000
+
+
+def hello_app(environ, start_response):
+    content = b'Hello World!'
+    response_headers = [('Content-type', 'text/plain'), ('Content-Length', str(len(content)))]
+    start_response('200 OK', response_headers)
+    return [content]
+
+
+def get(sock):
+    sock.sendall(b'GET / HTTP/1.1\r\nHost: 127.0.0.1:8000\r\nAccept: */*\r\n\r\n')
+    response = b''
+    while not response.endswith(b'Hello World!'):
+        response += sock.recv(4096)
+
+
+if __name__ == '__main__':
+    if not hasattr(wsgi_boost, 'allocation_count'):
+        raise SystemExit('wsgi_boost module is built without WSGI_BOOST_COUNT_ALLOCATIONS')
+    httpd = wsgi_boost.WsgiBoostHttp(num_threads=1)
+    httpd.set_app(hello_app)
+    server_thread = threading.Thread(target=httpd.start)
+    server_thread.daemon = True
+    server_thread.start()
+    time.sleep(0.5)
+    sock = socket.create_connection(('127.0.0.1', 8000))
+    # Warm up the connection and lazily initialized state
+    for _ in range(100):
+        get(sock)
+    start = wsgi_boost.allocation_count()
+    for _ in range(REQUESTS):
+        get(sock)
+    allocations = wsgi_boost.allocation_count() - start
+    sock.close()
+    httpd.stop()
+    server_thread.join()
+    print('Requests: {0}'.format(REQUESTS))
+    print('Allocations per request: {0:.1f}'.format(float(allocations) / REQUESTS))
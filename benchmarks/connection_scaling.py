@@ -0,0 +1,278 @@
+#!/usr/bin/env python
+"""
+WsgiBoostServer connection scaling benchmark
+
+Opens persistent connections to scenario_server.py in stages and at each stage samples
+the server memory (RSS), the number of open file descriptors and the latency
+of probe requests. The report shows memory per connection and tail latency
+against the number of connections. Linux only.
+
+Modes:
+
+- ``idle``: each connection makes one request and stays open as an idle keep-alive connection.
+- ``pending``: each connection sends an incomplete request header, so the server waits for the rest.
+
+Example::
+
+  python benchmarks/connection_scaling.py --stages 1000,10000,50000,100000 -o scaling.json
+
+Open files limits of the benchmark and of the server are raised to the hard limit,
+which must be above the max. number of connections (see ``ulimit -Hn``).
+Connections use several source addresses (127.0.0.1, 127.0.0.2...) to avoid running out
+of ephemeral ports.
+"""
+
+from __future__ import print_function
+import argparse
+import errno
+import json
+import os
+import resource
+import selectors
+import socket
+import subprocess
+import sys
+import time
+
+bench_dir = os.path.dirname(os.path.abspath(__file__))
+
+REQUEST = b'GET / HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n'
+PARTIAL_REQUEST = b'GET / HTTP/1.1\r\nHost: 127.0.0.1\r\n'
+RESPONSE_END = b'Hello World!'
+# Connections per source address, below the default ephemeral port range size
+CONNECTIONS_PER_ADDRESS = 25000
+BATCH_SIZE = 1000
+
+
+def raise_fd_limit():
+    soft, hard = resource.getrlimit(resource.RLIMIT_NOFILE)
+    resource.setrlimit(resource.RLIMIT_NOFILE, (hard, hard))
+    return hard
+
+
+def read_responses(socks, timeout=30.0):
+    """
+    Wait for a hello world response on each socket, returns response times in seconds
+    """
+    selector = selectors.DefaultSelector()
+    buffers = {}
+    start = time.time()
+    for sock in socks:
+        sock.setblocking(False)
+        selector.register(sock, selectors.EVENT_READ)
+        buffers[sock] = b''
+    latencies = []
+    while buffers:
+        events = selector.select(timeout=max(0.0, start + timeout - time.time()))
+        if not events:
+            raise RuntimeError('Timeout waiting for {0} responses'.format(len(buffers)))
+        for key, _ in events:
+            sock = key.fileobj
+            data = sock.recv(4096)
+            if not data:
+                raise RuntimeError('Connection closed by the server')
+            buffers[sock] += data
+            if buffers[sock].endswith(RESPONSE_END):
+                latencies.append(time.time() - start)
+                selector.unregister(sock)
+                del buffers[sock]
+    selector.close()
+    for sock in socks:
+        sock.setblocking(True)
+    return latencies
+
+
+def open_connections(count, first_index, port, mode):
+    socks = []
+    for i in range(first_index, first_index + count):
+        sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        sock.bind(('127.0.0.{0}'.format(1 + i // CONNECTIONS_PER_ADDRESS), 0))
+        sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        sock.connect(('127.0.0.1', port))
+        socks.append(sock)
+    for start in range(0, len(socks), BATCH_SIZE):
+        batch = socks[start:start + BATCH_SIZE]
+        for sock in batch:
+            sock.sendall(REQUEST if mode == 'idle' else PARTIAL_REQUEST)
+        if mode == 'idle':
+            read_responses(batch)
+    return socks
+
+
+def percentile(values, percent):
+    values = sorted(values)
+    if not values:
+        return 0.0
+    index = min(len(values) - 1, max(0, int(round(percent / 100.0 * len(values) + 0.5)) - 1))
+    return values[index]
+
+
+def probe_latencies(port, requests_count):
+    """
+    Latencies of sequential requests on a fresh keep-alive connection
+    """
+    sock = socket.create_connection(('127.0.0.1', port))
+    sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+    latencies = []
+    for _ in range(requests_count):
+        start = time.time()
+        sock.sendall(REQUEST)
+        response = b''
+        while not response.endswith(RESPONSE_END):
+            data = sock.recv(4096)
+            if not data:
+                raise RuntimeError('Connection closed by the server')
+            response += data
+        latencies.append(time.time() - start)
+    sock.close()
+    return latencies
+
+
+def wake_latencies(socks, sample_size):
+    """
+    Latencies of requests sent at once on a sample of idle connections
+    """
+    step = max(1, len(socks) // sample_size)
+    sample = socks[::step][:sample_size]
+    for sock in sample:
+        sock.sendall(REQUEST)
+    return read_responses(sample)
+
+
+def server_memory(pid):
+    rss = 0
+    with open('/proc/{0}/status'.format(pid)) as fo:
+        for line in fo:
+            if line.startswith('VmRSS:'):
+                rss = int(line.split()[1]) * 1024
+    return rss
+
+
+def server_fds(pid):
+    return len(os.listdir('/proc/{0}/fd'.format(pid)))
+
+
+def active_connections(port):
+    sock = socket.create_connection(('127.0.0.1', port))
+    sock.sendall(b'GET /metrics HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: close\r\n\r\n')
+    response = b''
+    while True:
+        data = sock.recv(65536)
+        if not data:
+            break
+        response += data
+    sock.close()
+    for line in response.decode('utf-8').splitlines():
+        if line.startswith('wsgi_boost_active_connections '):
+            return int(float(line.split()[1]))
+    return -1
+
+
+def wait_for_server(port, timeout=10.0):
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        try:
+            socket.create_connection(('127.0.0.1', port), timeout=1.0).close()
+            return
+        except socket.error:
+            time.sleep(0.1)
+    raise RuntimeError('The benchmark server is not responding')
+
+
+def sample(port, pid, args, socks, baseline_rss):
+    time.sleep(args.settle)
+    rss = server_memory(pid)
+    probe = probe_latencies(port, args.probe_requests)
+    result = {
+        'connections': len(socks),
+        'active_connections': active_connections(port),
+        'rss': rss,
+        'fds': server_fds(pid),
+        'rss_per_connection': float(rss - baseline_rss) / len(socks) if socks else 0.0,
+        'probe_ms': {
+            'p50': percentile(probe, 50) * 1000.0,
+            'p99': percentile(probe, 99) * 1000.0,
+            'max': max(probe) * 1000.0,
+        },
+    }
+    if args.mode == 'idle' and socks:
+        wake = wake_latencies(socks, args.wake_sample)
+        result['wake_ms'] = {
+            'p50': percentile(wake, 50) * 1000.0,
+            'p99': percentile(wake, 99) * 1000.0,
+            'max': max(wake) * 1000.0,
+        }
+    return result
+
+
+def print_report(report):
+    stages = report['stages']
+    max_memory = max(stage['rss_per_connection'] for stage in stages) or 1.0
+    max_latency = max(stage['probe_ms']['p99'] for stage in stages) or 1.0
+    print('Mode: {0}, baseline RSS: {1:.1f} MB'.format(report['mode'], report['baseline_rss'] / 1048576.0))
+    print('{0:>12}{1:>10}{2:>9}{3:>14}  {4:<22}{5:>10}  {6:<22}'.format(
+        'connections', 'RSS MB', 'fds', 'RSS/conn KB', '', 'p99 ms', ''))
+    for stage in stages:
+        memory_bar = '#' * int(round(20 * stage['rss_per_connection'] / max_memory))
+        latency_bar = '#' * int(round(20 * stage['probe_ms']['p99'] / max_latency))
+        print('{0:>12}{1:>10.1f}{2:>9}{3:>14.2f}  {4:<22}{5:>10.3f}  {6:<22}'.format(
+            stage['connections'], stage['rss'] / 1048576.0, stage['fds'],
+            stage['rss_per_connection'] / 1024.0, memory_bar, stage['probe_ms']['p99'], latency_bar))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='WsgiBoostServer connection scaling benchmark')
+    parser.add_argument('--stages', default='1000,10000,25000,50000,100000',
+                        help='comma-separated numbers of connections')
+    parser.add_argument('--mode', choices=('idle', 'pending'), default='idle')
+    parser.add_argument('--port', type=int, default=8000)
+    parser.add_argument('--threads', type=int, default=4, help='server threads')
+    parser.add_argument('--probe-requests', type=int, default=200, help='probe requests at each stage')
+    parser.add_argument('--wake-sample', type=int, default=500,
+                        help='idle connections that send a request at once at each stage')
+    parser.add_argument('--settle', type=float, default=1.0, help='delay before sampling in seconds')
+    parser.add_argument('-o', '--output', help='save the report to a JSON file')
+    args = parser.parse_args()
+    if not sys.platform.startswith('linux'):
+        raise SystemExit('The benchmark is supported only on Linux')
+    stages = sorted(int(stage) for stage in args.stages.split(','))
+    fd_limit = raise_fd_limit()
+    if stages[-1] + 100 > fd_limit:
+        raise SystemExit('Open files limit {0} is too low for {1} connections'.format(fd_limit, stages[-1]))
+    server = subprocess.Popen([sys.executable, os.path.join(bench_dir, 'scenario_server.py'),
+                               '--port', str(args.port), '--threads', str(args.threads),
+                               '--keep-alive-timeout', '3600', '--header-timeout', '3600',
+                               '--fd-watermark', '0', '--metrics-path', '/metrics'],
+                              preexec_fn=raise_fd_limit)
+    socks = []
+    report = {'mode': args.mode, 'stages': []}
+    try:
+        wait_for_server(args.port)
+        # Warm up the server before measuring the baseline
+        probe_latencies(args.port, args.probe_requests)
+        time.sleep(args.settle)
+        report['baseline_rss'] = server_memory(server.pid)
+        for count in stages:
+            print('Opening {0} connections...'.format(count), file=sys.stderr)
+            socks += open_connections(count - len(socks), len(socks), args.port, args.mode)
+            report['stages'].append(sample(args.port, server.pid, args, socks, report['baseline_rss']))
+    except socket.error as ex:
+        if ex.errno in (errno.EMFILE, errno.EADDRNOTAVAIL):
+            print('Unable to open more connections: {0}'.format(ex), file=sys.stderr)
+        else:
+            raise
+    finally:
+        for sock in socks:
+            sock.close()
+        server.terminate()
+        server.wait()
+    if report['stages']:
+        print_report(report)
+    if args.output:
+        with open(args.output, 'w') as fo:
+            json.dump(report, fo, indent=2, sort_keys=True)
+            fo.write('\n')
+
+
+if __name__ == '__main__':
+    main()
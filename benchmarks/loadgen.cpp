@@ -0,0 +1,722 @@
+/*
+HTTP load generator for WsgiBoostServer benchmarks
+
+Copyright (c) 2016 Roman Miroshnychenko <romanvm@yandex.ua>
+License: MIT, see License.txt
+*/
+
+#include <boost/asio.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+namespace asio = boost::asio;
+namespace sys = boost::system;
+
+typedef chrono::steady_clock steady_clock;
+
+
+namespace
+{
+	const char usage[] =
+		"Usage: wsgi_boost_loadgen [options] URL\n\n"
+		"Options:\n"
+		"  -c, --connections N   number of connections (default: 10)\n"
+		"  -t, --threads N       number of threads (default: 1)\n"
+		"  -d, --duration SEC    measurement duration in seconds (default: 10)\n"
+		"  -w, --warmup SEC      warm-up time excluded from results (default: 0)\n"
+		"  -R, --rate N          total request rate per second, 0 for max. throughput (default: 0)\n"
+		"  -p, --pipeline N      max. pipelined requests per connection (default: 1)\n"
+		"  -m, --method METHOD   HTTP method (default: GET)\n"
+		"  -H, --header HEADER   additional request header, e.g. \"Accept-Encoding: gzip\"\n"
+		"  -b, --body-size N     request body size in bytes (default: 0)\n"
+		"  -k, --no-keep-alive   open a new connection for each request\n"
+		"  -l, --label LABEL     scenario label for the report\n"
+		"  -o, --output FILE     write the JSON report to a file instead of stdout\n\n"
+		"With a fixed rate latencies are measured from the time a request was scheduled\n"
+		"to be sent, so a stalled server is not hidden by delayed requests (coordinated omission).\n";
+
+
+	struct Options
+	{
+		string url;
+		string host;
+		string port = "80";
+		string path = "/";
+		string method = "GET";
+		vector<string> headers;
+		size_t body_size = 0;
+		unsigned int connections = 10;
+		unsigned int threads = 1;
+		unsigned int pipeline = 1;
+		double duration = 10.0;
+		double warmup = 0.0;
+		double rate = 0.0;
+		bool keep_alive = true;
+		string label;
+		string output;
+	};
+
+
+	// Latency histogram in microseconds with 32 sub-buckets for each power of 2.
+	// Recorded values are exact below 32us and have relative error below 1/32 above.
+	class Histogram
+	{
+	public:
+		static const unsigned int sub_bits = 5;
+		static const size_t sub_count = 1 << sub_bits;
+
+		Histogram() : m_buckets((64 - sub_bits + 1) * sub_count, 0) {}
+
+		void record(unsigned long long value)
+		{
+			++m_buckets[index(value)];
+			++m_count;
+			m_sum += value;
+			m_min = min(m_min, value);
+			m_max = max(m_max, value);
+		}
+
+		void add(const Histogram& other)
+		{
+			for (size_t i = 0; i < m_buckets.size(); ++i)
+				m_buckets[i] += other.m_buckets[i];
+			m_count += other.m_count;
+			m_sum += other.m_sum;
+			m_min = min(m_min, other.m_min);
+			m_max = max(m_max, other.m_max);
+		}
+
+		// Get the highest value equivalent to a percentile (0-100)
+		unsigned long long percentile(double percent) const
+		{
+			if (m_count == 0)
+				return 0;
+			unsigned long long rank = static_cast<unsigned long long>(ceil(percent / 100.0 * m_count));
+			rank = max(rank, 1ULL);
+			unsigned long long total = 0;
+			for (size_t i = 0; i < m_buckets.size(); ++i)
+			{
+				total += m_buckets[i];
+				if (total >= rank)
+					return min(upper_bound(i), m_max);
+			}
+			return m_max;
+		}
+
+		unsigned long long count() const { return m_count; }
+		unsigned long long minimum() const { return m_count ? m_min : 0; }
+		unsigned long long maximum() const { return m_max; }
+		double mean() const { return m_count ? static_cast<double>(m_sum) / m_count : 0.0; }
+
+	private:
+		vector<unsigned long long> m_buckets;
+		unsigned long long m_count = 0;
+		unsigned long long m_sum = 0;
+		unsigned long long m_min = ~0ULL;
+		unsigned long long m_max = 0;
+
+		static size_t index(unsigned long long value)
+		{
+			if (value < sub_count)
+				return static_cast<size_t>(value);
+			unsigned int msb = 0;
+			for (unsigned long long v = value; v > 1; v >>= 1)
+				++msb;
+			unsigned int shift = msb - sub_bits;
+			return (shift + 1) * sub_count + static_cast<size_t>((value >> shift) - sub_count);
+		}
+
+		static unsigned long long upper_bound(size_t index)
+		{
+			if (index < sub_count)
+				return index;
+			size_t shift = index / sub_count - 1;
+			unsigned long long mantissa = sub_count + index % sub_count;
+			return ((mantissa + 1) << shift) - 1;
+		}
+	};
+
+
+	struct Stats
+	{
+		Histogram latency;
+		unsigned long long requests = 0;
+		unsigned long long bytes_received = 0;
+		unsigned long long connect_errors = 0;
+		unsigned long long read_errors = 0;
+		unsigned long long write_errors = 0;
+		// Responses with status codes other than 2xx and 3xx
+		unsigned long long status_errors = 0;
+		array<unsigned long long, 600> statuses;
+
+		Stats() { statuses.fill(0); }
+
+		void add(const Stats& other)
+		{
+			latency.add(other.latency);
+			requests += other.requests;
+			bytes_received += other.bytes_received;
+			connect_errors += other.connect_errors;
+			read_errors += other.read_errors;
+			write_errors += other.write_errors;
+			status_errors += other.status_errors;
+			for (size_t i = 0; i < statuses.size(); ++i)
+				statuses[i] += other.statuses[i];
+		}
+	};
+
+
+	struct Response
+	{
+		unsigned int status = 0;
+		size_t bytes = 0;
+		bool keep_alive = true;
+	};
+
+
+	bool iequals(const string& str, size_t pos, size_t length, const char* other)
+	{
+		if (length != strlen(other))
+			return false;
+		for (size_t i = 0; i < length; ++i)
+		{
+			if (tolower(static_cast<unsigned char>(str[pos + i])) != other[i])
+				return false;
+		}
+		return true;
+	}
+
+
+	bool icontains(const string& str, size_t pos, const char* other)
+	{
+		string value = str.substr(pos);
+		transform(value.begin(), value.end(), value.begin(), [](char ch) { return static_cast<char>(tolower(static_cast<unsigned char>(ch))); });
+		return value.find(other) != string::npos;
+	}
+
+
+	// A connection with a pipeline of requests in flight
+	class Connection
+	{
+	public:
+		Connection(asio::io_service& io_service, const Options& options, const string& request,
+			const asio::ip::tcp::resolver::iterator& endpoints, Stats& stats) :
+			m_socket{ io_service }, m_timer{ io_service }, m_options{ options }, m_request{ request },
+			m_endpoints{ endpoints }, m_stats{ stats } {}
+
+		void run(asio::yield_context yc, steady_clock::time_point first_request, steady_clock::duration interval,
+			steady_clock::time_point measure_start, steady_clock::time_point end)
+		{
+			m_end = end;
+			steady_clock::time_point scheduled = first_request;
+			bool fixed_rate = interval > steady_clock::duration::zero();
+			string batch;
+			while (!m_stopped)
+			{
+				if (!m_socket.is_open() && !connect(yc))
+					continue;
+				try
+				{
+					// Send as many requests as the pipeline and the schedule allow in one write
+					steady_clock::time_point now = steady_clock::now();
+					batch.clear();
+					while (m_pending.size() < m_options.pipeline && now < m_end && (!fixed_rate || scheduled <= now))
+					{
+						batch += m_request;
+						m_pending.push_back(fixed_rate ? scheduled : now);
+						scheduled += interval;
+					}
+					if (!batch.empty())
+					{
+						sys::error_code ec;
+						asio::async_write(m_socket, asio::buffer(batch), yc[ec]);
+						if (ec)
+						{
+							if (!m_stopped)
+								++m_stats.write_errors;
+							reset();
+							continue;
+						}
+					}
+					if (m_pending.empty())
+					{
+						if (now >= m_end)
+							break;
+						m_timer.expires_at(scheduled);
+						sys::error_code ec;
+						m_timer.async_wait(yc[ec]);
+						continue;
+					}
+					Response response = read_response(yc);
+					now = steady_clock::now();
+					steady_clock::time_point start = m_pending.front();
+					m_pending.pop_front();
+					if (now >= measure_start && now < m_end)
+					{
+						++m_stats.requests;
+						m_stats.bytes_received += response.bytes;
+						m_stats.latency.record(chrono::duration_cast<chrono::microseconds>(now - start).count());
+						if (response.status < m_stats.statuses.size())
+							++m_stats.statuses[response.status];
+						if (response.status < 200 || response.status >= 400)
+							++m_stats.status_errors;
+					}
+					if (!response.keep_alive || !m_options.keep_alive)
+						reset();
+				}
+				catch (const exception&)
+				{
+					if (!m_stopped)
+						++m_stats.read_errors;
+					reset();
+				}
+			}
+			reset();
+		}
+
+		// Stop the connection at the end of a test
+		void stop()
+		{
+			m_stopped = true;
+			sys::error_code ec;
+			m_socket.close(ec);
+			m_timer.cancel(ec);
+		}
+
+	private:
+		asio::ip::tcp::socket m_socket;
+		asio::steady_timer m_timer;
+		asio::streambuf m_buffer;
+		const Options& m_options;
+		const string& m_request;
+		asio::ip::tcp::resolver::iterator m_endpoints;
+		Stats& m_stats;
+		deque<steady_clock::time_point> m_pending;
+		steady_clock::time_point m_end;
+		bool m_stopped = false;
+
+		bool connect(asio::yield_context& yc)
+		{
+			sys::error_code ec;
+			asio::async_connect(m_socket, m_endpoints, yc[ec]);
+			if (!ec)
+			{
+				m_socket.set_option(asio::ip::tcp::no_delay(true), ec);
+				return true;
+			}
+			if (!m_stopped)
+			{
+				++m_stats.connect_errors;
+				// Do not spin if the server is not available
+				m_timer.expires_from_now(chrono::milliseconds(10));
+				m_timer.async_wait(yc[ec]);
+			}
+			m_socket.close(ec);
+			return false;
+		}
+
+		// Close the connection and forget requests in flight
+		void reset()
+		{
+			sys::error_code ec;
+			m_socket.close(ec);
+			m_buffer.consume(m_buffer.size());
+			m_pending.clear();
+		}
+
+		Response read_response(asio::yield_context& yc)
+		{
+			Response response;
+			size_t header_length = asio::async_read_until(m_socket, m_buffer, "\r\n\r\n", yc);
+			string header{ asio::buffers_begin(m_buffer.data()), asio::buffers_begin(m_buffer.data()) + header_length };
+			m_buffer.consume(header_length);
+			response.bytes = header_length;
+			if (header.compare(0, 5, "HTTP/") != 0 || header.length() < 12)
+				throw runtime_error("Invalid response");
+			response.status = strtoul(header.c_str() + 9, nullptr, 10);
+			response.keep_alive = header.compare(0, 8, "HTTP/1.0") != 0;
+			long long content_length = -1;
+			bool chunked = false;
+			size_t pos = header.find("\r\n") + 2;
+			while (pos < header.length() - 2)
+			{
+				size_t eol = header.find("\r\n", pos);
+				size_t colon = header.find(':', pos);
+				if (colon != string::npos && colon < eol)
+				{
+					size_t value = header.find_first_not_of(' ', colon + 1);
+					if (iequals(header, pos, colon - pos, "content-length"))
+						content_length = strtoll(header.c_str() + value, nullptr, 10);
+					else if (iequals(header, pos, colon - pos, "transfer-encoding"))
+						chunked = icontains(header.substr(0, eol), value, "chunked");
+					else if (iequals(header, pos, colon - pos, "connection"))
+					{
+						string connection = header.substr(0, eol);
+						if (icontains(connection, value, "close"))
+							response.keep_alive = false;
+						else if (icontains(connection, value, "keep-alive"))
+							response.keep_alive = true;
+					}
+				}
+				pos = eol + 2;
+			}
+			if (m_options.method == "HEAD" || response.status < 200 || response.status == 204 || response.status == 304)
+				return response;
+			if (chunked)
+			{
+				while (true)
+				{
+					size_t line_length = asio::async_read_until(m_socket, m_buffer, "\r\n", yc);
+					string line{ asio::buffers_begin(m_buffer.data()), asio::buffers_begin(m_buffer.data()) + line_length };
+					m_buffer.consume(line_length);
+					response.bytes += line_length;
+					size_t chunk_size = strtoul(line.c_str(), nullptr, 16);
+					if (chunk_size == 0)
+						break;
+					response.bytes += skip(chunk_size + 2, yc);
+				}
+				// Trailers end with an empty line
+				while (true)
+				{
+					size_t line_length = asio::async_read_until(m_socket, m_buffer, "\r\n", yc);
+					m_buffer.consume(line_length);
+					response.bytes += line_length;
+					if (line_length == 2)
+						break;
+				}
+			}
+			else if (content_length >= 0)
+			{
+				response.bytes += skip(static_cast<size_t>(content_length), yc);
+			}
+			else
+			{
+				// The body ends when the server closes the connection
+				response.bytes += skip(~static_cast<size_t>(0), yc);
+				response.keep_alive = false;
+			}
+			return response;
+		}
+
+		// Discard the given number of bytes or until the end of stream
+		size_t skip(size_t length, asio::yield_context& yc)
+		{
+			size_t skipped = 0;
+			while (skipped < length)
+			{
+				if (m_buffer.size() == 0)
+				{
+					sys::error_code ec;
+					asio::async_read(m_socket, m_buffer, asio::transfer_at_least(1), yc[ec]);
+					if (ec == asio::error::eof && length == ~static_cast<size_t>(0))
+						break;
+					if (ec)
+						throw sys::system_error(ec);
+				}
+				size_t chunk = min(m_buffer.size(), length - skipped);
+				m_buffer.consume(chunk);
+				skipped += chunk;
+			}
+			return skipped;
+		}
+	};
+
+
+	// Connections served by one thread
+	class Worker
+	{
+	public:
+		Worker(const Options& options, const string& request) : m_options{ options }, m_request{ request } {}
+
+		void run(const vector<unsigned int>& connection_indexes, steady_clock::time_point start,
+			steady_clock::time_point measure_start, steady_clock::time_point end)
+		{
+			asio::ip::tcp::resolver resolver{ m_io_service };
+			asio::ip::tcp::resolver::iterator endpoints = resolver.resolve(asio::ip::tcp::resolver::query{ m_options.host, m_options.port });
+			steady_clock::duration interval = steady_clock::duration::zero();
+			if (m_options.rate > 0.0)
+			{
+				interval = chrono::duration_cast<steady_clock::duration>(
+					chrono::duration<double>(m_options.connections / m_options.rate));
+			}
+			for (unsigned int index : connection_indexes)
+			{
+				m_connections.emplace_back(new Connection{ m_io_service, m_options, m_request, endpoints, m_stats });
+				Connection* connection = m_connections.back().get();
+				// Spread scheduled requests of different connections evenly over an interval
+				steady_clock::time_point first_request = start + interval * index / m_options.connections;
+				asio::spawn(m_io_service, [=](asio::yield_context yc)
+				{
+					connection->run(yc, first_request, interval, measure_start, end);
+				});
+			}
+			asio::steady_timer stop_timer{ m_io_service };
+			stop_timer.expires_at(end);
+			stop_timer.async_wait([this](const sys::error_code&)
+			{
+				for (auto& connection : m_connections)
+					connection->stop();
+			});
+			m_io_service.run();
+		}
+
+		const Stats& stats() const { return m_stats; }
+
+	private:
+		asio::io_service m_io_service;
+		const Options& m_options;
+		const string& m_request;
+		vector<unique_ptr<Connection>> m_connections;
+		Stats m_stats;
+	};
+
+
+	bool parse_url(Options& options)
+	{
+		const string prefix = "http://";
+		if (options.url.compare(0, prefix.length(), prefix) != 0)
+			return false;
+		size_t host_start = prefix.length();
+		size_t path_start = options.url.find('/', host_start);
+		string host_port = options.url.substr(host_start, path_start - host_start);
+		if (path_start != string::npos)
+			options.path = options.url.substr(path_start);
+		size_t colon = host_port.rfind(':');
+		if (colon != string::npos && host_port.find(']', colon) == string::npos)
+		{
+			options.host = host_port.substr(0, colon);
+			options.port = host_port.substr(colon + 1);
+		}
+		else
+		{
+			options.host = host_port;
+		}
+		if (options.host.length() > 2 && options.host.front() == '[' && options.host.back() == ']')
+			options.host = options.host.substr(1, options.host.length() - 2);
+		return !options.host.empty();
+	}
+
+
+	bool parse_options(int argc, char** argv, Options& options)
+	{
+		for (int i = 1; i < argc; ++i)
+		{
+			string arg = argv[i];
+			auto next = [&]() -> const char*
+			{
+				if (i + 1 >= argc)
+					throw invalid_argument("Missing value for " + arg);
+				return argv[++i];
+			};
+			if (arg == "-c" || arg == "--connections")
+				options.connections = static_cast<unsigned int>(stoul(next()));
+			else if (arg == "-t" || arg == "--threads")
+				options.threads = static_cast<unsigned int>(stoul(next()));
+			else if (arg == "-d" || arg == "--duration")
+				options.duration = stod(next());
+			else if (arg == "-w" || arg == "--warmup")
+				options.warmup = stod(next());
+			else if (arg == "-R" || arg == "--rate")
+				options.rate = stod(next());
+			else if (arg == "-p" || arg == "--pipeline")
+				options.pipeline = static_cast<unsigned int>(stoul(next()));
+			else if (arg == "-m" || arg == "--method")
+				options.method = next();
+			else if (arg == "-H" || arg == "--header")
+				options.headers.push_back(next());
+			else if (arg == "-b" || arg == "--body-size")
+				options.body_size = static_cast<size_t>(stoull(next()));
+			else if (arg == "-k" || arg == "--no-keep-alive")
+				options.keep_alive = false;
+			else if (arg == "-l" || arg == "--label")
+				options.label = next();
+			else if (arg == "-o" || arg == "--output")
+				options.output = next();
+			else if (arg == "-h" || arg == "--help")
+				return false;
+			else if (!arg.empty() && arg[0] == '-')
+				throw invalid_argument("Unknown option " + arg);
+			else
+				options.url = arg;
+		}
+		if (options.url.empty() || !parse_url(options))
+			throw invalid_argument("Invalid or missing URL, e.g. http://127.0.0.1:8000/");
+		if (options.connections == 0 || options.threads == 0 || options.pipeline == 0 || options.duration <= 0.0)
+			throw invalid_argument("Connections, threads, pipeline and duration must be positive");
+		options.threads = min(options.threads, options.connections);
+		if (!options.keep_alive)
+			options.pipeline = 1;
+		return true;
+	}
+
+
+	string build_request(const Options& options)
+	{
+		ostringstream oss;
+		oss << options.method << ' ' << options.path << " HTTP/1.1\r\n";
+		oss << "Host: " << options.host << ':' << options.port << "\r\n";
+		for (const auto& header : options.headers)
+			oss << header << "\r\n";
+		if (options.body_size > 0 || options.method == "POST" || options.method == "PUT")
+			oss << "Content-Length: " << options.body_size << "\r\n";
+		if (!options.keep_alive)
+			oss << "Connection: close\r\n";
+		oss << "\r\n";
+		oss << string(options.body_size, 'x');
+		return oss.str();
+	}
+
+
+	string json_string(const string& value)
+	{
+		string result = "\"";
+		for (char ch : value)
+		{
+			if (ch == '"' || ch == '\\')
+			{
+				result += '\\';
+				result += ch;
+			}
+			else if (static_cast<unsigned char>(ch) < 0x20)
+			{
+				char buffer[8];
+				snprintf(buffer, sizeof(buffer), "\\u%04x", static_cast<unsigned char>(ch));
+				result += buffer;
+			}
+			else
+			{
+				result += ch;
+			}
+		}
+		return result + '"';
+	}
+
+
+	string report(const Options& options, const Stats& stats)
+	{
+		ostringstream oss;
+		oss.precision(3);
+		oss << fixed;
+		const Histogram& latency = stats.latency;
+		oss << "{\n"
+			<< "  \"label\": " << json_string(options.label) << ",\n"
+			<< "  \"url\": " << json_string(options.url) << ",\n"
+			<< "  \"method\": " << json_string(options.method) << ",\n"
+			<< "  \"connections\": " << options.connections << ",\n"
+			<< "  \"threads\": " << options.threads << ",\n"
+			<< "  \"pipeline\": " << options.pipeline << ",\n"
+			<< "  \"keep_alive\": " << (options.keep_alive ? "true" : "false") << ",\n"
+			<< "  \"rate\": " << options.rate << ",\n"
+			<< "  \"duration\": " << options.duration << ",\n"
+			<< "  \"requests\": " << stats.requests << ",\n"
+			<< "  \"requests_per_second\": " << stats.requests / options.duration << ",\n"
+			<< "  \"bytes_received\": " << stats.bytes_received << ",\n"
+			<< "  \"bytes_per_second\": " << stats.bytes_received / options.duration << ",\n"
+			<< "  \"errors\": {\"connect\": " << stats.connect_errors
+			<< ", \"read\": " << stats.read_errors
+			<< ", \"write\": " << stats.write_errors
+			<< ", \"status\": " << stats.status_errors << "},\n"
+			<< "  \"status\": {";
+		bool first = true;
+		for (size_t i = 0; i < stats.statuses.size(); ++i)
+		{
+			if (stats.statuses[i] == 0)
+				continue;
+			oss << (first ? "" : ", ") << '"' << i << "\": " << stats.statuses[i];
+			first = false;
+		}
+		oss << "},\n"
+			<< "  \"latency_ms\": {"
+			<< "\"min\": " << latency.minimum() / 1000.0
+			<< ", \"mean\": " << latency.mean() / 1000.0
+			<< ", \"p50\": " << latency.percentile(50.0) / 1000.0
+			<< ", \"p75\": " << latency.percentile(75.0) / 1000.0
+			<< ", \"p90\": " << latency.percentile(90.0) / 1000.0
+			<< ", \"p99\": " << latency.percentile(99.0) / 1000.0
+			<< ", \"p99.9\": " << latency.percentile(99.9) / 1000.0
+			<< ", \"p99.99\": " << latency.percentile(99.99) / 1000.0
+			<< ", \"max\": " << latency.maximum() / 1000.0 << "}\n"
+			<< "}\n";
+		return oss.str();
+	}
+}
+
+
+int main(int argc, char** argv)
+{
+	Options options;
+	try
+	{
+		if (!parse_options(argc, argv, options))
+		{
+			cout << usage;
+			return 0;
+		}
+	}
+	catch (const exception& ex)
+	{
+		cerr << ex.what() << "\n\n" << usage;
+		return 2;
+	}
+	string request = build_request(options);
+	vector<unique_ptr<Worker>> workers;
+	vector<vector<unsigned int>> connection_indexes(options.threads);
+	for (unsigned int i = 0; i < options.connections; ++i)
+		connection_indexes[i % options.threads].push_back(i);
+	steady_clock::time_point start = steady_clock::now();
+	steady_clock::time_point measure_start = start + chrono::duration_cast<steady_clock::duration>(chrono::duration<double>(options.warmup));
+	steady_clock::time_point end = measure_start + chrono::duration_cast<steady_clock::duration>(chrono::duration<double>(options.duration));
+	vector<thread> threads;
+	for (unsigned int i = 0; i < options.threads; ++i)
+		workers.emplace_back(new Worker{ options, request });
+	for (unsigned int i = 0; i < options.threads; ++i)
+	{
+		Worker* worker = workers[i].get();
+		const vector<unsigned int>& indexes = connection_indexes[i];
+		threads.emplace_back([=]()
+		{
+			try
+			{
+				worker->run(indexes, start, measure_start, end);
+			}
+			catch (const exception& ex)
+			{
+				cerr << ex.what() << '\n';
+			}
+		});
+	}
+	for (auto& t : threads)
+		t.join();
+	Stats stats;
+	for (const auto& worker : workers)
+		stats.add(worker->stats());
+	string json = report(options, stats);
+	if (options.output.empty())
+	{
+		cout << json;
+	}
+	else
+	{
+		ofstream out{ options.output };
+		out << json;
+	}
+	return 0;
+}
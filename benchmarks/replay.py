@@ -0,0 +1,285 @@
+#!/usr/bin/env python
+"""
+WsgiBoostServer traffic replay
+
+Sends requests recorded with the ``capture_file`` server property back to a server
+and reports response statuses and latency percentiles. Request times are replayed
+at the original speed (default), scaled (``--speed 2`` sends twice as fast) or as fast
+as possible (``--speed 0``). Requests are sent over ``--connections`` persistent connections;
+request content that was not captured is padded up to the recorded content length.
+
+Example::
+
+  python benchmarks/replay.py --speed 0 -c 50 capture.bin http://127.0.0.1:8000
+
+Several capture files (e.g. of multi-process workers) are merged by request time.
+"""
+
+from __future__ import print_function
+import argparse
+import json
+import socket
+import struct
+import sys
+import threading
+import time
+
+try:
+    from urllib.parse import urlsplit
+    import queue
+except ImportError:
+    from urlparse import urlsplit
+    import Queue as queue
+
+MAGIC = b'WBCAP001'
+# Hop-by-hop and framing headers are set by the replay tool
+SKIPPED_HEADERS = (b'connection', b'keep-alive', b'content-length', b'transfer-encoding', b'te', b'upgrade')
+
+
+class Record(object):
+    __slots__ = ('time', 'content_length', 'method', 'path', 'version', 'headers', 'content')
+
+
+class CaptureReader(object):
+    def __init__(self, data):
+        self._data = data
+        self._pos = 0
+
+    def _read(self, size):
+        if self._pos + size > len(self._data):
+            raise ValueError('Truncated capture record')
+        value = self._data[self._pos:self._pos + size]
+        self._pos += size
+        return value
+
+    def _int(self, fmt):
+        return struct.unpack(fmt, self._read(struct.calcsize(fmt)))[0]
+
+    def _string(self, length_fmt):
+        return self._read(self._int(length_fmt))
+
+    def records(self):
+        while self._pos < len(self._data):
+            size = self._int('<I')
+            if self._pos + size > len(self._data):
+                # The server was stopped while writing a record
+                break
+            end = self._pos + size
+            record = Record()
+            record.time = self._int('<Q') / 1000000.0
+            record.content_length = self._int('<q')
+            record.method = self._string('<B')
+            record.path = self._string('<I')
+            record.version = self._string('<B')
+            record.headers = [(self._string('<H'), self._string('<I')) for _ in range(self._int('<H'))]
+            record.content = self._string('<I')
+            self._pos = end
+            yield record
+
+
+def load_captures(paths):
+    records = []
+    for path in paths:
+        with open(path, 'rb') as fo:
+            data = fo.read()
+        if not data.startswith(MAGIC):
+            raise SystemExit('{0} is not a WsgiBoostServer capture file'.format(path))
+        records.extend(CaptureReader(data[len(MAGIC):]).records())
+    records.sort(key=lambda record: record.time)
+    return records
+
+
+def build_request(record, host):
+    content_length = max(record.content_length, len(record.content))
+    lines = [record.method + b' ' + record.path + b' ' + record.version]
+    for name, value in record.headers:
+        lower = name.lower()
+        if lower in SKIPPED_HEADERS:
+            continue
+        if lower == b'host' and host is not None:
+            value = host
+        lines.append(name + b': ' + value)
+    if content_length > 0 or record.method in (b'POST', b'PUT', b'PATCH'):
+        lines.append(b'Content-Length: ' + str(content_length).encode('ascii'))
+    head = b'\r\n'.join(lines) + b'\r\n\r\n'
+    return head + record.content + b'x' * (content_length - len(record.content))
+
+
+class HttpConnection(object):
+    def __init__(self, address):
+        self._address = address
+        self._sock = None
+        self._buffer = b''
+
+    def close(self):
+        if self._sock is not None:
+            self._sock.close()
+            self._sock = None
+        self._buffer = b''
+
+    def _recv(self):
+        data = self._sock.recv(65536)
+        if not data:
+            raise EOFError('Connection closed by the server')
+        self._buffer += data
+
+    def _read_line(self):
+        while b'\r\n' not in self._buffer:
+            self._recv()
+        line, self._buffer = self._buffer.split(b'\r\n', 1)
+        return line
+
+    def _skip(self, size):
+        while len(self._buffer) < size:
+            self._recv()
+        self._buffer = self._buffer[size:]
+
+    def request(self, data, head):
+        """
+        Send a request and read the response, returns the status code
+        """
+        if self._sock is None:
+            self._sock = socket.create_connection(self._address)
+            self._sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self._sock.sendall(data)
+        status = int(self._read_line().split(b' ', 2)[1])
+        headers = {}
+        while True:
+            line = self._read_line()
+            if not line:
+                break
+            name, _, value = line.partition(b':')
+            headers[name.strip().lower()] = value.strip()
+        keep_alive = headers.get(b'connection', b'').lower() != b'close'
+        if head or status in (204, 304) or 100 <= status < 200:
+            pass
+        elif b'content-length' in headers:
+            self._skip(int(headers[b'content-length']))
+        elif headers.get(b'transfer-encoding', b'').lower() == b'chunked':
+            while True:
+                size = int(self._read_line().split(b';')[0], 16)
+                self._skip(size + 2)
+                if size == 0:
+                    break
+        else:
+            try:
+                while True:
+                    self._recv()
+            except EOFError:
+                pass
+            keep_alive = False
+        if not keep_alive:
+            self.close()
+        return status
+
+
+class Results(object):
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.latencies = []
+        self.lateness = []
+        self.statuses = {}
+        self.errors = 0
+
+    def add(self, status, latency, lateness):
+        with self.lock:
+            self.statuses[status] = self.statuses.get(status, 0) + 1
+            self.latencies.append(latency)
+            self.lateness.append(lateness)
+
+    def add_error(self):
+        with self.lock:
+            self.errors += 1
+
+
+def worker(address, jobs, results):
+    connection = HttpConnection(address)
+    while True:
+        job = jobs.get()
+        if job is None:
+            break
+        scheduled, data, head = job
+        start = time.time()
+        lateness = max(0.0, start - scheduled) if scheduled is not None else 0.0
+        try:
+            status = connection.request(data, head)
+        except (socket.error, EOFError, ValueError, IndexError):
+            connection.close()
+            results.add_error()
+        else:
+            # Latency is measured from the scheduled time, so server stalls are not hidden
+            # by requests waiting for a free connection
+            results.add(status, time.time() - (scheduled if scheduled is not None else start), lateness)
+    connection.close()
+
+
+def percentile(values, percent):
+    if not values:
+        return 0.0
+    index = min(len(values) - 1, max(0, int(round(percent / 100.0 * len(values) + 0.5)) - 1))
+    return values[index]
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Replay captured WsgiBoostServer traffic')
+    parser.add_argument('captures', nargs='+', help='capture files')
+    parser.add_argument('url', help='server URL, e.g. http://127.0.0.1:8000')
+    parser.add_argument('--speed', type=float, default=1.0,
+                        help='replay speed relative to the original request times, 0 - as fast as possible')
+    parser.add_argument('-c', '--connections', type=int, default=10, help='number of persistent connections')
+    parser.add_argument('-n', '--repeat', type=int, default=1, help='replay the capture several times')
+    parser.add_argument('--keep-host', action='store_true', help='send the original Host header')
+    parser.add_argument('-o', '--output', help='save results as JSON')
+    args = parser.parse_args()
+    url = urlsplit(args.url)
+    address = (url.hostname, url.port or 80)
+    records = load_captures(args.captures)
+    if not records:
+        raise SystemExit('No requests in capture files')
+    host = None if args.keep_host else url.netloc.encode('ascii')
+    requests = [(record.time - records[0].time, build_request(record, host), record.method == b'HEAD')
+                for record in records]
+    duration = requests[-1][0]
+    jobs = queue.Queue(maxsize=args.connections * 4)
+    results = Results()
+    threads = [threading.Thread(target=worker, args=(address, jobs, results)) for _ in range(args.connections)]
+    for thread in threads:
+        thread.daemon = True
+        thread.start()
+    start = time.time()
+    for iteration in range(args.repeat):
+        for offset, data, head in requests:
+            scheduled = None
+            if args.speed > 0:
+                scheduled = start + (iteration * duration + offset) / args.speed
+                delay = scheduled - time.time()
+                if delay > 0:
+                    time.sleep(delay)
+            jobs.put((scheduled, data, head))
+    for _ in threads:
+        jobs.put(None)
+    for thread in threads:
+        thread.join()
+    elapsed = time.time() - start
+    latencies = sorted(results.latencies)
+    report = {
+        'requests': len(latencies),
+        'errors': results.errors,
+        'elapsed_s': elapsed,
+        'rps': len(latencies) / elapsed if elapsed > 0 else 0.0,
+        'statuses': dict((str(status), count) for status, count in sorted(results.statuses.items())),
+        'latency_ms': dict(('p' + str(p), percentile(latencies, p) * 1000.0) for p in (50, 90, 99, 99.9)),
+        'max_lateness_ms': max(results.lateness or [0.0]) * 1000.0,
+        }
+    report['latency_ms']['max'] = latencies[-1] * 1000.0 if latencies else 0.0
+    print(json.dumps(report, indent=2, sort_keys=True))
+    if args.output:
+        with open(args.output, 'w') as fo:
+            json.dump(report, fo, indent=2, sort_keys=True)
+            fo.write('\n')
+    if results.errors:
+        sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
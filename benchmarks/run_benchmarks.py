@@ -0,0 +1,156 @@
+#!/usr/bin/env python
+"""
+WsgiBoostServer benchmark suite
+
+Runs benchmark scenarios with the native load generator against scenario_server.py
+and saves results with latency percentiles as JSON. Build the load generator first::
+
+  python setup.py build_loadgen
+
+Run all scenarios and save results::
+
+  python benchmarks/run_benchmarks.py -o results.json
+
+Compare results of two commits::
+
+  python benchmarks/run_benchmarks.py --compare base.json results.json
+"""
+
+from __future__ import print_function
+import argparse
+import json
+import os
+import shutil
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+
+bench_dir = os.path.dirname(os.path.abspath(__file__))
+repo_dir = os.path.dirname(bench_dir)
+
+# name: (path, load generator options)
+SCENARIOS = [
+    ('hello', '/', ['-c', '50']),
+    ('hello_pipelined', '/', ['-c', '50', '-p', '16']),
+    ('hello_no_keep_alive', '/', ['-c', '50', '-k']),
+    ('hello_fixed_rate', '/', ['-c', '50', '-R', '5000']),
+    ('static_4k', '/static/4k.bin', ['-c', '50']),
+    ('static_1m', '/static/1m.bin', ['-c', '10']),
+    ('static_gzip', '/static/64k.html', ['-c', '50', '-H', 'Accept-Encoding: gzip']),
+    ('post_upload', '/upload', ['-c', '50', '-m', 'POST', '-b', '65536']),
+    ('streaming', '/stream', ['-c', '10']),
+]
+
+
+def create_static_files(static_dir):
+    with open(os.path.join(static_dir, '4k.bin'), 'wb') as fo:
+        fo.write(os.urandom(4096))
+    with open(os.path.join(static_dir, '1m.bin'), 'wb') as fo:
+        fo.write(os.urandom(1048576))
+    with open(os.path.join(static_dir, '64k.html'), 'w') as fo:
+        line = '<p>The quick brown fox jumps over the lazy dog.</p>\n'
+        fo.write('<html><body>\n' + line * (65536 // len(line)) + '</body></html>\n')
+
+
+def wait_for_server(port, timeout=10.0):
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        try:
+            socket.create_connection(('127.0.0.1', port), timeout=1.0).close()
+            return
+        except socket.error:
+            time.sleep(0.1)
+    raise RuntimeError('The benchmark server is not responding')
+
+
+def git_revision():
+    try:
+        return subprocess.check_output(['git', 'rev-parse', '--short', 'HEAD'], cwd=repo_dir).decode('ascii').strip()
+    except (OSError, subprocess.CalledProcessError):
+        return ''
+
+
+def run(args):
+    loadgen = args.loadgen or os.path.join(bench_dir, 'wsgi_boost_loadgen' + ('.exe' if sys.platform == 'win32' else ''))
+    if not os.path.exists(loadgen):
+        raise SystemExit('Load generator not found, build it with "python setup.py build_loadgen"')
+    static_dir = tempfile.mkdtemp()
+    create_static_files(static_dir)
+    server = subprocess.Popen([sys.executable, os.path.join(bench_dir, 'scenario_server.py'),
+                               '--port', str(args.port), '--threads', str(args.threads),
+                               '--processes', str(args.processes), '--static-dir', static_dir])
+    results = []
+    try:
+        wait_for_server(args.port)
+        for name, path, options in SCENARIOS:
+            if args.scenarios and name not in args.scenarios:
+                continue
+            command = [loadgen, '-t', str(args.client_threads), '-d', str(args.duration),
+                       '-w', str(args.warmup), '-l', name] + options
+            command.append('http://127.0.0.1:{0}{1}'.format(args.port, path))
+            print('Running {0}...'.format(name), file=sys.stderr)
+            result = json.loads(subprocess.check_output(command).decode('utf-8'))
+            print('  {0:.0f} req/s, p50 {1:.3f} ms, p99 {2:.3f} ms'.format(
+                result['requests_per_second'], result['latency_ms']['p50'], result['latency_ms']['p99']),
+                file=sys.stderr)
+            results.append(result)
+    finally:
+        server.terminate()
+        server.wait()
+        shutil.rmtree(static_dir)
+    report = {
+        'revision': git_revision(),
+        'time': time.strftime('%Y-%m-%dT%H:%M:%SZ', time.gmtime()),
+        'server': {'threads': args.threads, 'processes': args.processes},
+        'scenarios': results,
+    }
+    output = json.dumps(report, indent=2, sort_keys=True)
+    if args.output:
+        with open(args.output, 'w') as fo:
+            fo.write(output + '\n')
+    else:
+        print(output)
+
+
+def compare(base_file, new_file):
+    with open(base_file, 'r') as fo:
+        base = dict((item['label'], item) for item in json.load(fo)['scenarios'])
+    with open(new_file, 'r') as fo:
+        new = json.load(fo)['scenarios']
+    row = '{0:<22}{1:>12}{2:>9}{3:>11}{4:>9}{5:>11}{6:>9}'
+    print(row.format('scenario', 'req/s', 'diff', 'p50 ms', 'diff', 'p99 ms', 'diff'))
+    for item in new:
+        old = base.get(item['label'])
+        if old is None:
+            continue
+
+        def diff(key, latency=False):
+            old_value = old['latency_ms'][key] if latency else old[key]
+            new_value = item['latency_ms'][key] if latency else item[key]
+            return '{0:+.1f}%'.format((new_value - old_value) * 100.0 / old_value) if old_value else 'n/a'
+
+        print(row.format(item['label'],
+                         '{0:.0f}'.format(item['requests_per_second']), diff('requests_per_second'),
+                         '{0:.3f}'.format(item['latency_ms']['p50']), diff('p50', True),
+                         '{0:.3f}'.format(item['latency_ms']['p99']), diff('p99', True)))
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='WsgiBoostServer benchmark suite')
+    parser.add_argument('-o', '--output', help='save results to a JSON file')
+    parser.add_argument('-d', '--duration', type=float, default=10.0, help='duration of each scenario in seconds')
+    parser.add_argument('-w', '--warmup', type=float, default=2.0, help='warm-up time of each scenario in seconds')
+    parser.add_argument('--port', type=int, default=8000)
+    parser.add_argument('--threads', type=int, default=4, help='server threads')
+    parser.add_argument('--processes', type=int, default=1, help='server processes')
+    parser.add_argument('--client-threads', type=int, default=2, help='load generator threads')
+    parser.add_argument('--loadgen', help='path to the load generator executable')
+    parser.add_argument('--compare', nargs=2, metavar=('BASE', 'NEW'), help='compare two result files')
+    parser.add_argument('scenarios', nargs='*', help='scenarios to run (default: all)')
+    args = parser.parse_args()
+    if args.compare:
+        compare(*args.compare)
+    else:
+        run(args)
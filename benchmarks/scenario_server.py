@@ -0,0 +1,79 @@
+#!/usr/bin/env python
+"""
+WsgiBoostServer benchmark scenario server
+
+Serves WSGI applications and static files used by run_benchmarks.py:
+
+- ``/`` - Hello World
+- ``/upload`` - reads the request body
+- ``/stream`` - a 1 MB response sent as 64 chunks
+- ``/static/`` - static files from ``--static-dir``
+"""
+
+from __future__ import print_function
+import argparse
+import wsgi_boost
+
+STREAM_CHUNK = b'x' * 16384
+STREAM_CHUNKS = 64
+
+
+def hello_app(environ, start_response):
+    content = b'Hello World!'
+    response_headers = [('Content-type', 'text/plain'), ('Content-Length', str(len(content)))]
+    start_response('200 OK', response_headers)
+    return [content]
+
+
+def upload_app(environ, start_response):
+    length = 0
+    stream = environ['wsgi.input']
+    while True:
+        data = stream.read(65536)
+        if not data:
+            break
+        length += len(data)
+    content = str(length).encode('ascii')
+    start_response('200 OK', [('Content-type', 'text/plain'), ('Content-Length', str(len(content)))])
+    return [content]
+
+
+def stream_app(environ, start_response):
+    start_response('200 OK', [('Content-type', 'application/octet-stream'),
+                              ('Content-Length', str(len(STREAM_CHUNK) * STREAM_CHUNKS))])
+    for _ in range(STREAM_CHUNKS):
+        yield STREAM_CHUNK
+
+
+def app(environ, start_response):
+    path = environ['PATH_INFO']
+    if path == '/upload':
+        return upload_app(environ, start_response)
+    if path == '/stream':
+        return stream_app(environ, start_response)
+    return hello_app(environ, start_response)
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='WsgiBoostServer benchmark scenario server')
+    parser.add_argument('--port', type=int, default=8000)
+    parser.add_argument('--threads', type=int, default=4)
+    parser.add_argument('--processes', type=int, default=1)
+    parser.add_argument('--static-dir', default='')
+    parser.add_argument('--header-timeout', type=int, default=5)
+    parser.add_argument('--keep-alive-timeout', type=int, default=5)
+    parser.add_argument('--fd-watermark', type=int, default=90)
+    parser.add_argument('--metrics-path', default='')
+    parser.add_argument('--capture-file', default='', help='record requests for replay.py')
+    args = parser.parse_args()
+    httpd = wsgi_boost.WsgiBoostHttp(port=args.port, num_threads=args.threads)
+    httpd.num_processes = args.processes
+    httpd.header_timeout = args.header_timeout
+    httpd.keep_alive_timeout = args.keep_alive_timeout
+    httpd.fd_watermark = args.fd_watermark
+    httpd.metrics_path = args.metrics_path
+    httpd.capture_file = args.capture_file
+    if args.static_dir:
+        httpd.add_static_route('^/static', args.static_dir)
+    httpd.set_app(app)
+    httpd.start()
@@ -4,7 +4,7 @@ import os
 import sys
 import re
 from codecs import open
-from setuptools import setup
+from setuptools import setup, Command
 from setuptools.extension import Extension
 try:
     import distutils.msvc9compiler
@@ -23,6 +23,78 @@ class BuildError(Exception):
     pass
 
 
+class BuildBenchmarkTool(Command):
+    """
+    Build a native benchmark executable in the benchmarks folder
+    """
+    user_options = []
+    executable = None
+    sources = []
+    # Link the server code that depends on Python
+    link_python = False
+
+    def initialize_options(self):
+        pass
+
+    def finalize_options(self):
+        pass
+
+    def run(self):
+        import sysconfig
+        from distutils.ccompiler import new_compiler
+        from distutils.sysconfig import customize_compiler
+        compiler = new_compiler()
+        customize_compiler(compiler)
+        bench_dir = os.path.join(cwd, 'benchmarks')
+        tool_include_dirs = list(include_dirs)
+        tool_library_dirs = list(library_dirs)
+        if sys.platform == 'win32':
+            tool_libraries = []
+        else:
+            tool_libraries = ['boost_system', 'boost_coroutine', 'boost_context', 'pthread']
+        if self.link_python:
+            tool_include_dirs.append(sysconfig.get_paths()['include'])
+            if sys.platform == 'win32':
+                tool_library_dirs.append(os.path.join(sys.prefix, 'libs'))
+            else:
+                tool_libraries = libraries + tool_libraries
+                tool_libraries.append('python' + sysconfig.get_config_var('LDVERSION'))
+                tool_library_dirs.append(sysconfig.get_config_var('LIBDIR'))
+        objects = compiler.compile(
+            self.sources,
+            output_dir=os.path.join(cwd, 'build', self.executable),
+            include_dirs=tool_include_dirs,
+            macros=define_macros,
+            extra_postargs=extra_compile_args
+            )
+        compiler.link_executable(
+            objects,
+            self.executable,
+            output_dir=bench_dir,
+            libraries=tool_libraries,
+            library_dirs=tool_library_dirs,
+            target_lang='c++'
+            )
+
+
+class BuildLoadgen(BuildBenchmarkTool):
+    description = 'build benchmarks/wsgi_boost_loadgen load generator'
+    executable = 'wsgi_boost_loadgen'
+    sources = [os.path.join(cwd, 'benchmarks', 'loadgen.cpp')]
+
+
+class BuildMicrobench(BuildBenchmarkTool):
+    description = 'build benchmarks/wsgi_boost_microbench microbenchmarks'
+    executable = 'wsgi_boost_microbench'
+    sources = [os.path.join(cwd, 'benchmarks', 'microbench.cpp')] + [
+        os.path.join(src, file_ + '.cpp') for file_ in (
+            'connection', 'gil_profiler', 'header_table', 'header_writer', 'idle_connections',
+            'io_uring', 'metrics', 'request', 'response', 'timeouts', 'tls', 'websocket'
+            )
+        ]
+    link_python = True
+
+
 def patch_msvc_compiler():
     """
     Monkey-patch distutils to use MS Visual C++ 2015 compiler
@@ -57,6 +129,22 @@ define_macros = []
 extra_compile_args = []
 extra_link_args = []
 
+if os.environ.get('WSGI_BOOST_COUNT_ALLOCATIONS'):
+    # Count C++ heap allocations for benchmarks/allocations_bench.py
+    define_macros.append(('WSGI_BOOST_COUNT_ALLOCATIONS', None))
+
+if os.environ.get('WSGI_BOOST_TLS'):
+    # TLS termination with OpenSSL 1.1.0 or newer
+    define_macros.append(('WSGI_BOOST_TLS', None))
+    if sys.platform == 'win32':
+        libraries += ['libssl', 'libcrypto']
+    else:
+        libraries += ['ssl', 'crypto']
+
+if os.environ.get('WSGI_BOOST_IO_URING') and sys.platform.startswith('linux'):
+    # io_uring backend for Linux 6.0 or newer, uses kernel headers only
+    define_macros.append(('WSGI_BOOST_IO_URING', None))
+
 if sys.platform == 'win32':
     patch_msvc_compiler()
 
@@ -133,6 +221,7 @@ setup(
     zip_safe=False,
     test_suite = 'test_wsgi_boost',
     tests_require=['requests'],
+    cmdclass={'build_loadgen': BuildLoadgen, 'build_microbench': BuildMicrobench},
     ext_modules=[
         Extension(
             name=NAME,
@@ -6,7 +6,12 @@ Test suite for testing core WsgiBoostServer functionality
 
 from __future__ import print_function
 import os
+import signal
+import socket
+import ssl
+import struct
 import sys
+import tempfile
 import threading
 import time
 import unittest
@@ -28,8 +33,11 @@ class App(object):
         self.environ = environ
         self.start_response = start_response
         content = b'App OK'
+        status = '200 OK'
         if self.environ['PATH_INFO'] == '/test_http_header':
             content = self.test_http_header()
+        elif self.environ['PATH_INFO'] == '/test_repeated_headers':
+            content = self.test_repeated_headers()
         elif self.environ['PATH_INFO'] == '/test_query_string':
             content = self.test_query_string()
         elif self.environ['PATH_INFO'] == '/test_input_read':
@@ -42,9 +50,16 @@ class App(object):
             content = self.test_input_readlines()
         elif self.environ['PATH_INFO'] == '/test_input_iterator':
             content = self.test_input_iterator()
+        elif self.environ['PATH_INFO'] == '/test_slow':
+            time.sleep(0.5)
+            content = b'Slow OK'
+        elif self.environ['PATH_INFO'] == '/test_pid':
+            content = str(os.getpid()).encode()
         elif self.environ['PATH_INFO'] == '/test_write':
             content = b'Write OK'
-        write = start_response('200 OK', [('Content-type', 'text/plain'), ('Content-Length', str(len(content)))])
+        elif self.environ['PATH_INFO'] == '/test_custom_status':
+            status = '200 Fine'
+        write = start_response(status, [('Content-type', 'text/plain'), ('Content-Length', str(len(content)))])
         if content == b'Write OK':
             write(content)
             content = b''
@@ -54,6 +69,11 @@ class App(object):
         assert self.environ['HTTP_FOO'] == 'bar'
         return b'HTTP header OK'
 
+    def test_repeated_headers(self):
+        assert self.environ['HTTP_FOO'] == 'bar,baz'
+        assert self.environ['CONTENT_LENGTH'] == '0'
+        return b'Repeated headers OK'
+
     def test_query_string(self):
         assert self.environ['QUERY_STRING'] == 'foo=bar'
         return b'Query string OK'
@@ -89,6 +109,85 @@ class App(object):
         return b'Input iterator OK'
 
 
+def h2_frame(frame_type, flags, stream_id, payload=b''):
+    return struct.pack('>I', len(payload))[1:] + struct.pack('>BBI', frame_type, flags, stream_id) + payload
+
+
+def h2_get_request(stream_id, path):
+    # Indexed :method GET and :scheme http, literal :path and :authority with indexed names
+    block = b'\x82\x86\x04' + struct.pack('B', len(path)) + path + b'\x01\x09127.0.0.1'
+    return h2_frame(0x1, 0x5, stream_id, block)
+
+
+def h2_read_responses(sock, count, window_updates=False):
+    """
+    Read HTTP/2 frames until count streams are finished,
+    returns {stream_id: [header block, data]}
+
+    If window_updates is True, received data is acknowledged with WINDOW_UPDATE frames.
+    """
+    buffer = b''
+    responses = {}
+    finished = 0
+    while finished < count:
+        while len(buffer) < 9 or len(buffer) < 9 + struct.unpack('>I', b'\x00' + buffer[:3])[0]:
+            data = sock.recv(65536)
+            if not data:
+                raise EOFError('Connection closed by the server')
+            buffer += data
+        length = struct.unpack('>I', b'\x00' + buffer[:3])[0]
+        frame_type, flags, stream_id = struct.unpack('>BBI', buffer[3:9])
+        payload = buffer[9:9 + length]
+        buffer = buffer[9 + length:]
+        if frame_type == 0x4 and not flags & 0x1:
+            sock.sendall(h2_frame(0x4, 0x1, 0))
+        elif frame_type in (0x0, 0x1):
+            if frame_type == 0x0 and window_updates and length > 0:
+                increment = struct.pack('>I', length)
+                sock.sendall(h2_frame(0x8, 0x0, 0, increment) + h2_frame(0x8, 0x0, stream_id, increment))
+            response = responses.setdefault(stream_id, [b'', b''])
+            response[0 if frame_type == 0x1 else 1] += payload
+            if flags & 0x1:
+                finished += 1
+    return responses
+
+
+def ws_frame(opcode, payload=b'', fin=True):
+    """
+    Build a masked client WebSocket frame
+    """
+    mask = os.urandom(4)
+    header = struct.pack('B', (0x80 if fin else 0) | opcode)
+    if len(payload) < 126:
+        header += struct.pack('B', 0x80 | len(payload))
+    elif len(payload) < 65536:
+        header += struct.pack('>BH', 0x80 | 126, len(payload))
+    else:
+        header += struct.pack('>BQ', 0x80 | 127, len(payload))
+    masked = bytes(bytearray(b ^ mask[i % 4] for i, b in enumerate(bytearray(payload))))
+    return header + mask + masked
+
+
+def ws_read_frame(sock):
+    """
+    Read an unmasked server WebSocket frame, returns (opcode, payload)
+    """
+    def read(size):
+        data = b''
+        while len(data) < size:
+            chunk = sock.recv(size - len(data))
+            if not chunk:
+                raise EOFError('Connection closed by the server')
+            data += chunk
+        return data
+    first, length = struct.unpack('BB', read(2))
+    if length == 126:
+        length = struct.unpack('>H', read(2))[0]
+    elif length == 127:
+        length = struct.unpack('>Q', read(8))[0]
+    return first & 0x0f, read(length)
+
+
 class ValidateWsgiServerComplianceTestCase(unittest.TestCase):
     @classmethod
     def tearDownClass(cls):
@@ -134,6 +233,16 @@ class WsgiServerFunctionsTestCase(unittest.TestCase):
         self.assertEqual(resp.status_code, 200)
         self.assertTrue('HTTP header OK' in resp.text)
 
+    def test_repeated_headers(self):
+        sock = socket.create_connection(('127.0.0.1', 8000))
+        sock.settimeout(5)
+        sock.sendall(b'POST /test_repeated_headers HTTP/1.1\r\nFoo: bar\r\ncontent-length: 0\r\nFOO: baz\r\n\r\n')
+        response = b''
+        while b'\r\n\r\n' not in response or not response.endswith(b'OK'):
+            response += sock.recv(1024)
+        self.assertTrue(response.endswith(b'Repeated headers OK'))
+        sock.close()
+
     def test_query_string(self):
         resp = requests.get('http://127.0.0.1:8000/test_query_string', params={'foo': 'bar'})
         self.assertEqual(resp.status_code, 200)
@@ -169,6 +278,122 @@ class WsgiServerFunctionsTestCase(unittest.TestCase):
         self.assertEqual(resp.status_code, 200)
         self.assertTrue('Input iterator OK' in resp.text)
 
+    def test_pipelined_requests(self):
+        sock = socket.create_connection(('127.0.0.1', 8000))
+        sock.settimeout(5)
+        content = b'x' * 100
+        sock.sendall(b'POST /test_input_read_limited HTTP/1.1\r\nContent-Length: 100\r\n\r\n' + content +
+                     b'GET / HTTP/1.1\r\n\r\n')
+        response = b''
+        while not response.endswith(b'App OK'):
+            response += sock.recv(1024)
+        self.assertTrue(b'Input read limited OK' in response)
+        sock.close()
+
+    def test_connection_close(self):
+        sock = socket.create_connection(('127.0.0.1', 8000))
+        sock.settimeout(5)
+        sock.sendall(b'GET / HTTP/1.1\r\nHost: 127.0.0.1:8000\r\nConnection: close\r\n\r\n')
+        response = b''
+        while True:
+            data = sock.recv(1024)
+            if not data:
+                break
+            response += data
+        sock.close()
+        self.assertTrue(b'Connection: close' in response)
+        self.assertTrue(response.endswith(b'App OK'))
+
+    def test_status_line(self):
+        for request, status_line in ((b'GET / HTTP/1.1\r\n', b'HTTP/1.1 200 OK\r\n'),
+                                     (b'GET /test_custom_status HTTP/1.1\r\n', b'HTTP/1.1 200 Fine\r\n'),
+                                     (b'GET / HTTP/1.0\r\n', b'HTTP/1.0 200 OK\r\n')):
+            sock = socket.create_connection(('127.0.0.1', 8000))
+            sock.settimeout(5)
+            sock.sendall(request + b'Host: 127.0.0.1:8000\r\nConnection: close\r\n\r\n')
+            response = b''
+            while True:
+                data = sock.recv(1024)
+                if not data:
+                    break
+                response += data
+            sock.close()
+            header = response.split(b'\r\n\r\n')[0] + b'\r\n'
+            self.assertTrue(header.startswith(status_line))
+            self.assertTrue(b'\r\nServer: WsgiBoost v.' in header)
+            self.assertTrue(b'\r\nDate: ' in header and header.endswith(b' GMT\r\nConnection: close\r\n'))
+
+    def test_stats(self):
+        requests.get('http://127.0.0.1:8000/')
+        stats = self._httpd.stats()
+        self.assertTrue(stats['requests'] > 0)
+        self.assertTrue(stats['bytes_sent'] > 0)
+        self.assertTrue(stats['responses'][200] > 0)
+        self.assertTrue(stats['latency']['app']['count'] > 0)
+        self.assertTrue(stats['latency']['app']['p99'] <= stats['latency']['app']['max'])
+
+    @unittest.skipIf(not sys.platform.startswith('linux'), 'Listen queue statistics are available only on Linux')
+    def test_listen_stats(self):
+        stats = self._httpd.listen_stats()
+        for key in ('queue_length', 'backlog', 'overflows', 'drops'):
+            self.assertTrue(key in stats)
+        self.assertTrue(stats['backlog'] > 0)
+
+
+class ServerMonitoringTestCase(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        cls._httpd = wsgi_boost.WsgiBoostHttp(num_threads=1)
+        cls._httpd.metrics_path = '/metrics'
+        cls._httpd.profile_gil = True
+        cls._access_log = os.path.join(tempfile.gettempdir(), 'wsgi_boost_access.log')
+        if os.path.exists(cls._access_log):
+            os.remove(cls._access_log)
+        cls._httpd.access_log = cls._access_log
+        cls._httpd.access_log_format = 'combined'
+        app = App()
+        cls._httpd.set_app(app)
+        cls._server_thread = threading.Thread(target=cls._httpd.start)
+        cls._server_thread.daemon = True
+        cls._server_thread.start()
+        time.sleep(0.5)
+        with open('german.txt', mode='r') as fo:
+            cls._data = fo.read()
+
+    @classmethod
+    def tearDownClass(cls):
+        cls._httpd.stop()
+        cls._server_thread.join()
+        del cls._httpd
+        os.remove(cls._access_log)
+        print()
+
+    def test_metrics_endpoint(self):
+        requests.get('http://127.0.0.1:8000/')
+        resp = requests.get('http://127.0.0.1:8000/metrics')
+        self.assertEqual(resp.status_code, 200)
+        self.assertTrue('wsgi_boost_requests_total ' in resp.text)
+        self.assertTrue('wsgi_boost_stage_duration_seconds_count{stage="app"}' in resp.text)
+
+    def test_gil_stats(self):
+        requests.post('http://127.0.0.1:8000/test_input_read', data=self._data)
+        stats = self._httpd.gil_stats()
+        self.assertTrue(stats['enabled'])
+        self.assertTrue(stats['requests'] > 0)
+        self.assertTrue(stats['hold_time']['count'] > 0)
+        sites = dict((site['site'], site) for site in stats['sites'])
+        self.assertTrue(sites['input_read']['count'] > 0)
+        self.assertTrue(len(stats['threads']) > 0)
+
+    def test_access_log(self):
+        requests.get('http://127.0.0.1:8000/test_query_string?foo=bar', headers={'User-Agent': 'access-log-test'})
+        time.sleep(0.3)
+        with open(self._access_log, mode='r') as fo:
+            log = fo.read()
+        self.assertTrue('"GET /test_query_string?foo=bar HTTP/1.1" 200 ' in log)
+        self.assertTrue('"-" "access-log-test"' in log)
+        self.assertEqual(self._httpd.stats()['access_log_dropped'], 0)
+
 
 class ServingStaticFilesTestCase(unittest.TestCase):
     @classmethod
@@ -211,6 +436,7 @@ class ServingStaticFilesTestCase(unittest.TestCase):
         png_size = os.path.getsize('profile_pic.png')
         resp = requests.get('http://127.0.0.1:8000/static/profile_pic.png')
         self.assertEqual(png_size, int(resp.headers['Content-Length']))
+        self.assertEqual(png_size, len(resp.content))
 
     def test_if_modified_since(self):
         os.utime(os.path.join(cwd, 'index.html'), (1419175200, 1419175200))
@@ -223,10 +449,904 @@ class ServingStaticFilesTestCase(unittest.TestCase):
 
     def test_range_header(self):
         resp = requests.get('http://127.0.0.1:8000/static/profile_pic.png', headers={'Range': 'bytes=1024-2048'})
+        self.assertEqual(resp.status_code, 206)
         self.assertEqual(resp.headers['Content-Range'], 'bytes 1024-2048/22003')
+        self.assertEqual(len(resp.content), 1025)
         resp = requests.get('http://127.0.0.1:8000/static/profile_pic.png', headers={'Range': 'bytes=1024-30000'})
         self.assertEqual(resp.status_code, 416)
 
 
+@unittest.skipIf(sys.platform == 'win32', 'Multi-process mode is not supported on Windows')
+class MultiProcessServerTestCase(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        cls._httpd = wsgi_boost.WsgiBoostHttp(num_threads=1)
+        cls._httpd.num_processes = 2
+        cls._httpd.set_app(App())
+        cls._server_thread = threading.Thread(target=cls._httpd.start)
+        cls._server_thread.daemon = True
+        cls._server_thread.start()
+        time.sleep(0.5)
+
+    @classmethod
+    def tearDownClass(cls):
+        cls._httpd.stop()
+        cls._server_thread.join()
+        del cls._httpd
+        print()
+
+    def test_worker_processes(self):
+        stats = self._httpd.worker_stats()
+        self.assertEqual(len(stats), 2)
+        pids = set(item['pid'] for item in stats)
+        self.assertFalse(os.getpid() in pids)
+        resp = requests.get('http://127.0.0.1:8000/test_pid')
+        self.assertEqual(resp.status_code, 200)
+        self.assertTrue(int(resp.text) in pids)
+        self.assertTrue(sum(item['requests'] for item in self._httpd.worker_stats()) >= 1)
+
+    def test_restart_dead_worker(self):
+        pid = self._httpd.worker_stats()[0]['pid']
+        os.kill(pid, signal.SIGKILL)
+        time.sleep(0.5)
+        stats = self._httpd.worker_stats()
+        self.assertNotEqual(stats[0]['pid'], pid)
+        self.assertTrue(stats[0]['restarts'] >= 1)
+        resp = requests.get('http://127.0.0.1:8000/')
+        self.assertEqual(resp.status_code, 200)
+
+
+class AdmissionControlTestCase(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        cls._httpd = wsgi_boost.WsgiBoostHttp(num_threads=4)
+        cls._httpd.max_app_requests = 1
+        cls._httpd.set_app(App())
+        cls._server_thread = threading.Thread(target=cls._httpd.start)
+        cls._server_thread.daemon = True
+        cls._server_thread.start()
+        time.sleep(0.5)
+
+    @classmethod
+    def tearDownClass(cls):
+        cls._httpd.stop()
+        cls._server_thread.join()
+        del cls._httpd
+        print()
+
+    def test_max_app_requests(self):
+        slow_responses = []
+        slow_thread = threading.Thread(
+            target=lambda: slow_responses.append(requests.get('http://127.0.0.1:8000/test_slow'))
+            )
+        slow_thread.start()
+        time.sleep(0.1)
+        resp = requests.get('http://127.0.0.1:8000/')
+        self.assertEqual(resp.status_code, 503)
+        self.assertEqual(resp.headers['Retry-After'], '1')
+        slow_thread.join()
+        self.assertEqual(slow_responses[0].status_code, 200)
+        resp = requests.get('http://127.0.0.1:8000/')
+        self.assertEqual(resp.status_code, 200)
+
+
+class ConnectionTimeoutsTestCase(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        cls._httpd = wsgi_boost.WsgiBoostHttp(num_threads=2)
+        cls._httpd.header_timeout = 1
+        cls._httpd.content_timeout = 1
+        cls._httpd.keep_alive_timeout = 1
+        cls._httpd.max_keep_alive_requests = 2
+        cls._httpd.set_app(App())
+        cls._server_thread = threading.Thread(target=cls._httpd.start)
+        cls._server_thread.daemon = True
+        cls._server_thread.start()
+        time.sleep(0.5)
+
+    @classmethod
+    def tearDownClass(cls):
+        cls._httpd.stop()
+        cls._server_thread.join()
+        del cls._httpd
+        print()
+
+    def test_header_timeout(self):
+        sock = socket.create_connection(('127.0.0.1', 8000))
+        sock.settimeout(5)
+        sock.sendall(b'GET / HTTP/1.1\r\n')
+        start = time.time()
+        self.assertEqual(sock.recv(1024), b'')
+        self.assertTrue(time.time() - start < 3)
+        sock.close()
+
+    def test_content_timeout(self):
+        sock = socket.create_connection(('127.0.0.1', 8000))
+        sock.settimeout(5)
+        sock.sendall(b'POST /test_input_read HTTP/1.1\r\nContent-Length: 4194\r\n\r\nfoo')
+        start = time.time()
+        while sock.recv(1024):
+            pass
+        self.assertTrue(time.time() - start < 3)
+        sock.close()
+
+    def test_keep_alive_timeout(self):
+        sock = socket.create_connection(('127.0.0.1', 8000))
+        sock.settimeout(5)
+        sock.sendall(b'GET / HTTP/1.1\r\n\r\n')
+        response = b''
+        while not response.endswith(b'App OK'):
+            response += sock.recv(1024)
+        self.assertTrue(b'Connection: keep-alive' in response)
+        start = time.time()
+        self.assertEqual(sock.recv(1024), b'')
+        self.assertTrue(time.time() - start < 3)
+        sock.close()
+
+    def test_max_keep_alive_requests(self):
+        sock = socket.create_connection(('127.0.0.1', 8000))
+        sock.settimeout(5)
+        for header in (b'Connection: keep-alive', b'Connection: close'):
+            sock.sendall(b'GET / HTTP/1.1\r\n\r\n')
+            response = b''
+            while not response.endswith(b'App OK'):
+                response += sock.recv(1024)
+            self.assertTrue(header in response)
+        self.assertEqual(sock.recv(1024), b'')
+        sock.close()
+
+
+class TrafficCaptureTestCase(unittest.TestCase):
+    def test_capture_file(self):
+        sys.path.insert(0, os.path.join(os.path.dirname(cwd), 'benchmarks'))
+        import replay
+        capture_file = os.path.join(tempfile.gettempdir(), 'wsgi_boost_capture.bin')
+        if os.path.exists(capture_file):
+            os.remove(capture_file)
+        httpd = wsgi_boost.WsgiBoostHttp(num_threads=1)
+        httpd.capture_file = capture_file
+        httpd.capture_content_limit = 16
+        httpd.set_app(App())
+        server_thread = threading.Thread(target=httpd.start)
+        server_thread.daemon = True
+        server_thread.start()
+        time.sleep(0.5)
+        with open('german.txt', mode='rb') as fo:
+            data = fo.read()
+        resp = requests.post('http://127.0.0.1:8000/test_input_read?foo=bar', data=data,
+                             headers={'Authorization': 'Basic Zm9vOmJhcg=='})
+        self.assertEqual(resp.status_code, 200)
+        httpd.stop()
+        server_thread.join()
+        records = replay.load_captures([capture_file])
+        os.remove(capture_file)
+        self.assertEqual(len(records), 1)
+        record = records[0]
+        self.assertEqual(record.method, b'POST')
+        self.assertEqual(record.path, b'/test_input_read?foo=bar')
+        self.assertEqual(record.content_length, len(data))
+        self.assertEqual(record.content, data[:16])
+        self.assertTrue((b'Authorization', b'[redacted]') in record.headers)
+
+
+class Http2TestCase(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        cls._httpd = wsgi_boost.WsgiBoostHttp(num_threads=2)
+        cls._httpd.http2 = True
+        cls._httpd.http2_max_content_size = 65536
+        cls._httpd.set_app(App())
+        cls._httpd.add_static_route('^/static', cwd)
+        cls._server_thread = threading.Thread(target=cls._httpd.start)
+        cls._server_thread.daemon = True
+        cls._server_thread.start()
+        time.sleep(0.5)
+
+    @classmethod
+    def tearDownClass(cls):
+        cls._httpd.stop()
+        cls._server_thread.join()
+        del cls._httpd
+        print()
+
+    def _connect(self):
+        sock = socket.create_connection(('127.0.0.1', 8000))
+        sock.settimeout(5)
+        sock.sendall(b'PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n' + h2_frame(0x4, 0x0, 0))
+        return sock
+
+    def test_prior_knowledge(self):
+        sock = self._connect()
+        sock.sendall(h2_get_request(1, b'/') + h2_get_request(3, b'/static/index.html'))
+        responses = h2_read_responses(sock, 2)
+        sock.close()
+        # :status 200 is encoded as static table index 8
+        self.assertEqual(responses[1][0][:1], b'\x88')
+        self.assertEqual(responses[1][1], b'App OK')
+        self.assertEqual(responses[3][0][:1], b'\x88')
+        with open('index.html', mode='rb') as fo:
+            self.assertEqual(responses[3][1], fo.read())
+
+    def test_concurrent_streams(self):
+        sock = self._connect()
+        start = time.time()
+        sock.sendall(h2_get_request(1, b'/test_slow') + h2_get_request(3, b'/test_slow'))
+        responses = h2_read_responses(sock, 2)
+        sock.close()
+        self.assertTrue(time.time() - start < 0.9)
+        self.assertEqual(responses[1][1], b'Slow OK')
+        self.assertEqual(responses[3][1], b'Slow OK')
+
+    def test_upgrade(self):
+        sock = socket.create_connection(('127.0.0.1', 8000))
+        sock.settimeout(5)
+        sock.sendall(b'GET /test_http_header HTTP/1.1\r\nHost: 127.0.0.1\r\nFoo: bar\r\n'
+                     b'Connection: Upgrade, HTTP2-Settings\r\nUpgrade: h2c\r\nHTTP2-Settings: \r\n\r\n')
+        response = b''
+        while b'\r\n\r\n' not in response:
+            response += sock.recv(1)
+        self.assertTrue(response.startswith(b'HTTP/1.1 101 Switching Protocols'))
+        sock.sendall(b'PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n' + h2_frame(0x4, 0x0, 0))
+        responses = h2_read_responses(sock, 1)
+        sock.close()
+        self.assertEqual(responses[1][1], b'HTTP header OK')
+
+    def test_flow_control(self):
+        # The file is larger than the response data that is queued for a stream,
+        # so the handler waits for window updates
+        data = os.urandom(1024 * 1024)
+        file_path = os.path.join(cwd, 'wsgi_boost_large.bin')
+        with open(file_path, mode='wb') as fo:
+            fo.write(data)
+        try:
+            sock = self._connect()
+            sock.sendall(h2_get_request(1, b'/static/wsgi_boost_large.bin'))
+            responses = h2_read_responses(sock, 1, window_updates=True)
+            sock.close()
+        finally:
+            os.remove(file_path)
+        self.assertEqual(responses[1][0][:1], b'\x88')
+        self.assertEqual(responses[1][1], data)
+
+    def test_content_too_large(self):
+        sock = self._connect()
+        # :method POST, :scheme http, :path, :authority and content-length without indexing
+        block = b'\x83\x86\x04\x10/test_input_read\x01\x09127.0.0.1'
+        sock.sendall(h2_frame(0x1, 0x4, 1, block + b'\x0f\x0d\x0570000'))
+        sock.sendall(h2_frame(0x1, 0x4, 3, block))
+        for i in range(5):
+            sock.sendall(h2_frame(0x0, 0x0, 3, b'x' * 16384))
+        responses = h2_read_responses(sock, 2)
+        sock.close()
+        # :status 413 is a literal with the indexed name :status
+        self.assertTrue(b'413' in responses[1][0])
+        self.assertTrue(b'413' in responses[3][0])
+
+
+class TlsTestCase(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        cls._httpd = wsgi_boost.WsgiBoostHttp(num_threads=2)
+        # The file contains a self-signed certificate and its private key
+        cls._httpd.tls_cert_file = os.path.join(cwd, 'tls_cert.pem')
+        cls._httpd.http2 = True
+        cls._httpd.set_app(App())
+        cls._httpd.add_static_route('^/static', cwd)
+        cls._errors = []
+        cls._server_thread = threading.Thread(target=cls._start)
+        cls._server_thread.daemon = True
+        cls._server_thread.start()
+        time.sleep(0.5)
+        if cls._errors:
+            cls._server_thread.join()
+            raise unittest.SkipTest(str(cls._errors[0]))
+
+    @classmethod
+    def _start(cls):
+        try:
+            cls._httpd.start()
+        except RuntimeError as ex:
+            cls._errors.append(ex)
+
+    @classmethod
+    def tearDownClass(cls):
+        cls._httpd.stop()
+        cls._server_thread.join()
+        del cls._httpd
+        print()
+
+    def test_https_request(self):
+        resp = requests.get('https://127.0.0.1:8000/', verify=False)
+        self.assertEqual(resp.status_code, 200)
+        self.assertEqual(resp.text, 'App OK')
+
+    def test_https_static_file(self):
+        resp = requests.get('https://127.0.0.1:8000/static/profile_pic.png', verify=False)
+        self.assertEqual(resp.status_code, 200)
+        with open('profile_pic.png', mode='rb') as fo:
+            self.assertEqual(resp.content, fo.read())
+
+    def test_alpn_http2(self):
+        context = ssl.SSLContext(ssl.PROTOCOL_TLS_CLIENT)
+        context.check_hostname = False
+        context.verify_mode = ssl.CERT_NONE
+        context.set_alpn_protocols(['h2', 'http/1.1'])
+        sock = context.wrap_socket(socket.create_connection(('127.0.0.1', 8000)))
+        sock.settimeout(5)
+        self.assertEqual(sock.selected_alpn_protocol(), 'h2')
+        sock.sendall(b'PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n' + h2_frame(0x4, 0x0, 0) + h2_get_request(1, b'/'))
+        responses = h2_read_responses(sock, 1)
+        sock.close()
+        self.assertEqual(responses[1][1], b'App OK')
+
+
+class IoUringTestCase(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        cls._httpd = wsgi_boost.WsgiBoostHttp(num_threads=2)
+        cls._httpd.io_uring = True
+        cls._httpd.http2 = True
+        cls._httpd.set_app(App())
+        cls._httpd.add_static_route('^/static', cwd)
+        cls._errors = []
+        cls._server_thread = threading.Thread(target=cls._start)
+        cls._server_thread.daemon = True
+        cls._server_thread.start()
+        time.sleep(0.5)
+        if cls._errors:
+            cls._server_thread.join()
+            raise unittest.SkipTest(str(cls._errors[0]))
+        if not cls._httpd.io_uring_stats()['running']:
+            # The kernel does not support io_uring and the server uses epoll
+            cls.tearDownClass()
+            raise unittest.SkipTest('io_uring is not available')
+        with open('german.txt', mode='r') as fo:
+            cls._data = fo.read()
+
+    @classmethod
+    def _start(cls):
+        try:
+            cls._httpd.start()
+        except RuntimeError as ex:
+            cls._errors.append(ex)
+
+    @classmethod
+    def tearDownClass(cls):
+        cls._httpd.stop()
+        cls._server_thread.join()
+        del cls._httpd
+        print()
+
+    def test_keep_alive_requests(self):
+        with requests.Session() as session:
+            for _ in range(3):
+                resp = session.get('http://127.0.0.1:8000/')
+                self.assertEqual(resp.status_code, 200)
+                self.assertEqual(resp.text, 'App OK')
+            resp = session.post('http://127.0.0.1:8000/test_input_read', data=self._data)
+            self.assertEqual(resp.text, 'Input read OK')
+        self.assertGreater(self._httpd.io_uring_stats()['completions'], 0)
+
+    def test_pipelined_requests(self):
+        sock = socket.create_connection(('127.0.0.1', 8000))
+        sock.settimeout(5)
+        sock.sendall(b'GET / HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n' * 2 +
+                     b'GET / HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: close\r\n\r\n')
+        response = b''
+        while True:
+            data = sock.recv(4096)
+            if not data:
+                break
+            response += data
+        sock.close()
+        self.assertEqual(response.count(b'HTTP/1.1 200 OK'), 3)
+
+    def test_http2_static_file(self):
+        # Static files of HTTP/2 streams are read into registered buffers
+        sock = socket.create_connection(('127.0.0.1', 8000))
+        sock.settimeout(5)
+        sock.sendall(b'PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n' + h2_frame(0x4, 0x0, 0) +
+                     h2_get_request(1, b'/static/profile_pic.png'))
+        responses = h2_read_responses(sock, 1)
+        sock.close()
+        with open('profile_pic.png', mode='rb') as fo:
+            self.assertEqual(responses[1][1], fo.read())
+
+
+def unix_request(address, host, family=socket.AF_UNIX):
+    sock = socket.socket(family, socket.SOCK_STREAM)
+    sock.settimeout(5)
+    sock.connect(address)
+    sock.sendall(b'GET / HTTP/1.1\r\nHost: ' + host + b'\r\nConnection: close\r\n\r\n')
+    response = b''
+    while True:
+        data = sock.recv(4096)
+        if not data:
+            break
+        response += data
+    sock.close()
+    return response
+
+
+@unittest.skipIf(sys.platform == 'win32', 'Unix domain sockets are supported only on POSIX systems')
+class UnixSocketTestCase(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        cls._tempdir = tempfile.mkdtemp()
+        cls._path = os.path.join(cls._tempdir, 'wsgi_boost.sock')
+        cls._app = App()
+        cls._httpd = wsgi_boost.WsgiBoostHttp(num_threads=2)
+        cls._httpd.unix_socket = cls._path
+        cls._httpd.unix_socket_mode = 0o660
+        cls._httpd.set_app(cls._app)
+        cls._server_thread = threading.Thread(target=cls._httpd.start)
+        cls._server_thread.daemon = True
+        cls._server_thread.start()
+        time.sleep(0.5)
+
+    @classmethod
+    def tearDownClass(cls):
+        cls._httpd.stop()
+        cls._server_thread.join()
+        del cls._httpd
+        # The socket file is removed when the server stops
+        os.rmdir(cls._tempdir)
+        print()
+
+    def test_unix_socket_request(self):
+        response = unix_request(self._path, b'example.com:8080')
+        self.assertTrue(response.startswith(b'HTTP/1.1 200 OK\r\n'))
+        self.assertTrue(response.endswith(b'App OK'))
+        self.assertEqual(self._app.environ['SERVER_PORT'], '8080')
+        self.assertEqual(self._app.environ['REMOTE_ADDR'], '')
+        self.assertEqual(self._app.environ['REMOTE_PORT'], '')
+        unix_request(self._path, b'example.com')
+        self.assertEqual(self._app.environ['SERVER_PORT'], '80')
+
+    def test_unix_socket_mode(self):
+        self.assertEqual(os.stat(self._path).st_mode & 0o777, 0o660)
+
+    @unittest.skipIf(not sys.platform.startswith('linux'), 'Abstract namespace is supported only on Linux')
+    def test_abstract_unix_socket(self):
+        name = 'wsgi_boost_test_{0}'.format(os.getpid())
+        httpd = wsgi_boost.WsgiBoostHttp(num_threads=1)
+        httpd.unix_socket = '@' + name
+        httpd.set_app(App())
+        server_thread = threading.Thread(target=httpd.start)
+        server_thread.start()
+        time.sleep(0.5)
+        try:
+            response = unix_request('\0' + name, b'localhost')
+        finally:
+            httpd.stop()
+            server_thread.join()
+        self.assertTrue(response.endswith(b'App OK'))
+
+    def test_inherited_listen_fd(self):
+        # A socket passed by a supervisor like systemd is already bound and listening
+        listener = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        listener.bind(('127.0.0.1', 0))
+        listener.listen(16)
+        port = listener.getsockname()[1]
+        app = App()
+        httpd = wsgi_boost.WsgiBoostHttp(num_threads=1)
+        # socket.detach() is not available in Python 2
+        httpd.listen_fd = os.dup(listener.fileno())
+        listener.close()
+        httpd.set_app(app)
+        server_thread = threading.Thread(target=httpd.start)
+        server_thread.start()
+        time.sleep(0.5)
+        try:
+            resp = requests.get('http://127.0.0.1:{0}/'.format(port))
+        finally:
+            httpd.stop()
+            server_thread.join()
+        self.assertEqual(resp.status_code, 200)
+        self.assertEqual(resp.text, 'App OK')
+        self.assertEqual(app.environ['SERVER_PORT'], str(port))
+        self.assertEqual(app.environ['REMOTE_ADDR'], '127.0.0.1')
+
+
+class GracefulShutdownTestCase(unittest.TestCase):
+    def _start_server(self, handoff_socket=''):
+        httpd = wsgi_boost.WsgiBoostHttp(ip_address='127.0.0.1', port=8001, num_threads=2)
+        httpd.handoff_socket = handoff_socket
+        httpd.set_app(App())
+        server_thread = threading.Thread(target=httpd.start)
+        server_thread.daemon = True
+        server_thread.start()
+        time.sleep(0.5)
+        return httpd, server_thread
+
+    def test_in_flight_request_finished(self):
+        httpd, server_thread = self._start_server()
+        slow_responses = []
+        slow_thread = threading.Thread(
+            target=lambda: slow_responses.append(requests.get('http://127.0.0.1:8001/test_slow'))
+            )
+        slow_thread.start()
+        time.sleep(0.1)
+        httpd.stop()
+        time.sleep(0.1)
+        # The listening socket is closed while the slow request is being served
+        with self.assertRaises(requests.ConnectionError):
+            requests.get('http://127.0.0.1:8001/')
+        slow_thread.join()
+        server_thread.join()
+        self.assertEqual(slow_responses[0].status_code, 200)
+        self.assertEqual(slow_responses[0].text, 'Slow OK')
+        self.assertEqual(slow_responses[0].headers['Connection'], 'close')
+
+    @unittest.skipIf(sys.platform == 'win32', 'Hot restart is supported only on POSIX systems')
+    def test_hot_restart(self):
+        handoff_socket = os.path.join(tempfile.mkdtemp(), 'handoff.sock')
+        old_httpd, old_thread = self._start_server(handoff_socket)
+        self.assertEqual(requests.get('http://127.0.0.1:8001/').status_code, 200)
+        # The new server takes over the listening socket that is bound to the same port
+        new_httpd, new_thread = self._start_server(handoff_socket)
+        old_thread.join(5)
+        self.assertFalse(old_thread.is_alive())
+        self.assertTrue(new_httpd.is_running)
+        resp = requests.get('http://127.0.0.1:8001/')
+        self.assertEqual(resp.status_code, 200)
+        self.assertEqual(new_httpd.stats()['connections'], 1)
+        new_httpd.stop()
+        new_thread.join()
+        self.assertFalse(os.path.exists(handoff_socket))
+        os.rmdir(os.path.dirname(handoff_socket))
+
+
+class CachingApp(object):
+    """
+    Test WSGI application with cacheable responses
+    """
+    def __init__(self):
+        self.calls = 0
+        self.lock = threading.Lock()
+
+    def __call__(self, environ, start_response):
+        with self.lock:
+            self.calls += 1
+        path = environ['PATH_INFO']
+        headers = [('Content-type', 'text/plain')]
+        if path == '/no_store':
+            headers.append(('Cache-Control', 'no-store'))
+        elif path == '/vary':
+            headers.append(('Cache-Control', 'max-age=60'))
+            headers.append(('Vary', 'Accept-Language'))
+        else:
+            headers.append(('Cache-Control', 'public, max-age=0, s-maxage=60'))
+        if path == '/slow':
+            time.sleep(0.5)
+        content = '{0} {1} {2}'.format(path, environ.get('QUERY_STRING', ''),
+                                       environ.get('HTTP_ACCEPT_LANGUAGE', '')).encode()
+        headers.append(('Content-Length', str(len(content))))
+        start_response('200 OK', headers)
+        return [content]
+
+
+class ResponseCacheTestCase(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        cls._httpd = wsgi_boost.WsgiBoostHttp(ip_address='127.0.0.1', port=8001, num_threads=4)
+        cls._httpd.response_cache_size = 1024 * 1024
+        cls._app = CachingApp()
+        cls._httpd.set_app(cls._app)
+        cls._server_thread = threading.Thread(target=cls._httpd.start)
+        cls._server_thread.daemon = True
+        cls._server_thread.start()
+        time.sleep(0.5)
+
+    @classmethod
+    def tearDownClass(cls):
+        cls._httpd.stop()
+        cls._server_thread.join()
+        del cls._httpd
+        print()
+
+    def setUp(self):
+        self._httpd.purge_cache()
+        self._app.calls = 0
+
+    def test_cache_hit(self):
+        resp = requests.get('http://127.0.0.1:8001/page?foo=bar')
+        self.assertEqual(resp.text, '/page foo=bar ')
+        self.assertNotIn('Age', resp.headers)
+        resp = requests.get('http://127.0.0.1:8001/page?foo=bar')
+        self.assertEqual(resp.text, '/page foo=bar ')
+        self.assertEqual(resp.headers['Age'], '0')
+        self.assertEqual(resp.headers['Content-Length'], str(len(resp.content)))
+        resp = requests.head('http://127.0.0.1:8001/page?foo=bar')
+        self.assertEqual(resp.status_code, 200)
+        self.assertEqual(self._app.calls, 1)
+        requests.get('http://127.0.0.1:8001/page?foo=baz')
+        self.assertEqual(self._app.calls, 2)
+        stats = self._httpd.cache_stats()
+        self.assertEqual(stats['entries'], 2)
+        self.assertEqual(stats['hits'], 2)
+
+    def test_not_cacheable(self):
+        requests.get('http://127.0.0.1:8001/no_store')
+        requests.get('http://127.0.0.1:8001/no_store')
+        requests.get('http://127.0.0.1:8001/page', headers={'Authorization': 'Basic Zm9vOmJhcg=='})
+        requests.get('http://127.0.0.1:8001/page', headers={'Authorization': 'Basic Zm9vOmJhcg=='})
+        self.assertEqual(self._app.calls, 4)
+
+    def test_vary(self):
+        for language in ('en', 'fr', 'en', 'fr'):
+            resp = requests.get('http://127.0.0.1:8001/vary', headers={'Accept-Language': language})
+            self.assertEqual(resp.text, '/vary  ' + language)
+        self.assertEqual(self._app.calls, 2)
+
+    def test_collapsed_misses(self):
+        responses = []
+        threads = [threading.Thread(target=lambda: responses.append(requests.get('http://127.0.0.1:8001/slow')))
+                   for _ in range(3)]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+        self.assertEqual([resp.text for resp in responses], ['/slow  '] * 3)
+        self.assertEqual(self._app.calls, 1)
+
+    def test_purge_cache(self):
+        requests.get('http://127.0.0.1:8001/page')
+        requests.get('http://127.0.0.1:8001/page?foo=bar')
+        requests.get('http://127.0.0.1:8001/other')
+        self.assertEqual(self._httpd.purge_cache('/page'), 1)
+        self.assertEqual(self._httpd.purge_cache('/page*'), 1)
+        requests.get('http://127.0.0.1:8001/page')
+        requests.get('http://127.0.0.1:8001/other')
+        self.assertEqual(self._app.calls, 4)
+
+
+class FastPathsTestCase(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        cls._httpd = wsgi_boost.WsgiBoostHttp(ip_address='127.0.0.1', port=8001, num_threads=2)
+        cls._httpd.add_fixed_response('/health', headers=[('Content-Type', 'text/plain'), ('Content-Length', '100')],
+                                      body=b'OK')
+        cls._httpd.add_redirect('/old', 'http://example.com/new')
+        cls._httpd.add_redirect('/old/docs/', '/docs/', status='308 Permanent Redirect', append_path=True)
+        cls._app = CachingApp()
+        cls._httpd.set_app(cls._app)
+        cls._server_thread = threading.Thread(target=cls._httpd.start)
+        cls._server_thread.daemon = True
+        cls._server_thread.start()
+        time.sleep(0.5)
+
+    @classmethod
+    def tearDownClass(cls):
+        cls._httpd.stop()
+        cls._server_thread.join()
+        del cls._httpd
+        print()
+
+    def setUp(self):
+        self._app.calls = 0
+
+    def test_fixed_response(self):
+        resp = requests.get('http://127.0.0.1:8001/health?probe=1')
+        self.assertEqual(resp.status_code, 200)
+        self.assertEqual(resp.text, 'OK')
+        self.assertEqual(resp.headers['Content-Type'], 'text/plain')
+        self.assertEqual(resp.headers['Content-Length'], '2')
+        resp = requests.head('http://127.0.0.1:8001/health')
+        self.assertEqual(resp.status_code, 200)
+        self.assertEqual(resp.headers['Content-Length'], '2')
+        self.assertEqual(self._app.calls, 0)
+        resp = requests.post('http://127.0.0.1:8001/health')
+        self.assertEqual(resp.text, '/health  ')
+        self.assertEqual(self._app.calls, 1)
+
+    def test_redirects(self):
+        resp = requests.get('http://127.0.0.1:8001/old/page', allow_redirects=False)
+        self.assertEqual(resp.status_code, 301)
+        self.assertEqual(resp.headers['Location'], 'http://example.com/new')
+        resp = requests.get('http://127.0.0.1:8001/old/docs/index.html?lang=en', allow_redirects=False)
+        self.assertEqual(resp.status_code, 308)
+        self.assertEqual(resp.headers['Location'], '/docs/index.html?lang=en')
+        self.assertEqual(self._app.calls, 0)
+
+    def test_add_while_running(self):
+        with self.assertRaises(RuntimeError):
+            self._httpd.add_fixed_response('/ping', body=b'pong')
+        with self.assertRaises(RuntimeError):
+            wsgi_boost.WsgiBoostHttp().add_redirect('/', '/index.html', status='Found')
+
+
+class EchoHandler(object):
+    """
+    Test WebSocket handler
+    """
+    def __init__(self):
+        self.closed = []
+
+    def on_open(self, websocket):
+        websocket.send(u'Hello ' + websocket.environ['QUERY_STRING'])
+
+    def on_message(self, websocket, message):
+        if message == u'bye':
+            websocket.close(4000, 'Bye')
+        else:
+            websocket.send(message)
+
+    def on_close(self, websocket, code, reason):
+        self.closed.append((code, reason))
+
+
+class WebSocketTestCase(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        cls._httpd = wsgi_boost.WsgiBoostHttp(ip_address='127.0.0.1', port=8001, num_threads=2)
+        cls._httpd.websocket_max_message_size = 1024
+        cls._handler = EchoHandler()
+        cls._httpd.add_websocket_route('^/ws', cls._handler)
+        cls._httpd.set_app(App())
+        cls._server_thread = threading.Thread(target=cls._httpd.start)
+        cls._server_thread.daemon = True
+        cls._server_thread.start()
+        time.sleep(0.5)
+
+    @classmethod
+    def tearDownClass(cls):
+        cls._httpd.stop()
+        cls._server_thread.join()
+        del cls._httpd
+        print()
+
+    def _connect(self, version=b'13'):
+        sock = socket.create_connection(('127.0.0.1', 8001))
+        sock.settimeout(5)
+        sock.sendall(b'GET /ws?name=test HTTP/1.1\r\nHost: 127.0.0.1\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n'
+                     b'Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: ' + version + b'\r\n\r\n')
+        response = b''
+        while b'\r\n\r\n' not in response:
+            response += sock.recv(1)
+        return sock, response
+
+    def test_echo(self):
+        sock, response = self._connect()
+        self.assertTrue(response.startswith(b'HTTP/1.1 101 Switching Protocols'))
+        self.assertIn(b'Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n', response)
+        self.assertEqual(ws_read_frame(sock), (0x1, b'Hello name=test'))
+        text = u'Привет, WebSocket!'.encode('utf-8') * 10
+        sock.sendall(ws_frame(0x1, text))
+        self.assertEqual(ws_read_frame(sock), (0x1, text))
+        sock.sendall(ws_frame(0x2, b'\x00\xff' * 100))
+        self.assertEqual(ws_read_frame(sock), (0x2, b'\x00\xff' * 100))
+        # A ping between fragments of a message is answered right away
+        sock.sendall(ws_frame(0x1, b'Hello, ', fin=False) + ws_frame(0x9, b'ping') + ws_frame(0x0, b'World!'))
+        self.assertEqual(ws_read_frame(sock), (0xa, b'ping'))
+        self.assertEqual(ws_read_frame(sock), (0x1, b'Hello, World!'))
+        sock.sendall(ws_frame(0x8, struct.pack('>H', 1000) + b'Done'))
+        self.assertEqual(ws_read_frame(sock), (0x8, struct.pack('>H', 1000)))
+        sock.close()
+        time.sleep(0.1)
+        self.assertEqual(self._handler.closed[-1], (1000, 'Done'))
+
+    def test_server_close(self):
+        sock = self._connect()[0]
+        ws_read_frame(sock)
+        sock.sendall(ws_frame(0x1, b'bye'))
+        self.assertEqual(ws_read_frame(sock), (0x8, struct.pack('>H', 4000) + b'Bye'))
+        sock.sendall(ws_frame(0x8, struct.pack('>H', 4000)))
+        self.assertEqual(sock.recv(1), b'')
+        sock.close()
+
+    def test_protocol_errors(self):
+        sock = self._connect()[0]
+        ws_read_frame(sock)
+        sock.sendall(ws_frame(0x1, b'x' * 2048))
+        self.assertEqual(ws_read_frame(sock), (0x8, struct.pack('>H', 1009)))
+        sock.close()
+        sock = self._connect()[0]
+        ws_read_frame(sock)
+        sock.sendall(ws_frame(0x1, b'\xc0\xaf'))
+        self.assertEqual(ws_read_frame(sock), (0x8, struct.pack('>H', 1007)))
+        sock.close()
+
+    def test_not_upgraded(self):
+        sock, response = self._connect(version=b'8')
+        sock.close()
+        self.assertTrue(response.startswith(b'HTTP/1.1 426 Upgrade Required'))
+        self.assertIn(b'Sec-WebSocket-Version: 13\r\n', response)
+        resp = requests.get('http://127.0.0.1:8001/ws')
+        self.assertEqual(resp.text, 'App OK')
+
+
+# async def is a syntax error in Python 2, so the ASGI app is compiled only in Python 3
+ASGI_APP_SOURCE = """
+import asyncio
+
+
+class AsgiApp(object):
+    async def __call__(self, scope, receive, send):
+        assert scope['type'] == 'http'
+        path = scope['path']
+        if path == '/error':
+            raise RuntimeError('ASGI app error')
+        if path == '/slow':
+            await asyncio.sleep(0.5)
+        if path == '/stream':
+            await send({'type': 'http.response.start', 'status': 200, 'headers': [(b'content-type', b'text/plain')]})
+            for chunk in (b'foo', b'bar', b'baz'):
+                await send({'type': 'http.response.body', 'body': chunk, 'more_body': True})
+            await send({'type': 'http.response.body'})
+            return
+        body = b''
+        more_body = True
+        while more_body:
+            message = await receive()
+            body += message['body']
+            more_body = message['more_body']
+        headers = dict(scope['headers'])
+        content = u'{0} {1} {2} {3} {4} {5}'.format(scope['method'], path, scope['query_string'].decode(),
+                                                    headers[b'host'].decode(), scope['http_version'],
+                                                    len(body)).encode('utf-8')
+        await send({'type': 'http.response.start', 'status': 201, 'headers': [[b'x-app', b'asgi']]})
+        await send({'type': 'http.response.body', 'body': content + b' ' + body})
+"""
+
+if sys.version_info >= (3, 5):
+    exec(ASGI_APP_SOURCE)
+
+
+@unittest.skipIf(sys.version_info < (3, 5), 'ASGI requires Python 3.5 or newer')
+class AsgiTestCase(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        cls._httpd = wsgi_boost.WsgiBoostHttp(ip_address='127.0.0.1', port=8001, num_threads=2)
+        cls._httpd.asgi = True
+        cls._httpd.set_app(AsgiApp())
+        cls._server_thread = threading.Thread(target=cls._httpd.start)
+        cls._server_thread.daemon = True
+        cls._server_thread.start()
+        time.sleep(0.5)
+
+    @classmethod
+    def tearDownClass(cls):
+        cls._httpd.stop()
+        cls._server_thread.join()
+        del cls._httpd
+        print()
+
+    def test_request(self):
+        with requests.Session() as session:
+            resp = session.get('http://127.0.0.1:8001/hello%20world?foo=bar')
+            self.assertEqual(resp.status_code, 201)
+            self.assertEqual(resp.headers['X-App'], 'asgi')
+            self.assertEqual(resp.text, 'GET /hello world foo=bar 127.0.0.1:8001 1.1 0 ')
+            data = b'x' * 300000
+            resp = session.post('http://127.0.0.1:8001/echo', data=data)
+            self.assertEqual(resp.content, b'POST /echo  127.0.0.1:8001 1.1 300000 ' + data)
+            self.assertEqual(resp.headers['Content-Length'], str(len(resp.content)))
+
+    def test_streaming_response(self):
+        with requests.Session() as session:
+            for _ in range(2):
+                resp = session.get('http://127.0.0.1:8001/stream')
+                self.assertEqual(resp.text, 'foobarbaz')
+                self.assertEqual(resp.headers['Transfer-Encoding'], 'chunked')
+
+    def test_app_error(self):
+        resp = requests.get('http://127.0.0.1:8001/error')
+        self.assertEqual(resp.status_code, 500)
+
+    def test_concurrent_requests(self):
+        # Slow requests wait on the event loop, so they do not occupy server threads
+        responses = []
+        threads = [threading.Thread(target=lambda: responses.append(requests.get('http://127.0.0.1:8001/slow')))
+                   for _ in range(20)]
+        start = time.time()
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+        self.assertLess(time.time() - start, 3.0)
+        self.assertEqual([resp.status_code for resp in responses], [201] * 20)
+
+
 if __name__ == '__main__':
     unittest.main()
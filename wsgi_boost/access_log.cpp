@@ -0,0 +1,372 @@
+/*
+Asynchronous access log
+
+Copyright (c) 2016 Roman Miroshnychenko <romanvm@yandex.ua>
+License: MIT, see License.txt
+*/
+
+#include "access_log.h"
+#include "exceptions.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <iostream>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif // _WIN32
+
+using namespace std;
+
+
+namespace wsgi_boost
+{
+	namespace
+	{
+		// Identifies open() calls to invalidate ring buffers cached by threads
+		atomic<unsigned long long> next_generation{ 1 };
+
+		struct LocalRing
+		{
+			AccessLog* log = nullptr;
+			unsigned long long generation = 0;
+			AccessLogRing* ring = nullptr;
+		};
+
+		thread_local LocalRing local_ring_cache;
+
+		const char* months[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+
+		// Append a string escaping quotes, backslashes and non-printable characters
+		void append_escaped(string& line, const char* value, bool json)
+		{
+			if (*value == '\0' && !json)
+			{
+				line += '-';
+				return;
+			}
+			for (const char* ch = value; *ch != '\0'; ++ch)
+			{
+				unsigned char uch = static_cast<unsigned char>(*ch);
+				if (uch == '"' || uch == '\\')
+				{
+					line += '\\';
+					line += *ch;
+				}
+				else if (uch < 0x20 || uch == 0x7f)
+				{
+					char buffer[8];
+					snprintf(buffer, sizeof(buffer), json ? "\\u%04x" : "\\x%02x", uch);
+					line += buffer;
+				}
+				else
+				{
+					line += *ch;
+				}
+			}
+		}
+
+
+		tm to_utc(time_t time)
+		{
+			tm utc;
+#ifdef _WIN32
+			gmtime_s(&utc, &time);
+#else
+			gmtime_r(&time, &utc);
+#endif // _WIN32
+			return utc;
+		}
+	}
+
+
+	AccessLog::~AccessLog()
+	{
+		close();
+	}
+
+
+	bool AccessLog::parse_format(const string& name, Format& format)
+	{
+		if (name == "common")
+			format = Format::common;
+		else if (name == "combined")
+			format = Format::combined;
+		else if (name == "json")
+			format = Format::json;
+		else
+			return false;
+		return true;
+	}
+
+
+	void AccessLog::open(const string& path, Format format, atomic<unsigned long long>* dropped)
+	{
+		close();
+		m_path = path;
+		m_format = format;
+		m_dropped = dropped;
+		m_generation = next_generation.fetch_add(1);
+		open_file();
+		if (m_fd < 0)
+			throw RuntimeError("Unable to open access log file " + path);
+		m_reopen.store(false);
+		m_running.store(true);
+		m_thread = thread{ [this]() { run(); } };
+	}
+
+
+	void AccessLog::close()
+	{
+		if (!m_running.exchange(false))
+			return;
+		m_wakeup.notify_one();
+		m_thread.join();
+		close_file();
+		m_rings.clear();
+	}
+
+
+	bool AccessLog::is_open() const
+	{
+		return m_running.load();
+	}
+
+
+	void AccessLog::reopen()
+	{
+		m_reopen.store(true);
+		m_wakeup.notify_one();
+	}
+
+
+	AccessLog::Format AccessLog::format() const
+	{
+		return m_format;
+	}
+
+
+	AccessLogRing* AccessLog::local_ring()
+	{
+		LocalRing& cache = local_ring_cache;
+		if (cache.log != this || cache.generation != m_generation)
+		{
+			// A ring buffer is allocated once for each thread
+			unique_ptr<AccessLogRing> ring{ new AccessLogRing };
+			lock_guard<mutex> lock{ m_mutex };
+			cache.log = this;
+			cache.generation = m_generation;
+			cache.ring = ring.get();
+			m_rings.push_back(move(ring));
+		}
+		return cache.ring;
+	}
+
+
+	AccessRecord* AccessLog::reserve()
+	{
+		AccessLogRing* ring = local_ring();
+		size_t head = ring->head.load(memory_order_relaxed);
+		if (head - ring->tail.load(memory_order_acquire) >= AccessLogRing::capacity)
+		{
+			if (m_dropped != nullptr)
+				m_dropped->fetch_add(1, memory_order_relaxed);
+			return nullptr;
+		}
+		return &ring->records[head % AccessLogRing::capacity];
+	}
+
+
+	void AccessLog::commit()
+	{
+		AccessLogRing* ring = local_ring_cache.ring;
+		ring->head.store(ring->head.load(memory_order_relaxed) + 1, memory_order_release);
+	}
+
+
+	void AccessLog::open_file()
+	{
+		if (m_path == "-")
+		{
+			m_fd = 1;
+			return;
+		}
+#ifdef _WIN32
+		m_fd = _open(m_path.c_str(), _O_WRONLY | _O_APPEND | _O_CREAT | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+		// O_APPEND keeps lines of several worker processes writing to the same file intact
+		m_fd = ::open(m_path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+#endif // _WIN32
+	}
+
+
+	void AccessLog::close_file()
+	{
+		if (m_fd > 2)
+		{
+#ifdef _WIN32
+			_close(m_fd);
+#else
+			::close(m_fd);
+#endif // _WIN32
+		}
+		m_fd = -1;
+	}
+
+
+	void AccessLog::run()
+	{
+		vector<string> lines;
+		while (true)
+		{
+			bool running = m_running.load();
+			if (m_reopen.exchange(false))
+			{
+				close_file();
+				open_file();
+				if (m_fd < 0)
+					cerr << "Unable to reopen access log file " << m_path << '\n';
+			}
+			size_t count = drain(lines);
+			if (count > 0)
+				write_lines(lines, count);
+			if (!running)
+				break;
+			if (count == 0)
+			{
+				// Server threads never wait for the writer, so it polls the ring buffers
+				unique_lock<mutex> lock{ m_mutex };
+				m_wakeup.wait_for(lock, chrono::milliseconds(100));
+			}
+		}
+	}
+
+
+	size_t AccessLog::drain(vector<string>& lines)
+	{
+		vector<AccessLogRing*> rings;
+		{
+			lock_guard<mutex> lock{ m_mutex };
+			for (const auto& ring : m_rings)
+				rings.push_back(ring.get());
+		}
+		size_t count = 0;
+		for (AccessLogRing* ring : rings)
+		{
+			size_t tail = ring->tail.load(memory_order_relaxed);
+			size_t head = ring->head.load(memory_order_acquire);
+			for (; tail != head; ++tail)
+			{
+				if (count == lines.size())
+					lines.emplace_back();
+				format_record(ring->records[tail % AccessLogRing::capacity], lines[count++]);
+			}
+			ring->tail.store(tail, memory_order_release);
+		}
+		return count;
+	}
+
+
+	void AccessLog::write_lines(vector<string>& lines, size_t count)
+	{
+		if (m_fd < 0)
+			return;
+#ifdef _WIN32
+		for (size_t i = 0; i < count; ++i)
+			_write(m_fd, lines[i].data(), static_cast<unsigned int>(lines[i].length()));
+#else
+		vector<iovec> iov;
+		iov.reserve(count);
+		for (size_t i = 0; i < count; ++i)
+			iov.push_back(iovec{ &lines[i][0], lines[i].length() });
+		size_t index = 0;
+		while (index < iov.size())
+		{
+			int batch = static_cast<int>(min(iov.size() - index, static_cast<size_t>(IOV_MAX)));
+			ssize_t written = ::writev(m_fd, &iov[index], batch);
+			if (written < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				break;
+			}
+			// Skip fully written lines and continue a partially written one
+			while (index < iov.size() && static_cast<size_t>(written) >= iov[index].iov_len)
+			{
+				written -= iov[index].iov_len;
+				++index;
+			}
+			if (index < iov.size())
+			{
+				iov[index].iov_base = static_cast<char*>(iov[index].iov_base) + written;
+				iov[index].iov_len -= written;
+			}
+		}
+#endif // _WIN32
+	}
+
+
+	void AccessLog::format_record(const AccessRecord& record, string& line) const
+	{
+		line.clear();
+		time_t seconds = static_cast<time_t>(record.timestamp / 1000000);
+		tm utc = to_utc(seconds);
+		char buffer[64];
+		if (m_format == Format::json)
+		{
+			snprintf(buffer, sizeof(buffer), "%04d-%02d-%02dT%02d:%02d:%02d.%06dZ",
+				utc.tm_year + 1900, utc.tm_mon + 1, utc.tm_mday, utc.tm_hour, utc.tm_min, utc.tm_sec,
+				static_cast<int>(record.timestamp % 1000000));
+			line += "{\"time\": \"";
+			line += buffer;
+			line += "\", \"remote_addr\": \"";
+			append_escaped(line, record.remote_address, true);
+			line += "\", \"method\": \"";
+			append_escaped(line, record.method, true);
+			line += "\", \"path\": \"";
+			append_escaped(line, record.path, true);
+			line += "\", \"protocol\": \"";
+			append_escaped(line, record.protocol, true);
+			snprintf(buffer, sizeof(buffer), "\", \"status\": %u, \"bytes\": %llu, \"duration\": %.6f",
+				record.status, record.bytes_sent, record.duration / 1000000.0);
+			line += buffer;
+			line += ", \"referer\": \"";
+			append_escaped(line, record.referer, true);
+			line += "\", \"user_agent\": \"";
+			append_escaped(line, record.user_agent, true);
+			line += "\"}\n";
+			return;
+		}
+		line += record.remote_address;
+		snprintf(buffer, sizeof(buffer), " - - [%02d/%s/%04d:%02d:%02d:%02d +0000] \"",
+			utc.tm_mday, months[utc.tm_mon], utc.tm_year + 1900, utc.tm_hour, utc.tm_min, utc.tm_sec);
+		line += buffer;
+		append_escaped(line, record.method, false);
+		line += ' ';
+		append_escaped(line, record.path, false);
+		line += ' ';
+		append_escaped(line, record.protocol, false);
+		snprintf(buffer, sizeof(buffer), "\" %u %llu", record.status, record.bytes_sent);
+		line += buffer;
+		if (m_format == Format::combined)
+		{
+			line += " \"";
+			append_escaped(line, record.referer, false);
+			line += "\" \"";
+			append_escaped(line, record.user_agent, false);
+			line += '"';
+		}
+		line += '\n';
+	}
+}
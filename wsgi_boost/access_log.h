@@ -0,0 +1,124 @@
+#pragma once
+/*
+Asynchronous access log
+
+Copyright (c) 2016 Roman Miroshnychenko <romanvm@yandex.ua>
+License: MIT, see License.txt
+*/
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace wsgi_boost
+{
+	// Fixed-size access log record. Longer strings are truncated.
+	struct AccessRecord
+	{
+		// Request time in microseconds since the epoch
+		long long timestamp;
+		unsigned long long bytes_sent;
+		// Request processing time in microseconds
+		unsigned long long duration;
+		unsigned int status;
+		char remote_address[48];
+		char method[16];
+		char protocol[16];
+		char path[512];
+		char referer[256];
+		char user_agent[256];
+
+		// Copy a string into a record field
+		template <size_t N>
+		static void set(char(&field)[N], const std::string& value)
+		{
+			size_t length = value.length() < N - 1 ? value.length() : N - 1;
+			value.copy(field, length);
+			field[length] = '\0';
+		}
+	};
+
+
+	// Single-producer single-consumer queue of access log records
+	struct AccessLogRing
+	{
+		static const size_t capacity = 512;
+
+		std::array<AccessRecord, capacity> records;
+		std::atomic<size_t> head{ 0 };
+		std::atomic<size_t> tail{ 0 };
+	};
+
+
+	// Collects access log records from server threads without locks and writes them
+	// to a file in a background thread. Each server thread pushes records into its own ring buffer.
+	// If a ring buffer is full, the record is dropped and counted instead of blocking the thread.
+	class AccessLog
+	{
+	public:
+		enum class Format
+		{
+			common,
+			combined,
+			json
+		};
+
+		AccessLog(const AccessLog&) = delete;
+		AccessLog& operator=(const AccessLog&) = delete;
+
+		AccessLog() {}
+
+		~AccessLog();
+
+		// Parse a format name, returns false if the name is invalid
+		static bool parse_format(const std::string& name, Format& format);
+
+		// Open a log file ("-" for stdout) and start the writer thread.
+		// Dropped records are counted in the dropped counter.
+		void open(const std::string& path, Format format, std::atomic<unsigned long long>* dropped);
+
+		// Write pending records, stop the writer thread and close the log file.
+		// Must not be called while server threads are logging.
+		void close();
+
+		bool is_open() const;
+
+		// Reopen the log file in the writer thread, e.g. after log rotation
+		void reopen();
+
+		// Get a free record in the ring buffer of the current thread or nullptr if the buffer is full.
+		// The record is published by commit() that must be called in the same thread.
+		AccessRecord* reserve();
+
+		void commit();
+
+		Format format() const;
+
+	private:
+		std::string m_path;
+		Format m_format = Format::common;
+		std::atomic<unsigned long long>* m_dropped = nullptr;
+		int m_fd = -1;
+		std::atomic_bool m_running{ false };
+		std::atomic_bool m_reopen{ false };
+		unsigned long long m_generation = 0;
+		std::mutex m_mutex;
+		std::condition_variable m_wakeup;
+		std::vector<std::unique_ptr<AccessLogRing>> m_rings;
+		std::thread m_thread;
+
+		AccessLogRing* local_ring();
+		void open_file();
+		void close_file();
+		void run();
+		size_t drain(std::vector<std::string>& lines);
+		void write_lines(std::vector<std::string>& lines, size_t count);
+		void format_record(const AccessRecord& record, std::string& line) const;
+	};
+}
@@ -0,0 +1,80 @@
+/*
+Admission control for WSGI requests
+
+Copyright (c) 2016 Roman Miroshnychenko <romanvm@yandex.ua>
+License: MIT, see License.txt
+*/
+
+#include "admission.h"
+
+using namespace std;
+
+
+namespace wsgi_boost
+{
+	void AdmissionControl::configure(unsigned int max_requests, unsigned int target_ms, unsigned int interval_ms)
+	{
+		lock_guard<mutex> lock{ m_mutex };
+		m_max_requests = max_requests;
+		m_target = chrono::milliseconds(target_ms);
+		m_interval = chrono::milliseconds(interval_ms);
+		m_in_flight = 0;
+		m_waiting = 0;
+		m_above_target = false;
+		m_overloaded = false;
+	}
+
+
+	bool AdmissionControl::enter()
+	{
+		lock_guard<mutex> lock{ m_mutex };
+		if (m_max_requests > 0 && m_in_flight >= m_max_requests)
+			return false;
+		if (m_overloaded)
+		{
+			// Without waiting requests there are no more delay samples,
+			// so the next request is let through to probe the queue.
+			if (m_waiting > 0)
+				return false;
+			m_overloaded = false;
+			m_above_target = false;
+		}
+		++m_in_flight;
+		++m_waiting;
+		return true;
+	}
+
+
+	bool AdmissionControl::dequeue(chrono::steady_clock::time_point arrival)
+	{
+		auto now = chrono::steady_clock::now();
+		lock_guard<mutex> lock{ m_mutex };
+		--m_waiting;
+		if (m_target == chrono::steady_clock::duration::zero())
+			return true;
+		if (now - arrival < m_target)
+		{
+			m_above_target = false;
+			m_overloaded = false;
+			return true;
+		}
+		// The delay must stay above the target for the whole interval
+		// to tell a standing queue from a short burst
+		if (!m_above_target)
+		{
+			m_above_target = true;
+			m_first_above_time = now + m_interval;
+			return true;
+		}
+		if (now >= m_first_above_time)
+			m_overloaded = true;
+		return !m_overloaded;
+	}
+
+
+	void AdmissionControl::leave()
+	{
+		lock_guard<mutex> lock{ m_mutex };
+		--m_in_flight;
+	}
+}
@@ -0,0 +1,75 @@
+#pragma once
+/*
+Admission control for WSGI requests
+
+Copyright (c) 2016 Roman Miroshnychenko <romanvm@yandex.ua>
+License: MIT, see License.txt
+*/
+
+#include <chrono>
+#include <mutex>
+
+
+namespace wsgi_boost
+{
+	// Limits the number of in-flight WSGI requests and sheds load
+	// when the delay of waiting for the GIL stays above the target (CoDel-style)
+	class AdmissionControl
+	{
+	private:
+		std::mutex m_mutex;
+		unsigned int m_max_requests = 0;
+		std::chrono::steady_clock::duration m_target;
+		std::chrono::steady_clock::duration m_interval;
+		unsigned int m_in_flight = 0;
+		unsigned int m_waiting = 0;
+		std::chrono::steady_clock::time_point m_first_above_time;
+		bool m_above_target = false;
+		bool m_overloaded = false;
+
+	public:
+		AdmissionControl(const AdmissionControl&) = delete;
+		AdmissionControl& operator=(const AdmissionControl&) = delete;
+
+		AdmissionControl() : m_target{ std::chrono::steady_clock::duration::zero() }, m_interval{ std::chrono::milliseconds(100) } {}
+
+		// Set limits: 0 disables the respective check
+		void configure(unsigned int max_requests, unsigned int target_ms, unsigned int interval_ms);
+
+		// Try to admit a new request before it starts waiting for the GIL
+		bool enter();
+
+		// Register that a request has acquired the GIL.
+		// Returns false if the request has waited too long and must be rejected.
+		bool dequeue(std::chrono::steady_clock::time_point arrival);
+
+		// Register that an admitted request is done
+		void leave();
+	};
+
+
+	// RAII wrapper for an admitted request
+	class AdmissionTicket
+	{
+	private:
+		AdmissionControl& m_control;
+		bool m_admitted;
+
+	public:
+		AdmissionTicket(const AdmissionTicket&) = delete;
+		AdmissionTicket& operator=(const AdmissionTicket&) = delete;
+
+		explicit AdmissionTicket(AdmissionControl& control) : m_control{ control }, m_admitted{ control.enter() } {}
+
+		~AdmissionTicket()
+		{
+			if (m_admitted)
+				m_control.leave();
+		}
+
+		bool admitted() const
+		{
+			return m_admitted;
+		}
+	};
+}
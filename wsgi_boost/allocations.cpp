@@ -0,0 +1,64 @@
+/*
+Heap allocation counter for allocation benchmarks
+
+The global operator new is replaced only if the module is built
+with WSGI_BOOST_COUNT_ALLOCATIONS macro defined.
+
+Copyright (c) 2016 Roman Miroshnychenko <romanvm@yandex.ua>
+License: MIT, see License.txt
+*/
+
+#include "allocations.h"
+
+#ifdef WSGI_BOOST_COUNT_ALLOCATIONS
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+using namespace std;
+
+
+namespace
+{
+	atomic<unsigned long long> counter{ 0 };
+}
+
+
+void* operator new(size_t size)
+{
+	counter.fetch_add(1, memory_order_relaxed);
+	void* ptr = malloc(size > 0 ? size : 1);
+	if (ptr == nullptr)
+		throw bad_alloc();
+	return ptr;
+}
+
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+
+void operator delete(void* ptr) noexcept
+{
+	free(ptr);
+}
+
+
+void operator delete[](void* ptr) noexcept
+{
+	free(ptr);
+}
+
+
+namespace wsgi_boost
+{
+	unsigned long long allocation_count()
+	{
+		return counter.load(memory_order_relaxed);
+	}
+}
+
+#endif // WSGI_BOOST_COUNT_ALLOCATIONS
@@ -0,0 +1,17 @@
+#pragma once
+/*
+Heap allocation counter for allocation benchmarks
+
+Copyright (c) 2016 Roman Miroshnychenko <romanvm@yandex.ua>
+License: MIT, see License.txt
+*/
+
+#ifdef WSGI_BOOST_COUNT_ALLOCATIONS
+
+namespace wsgi_boost
+{
+	// Get the number of global operator new calls since the module was loaded
+	unsigned long long allocation_count();
+}
+
+#endif // WSGI_BOOST_COUNT_ALLOCATIONS
@@ -0,0 +1,448 @@
+/*
+Event loop thread for ASGI applications
+
+Copyright (c) 2016 Roman Miroshnychenko <romanvm@yandex.ua>
+License: MIT, see License.txt
+*/
+
+#include "asgi.h"
+
+#include <iostream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif // _WIN32
+
+using namespace std;
+namespace asio = boost::asio;
+namespace sys = boost::system;
+namespace py = boost::python;
+
+
+namespace wsgi_boost
+{
+	namespace
+	{
+		py::object to_bytes(const string& data)
+		{
+			return get_python_object(PyBytes_FromStringAndSize(data.data(), data.length()));
+		}
+
+
+		// Resolve a future unless it has been cancelled
+		void set_result(py::object& future, py::object result)
+		{
+			if (!py::extract<bool>(future.attr("done")()))
+				future.attr("set_result")(result);
+		}
+
+
+		py::dict make_receive_event(const AsgiReceived& received)
+		{
+			py::dict event;
+			if (received.disconnect)
+			{
+				event["type"] = "http.disconnect";
+			}
+			else
+			{
+				event["type"] = "http.request";
+				event["body"] = to_bytes(received.body);
+				event["more_body"] = received.more_body;
+			}
+			return event;
+		}
+	}
+
+
+#pragma region AsgiCall
+
+	void AsgiCall::wait(vector<AsgiCommand>& taken, asio::io_service& io_service, asio::yield_context yc)
+	{
+		taken.clear();
+		typedef asio::async_completion<asio::yield_context, void(sys::error_code)> completion_type;
+		unique_lock<std::mutex> lock{ mutex };
+		if (commands.empty())
+		{
+			completion_type completion{ yc };
+			auto handler = make_shared<completion_type::completion_handler_type>(move(completion.completion_handler));
+			// The coroutine is resumed through its own strand
+			resume = [handler, &io_service]()
+			{
+				asio::post(asio::get_associated_executor(*handler, io_service.get_executor()), [handler]()
+				{
+					(*handler)(sys::error_code());
+				});
+			};
+			lock.unlock();
+			completion.result.get();
+			lock.lock();
+		}
+		taken.reserve(commands.size());
+		for (auto& command : commands)
+			taken.push_back(move(command));
+		commands.clear();
+	}
+
+
+	void AsgiCall::push(AsgiCommand command)
+	{
+		function<void()> waiting;
+		{
+			lock_guard<std::mutex> lock{ mutex };
+			commands.push_back(move(command));
+			waiting.swap(resume);
+		}
+		if (waiting)
+			waiting();
+	}
+
+#pragma endregion
+
+#pragma region AsgiLoop
+
+	void AsgiLoop::start(const py::object& app)
+	{
+		GilAcquire acquire_gil;
+		m_app = app;
+		py::object asyncio = py::import("asyncio");
+		m_loop = asyncio.attr("new_event_loop")();
+		m_unquote = py::import("urllib.parse").attr("unquote");
+		function<void()> dispatch_function{ [this]() { dispatch(); } };
+		m_dispatch = py::make_function(dispatch_function, py::default_call_policies(), boost::mpl::vector<void>());
+#ifndef _WIN32
+		// Request coroutines wake up the event loop without acquiring the GIL
+		if (::pipe(m_wakeup) != 0)
+			throw RuntimeError("Unable to create ASGI event loop wakeup pipe!");
+		for (int fd : m_wakeup)
+		{
+			::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+			::fcntl(fd, F_SETFD, FD_CLOEXEC);
+		}
+		m_loop.attr("add_reader")(m_wakeup[0], m_dispatch);
+#endif // _WIN32
+		m_running.store(true);
+		m_thread = thread([this]()
+		{
+			GilAcquire acquire_gil;
+			try
+			{
+				py::import("asyncio").attr("set_event_loop")(m_loop);
+				m_loop.attr("run_forever")();
+			}
+			catch (const py::error_already_set&)
+			{
+				PyErr_Print();
+			}
+		});
+	}
+
+
+	void AsgiLoop::stop()
+	{
+		if (!m_running.load())
+			return;
+		{
+			GilAcquire acquire_gil;
+			m_loop.attr("call_soon_threadsafe")(py::object(m_loop.attr("stop")));
+		}
+		m_thread.join();
+		GilAcquire acquire_gil;
+		// Tasks that are still running when the server is terminated are abandoned
+		for (const auto& call : m_calls)
+		{
+			call->task->task.attr("cancel")();
+			call->task.reset();
+		}
+		m_calls.clear();
+		{
+			lock_guard<mutex> lock{ m_mutex };
+			m_queue.clear();
+			m_wakeup_pending = false;
+		}
+#ifndef _WIN32
+		m_loop.attr("remove_reader")(m_wakeup[0]);
+		for (int& fd : m_wakeup)
+		{
+			::close(fd);
+			fd = -1;
+		}
+#endif // _WIN32
+		try
+		{
+			m_loop.attr("close")();
+		}
+		catch (const py::error_already_set&)
+		{
+			PyErr_Print();
+		}
+		m_loop = py::object();
+		m_dispatch = py::object();
+		m_unquote = py::object();
+		m_app = py::object();
+		m_running.store(false);
+	}
+
+
+	bool AsgiLoop::is_running() const
+	{
+		return m_running.load();
+	}
+
+
+	void AsgiLoop::submit(const shared_ptr<AsgiCall>& call)
+	{
+		// A call is queued once until the event loop thread picks it up
+		if (call->queued.exchange(true))
+			return;
+		bool wakeup;
+		{
+			lock_guard<mutex> lock{ m_mutex };
+			m_queue.push_back(call);
+			wakeup = !m_wakeup_pending;
+			m_wakeup_pending = true;
+		}
+		if (!wakeup)
+			return;
+#ifndef _WIN32
+		char signal = 1;
+		if (::write(m_wakeup[1], &signal, 1) < 0 && errno != EAGAIN)
+			cerr << "Unable to wake up ASGI event loop!\n";
+#else
+		GilAcquire acquire_gil;
+		m_loop.attr("call_soon_threadsafe")(m_dispatch);
+#endif // _WIN32
+	}
+
+
+	void AsgiLoop::dispatch()
+	{
+#ifndef _WIN32
+		char buffer[64];
+		while (::read(m_wakeup[0], buffer, sizeof(buffer)) > 0);
+#endif // _WIN32
+		vector<shared_ptr<AsgiCall>> calls;
+		{
+			lock_guard<mutex> lock{ m_mutex };
+			calls.swap(m_queue);
+			m_wakeup_pending = false;
+		}
+		for (const auto& call : calls)
+		{
+			call->queued.store(false);
+			try
+			{
+				update(call);
+			}
+			catch (const py::error_already_set&)
+			{
+				PyErr_Print();
+				AsgiCommand command{ AsgiCommand::Type::finish };
+				command.error = true;
+				if (call->task)
+				{
+					m_calls.erase(call);
+					call->task.reset();
+				}
+				call->push(move(command));
+			}
+		}
+	}
+
+
+	void AsgiLoop::update(const shared_ptr<AsgiCall>& call)
+	{
+		if (!call->started)
+		{
+			call->started = true;
+			start_task(call);
+		}
+		if (!call->task)
+			return;
+		vector<AsgiReceived> received;
+		size_t sent;
+		{
+			lock_guard<mutex> lock{ call->mutex };
+			received.swap(call->received);
+			sent = call->sent;
+		}
+		AsgiTask& task = *call->task;
+		for (const auto& item : received)
+		{
+			if (task.receive_futures.empty())
+				break;
+			py::object future = task.receive_futures.front();
+			task.receive_futures.pop_front();
+			set_result(future, make_receive_event(item));
+		}
+		for (; task.sends_resolved < sent && !task.send_futures.empty(); ++task.sends_resolved)
+		{
+			py::object future = task.send_futures.front();
+			task.send_futures.pop_front();
+			set_result(future, py::object());
+		}
+	}
+
+
+	void AsgiLoop::start_task(const shared_ptr<AsgiCall>& call)
+	{
+		py::dict scope = make_scope(call->scope);
+		function<py::object()> receive_function{ [this, call]() { return receive(call); } };
+		py::object receive_callable = py::make_function(receive_function, py::default_call_policies(),
+			boost::mpl::vector<py::object>());
+		function<py::object(py::object)> send_function{ [this, call](py::object message) { return send(call, message); } };
+		py::object send_callable = py::make_function(send_function, py::default_call_policies(), py::args("message"),
+			boost::mpl::vector<py::object, py::object>());
+		// Task callbacks hold the call, so the call must not hold the task after the app is finished
+		function<void(py::object)> done_function{ [this, call](py::object task) { finish(call, task); } };
+		py::object done_callable = py::make_function(done_function, py::default_call_policies(), py::args("task"),
+			boost::mpl::vector<void, py::object>());
+		py::object coroutine = m_app(scope, receive_callable, send_callable);
+		call->task.reset(new AsgiTask);
+		call->task->task = m_loop.attr("create_task")(coroutine);
+		m_calls.insert(call);
+		call->task->task.attr("add_done_callback")(done_callable);
+	}
+
+
+	py::dict AsgiLoop::make_scope(const AsgiScope& scope)
+	{
+		py::dict result;
+		result["type"] = "http";
+		py::dict asgi;
+		asgi["version"] = "3.0";
+		asgi["spec_version"] = "2.3";
+		result["asgi"] = asgi;
+		string http_version = scope.http_version.substr(scope.http_version.find('/') + 1);
+		result["http_version"] = http_version == "2.0" ? "2" : http_version;
+		result["method"] = scope.method;
+		result["scheme"] = scope.scheme;
+		pair<string, string> path_and_query = split_path(scope.path);
+		result["path"] = m_unquote(path_and_query.first);
+		result["raw_path"] = to_bytes(path_and_query.first);
+		result["query_string"] = to_bytes(path_and_query.second);
+		result["root_path"] = "";
+		py::list headers;
+		for (const auto& header : scope.headers)
+			headers.append(py::make_tuple(to_bytes(header.first), to_bytes(header.second)));
+		result["headers"] = headers;
+		if (!scope.client_address.empty())
+			result["client"] = py::make_tuple(scope.client_address, scope.client_port);
+		else
+			result["client"] = py::object();
+		if (scope.server_port != 0)
+			result["server"] = py::make_tuple(scope.server_name, scope.server_port);
+		else
+			result["server"] = py::object();
+		return result;
+	}
+
+
+	py::object AsgiLoop::receive(const shared_ptr<AsgiCall>& call)
+	{
+		py::object future = m_loop.attr("create_future")();
+		if (!call->task)
+		{
+			AsgiReceived disconnect;
+			disconnect.disconnect = true;
+			set_result(future, make_receive_event(disconnect));
+			return future;
+		}
+		AsgiTask& task = *call->task;
+		// A request without content is answered right away
+		if (!call->scope.has_content && !task.content_received)
+		{
+			task.content_received = true;
+			set_result(future, make_receive_event(AsgiReceived()));
+			return future;
+		}
+		task.receive_futures.push_back(future);
+		call->push(AsgiCommand{ AsgiCommand::Type::receive });
+		return future;
+	}
+
+
+	py::object AsgiLoop::send(const shared_ptr<AsgiCall>& call, py::object message)
+	{
+		py::object future = m_loop.attr("create_future")();
+		string type = py::extract<string>(message["type"]);
+		if (type == "http.response.start")
+		{
+			AsgiCommand command{ AsgiCommand::Type::start_response };
+			unsigned int status_code = py::extract<unsigned int>(message["status"]);
+			command.status = to_string(status_code) + " " + status_reason(status_code);
+			py::list headers{ message.attr("get")("headers", py::list()) };
+			size_t headers_count = py::len(headers);
+			// Reserve space for Content-Length or Transfer-Encoding added by the request handler
+			command.headers.reserve(headers_count + 1);
+			for (size_t i = 0; i < headers_count; ++i)
+			{
+				py::object header = headers[i];
+				command.headers.emplace_back(py::extract<string>(header[0]), py::extract<string>(header[1]));
+			}
+			// Response headers are sent together with the first body message
+			set_result(future, py::object());
+			if (call->task)
+				call->push(move(command));
+		}
+		else if (type == "http.response.body")
+		{
+			AsgiCommand command{ AsgiCommand::Type::body };
+			py::object body = message.attr("get")("body", py::object());
+			if (!body.is_none())
+				command.body = py::extract<string>(body);
+			command.more_body = py::extract<bool>(message.attr("get")("more_body", false));
+			if (call->task)
+			{
+				call->task->send_futures.push_back(future);
+				call->push(move(command));
+			}
+			else
+			{
+				set_result(future, py::object());
+			}
+		}
+		else
+		{
+			throw RuntimeError("Unsupported ASGI message type: " + type + "!");
+		}
+		return future;
+	}
+
+
+	void AsgiLoop::finish(const shared_ptr<AsgiCall>& call, py::object task)
+	{
+		AsgiCommand command{ AsgiCommand::Type::finish };
+		try
+		{
+			if (py::extract<bool>(task.attr("cancelled")()))
+			{
+				command.error = true;
+			}
+			else
+			{
+				py::object exception = task.attr("exception")();
+				if (!exception.is_none())
+				{
+					command.error = true;
+					py::import("traceback").attr("print_exception")(py::object(exception.attr("__class__")), exception,
+						py::object(exception.attr("__traceback__")));
+				}
+			}
+		}
+		catch (const py::error_already_set&)
+		{
+			PyErr_Print();
+			command.error = true;
+		}
+		if (call->task)
+		{
+			m_calls.erase(call);
+			call->task.reset();
+		}
+		call->push(move(command));
+	}
+
+#pragma endregion
+}
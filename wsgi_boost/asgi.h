@@ -0,0 +1,174 @@
+#pragma once
+/*
+Event loop thread for ASGI applications
+
+Copyright (c) 2016 Roman Miroshnychenko <romanvm@yandex.ua>
+License: MIT, see License.txt
+*/
+
+#include "connection.h"
+
+#include <boost/asio.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/python.hpp>
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+
+namespace wsgi_boost
+{
+	// Request data for building an ASGI connection scope in the event loop thread
+	struct AsgiScope
+	{
+		std::string http_version;
+		std::string method;
+		std::string scheme;
+		// Path with a query string
+		std::string path;
+		// Headers with lowercase names
+		headers_type headers;
+		std::string client_address;
+		unsigned short client_port = 0;
+		std::string server_name;
+		unsigned short server_port = 0;
+		// False if the request has no content, so the first receive() is answered without the request coroutine
+		bool has_content = false;
+	};
+
+
+	// A message from the app to the request coroutine
+	struct AsgiCommand
+	{
+		enum class Type : unsigned char
+		{
+			start_response,
+			body,
+			receive,
+			// The app has returned or raised an exception
+			finish
+		};
+
+		Type type;
+		std::string status;
+		headers_type headers;
+		std::string body;
+		bool more_body = false;
+		bool error = false;
+
+		explicit AsgiCommand(Type command_type) : type{ command_type } {}
+	};
+
+
+	// Request content or disconnect event returned by receive()
+	struct AsgiReceived
+	{
+		std::string body;
+		bool more_body = false;
+		bool disconnect = false;
+	};
+
+
+	// Python objects of a running ASGI call. They are accessed only in the event loop thread.
+	struct AsgiTask
+	{
+		boost::python::object task;
+		std::deque<boost::python::object> receive_futures;
+		std::deque<boost::python::object> send_futures;
+		size_t sends_resolved = 0;
+		bool content_received = false;
+	};
+
+
+	// An ASGI request shared by the request coroutine and the event loop thread
+	struct AsgiCall
+	{
+		AsgiScope scope;
+
+		// Guards the fields below
+		std::mutex mutex;
+		std::deque<AsgiCommand> commands;
+		// Resumes the request coroutine waiting for commands
+		std::function<void()> resume;
+		std::vector<AsgiReceived> received;
+		// The number of body messages that have been sent or discarded
+		size_t sent = 0;
+
+		// Set while the call is queued for the event loop thread
+		std::atomic_bool queued;
+		// Event loop thread only
+		bool started = false;
+		std::unique_ptr<AsgiTask> task;
+
+		AsgiCall()
+		{
+			queued.store(false);
+		}
+
+		// Wait in the request coroutine until the app sends commands and take them
+		void wait(std::vector<AsgiCommand>& taken, boost::asio::io_service& io_service, boost::asio::yield_context yc);
+
+		// Queue a command from the event loop thread and resume the request coroutine
+		void push(AsgiCommand command);
+	};
+
+
+	// Runs ASGI 3 application coroutines on an asyncio event loop in a dedicated thread.
+	//
+	// Request coroutines do not acquire the GIL: they queue calls that need attention and wake up
+	// the event loop through a pipe once per batch. The loop thread creates tasks for new calls
+	// and resolves receive() and send() futures for all queued calls with a single GIL acquisition.
+	class AsgiLoop
+	{
+	private:
+		boost::python::object m_app;
+		boost::python::object m_loop;
+		boost::python::object m_dispatch;
+		boost::python::object m_unquote;
+		std::thread m_thread;
+		std::atomic_bool m_running;
+
+		std::mutex m_mutex;
+		std::vector<std::shared_ptr<AsgiCall>> m_queue;
+		bool m_wakeup_pending = false;
+		int m_wakeup[2] = { -1, -1 };
+
+		// Calls with running tasks, event loop thread only
+		std::unordered_set<std::shared_ptr<AsgiCall>> m_calls;
+
+		void dispatch();
+		void update(const std::shared_ptr<AsgiCall>& call);
+		void start_task(const std::shared_ptr<AsgiCall>& call);
+		boost::python::dict make_scope(const AsgiScope& scope);
+		boost::python::object receive(const std::shared_ptr<AsgiCall>& call);
+		boost::python::object send(const std::shared_ptr<AsgiCall>& call, boost::python::object message);
+		void finish(const std::shared_ptr<AsgiCall>& call, boost::python::object task);
+
+	public:
+		AsgiLoop(const AsgiLoop&) = delete;
+		AsgiLoop& operator=(const AsgiLoop&) = delete;
+
+		AsgiLoop()
+		{
+			m_running.store(false);
+		}
+
+		// Start the event loop thread. Must be called without the GIL.
+		void start(const boost::python::object& app);
+
+		// Stop the event loop thread and drop unfinished calls. Must be called without the GIL.
+		void stop();
+
+		bool is_running() const;
+
+		// Queue a call for the event loop thread, called by request coroutines without the GIL
+		void submit(const std::shared_ptr<AsgiCall>& call);
+	};
+}
@@ -1,9 +1,16 @@
 #include "connection.h"
+#include "response.h"
 
 #include <boost/system/system_error.hpp>
 
-#include <sstream>
-#include <vector>
+#include <algorithm>
+#include <cstring>
+
+#ifdef WSGI_BOOST_SENDFILE
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+#endif // WSGI_BOOST_SENDFILE
 
 using namespace std;
 namespace asio = boost::asio;
@@ -13,19 +20,105 @@ namespace py = boost::python;
 
 namespace wsgi_boost
 {
+	bool get_ip_endpoint(const socket_type::endpoint_type& endpoint, asio::ip::tcp::endpoint& ip_endpoint)
+	{
+		int family = endpoint.protocol().family();
+		if ((family != AF_INET && family != AF_INET6) || endpoint.size() > ip_endpoint.capacity())
+			return false;
+		memcpy(ip_endpoint.data(), endpoint.data(), endpoint.size());
+		ip_endpoint.resize(endpoint.size());
+		return true;
+	}
+
 #pragma region Connection
 
+	Connection::~Connection()
+	{
+		m_timeouts.cancel(m_timeout_entry);
+#ifdef WSGI_BOOST_IO_URING
+		if (m_receiver)
+			m_receiver->close();
+#endif // WSGI_BOOST_IO_URING
+#ifdef WSGI_BOOST_TLS
+		if (m_tls)
+			m_tls->shutdown();
+#endif // WSGI_BOOST_TLS
+	}
+
+
 	void Connection::set_timeout(unsigned int timeout)
 	{
-		m_timer.expires_from_now(boost::posix_time::seconds(timeout));
-		m_timer.async_wait(m_strand->wrap([this](const sys::error_code& ec)
+		m_timeouts.schedule(m_timeout_entry, timeout);
+	}
+
+
+	sys::error_code Connection::wait_for_request(unsigned int timeout, IdleConnections& idle_connections)
+	{
+		sys::error_code ec;
+		// The next pipelined request may be already received
+		if (m_istreambuf.size() > 0)
+			return ec;
+		IdleGuard idle_guard{ idle_connections, m_socket->native_handle() };
+		return receive(timeout);
+	}
+
+
+	sys::error_code Connection::receive(unsigned int timeout, size_t size)
+	{
+		sys::error_code ec;
+		set_timeout(timeout);
+		size_t bytes_read = read_some(size, ec);
+		m_timeouts.cancel(m_timeout_entry);
+		m_metrics.add_bytes_received(bytes_read);
+		return ec;
+	}
+
+
+	size_t Connection::read_some(size_t size, sys::error_code& ec)
+	{
+#ifdef WSGI_BOOST_IO_URING
+		// The receiver moves all data received so far regardless of the size
+		if (m_receiver)
+			return m_receiver->async_read(m_istreambuf, m_yc, ec);
+#endif // WSGI_BOOST_IO_URING
+		size_t bytes_read;
+#ifdef WSGI_BOOST_TLS
+		if (m_tls)
+			bytes_read = m_tls->async_read_some(*m_socket, m_istreambuf.prepare(size), m_yc, ec);
+		else
+#endif // WSGI_BOOST_TLS
+			bytes_read = m_socket->async_read_some(m_istreambuf.prepare(size), m_yc[ec]);
+		m_istreambuf.commit(bytes_read);
+		return bytes_read;
+	}
+
+
+	asio::streambuf& Connection::input_buffer()
+	{
+		return m_istreambuf;
+	}
+
+
+	asio::streambuf& Connection::output_buffer()
+	{
+		return m_ostreambuf;
+	}
+
+
+	bool Connection::next_request()
+	{
+		if (m_bytes_left > 0)
 		{
-			if (ec != asio::error::operation_aborted)
-			{
-				m_socket->shutdown(asio::ip::tcp::socket::shutdown_both);
-				m_socket->close();
-			}
-		}));
+			if (m_bytes_left > (long long)m_istreambuf.size())
+				return false;
+			m_istreambuf.consume(m_bytes_left);
+		}
+		m_bytes_left = -1;
+		m_content_length = -1;
+		m_first_byte_time = chrono::steady_clock::time_point();
+		m_write_time = chrono::steady_clock::duration::zero();
+		m_bytes_sent = 0;
+		return true;
 	}
 
 
@@ -33,14 +126,52 @@ namespace wsgi_boost
 	{
 		sys::error_code ec;
 		set_timeout(m_header_timeout);
-		size_t bytes_read = asio::async_read_until(*m_socket, m_istreambuf, "\r\n\r\n", m_yc[ec]);
-		m_timer.cancel();
+		size_t buffered = m_istreambuf.size();
+		size_t bytes_read;
+		// OpenSSL and the io_uring receiver read the socket themselves,
+		// so asio composed operations cannot be used
+		bool composed = true;
+#ifdef WSGI_BOOST_TLS
+		if (m_tls)
+			composed = false;
+#endif // WSGI_BOOST_TLS
+#ifdef WSGI_BOOST_IO_URING
+		if (m_receiver)
+			composed = false;
+#endif // WSGI_BOOST_IO_URING
+		if (composed)
+		{
+			bytes_read = asio::async_read_until(*m_socket, m_istreambuf, "\r\n\r\n", m_yc[ec]);
+		}
+		else
+		{
+			const char delimiter[] = "\r\n\r\n";
+			size_t searched = 0;
+			while (true)
+			{
+				const char* data = asio::buffer_cast<const char*>(m_istreambuf.data());
+				const char* end = data + m_istreambuf.size();
+				const char* found = search(data + searched, end, delimiter, delimiter + 4);
+				if (found != end)
+				{
+					bytes_read = found + 4 - data;
+					break;
+				}
+				searched = m_istreambuf.size() >= 3 ? m_istreambuf.size() - 3 : 0;
+				read_some(4096, ec);
+				if (ec)
+				{
+					bytes_read = 0;
+					break;
+				}
+			}
+		}
+		m_timeouts.cancel(m_timeout_entry);
+		m_metrics.add_bytes_received(m_istreambuf.size() - buffered);
 		if (!ec)
 		{
-			vector<char> buffer(bytes_read);
-			istream is{ &m_istreambuf };
-			is.read(&buffer[0], bytes_read);
-			header = string(buffer.begin(), buffer.end() - 2);
+			header.assign(asio::buffer_cast<const char*>(m_istreambuf.data()), bytes_read - 2);
+			m_istreambuf.consume(bytes_read);
 		}
 		return ec;
 	}
@@ -50,26 +181,38 @@ namespace wsgi_boost
 	{
 		if (m_bytes_left <= 0)
 			return false;
-		size_t residual_bytes = m_istreambuf.size();
-		size_t size;
-		if (length >= 0 && length > residual_bytes)
-		{
-			size = min(m_bytes_left, length - (long long)residual_bytes);
-		}
-		else if (length >= 0 && length <= residual_bytes)
+		// The buffer may already hold a part of the content and the next pipelined request after it
+		long long size = (length >= 0 ? min(length, m_bytes_left) : m_bytes_left) - (long long)m_istreambuf.size();
+		if (size <= 0)
+			return true;
+		sys::error_code ec;
+		set_timeout(m_content_timeout);
+		// For receivind POST content I'm using a syncronous read because a stackful coroutine can be resumed
+		// in a different thread while the GIL is held which results in Python crash.
+		size_t bytes_read = 0;
+#ifdef WSGI_BOOST_IO_URING
+		if (m_receiver)
 		{
-			size = 0;
+			while (bytes_read < static_cast<size_t>(size) && !ec)
+				bytes_read += m_receiver->read(m_istreambuf, ec);
 		}
 		else
+#endif // WSGI_BOOST_IO_URING
+#ifdef WSGI_BOOST_TLS
+		if (m_tls)
 		{
-			size = m_bytes_left - residual_bytes;
+			while (bytes_read < static_cast<size_t>(size) && !ec)
+			{
+				size_t received = m_tls->read_some(*m_socket, m_istreambuf.prepare(size - bytes_read), ec);
+				m_istreambuf.commit(received);
+				bytes_read += received;
+			}
 		}
-		sys::error_code ec;
-		set_timeout(m_content_timeout);
-		// For receivind POST content I'm using a syncronous read because a stackful coroutine can be resumed
-		// in a different thread while the GIL is held which results in Python crash.
-		size_t bytes_read = asio::read(*m_socket, m_istreambuf, asio::transfer_exactly(size), ec);
-		m_timer.cancel();
+		else
+#endif // WSGI_BOOST_TLS
+			bytes_read = asio::read(*m_socket, m_istreambuf, asio::transfer_exactly(size), ec);
+		m_timeouts.cancel(m_timeout_entry);
+		m_metrics.add_bytes_received(bytes_read);
 		if (!ec || (ec && bytes_read > 0))			
 			return true;
 		return false;
@@ -81,19 +224,12 @@ namespace wsgi_boost
 		bool result = read_into_buffer(length);
 		if (result)
 		{
-			istream is{ &m_istreambuf };
-			long long size;
-			if (length > 0)
-			{
-				size = min(length, m_bytes_left);
-			}
-			else
-			{
-				size = m_bytes_left;
-			}
-			vector<char> buffer(size);
-			is.read(&buffer[0], size);
-			data = string(buffer.begin(), buffer.end());
+			long long size = length >= 0 ? min(length, m_bytes_left) : m_bytes_left;
+			size = min(size, (long long)m_istreambuf.size());
+			data.assign(asio::buffer_cast<const char*>(m_istreambuf.data()), size);
+			capture(data.data(), data.length());
+			m_istreambuf.consume(size);
+			m_bytes_left -= size;
 		}
 		return result;
 	}
@@ -101,68 +237,326 @@ namespace wsgi_boost
 
 	string Connection::read_line()
 	{
-		istream is{ &m_istreambuf };
-		string line = string();
-		while (true)
+		string line;
+		while (m_bytes_left > 0)
 		{
-			string temp = string();
-			getline(is, temp);
-			line += temp;
-			m_bytes_left -= temp.length();
-			if (!is.eof())
-			{
-				line += '\n';
-				--m_bytes_left;
+			if (m_istreambuf.size() == 0 && !read_into_buffer(min((long long)128, m_bytes_left)))
+				break;
+			const char* data = asio::buffer_cast<const char*>(m_istreambuf.data());
+			size_t available = min((long long)m_istreambuf.size(), m_bytes_left);
+			size_t length = find(data, data + available, '\n') - data;
+			bool eol = length < available;
+			if (eol)
+				++length;
+			line.append(data, length);
+			capture(data, length);
+			m_istreambuf.consume(length);
+			m_bytes_left -= length;
+			if (eol)
 				break;
+		}
+		return line;
+	}
+
+
+	sys::error_code Connection::read_content(string& data, size_t size)
+	{
+		sys::error_code ec;
+		data.clear();
+		if (m_bytes_left <= 0)
+			return ec;
+		if (m_istreambuf.size() == 0)
+		{
+			ec = receive(m_content_timeout, static_cast<size_t>(min(static_cast<long long>(size), m_bytes_left)));
+			if (ec)
+				return ec;
+		}
+		size_t length = static_cast<size_t>(min(min(static_cast<long long>(size), m_bytes_left), (long long)m_istreambuf.size()));
+		data.assign(asio::buffer_cast<const char*>(m_istreambuf.data()), length);
+		capture(data.data(), data.length());
+		m_istreambuf.consume(length);
+		m_bytes_left -= length;
+		return ec;
+	}
+
+
+	long long Connection::content_left() const
+	{
+		return max(m_bytes_left, 0LL);
+	}
+
+
+	void Connection::set_post_content_length(long long cl)
+	{
+		m_bytes_left = cl;
+		m_content_length = cl;
+	}
+
+
+	void Connection::capture_content(string* content, size_t limit)
+	{
+		m_capture = content;
+		m_capture_limit = limit;
+	}
+
+
+	void Connection::capture(const char* data, size_t length)
+	{
+		if (m_capture != nullptr && m_capture->length() < m_capture_limit)
+			m_capture->append(data, min(length, m_capture_limit - m_capture->length()));
+	}
+
+
+	void Connection::append(const char* data, size_t length)
+	{
+		memcpy(asio::buffer_cast<char*>(m_ostreambuf.prepare(length)), data, length);
+		m_ostreambuf.commit(length);
+	}
+
+
+	void Connection::append(const string& data)
+	{
+		append(data.data(), data.length());
+	}
+
+
+	void Connection::append(ByteString data)
+	{
+		append(data.data, data.length);
+	}
+
+
+	namespace
+	{
+		// Status line, a header block and server headers written with a single buffer reservation
+		void put_header(asio::streambuf& buffer, const string& http_version, const string& status,
+			const string& header_lines, const headers_type& headers, bool keep_alive)
+		{
+			ByteString status_bytes = status_line(http_version, status);
+			const string& date = current_http_date();
+			ByteString connection_bytes = keep_alive ? keep_alive_header_line : close_header_line;
+			size_t size = status_bytes.length > 0 ? status_bytes.length : http_version.length() + status.length() + 3;
+			size += header_lines.length();
+			for (const auto& header : headers)
+			{
+				size += header.first.length() + header.second.length() + 4;
 			}
-			if (read_into_buffer(min((long long)128, m_bytes_left)))
+			size += server_header_line.length + date.length() + 8 + connection_bytes.length + 2;
+			char* begin = asio::buffer_cast<char*>(buffer.prepare(size));
+			char* out = begin;
+			if (status_bytes.length > 0)
 			{
-				is.clear();
+				out = put_bytes(out, status_bytes);
 			}
 			else
 			{
-				break;
+				out = put_bytes(out, http_version);
+				*out++ = ' ';
+				out = put_bytes(out, status);
+				out = put_bytes(out, "\r\n", 2);
 			}
+			out = put_bytes(out, header_lines);
+			for (const auto& header : headers)
+			{
+				out = put_bytes(out, header.first);
+				out = put_bytes(out, ": ", 2);
+				out = put_bytes(out, header.second);
+				out = put_bytes(out, "\r\n", 2);
+			}
+			out = put_bytes(out, server_header_line);
+			out = put_bytes(out, "Date: ", 6);
+			out = put_bytes(out, date);
+			out = put_bytes(out, "\r\n", 2);
+			out = put_bytes(out, connection_bytes);
+			out = put_bytes(out, "\r\n", 2);
+			buffer.commit(out - begin);
 		}
-		return line;
 	}
 
 
-	void Connection::set_post_content_length(long long cl)
+	void Connection::write_header(const string& http_version, const string& status,
+		const headers_type& headers, bool keep_alive)
 	{
-		m_bytes_left = cl;
-		m_content_length = cl;
+		put_header(m_ostreambuf, http_version, status, string(), headers, keep_alive);
+	}
+
+
+	void Connection::write_prebuilt_header(const string& http_version, const PrebuiltResponse& prebuilt, bool keep_alive)
+	{
+		put_header(m_ostreambuf, http_version, prebuilt.status, prebuilt.header_lines, headers_type(), keep_alive);
 	}
 
 
 	sys::error_code Connection::flush()
 	{
 		sys::error_code ec;
+		auto start = chrono::steady_clock::now();
+		if (m_first_byte_time == chrono::steady_clock::time_point())
+			m_first_byte_time = start;
 		set_timeout(m_content_timeout);
 		// For sending HTTP response I'm using a syncronous write because a stackful coroutine can be resumed
 		// in a different thread while the GIL is held which results in Python crash.
-		asio::write(*m_socket, m_ostreambuf, ec);
-		m_timer.cancel();
+		size_t bytes_written;
+#ifdef WSGI_BOOST_TLS
+		if (m_tls)
+		{
+			bytes_written = m_tls->write(*m_socket, asio::buffer_cast<const char*>(m_ostreambuf.data()), m_ostreambuf.size(), ec);
+			m_ostreambuf.consume(bytes_written);
+		}
+		else
+#endif // WSGI_BOOST_TLS
+			bytes_written = asio::write(*m_socket, m_ostreambuf, ec);
+		m_timeouts.cancel(m_timeout_entry);
+		m_write_time += chrono::steady_clock::now() - start;
+		m_metrics.add_bytes_sent(bytes_written);
+		m_bytes_sent += bytes_written;
 		return ec;
 	}
 
-	std::shared_ptr<boost::asio::ip::tcp::socket> Connection::socket() const
+	sys::error_code Connection::send_file(const string& path, long long offset, size_t length)
+	{
+		sys::error_code ec;
+#ifdef WSGI_BOOST_SENDFILE
+#ifdef WSGI_BOOST_TLS
+		if (m_tls && !m_tls->ktls_send())
+			return sys::error_code(sys::errc::operation_not_supported, sys::system_category());
+#endif // WSGI_BOOST_TLS
+		if (m_ostreambuf.size() > 0)
+		{
+			ec = flush();
+			if (ec)
+				return ec;
+		}
+		int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			return sys::error_code(errno, sys::system_category());
+		auto start = chrono::steady_clock::now();
+		if (m_first_byte_time == chrono::steady_clock::time_point())
+			m_first_byte_time = start;
+		size_t sent = 0;
+		set_timeout(m_content_timeout);
+#ifdef WSGI_BOOST_TLS
+		if (m_tls)
+		{
+			// The kernel encrypts the file data
+			sent = m_tls->send_file(*m_socket, fd, offset, length, ec);
+		}
+		else
+#endif // WSGI_BOOST_TLS
+		{
+			// The socket is in non-blocking mode after asynchronous operations
+			while (sent < length)
+			{
+				off_t file_offset = static_cast<off_t>(offset + sent);
+				ssize_t result = ::sendfile(static_cast<int>(m_socket->native_handle()), fd, &file_offset, length - sent);
+				if (result > 0)
+				{
+					sent += result;
+				}
+				else if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+				{
+					m_socket->wait(asio::socket_base::wait_write, ec);
+					if (ec)
+						break;
+				}
+				else
+				{
+					// The file has been truncated
+					ec = result < 0 ? sys::error_code(errno, sys::system_category()) : asio::error::eof;
+					break;
+				}
+			}
+		}
+		m_timeouts.cancel(m_timeout_entry);
+		::close(fd);
+		m_write_time += chrono::steady_clock::now() - start;
+		m_metrics.add_bytes_sent(sent);
+		m_bytes_sent += sent;
+#else
+		ec = sys::error_code(sys::errc::operation_not_supported, sys::system_category());
+#endif // WSGI_BOOST_SENDFILE
+		return ec;
+	}
+
+#ifdef WSGI_BOOST_TLS
+	sys::error_code Connection::start_tls(TlsContext& context)
+	{
+		shared_ptr<TlsSession> tls = make_shared<TlsSession>(context, *m_socket);
+		set_timeout(m_header_timeout);
+		sys::error_code ec = tls->handshake(*m_socket, m_yc);
+		m_timeouts.cancel(m_timeout_entry);
+		if (!ec)
+			m_tls = tls;
+		return ec;
+	}
+#endif // WSGI_BOOST_TLS
+
+	shared_ptr<TlsSession> Connection::tls() const
+	{
+		return m_tls;
+	}
+
+#ifdef WSGI_BOOST_IO_URING
+	void Connection::use_io_uring(IoUring& ring, bool receive)
+	{
+		m_io_uring = &ring;
+		if (receive)
+			m_receiver = make_shared<IoUringReceiver>(ring, m_socket->native_handle());
+	}
+
+	IoUring* Connection::io_uring() const
+	{
+		return m_io_uring;
+	}
+#endif // WSGI_BOOST_IO_URING
+
+	socket_ptr Connection::socket() const
 	{
 		return m_socket;
 	}
 
+	asio::yield_context Connection::yield_context() const
+	{
+		return m_yc;
+	}
+
 	long long Connection::content_length() const
 	{
 		return m_content_length;
 	}
 
+	Metrics& Connection::metrics() const
+	{
+		return m_metrics;
+	}
+
+	TimeoutWheel& Connection::timeouts() const
+	{
+		return m_timeouts;
+	}
+
+	chrono::steady_clock::time_point Connection::first_byte_time() const
+	{
+		return m_first_byte_time;
+	}
+
+	chrono::steady_clock::duration Connection::write_time() const
+	{
+		return m_write_time;
+	}
+
+	unsigned long long Connection::bytes_sent() const
+	{
+		return m_bytes_sent;
+	}
+
 #pragma endregion
 
 #pragma region InputWrapper
 
 	string InputWrapper::read(long long size)
 	{
-		GilRelease release_gil;
+		GilRelease release_gil{ GilSite::input_read };
 		string data;
 		if (m_connection.read_bytes(data, size))
 			return data;
@@ -171,7 +565,7 @@ namespace wsgi_boost
 
 	string InputWrapper::readline(long long size)
 	{
-		GilRelease release_gil;
+		GilRelease release_gil{ GilSite::input_readline };
 		string line = m_connection.read_line();
 		if (size > 0 && line.length() > size)
 			line = line.substr(0, size);
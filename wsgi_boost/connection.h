@@ -7,49 +7,109 @@ License: MIT, see License.txt
 */
 
 #include "exceptions.h"
+#include "header_writer.h"
+#include "idle_connections.h"
+#include "io_uring.h"
+#include "metrics.h"
+#include "timeouts.h"
+#include "tls.h"
 #include "utils.h"
 
 #include <boost/asio.hpp>
 #include <boost/asio/spawn.hpp>
 #include <boost/python.hpp>
+#include <boost/version.hpp>
 
+#include <chrono>
 #include <memory>
-#include <iostream>
 #include <string>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__) && BOOST_VERSION >= 106600
+// Send static files with sendfile()
+#define WSGI_BOOST_SENDFILE
+#endif
+
 
 namespace wsgi_boost
 {
-	typedef std::shared_ptr<boost::asio::ip::tcp::socket> socket_ptr;
-	typedef std::shared_ptr<boost::asio::strand> strand_ptr;
+	typedef boost::asio::generic::stream_protocol::socket socket_type;
+	typedef std::shared_ptr<socket_type> socket_ptr;
+	typedef std::vector<std::pair<std::string, std::string>> headers_type;
+
+	struct PrebuiltResponse;
+
+	// Convert a socket endpoint to an IP endpoint, false for other address families (Unix domain sockets)
+	bool get_ip_endpoint(const socket_type::endpoint_type& endpoint, boost::asio::ip::tcp::endpoint& ip_endpoint);
 
 	// Represents a http connection to a client
-	class Connection : public std::ostream
+	class Connection
 	{
-	private:
+	protected:
 		socket_ptr m_socket;
 		boost::asio::streambuf m_istreambuf;
 		boost::asio::streambuf m_ostreambuf;
-		boost::asio::deadline_timer m_timer;
-		strand_ptr m_strand;
+		Metrics& m_metrics;
+		std::chrono::steady_clock::time_point m_first_byte_time;
+		std::chrono::steady_clock::duration m_write_time;
+		unsigned long long m_bytes_sent = 0;
+
+	private:
+		TimeoutWheel& m_timeouts;
+		TimeoutEntry m_timeout_entry;
 		unsigned int m_header_timeout;
 		unsigned int m_content_timeout;
 		long long m_bytes_left = -1;
 		long long m_content_length = -1;
+		std::string* m_capture = nullptr;
+		size_t m_capture_limit = 0;
 		boost::asio::yield_context m_yc;
+		std::shared_ptr<TlsSession> m_tls;
+#ifdef WSGI_BOOST_IO_URING
+		IoUring* m_io_uring = nullptr;
+		std::shared_ptr<IoUringReceiver> m_receiver;
+#endif // WSGI_BOOST_IO_URING
 
 		void set_timeout(unsigned int timeout);
 
+		// Receive available data into the input buffer waiting in the coroutine
+		size_t read_some(size_t size, boost::system::error_code& ec);
+
 		bool read_into_buffer(long long length = -1);
 
+		void capture(const char* data, size_t length);
+
 	public:
 		Connection(const Connection&) = delete;
 		Connection& operator=(const Connection&) = delete;
 
-		Connection(socket_ptr socket, boost::asio::io_service& io_service, strand_ptr strand,
+		Connection(socket_ptr socket, TimeoutWheel& timeouts, Metrics& metrics,
 			boost::asio::yield_context yc, unsigned int header_timeout, unsigned int content_timeout) :
-			std::ostream(&m_ostreambuf),
-			m_socket{ socket }, m_timer{ io_service }, m_strand{ strand }, m_yc{ yc },
-			m_header_timeout{ header_timeout }, m_content_timeout{ content_timeout } {}
+			m_socket{ socket }, m_metrics{ metrics }, m_write_time{ 0 }, m_timeouts{ timeouts }, m_yc{ yc },
+			m_header_timeout{ header_timeout }, m_content_timeout{ content_timeout }
+		{
+			m_timeout_entry.handle = m_socket->native_handle();
+		}
+
+		virtual ~Connection();
+
+		// Wait for the next request on a persistent connection
+		boost::system::error_code wait_for_request(unsigned int timeout, IdleConnections& idle_connections);
+
+		// Receive up to size bytes into the input buffer
+		boost::system::error_code receive(unsigned int timeout, size_t size = 4096);
+
+		// Get received data that has not been consumed yet
+		boost::asio::streambuf& input_buffer();
+
+		// Get buffered output data that has not been flushed yet
+		boost::asio::streambuf& output_buffer();
+
+		// Reset per-request state before the next request on a persistent connection
+		// keeping the allocated buffers. Returns false if unread request content
+		// does not allow to reuse the connection.
+		bool next_request();
 
 		// Read HTTP header
 		boost::system::error_code read_header(std::string& header);
@@ -60,17 +120,85 @@ namespace wsgi_boost
 		// Read a specified number of bytes or all data left
 		bool read_bytes(std::string& data, long long length = -1);
 
+		// Read up to size bytes of request content waiting in the coroutine instead of blocking the thread.
+		// data is empty if all content has been read.
+		boost::system::error_code read_content(std::string& data, size_t size);
+
+		// Get the number of request content bytes that have not been read yet
+		long long content_left() const;
+
 		// Set content length to control reading POST data
 		void set_post_content_length(long long cl);
 
+		// Copy request content read by the application into a string up to the limit,
+		// nullptr disables copying
+		void capture_content(std::string* content, size_t limit);
+
+		// Append raw bytes to the output buffer
+		void append(const char* data, size_t length);
+
+		void append(const std::string& data);
+
+		void append(ByteString data);
+
+		// Format a response status line and headers followed by Server, Date and Connection headers
+		// into the output buffer
+		virtual void write_header(const std::string& http_version, const std::string& status,
+			const headers_type& headers, bool keep_alive);
+
+		// Format the status line and header lines of a prebuilt response followed by the server headers.
+		// Connections that encode headers differently use the headers of the response instead.
+		virtual void write_prebuilt_header(const std::string& http_version, const PrebuiltResponse& prebuilt,
+			bool keep_alive);
+
 		// Send all output data to the client
-		boost::system::error_code flush();
+		virtual boost::system::error_code flush();
+
+		// Send a region of a file after flushing output data. Returns operation_not_supported
+		// if the file cannot be sent by the kernel, so that the caller sends it with flush().
+		virtual boost::system::error_code send_file(const std::string& path, long long offset, size_t length);
+
+#ifdef WSGI_BOOST_TLS
+		// Perform TLS handshake within the header timeout and encrypt the connection
+		boost::system::error_code start_tls(TlsContext& context);
+#endif // WSGI_BOOST_TLS
+
+		// Get the TLS session, nullptr for a plain connection
+		std::shared_ptr<TlsSession> tls() const;
+
+#ifdef WSGI_BOOST_IO_URING
+		// Read static files through the ring and, if receive is true, receive request data
+		// with a multishot receive instead of the asio reactor
+		void use_io_uring(IoUring& ring, bool receive);
+
+		// Get the ring of the connection, nullptr if it is not used
+		IoUring* io_uring() const;
+#endif // WSGI_BOOST_IO_URING
 
 		// Get asio socket pointer
-		std::shared_ptr<boost::asio::ip::tcp::socket> socket() const;
+		socket_ptr socket() const;
+
+		// Get the coroutine context of the connection
+		boost::asio::yield_context yield_context() const;
 
 		// Get POST content length
 		long long content_length() const;
+
+		// Get metrics of the server process
+		Metrics& metrics() const;
+
+		// Get the timing wheel of the connection
+		TimeoutWheel& timeouts() const;
+
+		// Get the time when the first byte of the current response was sent
+		// or the default time point if nothing has been sent yet
+		std::chrono::steady_clock::time_point first_byte_time() const;
+
+		// Get the total time of sending the current response
+		std::chrono::steady_clock::duration write_time() const;
+
+		// Get the number of bytes of the current response sent so far
+		unsigned long long bytes_sent() const;
 	};
 
 	// Wraps Connection instance to provide Python file-like object for wsgi.input
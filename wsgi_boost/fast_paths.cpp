@@ -0,0 +1,87 @@
+/*
+Fixed responses and redirects served without calling the WSGI app
+
+Copyright (c) 2016 Roman Miroshnychenko <romanvm@yandex.ua>
+License: MIT, see License.txt
+*/
+
+#include "fast_paths.h"
+#include "exceptions.h"
+
+#include <boost/algorithm/string.hpp>
+
+#include <algorithm>
+#include <cctype>
+
+using namespace std;
+namespace alg = boost::algorithm;
+
+
+namespace wsgi_boost
+{
+	namespace
+	{
+		void check_status(const string& status)
+		{
+			if (status.length() < 5 || !isdigit(status[0]) || !isdigit(status[1]) || !isdigit(status[2]) || status[3] != ' ')
+				throw RuntimeError("Invalid HTTP status: " + status + "!");
+		}
+	}
+
+
+	void FastPaths::add_fixed_response(const string& path, const string& status, headers_type headers, const string& body)
+	{
+		check_status(status);
+		// Content-Length is set by the server
+		headers.erase(remove_if(headers.begin(), headers.end(), [](const pair<string, string>& header)
+		{
+			return alg::iequals(header.first, "Content-Length");
+		}), headers.end());
+		m_responses[path] = make_shared<const PrebuiltResponse>(status, move(headers), body);
+	}
+
+
+	void FastPaths::add_redirect(const string& prefix, const string& target, const string& status, bool append_path)
+	{
+		check_status(status);
+		Redirect redirect;
+		redirect.prefix = prefix;
+		redirect.target = target;
+		redirect.status = status;
+		redirect.append_path = append_path;
+		if (!append_path)
+		{
+			headers_type headers;
+			headers.emplace_back("Location", target);
+			redirect.response = make_shared<const PrebuiltResponse>(status, move(headers), string());
+		}
+		auto it = m_redirects.begin();
+		while (it != m_redirects.end() && it->prefix.length() >= prefix.length())
+			++it;
+		m_redirects.insert(it, move(redirect));
+	}
+
+
+	shared_ptr<const PrebuiltResponse> FastPaths::find(const Request& request) const
+	{
+		if (!m_responses.empty() && (request.method == "GET" || request.method == "HEAD"))
+		{
+			size_t query = request.path.find('?');
+			auto it = query == string::npos ? m_responses.find(request.path) : m_responses.find(request.path.substr(0, query));
+			if (it != m_responses.end())
+				return it->second;
+		}
+		for (const auto& redirect : m_redirects)
+		{
+			if (request.path.compare(0, redirect.prefix.length(), redirect.prefix) == 0)
+			{
+				if (redirect.response)
+					return redirect.response;
+				headers_type headers;
+				headers.emplace_back("Location", redirect.target + request.path.substr(redirect.prefix.length()));
+				return make_shared<const PrebuiltResponse>(redirect.status, move(headers), string());
+			}
+		}
+		return nullptr;
+	}
+}
@@ -0,0 +1,55 @@
+#pragma once
+/*
+Fixed responses and redirects served without calling the WSGI app
+
+Copyright (c) 2016 Roman Miroshnychenko <romanvm@yandex.ua>
+License: MIT, see License.txt
+*/
+
+#include "request.h"
+#include "response.h"
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+namespace wsgi_boost
+{
+	// Routes that are matched before static routes and the WSGI app and served without the GIL.
+	// Routes are added before the server is started, so lookups do not need locking.
+	class FastPaths
+	{
+	private:
+		struct Redirect
+		{
+			std::string prefix;
+			std::string target;
+			std::string status;
+			bool append_path;
+			// The response for redirects to the same location
+			std::shared_ptr<const PrebuiltResponse> response;
+		};
+
+		std::unordered_map<std::string, std::shared_ptr<const PrebuiltResponse>> m_responses;
+		// Longest prefixes first
+		std::vector<Redirect> m_redirects;
+
+	public:
+		FastPaths(const FastPaths&) = delete;
+		FastPaths& operator=(const FastPaths&) = delete;
+
+		FastPaths() {}
+
+		// Respond to GET and HEAD requests for the path without query string
+		void add_fixed_response(const std::string& path, const std::string& status, headers_type headers, const std::string& body);
+
+		// Redirect requests for paths starting with the prefix to the target,
+		// followed by the rest of the path and the query string if append_path is true
+		void add_redirect(const std::string& prefix, const std::string& target, const std::string& status, bool append_path);
+
+		// Find a response for the request, nullptr if the request is not matched
+		std::shared_ptr<const PrebuiltResponse> find(const Request& request) const;
+	};
+}
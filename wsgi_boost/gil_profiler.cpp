@@ -0,0 +1,170 @@
+/*
+GIL contention profiler
+
+Copyright (c) 2016 Roman Miroshnychenko <romanvm@yandex.ua>
+License: MIT, see License.txt
+*/
+
+#include "gil_profiler.h"
+
+#include <algorithm>
+#include <functional>
+#include <thread>
+
+using namespace std;
+
+
+namespace wsgi_boost
+{
+	namespace
+	{
+		// GIL state of a server thread within a request
+		struct ThreadState
+		{
+			GilStats* stats = nullptr;
+			size_t slot = 0;
+			bool in_request = false;
+			chrono::steady_clock::time_point hold_start;
+			chrono::steady_clock::duration hold_time;
+		};
+
+		thread_local ThreadState thread_state;
+
+
+		unsigned long long to_ns(chrono::steady_clock::duration duration)
+		{
+			return static_cast<unsigned long long>(chrono::duration_cast<chrono::nanoseconds>(duration).count());
+		}
+	}
+
+
+	const char* gil_site_name(GilSite site)
+	{
+		switch (site)
+		{
+		case GilSite::request:
+			return "request";
+		case GilSite::reject:
+			return "reject";
+		case GilSite::write:
+			return "write";
+		case GilSite::send_iterable:
+			return "send_iterable";
+		case GilSite::input_read:
+			return "input_read";
+		case GilSite::input_readline:
+			return "input_readline";
+		case GilSite::websocket:
+			return "websocket";
+		case GilSite::websocket_send:
+			return "websocket_send";
+		default:
+			return "unknown";
+		}
+	}
+
+
+	void GilStats::reset()
+	{
+		for (auto& site : sites)
+		{
+			site.count.store(0);
+			site.wait_time.store(0);
+			site.max_wait.store(0);
+		}
+		for (auto& thread : threads)
+		{
+			thread.thread_id.store(0);
+			thread.waits.store(0);
+			thread.wait_time.store(0);
+			thread.hold_time.store(0);
+		}
+		thread_count.store(0);
+		hold.reset();
+	}
+
+
+	atomic<bool> GilProfiler::s_enabled{ false };
+	atomic<GilStats*> GilProfiler::s_stats{ nullptr };
+
+
+	void GilProfiler::configure(GilStats* stats, bool enabled)
+	{
+		s_stats.store(stats);
+		s_enabled.store(enabled && stats != nullptr);
+	}
+
+
+	void GilProfiler::acquired(GilSite site, chrono::steady_clock::time_point start)
+	{
+		GilStats* stats = s_stats.load(memory_order_relaxed);
+		if (stats == nullptr)
+			return;
+		auto now = chrono::steady_clock::now();
+		stats->sites[static_cast<size_t>(site)].count.fetch_add(1, memory_order_relaxed);
+		record_wait(*stats, site, now - start);
+		thread_state.in_request = true;
+		thread_state.hold_start = now;
+		thread_state.hold_time = chrono::steady_clock::duration::zero();
+	}
+
+
+	void GilProfiler::releasing()
+	{
+		GilStats* stats = s_stats.load(memory_order_relaxed);
+		if (stats == nullptr || !thread_state.in_request)
+			return;
+		thread_state.in_request = false;
+		thread_state.hold_time += chrono::steady_clock::now() - thread_state.hold_start;
+		stats->hold.record(thread_state.hold_time);
+		thread_stats(*stats).hold_time.fetch_add(to_ns(thread_state.hold_time), memory_order_relaxed);
+	}
+
+
+	void GilProfiler::handing_off(GilSite site)
+	{
+		GilStats* stats = s_stats.load(memory_order_relaxed);
+		if (stats == nullptr)
+			return;
+		stats->sites[static_cast<size_t>(site)].count.fetch_add(1, memory_order_relaxed);
+		if (thread_state.in_request)
+			thread_state.hold_time += chrono::steady_clock::now() - thread_state.hold_start;
+	}
+
+
+	void GilProfiler::reacquired(GilSite site, chrono::steady_clock::time_point start)
+	{
+		GilStats* stats = s_stats.load(memory_order_relaxed);
+		if (stats == nullptr)
+			return;
+		auto now = chrono::steady_clock::now();
+		// The handoff is already counted in handing_off()
+		record_wait(*stats, site, now - start);
+		thread_state.hold_start = now;
+	}
+
+
+	void GilProfiler::record_wait(GilStats& stats, GilSite site, chrono::steady_clock::duration wait)
+	{
+		GilSiteStats& site_stats = stats.sites[static_cast<size_t>(site)];
+		unsigned long long wait_ns = to_ns(wait);
+		site_stats.wait_time.fetch_add(wait_ns, memory_order_relaxed);
+		unsigned long long max_wait = site_stats.max_wait.load(memory_order_relaxed);
+		while (wait_ns > max_wait && !site_stats.max_wait.compare_exchange_weak(max_wait, wait_ns, memory_order_relaxed));
+		GilThreadStats& thread = thread_stats(stats);
+		thread.waits.fetch_add(1, memory_order_relaxed);
+		thread.wait_time.fetch_add(wait_ns, memory_order_relaxed);
+	}
+
+
+	GilThreadStats& GilProfiler::thread_stats(GilStats& stats)
+	{
+		if (thread_state.stats != &stats)
+		{
+			thread_state.stats = &stats;
+			thread_state.slot = min(stats.thread_count.fetch_add(1), GilStats::max_threads - 1);
+			stats.threads[thread_state.slot].thread_id.store(hash<thread::id>()(this_thread::get_id()));
+		}
+		return stats.threads[thread_state.slot];
+	}
+}
@@ -0,0 +1,115 @@
+#pragma once
+/*
+GIL contention profiler
+
+Copyright (c) 2016 Roman Miroshnychenko <romanvm@yandex.ua>
+License: MIT, see License.txt
+*/
+
+#include "metrics.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+
+
+namespace wsgi_boost
+{
+	// Code paths that acquire or release the GIL
+	enum class GilSite : unsigned char
+	{
+		// Acquiring the GIL to run a WSGI application
+		request,
+		// Releasing the GIL to reject a request
+		reject,
+		// Releasing the GIL in write() callable
+		write,
+		// Releasing the GIL to send chunks of a response iterable
+		send_iterable,
+		// Releasing the GIL in wsgi.input read()
+		input_read,
+		// Releasing the GIL in wsgi.input readline(), readlines() and iteration
+		input_readline,
+		// Acquiring the GIL to pass a WebSocket event to a handler
+		websocket,
+		// Releasing the GIL to send a WebSocket message
+		websocket_send,
+		count
+	};
+
+
+	const size_t gil_site_count = static_cast<size_t>(GilSite::count);
+
+	const char* gil_site_name(GilSite site);
+
+
+	struct GilSiteStats
+	{
+		// The number of GIL acquisitions or releases at the site
+		std::atomic<unsigned long long> count;
+		// Total and max. time of waiting to (re)acquire the GIL in ns
+		std::atomic<unsigned long long> wait_time;
+		std::atomic<unsigned long long> max_wait;
+	};
+
+
+	struct GilThreadStats
+	{
+		std::atomic<unsigned long long> thread_id;
+		std::atomic<unsigned long long> waits;
+		// Total time of waiting for and holding the GIL in ns
+		std::atomic<unsigned long long> wait_time;
+		std::atomic<unsigned long long> hold_time;
+	};
+
+
+	// GIL statistics of a server process. It contains only atomics, so it can be placed into shared memory.
+	struct GilStats
+	{
+		// Threads above the limit share the last slot
+		static const size_t max_threads = 64;
+
+		std::array<GilSiteStats, gil_site_count> sites;
+		std::array<GilThreadStats, max_threads> threads;
+		std::atomic<size_t> thread_count;
+		// GIL hold time per request
+		LatencyHistogram hold;
+
+		// Reset all counters to 0
+		void reset();
+	};
+
+
+	// Records GIL wait and hold times of the current process if profiling is enabled.
+	// Used by GilAcquire and GilRelease.
+	class GilProfiler
+	{
+	public:
+		// Set statistics of the current process and enable or disable profiling
+		static void configure(GilStats* stats, bool enabled);
+
+		static bool enabled()
+		{
+			return s_enabled.load(std::memory_order_relaxed);
+		}
+
+		// The GIL has been acquired for a request
+		static void acquired(GilSite site, std::chrono::steady_clock::time_point start);
+
+		// The GIL is about to be released at the end of a request
+		static void releasing();
+
+		// The GIL is about to be handed off to other threads inside a request
+		static void handing_off(GilSite site);
+
+		// The GIL has been reacquired after a handoff
+		static void reacquired(GilSite site, std::chrono::steady_clock::time_point start);
+
+	private:
+		static std::atomic<bool> s_enabled;
+		static std::atomic<GilStats*> s_stats;
+
+		static void record_wait(GilStats& stats, GilSite site, std::chrono::steady_clock::duration wait);
+		static GilThreadStats& thread_stats(GilStats& stats);
+	};
+}
@@ -0,0 +1,98 @@
+/*
+Passing the listening socket to a new server process for hot restart
+
+Copyright (c) 2016 Roman Miroshnychenko <romanvm@yandex.ua>
+License: MIT, see License.txt
+*/
+
+#include "handoff.h"
+
+#ifndef _WIN32
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+#endif // _WIN32
+
+
+namespace wsgi_boost
+{
+#ifndef _WIN32
+
+	bool send_descriptor(int channel, int fd)
+	{
+		// At least 1 byte of normal data must accompany ancillary data
+		char tag = 'L';
+		iovec data{ &tag, 1 };
+		char control[CMSG_SPACE(sizeof(int))];
+		memset(control, 0, sizeof(control));
+		msghdr message{};
+		message.msg_iov = &data;
+		message.msg_iovlen = 1;
+		message.msg_control = control;
+		message.msg_controllen = sizeof(control);
+		cmsghdr* header = CMSG_FIRSTHDR(&message);
+		header->cmsg_level = SOL_SOCKET;
+		header->cmsg_type = SCM_RIGHTS;
+		header->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(header), &fd, sizeof(int));
+		ssize_t result;
+		do
+		{
+			result = sendmsg(channel, &message, MSG_NOSIGNAL);
+		} while (result < 0 && errno == EINTR);
+		return result == 1;
+	}
+
+
+	int receive_descriptor(int channel)
+	{
+		char tag = 0;
+		iovec data{ &tag, 1 };
+		char control[CMSG_SPACE(sizeof(int))];
+		msghdr message{};
+		message.msg_iov = &data;
+		message.msg_iovlen = 1;
+		message.msg_control = control;
+		message.msg_controllen = sizeof(control);
+		ssize_t result;
+		do
+		{
+			result = recvmsg(channel, &message, 0);
+		} while (result < 0 && errno == EINTR);
+		if (result != 1 || tag != 'L')
+			return -1;
+		cmsghdr* header = CMSG_FIRSTHDR(&message);
+		if (header == nullptr || header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS ||
+			header->cmsg_len != CMSG_LEN(sizeof(int)))
+			return -1;
+		int fd;
+		memcpy(&fd, CMSG_DATA(header), sizeof(int));
+		// Worker processes forked later inherit the socket, but programs they exec do not
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+		return fd;
+	}
+
+#else
+
+	bool send_descriptor(int channel, int fd)
+	{
+		return false;
+	}
+
+
+	int receive_descriptor(int channel)
+	{
+		return -1;
+	}
+
+#endif // _WIN32
+}
@@ -0,0 +1,17 @@
+#pragma once
+/*
+Passing the listening socket to a new server process for hot restart
+
+Copyright (c) 2016 Roman Miroshnychenko <romanvm@yandex.ua>
+License: MIT, see License.txt
+*/
+
+
+namespace wsgi_boost
+{
+	// Send a file descriptor over a connected Unix domain socket with SCM_RIGHTS
+	bool send_descriptor(int channel, int fd);
+
+	// Receive a file descriptor sent with send_descriptor or return -1
+	int receive_descriptor(int channel);
+}
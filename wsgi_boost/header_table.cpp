@@ -0,0 +1,132 @@
+/*
+Flat table of HTTP request headers
+
+Copyright (c) 2016 Roman Miroshnychenko <romanvm@yandex.ua>
+License: MIT, see License.txt
+*/
+
+#include "header_table.h"
+
+#include <cctype>
+#include <cstring>
+
+using namespace std;
+
+
+namespace wsgi_boost
+{
+	namespace
+	{
+		// The order must match KnownHeader enum
+		const array<const char*, static_cast<size_t>(KnownHeader::unknown)> known_names{ {
+			"Host",
+			"Connection",
+			"Content-Length",
+			"Content-Type",
+			"Accept-Encoding",
+			"Range",
+			"If-Modified-Since",
+			"Expect",
+			"Upgrade",
+			"Transfer-Encoding",
+			"Referer",
+			"User-Agent"
+		} };
+
+
+		bool iequals(const char* str1, const char* str2, size_t length)
+		{
+			for (size_t i = 0; i < length; ++i)
+			{
+				if (tolower(static_cast<unsigned char>(str1[i])) != tolower(static_cast<unsigned char>(str2[i])))
+					return false;
+			}
+			return true;
+		}
+	}
+
+
+	KnownHeader HeaderTable::classify(const char* name, size_t length)
+	{
+		for (size_t i = 0; i < known_names.size(); ++i)
+		{
+			if (strlen(known_names[i]) == length && iequals(known_names[i], name, length))
+				return static_cast<KnownHeader>(i);
+		}
+		return KnownHeader::unknown;
+	}
+
+
+	void HeaderTable::clear()
+	{
+		m_size = 0;
+		m_slots.fill(0);
+	}
+
+
+	void HeaderTable::add(const char* name, size_t name_length, const char* value, size_t value_length)
+	{
+		KnownHeader known = classify(name, name_length);
+		Header* existing = nullptr;
+		if (known != KnownHeader::unknown)
+		{
+			size_t slot = m_slots[static_cast<size_t>(known)];
+			if (slot > 0)
+				existing = &m_headers[slot - 1];
+		}
+		else
+		{
+			for (size_t i = 0; i < m_size; ++i)
+			{
+				Header& header = m_headers[i];
+				if (header.known == KnownHeader::unknown && header.name.length() == name_length &&
+					iequals(header.name.data(), name, name_length))
+				{
+					existing = &header;
+					break;
+				}
+			}
+		}
+		if (existing != nullptr)
+		{
+			existing->value += ',';
+			existing->value.append(value, value_length);
+			return;
+		}
+		if (m_size == m_headers.size())
+			m_headers.emplace_back();
+		Header& header = m_headers[m_size++];
+		header.name.assign(name, name_length);
+		header.value.assign(value, value_length);
+		header.known = known;
+		if (known != KnownHeader::unknown)
+			m_slots[static_cast<size_t>(known)] = m_size;
+	}
+
+
+	const string* HeaderTable::find(KnownHeader header) const
+	{
+		if (header == KnownHeader::unknown)
+			return nullptr;
+		size_t slot = m_slots[static_cast<size_t>(header)];
+		if (slot == 0)
+			return nullptr;
+		return &m_headers[slot - 1].value;
+	}
+
+
+	const string* HeaderTable::find(const string& name) const
+	{
+		KnownHeader known = classify(name.data(), name.length());
+		if (known != KnownHeader::unknown)
+			return find(known);
+		for (size_t i = 0; i < m_size; ++i)
+		{
+			const Header& header = m_headers[i];
+			if (header.known == KnownHeader::unknown && header.name.length() == name.length() &&
+				iequals(header.name.data(), name.data(), name.length()))
+				return &header.value;
+		}
+		return nullptr;
+	}
+}
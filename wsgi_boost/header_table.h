@@ -0,0 +1,90 @@
+#pragma once
+/*
+Flat table of HTTP request headers
+
+Copyright (c) 2016 Roman Miroshnychenko <romanvm@yandex.ua>
+License: MIT, see License.txt
+*/
+
+#include <array>
+#include <string>
+#include <vector>
+
+
+namespace wsgi_boost
+{
+	// Well-known request headers that are resolved to fixed slots at parse time
+	enum class KnownHeader : unsigned char
+	{
+		host,
+		connection,
+		content_length,
+		content_type,
+		accept_encoding,
+		range,
+		if_modified_since,
+		expect,
+		upgrade,
+		transfer_encoding,
+		referer,
+		user_agent,
+		unknown
+	};
+
+
+	struct Header
+	{
+		std::string name;
+		std::string value;
+		KnownHeader known;
+	};
+
+
+	// Stores request headers in insertion order in a flat array.
+	// Known headers are found by their slots, other headers by a case-insensitive linear search.
+	// Header strings are not freed on clear() so that a persistent connection reuses their memory.
+	class HeaderTable
+	{
+	private:
+		std::vector<Header> m_headers;
+		size_t m_size = 0;
+		// Index + 1 of a known header in m_headers, 0 if the header is missing
+		std::array<size_t, static_cast<size_t>(KnownHeader::unknown)> m_slots;
+
+	public:
+		typedef std::vector<Header>::const_iterator const_iterator;
+
+		HeaderTable()
+		{
+			m_slots.fill(0);
+		}
+
+		// Resolve a header name to a known header
+		static KnownHeader classify(const char* name, size_t length);
+
+		void clear();
+
+		// Add a header or append its value to an existing header of the same name
+		void add(const char* name, size_t name_length, const char* value, size_t value_length);
+
+		// Find a header value, nullptr if the header is missing
+		const std::string* find(KnownHeader header) const;
+
+		const std::string* find(const std::string& name) const;
+
+		size_t size() const
+		{
+			return m_size;
+		}
+
+		const_iterator begin() const
+		{
+			return m_headers.begin();
+		}
+
+		const_iterator end() const
+		{
+			return m_headers.begin() + m_size;
+		}
+	};
+}
@@ -0,0 +1,134 @@
+/*
+Preformatted HTTP/1.x status lines and fixed response headers
+
+Copyright (c) 2016 Roman Miroshnychenko <romanvm@yandex.ua>
+License: MIT, see License.txt
+*/
+
+#include "header_writer.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <ctime>
+
+using namespace std;
+
+
+#define WSGI_BOOST_STATUS(code, reason) { code, byte_string(reason), byte_string("HTTP/1.1 " #code " " reason "\r\n") }
+
+
+namespace wsgi_boost
+{
+	namespace
+	{
+		struct StatusEntry
+		{
+			unsigned int code;
+			ByteString reason;
+			ByteString line;
+		};
+
+
+		// Sorted by status code
+		const StatusEntry status_table[] = {
+			WSGI_BOOST_STATUS(100, "Continue"),
+			WSGI_BOOST_STATUS(101, "Switching Protocols"),
+			WSGI_BOOST_STATUS(200, "OK"),
+			WSGI_BOOST_STATUS(201, "Created"),
+			WSGI_BOOST_STATUS(202, "Accepted"),
+			WSGI_BOOST_STATUS(203, "Non-Authoritative Information"),
+			WSGI_BOOST_STATUS(204, "No Content"),
+			WSGI_BOOST_STATUS(205, "Reset Content"),
+			WSGI_BOOST_STATUS(206, "Partial Content"),
+			WSGI_BOOST_STATUS(300, "Multiple Choices"),
+			WSGI_BOOST_STATUS(301, "Moved Permanently"),
+			WSGI_BOOST_STATUS(302, "Found"),
+			WSGI_BOOST_STATUS(303, "See Other"),
+			WSGI_BOOST_STATUS(304, "Not Modified"),
+			WSGI_BOOST_STATUS(307, "Temporary Redirect"),
+			WSGI_BOOST_STATUS(308, "Permanent Redirect"),
+			WSGI_BOOST_STATUS(400, "Bad Request"),
+			WSGI_BOOST_STATUS(401, "Unauthorized"),
+			WSGI_BOOST_STATUS(402, "Payment Required"),
+			WSGI_BOOST_STATUS(403, "Forbidden"),
+			WSGI_BOOST_STATUS(404, "Not Found"),
+			WSGI_BOOST_STATUS(405, "Method Not Allowed"),
+			WSGI_BOOST_STATUS(406, "Not Acceptable"),
+			WSGI_BOOST_STATUS(407, "Proxy Authentication Required"),
+			WSGI_BOOST_STATUS(408, "Request Timeout"),
+			WSGI_BOOST_STATUS(409, "Conflict"),
+			WSGI_BOOST_STATUS(410, "Gone"),
+			WSGI_BOOST_STATUS(411, "Length Required"),
+			WSGI_BOOST_STATUS(412, "Precondition Failed"),
+			WSGI_BOOST_STATUS(413, "Payload Too Large"),
+			WSGI_BOOST_STATUS(414, "URI Too Long"),
+			WSGI_BOOST_STATUS(415, "Unsupported Media Type"),
+			WSGI_BOOST_STATUS(416, "Range Not Satisfiable"),
+			WSGI_BOOST_STATUS(417, "Expectation Failed"),
+			WSGI_BOOST_STATUS(421, "Misdirected Request"),
+			WSGI_BOOST_STATUS(422, "Unprocessable Entity"),
+			WSGI_BOOST_STATUS(426, "Upgrade Required"),
+			WSGI_BOOST_STATUS(428, "Precondition Required"),
+			WSGI_BOOST_STATUS(429, "Too Many Requests"),
+			WSGI_BOOST_STATUS(431, "Request Header Fields Too Large"),
+			WSGI_BOOST_STATUS(451, "Unavailable For Legal Reasons"),
+			WSGI_BOOST_STATUS(500, "Internal Server Error"),
+			WSGI_BOOST_STATUS(501, "Not Implemented"),
+			WSGI_BOOST_STATUS(502, "Bad Gateway"),
+			WSGI_BOOST_STATUS(503, "Service Unavailable"),
+			WSGI_BOOST_STATUS(504, "Gateway Timeout"),
+			WSGI_BOOST_STATUS(505, "HTTP Version Not Supported")
+		};
+
+
+		const StatusEntry* find_status(unsigned int status_code)
+		{
+			const StatusEntry* end = status_table + sizeof(status_table) / sizeof(status_table[0]);
+			const StatusEntry* entry = lower_bound(status_table, end, status_code,
+				[](const StatusEntry& item, unsigned int code) { return item.code < code; });
+			return entry != end && entry->code == status_code ? entry : nullptr;
+		}
+	}
+
+
+	const char* status_reason(unsigned int status_code)
+	{
+		const StatusEntry* entry = find_status(status_code);
+		return entry != nullptr ? entry->reason.data : "";
+	}
+
+
+	ByteString status_line(const string& http_version, const string& status)
+	{
+		ByteString none{ nullptr, 0 };
+		if (status.length() < 5 || status[3] != ' ' || http_version != "HTTP/1.1")
+			return none;
+		unsigned int status_code = 0;
+		for (size_t i = 0; i < 3; ++i)
+		{
+			if (status[i] < '0' || status[i] > '9')
+				return none;
+			status_code = status_code * 10 + (status[i] - '0');
+		}
+		const StatusEntry* entry = find_status(status_code);
+		// Apps may send custom reason phrases
+		if (entry == nullptr || status.length() != entry->reason.length + 4 ||
+			status.compare(4, string::npos, entry->reason.data, entry->reason.length) != 0)
+			return none;
+		return entry->line;
+	}
+
+
+	const string& current_http_date()
+	{
+		thread_local time_t formatted_time = 0;
+		thread_local string date;
+		time_t now = time(nullptr);
+		if (now != formatted_time)
+		{
+			date = time_to_header(now);
+			formatted_time = now;
+		}
+		return date;
+	}
+}
@@ -0,0 +1,69 @@
+#pragma once
+/*
+Preformatted HTTP/1.x status lines and fixed response headers
+
+Copyright (c) 2016 Roman Miroshnychenko <romanvm@yandex.ua>
+License: MIT, see License.txt
+*/
+
+#include "version.h"
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+
+namespace wsgi_boost
+{
+	// A string literal with the length computed at compile time
+	struct ByteString
+	{
+		const char* data;
+		size_t length;
+	};
+
+
+	template <size_t N>
+	constexpr ByteString byte_string(const char (&literal)[N])
+	{
+		return ByteString{ literal, N - 1 };
+	}
+
+
+	const char server_name[] = "WsgiBoost v." WSGI_BOOST_VERSION;
+
+	constexpr ByteString server_header_line = byte_string("Server: WsgiBoost v." WSGI_BOOST_VERSION "\r\n");
+	constexpr ByteString keep_alive_header_line = byte_string("Connection: keep-alive\r\n");
+	constexpr ByteString close_header_line = byte_string("Connection: close\r\n");
+
+
+	// Get the reason phrase of an HTTP status code, "" for unknown codes
+	const char* status_reason(unsigned int status_code);
+
+	// Get a preformatted "HTTP/1.1 <status>\r\n" line if the status is a well-known code
+	// with its standard reason phrase, otherwise the length of the result is 0
+	ByteString status_line(const std::string& http_version, const std::string& status);
+
+	// Get the current time in HTTP header format. It's formatted once per second in each thread.
+	const std::string& current_http_date();
+
+
+	// Copy bytes to a raw output buffer and return the position after them
+	inline char* put_bytes(char* out, const char* data, size_t length)
+	{
+		std::memcpy(out, data, length);
+		return out + length;
+	}
+
+
+	inline char* put_bytes(char* out, const std::string& data)
+	{
+		return put_bytes(out, data.data(), data.length());
+	}
+
+
+	inline char* put_bytes(char* out, ByteString data)
+	{
+		return put_bytes(out, data.data, data.length);
+	}
+}
@@ -0,0 +1,400 @@
+/*
+HPACK header compression for HTTP/2 (RFC 7541)
+
+Copyright (c) 2016 Roman Miroshnychenko <romanvm@yandex.ua>
+License: MIT, see License.txt
+*/
+
+#include "hpack.h"
+
+#include <array>
+#include <unordered_map>
+
+using namespace std;
+
+
+namespace wsgi_boost
+{
+	namespace
+	{
+		// Limit of the decoded size of a header block to protect from decompression bombs
+		const size_t max_header_list_size = 262144;
+		const size_t entry_overhead = 32;
+
+		struct StaticEntry
+		{
+			const char* name;
+			const char* value;
+		};
+
+		const array<StaticEntry, 61> static_table{ {
+			{ ":authority", "" }, { ":method", "GET" }, { ":method", "POST" },
+			{ ":path", "/" }, { ":path", "/index.html" }, { ":scheme", "http" },
+			{ ":scheme", "https" }, { ":status", "200" }, { ":status", "204" },
+			{ ":status", "206" }, { ":status", "304" }, { ":status", "400" },
+			{ ":status", "404" }, { ":status", "500" }, { "accept-charset", "" },
+			{ "accept-encoding", "gzip, deflate" }, { "accept-language", "" }, { "accept-ranges", "" },
+			{ "accept", "" }, { "access-control-allow-origin", "" }, { "age", "" },
+			{ "allow", "" }, { "authorization", "" }, { "cache-control", "" },
+			{ "content-disposition", "" }, { "content-encoding", "" }, { "content-language", "" },
+			{ "content-length", "" }, { "content-location", "" }, { "content-range", "" },
+			{ "content-type", "" }, { "cookie", "" }, { "date", "" },
+			{ "etag", "" }, { "expect", "" }, { "expires", "" },
+			{ "from", "" }, { "host", "" }, { "if-match", "" },
+			{ "if-modified-since", "" }, { "if-none-match", "" }, { "if-range", "" },
+			{ "if-unmodified-since", "" }, { "last-modified", "" }, { "link", "" },
+			{ "location", "" }, { "max-forwards", "" }, { "proxy-authenticate", "" },
+			{ "proxy-authorization", "" }, { "range", "" }, { "referer", "" },
+			{ "refresh", "" }, { "retry-after", "" }, { "server", "" },
+			{ "set-cookie", "" }, { "strict-transport-security", "" }, { "transfer-encoding", "" },
+			{ "user-agent", "" }, { "vary", "" }, { "via", "" },
+			{ "www-authenticate", "" }
+		} };
+
+		struct HuffmanCode
+		{
+			unsigned int code;
+			unsigned char length;
+		};
+
+		// Codes of 256 octets and EOS
+		const array<HuffmanCode, 257> huffman_codes{ {
+			{ 0x1ff8, 13 }, { 0x7fffd8, 23 }, { 0xfffffe2, 28 }, { 0xfffffe3, 28 }, { 0xfffffe4, 28 }, { 0xfffffe5, 28 },
+			{ 0xfffffe6, 28 }, { 0xfffffe7, 28 }, { 0xfffffe8, 28 }, { 0xffffea, 24 }, { 0x3ffffffc, 30 }, { 0xfffffe9, 28 },
+			{ 0xfffffea, 28 }, { 0x3ffffffd, 30 }, { 0xfffffeb, 28 }, { 0xfffffec, 28 }, { 0xfffffed, 28 }, { 0xfffffee, 28 },
+			{ 0xfffffef, 28 }, { 0xffffff0, 28 }, { 0xffffff1, 28 }, { 0xffffff2, 28 }, { 0x3ffffffe, 30 }, { 0xffffff3, 28 },
+			{ 0xffffff4, 28 }, { 0xffffff5, 28 }, { 0xffffff6, 28 }, { 0xffffff7, 28 }, { 0xffffff8, 28 }, { 0xffffff9, 28 },
+			{ 0xffffffa, 28 }, { 0xffffffb, 28 }, { 0x14, 6 }, { 0x3f8, 10 }, { 0x3f9, 10 }, { 0xffa, 12 },
+			{ 0x1ff9, 13 }, { 0x15, 6 }, { 0xf8, 8 }, { 0x7fa, 11 }, { 0x3fa, 10 }, { 0x3fb, 10 },
+			{ 0xf9, 8 }, { 0x7fb, 11 }, { 0xfa, 8 }, { 0x16, 6 }, { 0x17, 6 }, { 0x18, 6 },
+			{ 0x0, 5 }, { 0x1, 5 }, { 0x2, 5 }, { 0x19, 6 }, { 0x1a, 6 }, { 0x1b, 6 },
+			{ 0x1c, 6 }, { 0x1d, 6 }, { 0x1e, 6 }, { 0x1f, 6 }, { 0x5c, 7 }, { 0xfb, 8 },
+			{ 0x7ffc, 15 }, { 0x20, 6 }, { 0xffb, 12 }, { 0x3fc, 10 }, { 0x1ffa, 13 }, { 0x21, 6 },
+			{ 0x5d, 7 }, { 0x5e, 7 }, { 0x5f, 7 }, { 0x60, 7 }, { 0x61, 7 }, { 0x62, 7 },
+			{ 0x63, 7 }, { 0x64, 7 }, { 0x65, 7 }, { 0x66, 7 }, { 0x67, 7 }, { 0x68, 7 },
+			{ 0x69, 7 }, { 0x6a, 7 }, { 0x6b, 7 }, { 0x6c, 7 }, { 0x6d, 7 }, { 0x6e, 7 },
+			{ 0x6f, 7 }, { 0x70, 7 }, { 0x71, 7 }, { 0x72, 7 }, { 0xfc, 8 }, { 0x73, 7 },
+			{ 0xfd, 8 }, { 0x1ffb, 13 }, { 0x7fff0, 19 }, { 0x1ffc, 13 }, { 0x3ffc, 14 }, { 0x22, 6 },
+			{ 0x7ffd, 15 }, { 0x3, 5 }, { 0x23, 6 }, { 0x4, 5 }, { 0x24, 6 }, { 0x5, 5 },
+			{ 0x25, 6 }, { 0x26, 6 }, { 0x27, 6 }, { 0x6, 5 }, { 0x74, 7 }, { 0x75, 7 },
+			{ 0x28, 6 }, { 0x29, 6 }, { 0x2a, 6 }, { 0x7, 5 }, { 0x2b, 6 }, { 0x76, 7 },
+			{ 0x2c, 6 }, { 0x8, 5 }, { 0x9, 5 }, { 0x2d, 6 }, { 0x77, 7 }, { 0x78, 7 },
+			{ 0x79, 7 }, { 0x7a, 7 }, { 0x7b, 7 }, { 0x7ffe, 15 }, { 0x7fc, 11 }, { 0x3ffd, 14 },
+			{ 0x1ffd, 13 }, { 0xffffffc, 28 }, { 0xfffe6, 20 }, { 0x3fffd2, 22 }, { 0xfffe7, 20 }, { 0xfffe8, 20 },
+			{ 0x3fffd3, 22 }, { 0x3fffd4, 22 }, { 0x3fffd5, 22 }, { 0x7fffd9, 23 }, { 0x3fffd6, 22 }, { 0x7fffda, 23 },
+			{ 0x7fffdb, 23 }, { 0x7fffdc, 23 }, { 0x7fffdd, 23 }, { 0x7fffde, 23 }, { 0xffffeb, 24 }, { 0x7fffdf, 23 },
+			{ 0xffffec, 24 }, { 0xffffed, 24 }, { 0x3fffd7, 22 }, { 0x7fffe0, 23 }, { 0xffffee, 24 }, { 0x7fffe1, 23 },
+			{ 0x7fffe2, 23 }, { 0x7fffe3, 23 }, { 0x7fffe4, 23 }, { 0x1fffdc, 21 }, { 0x3fffd8, 22 }, { 0x7fffe5, 23 },
+			{ 0x3fffd9, 22 }, { 0x7fffe6, 23 }, { 0x7fffe7, 23 }, { 0xffffef, 24 }, { 0x3fffda, 22 }, { 0x1fffdd, 21 },
+			{ 0xfffe9, 20 }, { 0x3fffdb, 22 }, { 0x3fffdc, 22 }, { 0x7fffe8, 23 }, { 0x7fffe9, 23 }, { 0x1fffde, 21 },
+			{ 0x7fffea, 23 }, { 0x3fffdd, 22 }, { 0x3fffde, 22 }, { 0xfffff0, 24 }, { 0x1fffdf, 21 }, { 0x3fffdf, 22 },
+			{ 0x7fffeb, 23 }, { 0x7fffec, 23 }, { 0x1fffe0, 21 }, { 0x1fffe1, 21 }, { 0x3fffe0, 22 }, { 0x1fffe2, 21 },
+			{ 0x7fffed, 23 }, { 0x3fffe1, 22 }, { 0x7fffee, 23 }, { 0x7fffef, 23 }, { 0xfffea, 20 }, { 0x3fffe2, 22 },
+			{ 0x3fffe3, 22 }, { 0x3fffe4, 22 }, { 0x7ffff0, 23 }, { 0x3fffe5, 22 }, { 0x3fffe6, 22 }, { 0x7ffff1, 23 },
+			{ 0x3ffffe0, 26 }, { 0x3ffffe1, 26 }, { 0xfffeb, 20 }, { 0x7fff1, 19 }, { 0x3fffe7, 22 }, { 0x7ffff2, 23 },
+			{ 0x3fffe8, 22 }, { 0x1ffffec, 25 }, { 0x3ffffe2, 26 }, { 0x3ffffe3, 26 }, { 0x3ffffe4, 26 }, { 0x7ffffde, 27 },
+			{ 0x7ffffdf, 27 }, { 0x3ffffe5, 26 }, { 0xfffff1, 24 }, { 0x1ffffed, 25 }, { 0x7fff2, 19 }, { 0x1fffe3, 21 },
+			{ 0x3ffffe6, 26 }, { 0x7ffffe0, 27 }, { 0x7ffffe1, 27 }, { 0x3ffffe7, 26 }, { 0x7ffffe2, 27 }, { 0xfffff2, 24 },
+			{ 0x1fffe4, 21 }, { 0x1fffe5, 21 }, { 0x3ffffe8, 26 }, { 0x3ffffe9, 26 }, { 0xffffffd, 28 }, { 0x7ffffe3, 27 },
+			{ 0x7ffffe4, 27 }, { 0x7ffffe5, 27 }, { 0xfffec, 20 }, { 0xfffff3, 24 }, { 0xfffed, 20 }, { 0x1fffe6, 21 },
+			{ 0x3fffe9, 22 }, { 0x1fffe7, 21 }, { 0x1fffe8, 21 }, { 0x7ffff3, 23 }, { 0x3fffea, 22 }, { 0x3fffeb, 22 },
+			{ 0x1ffffee, 25 }, { 0x1ffffef, 25 }, { 0xfffff4, 24 }, { 0xfffff5, 24 }, { 0x3ffffea, 26 }, { 0x7ffff4, 23 },
+			{ 0x3ffffeb, 26 }, { 0x7ffffe6, 27 }, { 0x3ffffec, 26 }, { 0x3ffffed, 26 }, { 0x7ffffe7, 27 }, { 0x7ffffe8, 27 },
+			{ 0x7ffffe9, 27 }, { 0x7ffffea, 27 }, { 0x7ffffeb, 27 }, { 0xffffffe, 28 }, { 0x7ffffec, 27 }, { 0x7ffffed, 27 },
+			{ 0x7ffffee, 27 }, { 0x7ffffef, 27 }, { 0x7fffff0, 27 }, { 0x3ffffee, 26 }, { 0x3fffffff, 30 }
+		} };
+
+
+		// Binary decoding tree. A positive child is a node index,
+		// a negative child is a leaf with the symbol -(child + 1), 0 is a missing child.
+		vector<array<int, 2>> build_huffman_tree()
+		{
+			vector<array<int, 2>> tree(1, array<int, 2>{ { 0, 0 } });
+			for (size_t symbol = 0; symbol < huffman_codes.size(); ++symbol)
+			{
+				size_t node = 0;
+				for (int bit = huffman_codes[symbol].length - 1; bit >= 0; --bit)
+				{
+					int branch = (huffman_codes[symbol].code >> bit) & 1;
+					if (bit == 0)
+					{
+						tree[node][branch] = -static_cast<int>(symbol) - 1;
+					}
+					else
+					{
+						if (tree[node][branch] == 0)
+						{
+							tree[node][branch] = static_cast<int>(tree.size());
+							tree.push_back(array<int, 2>{ { 0, 0 } });
+						}
+						node = tree[node][branch];
+					}
+				}
+			}
+			return tree;
+		}
+
+
+		bool decode_integer(const unsigned char*& pos, const unsigned char* end, unsigned int prefix_bits, size_t& value)
+		{
+			if (pos == end)
+				return false;
+			size_t max_prefix = (1u << prefix_bits) - 1;
+			value = *pos++ & max_prefix;
+			if (value < max_prefix)
+				return true;
+			for (unsigned int shift = 0; pos != end && shift <= 28; shift += 7)
+			{
+				unsigned char byte = *pos++;
+				value += static_cast<size_t>(byte & 0x7f) << shift;
+				if ((byte & 0x80) == 0)
+					return true;
+			}
+			return false;
+		}
+
+
+		bool decode_string(const unsigned char*& pos, const unsigned char* end, string& value)
+		{
+			if (pos == end)
+				return false;
+			bool huffman = (*pos & 0x80) != 0;
+			size_t length;
+			if (!decode_integer(pos, end, 7, length) || length > static_cast<size_t>(end - pos))
+				return false;
+			const char* data = reinterpret_cast<const char*>(pos);
+			pos += length;
+			if (huffman)
+			{
+				value.clear();
+				return huffman_decode(data, length, value);
+			}
+			value.assign(data, length);
+			return true;
+		}
+
+
+		void encode_integer(string& block, unsigned char flags, unsigned int prefix_bits, size_t value)
+		{
+			size_t max_prefix = (1u << prefix_bits) - 1;
+			if (value < max_prefix)
+			{
+				block += static_cast<char>(flags | value);
+				return;
+			}
+			block += static_cast<char>(flags | max_prefix);
+			value -= max_prefix;
+			while (value >= 0x80)
+			{
+				block += static_cast<char>((value & 0x7f) | 0x80);
+				value >>= 7;
+			}
+			block += static_cast<char>(value);
+		}
+
+
+		void encode_string(string& block, const string& value)
+		{
+			encode_integer(block, 0x00, 7, value.length());
+			block += value;
+		}
+
+
+		// Index of the first static table entry with the name, 0 if there is none
+		size_t find_static_name(const string& name)
+		{
+			static const unordered_map<string, size_t> names = []()
+			{
+				unordered_map<string, size_t> result;
+				for (size_t i = static_table.size(); i > 0; --i)
+					result[static_table[i - 1].name] = i;
+				return result;
+			}();
+			auto it = names.find(name);
+			return it != names.end() ? it->second : 0;
+		}
+	}
+
+
+	bool huffman_decode(const char* data, size_t length, string& output)
+	{
+		static const vector<array<int, 2>> tree = build_huffman_tree();
+		size_t node = 0;
+		// Bits after the last complete symbol must be a prefix of EOS (all ones) shorter than 8 bits
+		unsigned int padding_bits = 0;
+		bool padding_ones = true;
+		for (size_t i = 0; i < length; ++i)
+		{
+			unsigned char byte = static_cast<unsigned char>(data[i]);
+			for (int bit = 7; bit >= 0; --bit)
+			{
+				int branch = (byte >> bit) & 1;
+				int next = tree[node][branch];
+				if (next == 0)
+					return false;
+				if (next < 0)
+				{
+					int symbol = -next - 1;
+					if (symbol == 256)
+						return false;
+					output += static_cast<char>(symbol);
+					node = 0;
+					padding_bits = 0;
+					padding_ones = true;
+				}
+				else
+				{
+					node = next;
+					++padding_bits;
+					padding_ones = padding_ones && branch == 1;
+				}
+			}
+		}
+		return padding_bits < 8 && padding_ones;
+	}
+
+
+#pragma region HpackDecoder
+
+	bool HpackDecoder::get_entry(size_t index, pair<string, string>& entry) const
+	{
+		if (index == 0)
+			return false;
+		if (index <= static_table.size())
+		{
+			entry.first = static_table[index - 1].name;
+			entry.second = static_table[index - 1].value;
+			return true;
+		}
+		index -= static_table.size() + 1;
+		if (index >= m_table.size())
+			return false;
+		entry = m_table[index];
+		return true;
+	}
+
+
+	void HpackDecoder::evict(size_t max_size)
+	{
+		while (m_table_size > max_size && !m_table.empty())
+		{
+			m_table_size -= m_table.back().first.length() + m_table.back().second.length() + entry_overhead;
+			m_table.pop_back();
+		}
+	}
+
+
+	void HpackDecoder::add_entry(const string& name, const string& value)
+	{
+		size_t size = name.length() + value.length() + entry_overhead;
+		if (size > m_max_table_size)
+		{
+			evict(0);
+			return;
+		}
+		evict(m_max_table_size - size);
+		m_table.emplace_front(name, value);
+		m_table_size += size;
+	}
+
+
+	bool HpackDecoder::decode(const string& block, header_list_type& headers)
+	{
+		const unsigned char* pos = reinterpret_cast<const unsigned char*>(block.data());
+		const unsigned char* end = pos + block.size();
+		size_t list_size = 0;
+		size_t first_header = headers.size();
+		pair<string, string> entry;
+		while (pos != end)
+		{
+			unsigned char byte = *pos;
+			size_t index;
+			if (byte & 0x80)
+			{
+				// Indexed header field
+				if (!decode_integer(pos, end, 7, index) || !get_entry(index, entry))
+					return false;
+			}
+			else if ((byte & 0xe0) == 0x20)
+			{
+				// Dynamic table size update is allowed only at the beginning of a header block
+				if (!decode_integer(pos, end, 5, index) || index > m_settings_table_size || headers.size() != first_header)
+					return false;
+				m_max_table_size = index;
+				evict(m_max_table_size);
+				continue;
+			}
+			else
+			{
+				// Literal header field with incremental indexing (01), without indexing (0000) or never indexed (0001)
+				bool indexing = (byte & 0x40) != 0;
+				if (!decode_integer(pos, end, indexing ? 6 : 4, index))
+					return false;
+				if (index > 0)
+				{
+					if (!get_entry(index, entry))
+						return false;
+				}
+				else if (!decode_string(pos, end, entry.first))
+				{
+					return false;
+				}
+				if (!decode_string(pos, end, entry.second))
+					return false;
+				if (indexing)
+					add_entry(entry.first, entry.second);
+			}
+			list_size += entry.first.length() + entry.second.length() + entry_overhead;
+			if (list_size > max_header_list_size)
+				return false;
+			headers.push_back(entry);
+		}
+		return true;
+	}
+
+#pragma endregion
+
+#pragma region HpackEncoder
+
+	void HpackEncoder::encode_status(string& block, unsigned int status_code)
+	{
+		switch (status_code)
+		{
+		case 200:
+			block += static_cast<char>(0x88);
+			return;
+		case 204:
+			block += static_cast<char>(0x89);
+			return;
+		case 206:
+			block += static_cast<char>(0x8a);
+			return;
+		case 304:
+			block += static_cast<char>(0x8b);
+			return;
+		case 400:
+			block += static_cast<char>(0x8c);
+			return;
+		case 404:
+			block += static_cast<char>(0x8d);
+			return;
+		case 500:
+			block += static_cast<char>(0x8e);
+			return;
+		}
+		encode_integer(block, 0x00, 4, 8);
+		encode_string(block, to_string(status_code));
+	}
+
+
+	void HpackEncoder::encode(string& block, const string& name, const string& value)
+	{
+		size_t index = find_static_name(name);
+		encode_integer(block, 0x00, 4, index);
+		if (index == 0)
+			encode_string(block, name);
+		encode_string(block, value);
+	}
+
+#pragma endregion
+}
@@ -0,0 +1,65 @@
+#pragma once
+/*
+HPACK header compression for HTTP/2 (RFC 7541)
+
+Copyright (c) 2016 Roman Miroshnychenko <romanvm@yandex.ua>
+License: MIT, see License.txt
+*/
+
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+namespace wsgi_boost
+{
+	typedef std::vector<std::pair<std::string, std::string>> header_list_type;
+
+
+	// Decodes header blocks of one HTTP/2 connection.
+	// The dynamic table is shared by all header blocks of the connection,
+	// so blocks must be decoded in the order they are received.
+	class HpackDecoder
+	{
+	private:
+		std::deque<std::pair<std::string, std::string>> m_table;
+		size_t m_table_size = 0;
+		size_t m_max_table_size;
+		// The limit advertised in SETTINGS_HEADER_TABLE_SIZE
+		size_t m_settings_table_size;
+
+		bool get_entry(size_t index, std::pair<std::string, std::string>& entry) const;
+		void add_entry(const std::string& name, const std::string& value);
+		void evict(size_t max_size);
+
+	public:
+		HpackDecoder(const HpackDecoder&) = delete;
+		HpackDecoder& operator=(const HpackDecoder&) = delete;
+
+		explicit HpackDecoder(size_t max_table_size = 4096) :
+			m_max_table_size{ max_table_size }, m_settings_table_size{ max_table_size } {}
+
+		// Decode a complete header block into a list of headers,
+		// false on a compression error that must be treated as a connection error
+		bool decode(const std::string& block, header_list_type& headers);
+	};
+
+
+	// Encodes response header blocks.
+	// Header fields are encoded as literals without indexing with indexed names where possible,
+	// so the encoder does not keep a dynamic table and can be used from any thread.
+	class HpackEncoder
+	{
+	public:
+		// Append :status pseudo-header
+		static void encode_status(std::string& block, unsigned int status_code);
+
+		// Append a header field, the name must be lower-case
+		static void encode(std::string& block, const std::string& name, const std::string& value);
+	};
+
+
+	// Decode a Huffman-encoded string, false if the string is malformed
+	bool huffman_decode(const char* data, size_t length, std::string& output);
+}
@@ -0,0 +1,1031 @@
+/*
+HTTP/2 connections
+
+Copyright (c) 2016 Roman Miroshnychenko <romanvm@yandex.ua>
+License: MIT, see License.txt
+*/
+
+#include "http2.h"
+#include "response.h"
+
+#include <boost/algorithm/string.hpp>
+
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+namespace asio = boost::asio;
+namespace sys = boost::system;
+namespace alg = boost::algorithm;
+
+
+namespace wsgi_boost
+{
+	namespace
+	{
+		const char client_preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+		// The length of "PRI * HTTP/2.0\r\n\r\n" that is parsed as HTTP/1.x request header
+		const size_t preface_request_length = 18;
+		const size_t frame_header_size = 9;
+		// SETTINGS_MAX_FRAME_SIZE is not changed, so clients send frames up to the default size
+		const size_t max_frame_size = 16384;
+		const size_t max_header_block_size = 262144;
+		const long long default_window_size = 65535;
+		const long long max_window_size = 0x7fffffff;
+		// Request content is buffered until the request is complete, so the received data
+		// is acknowledged at once and a large window lets clients upload without waiting.
+		// The content of each stream is limited by max_content_size.
+		const long long receive_window_size = 1 << 20;
+		// A handler coroutine waits if more response data is queued for its stream
+		const size_t max_pending_data = 262144;
+		// Handlers that hold the GIL cannot wait, so their streams are cancelled instead
+		const size_t max_queued_data = 16 << 20;
+		// The same limit as for HTTP/1.x requests
+		const size_t max_headers = 100;
+
+		enum FrameType : unsigned char
+		{
+			data_frame = 0x0,
+			headers_frame = 0x1,
+			priority_frame = 0x2,
+			rst_stream_frame = 0x3,
+			settings_frame = 0x4,
+			push_promise_frame = 0x5,
+			ping_frame = 0x6,
+			goaway_frame = 0x7,
+			window_update_frame = 0x8,
+			continuation_frame = 0x9
+		};
+
+		enum FrameFlags : unsigned char
+		{
+			end_stream_flag = 0x1,
+			ack_flag = 0x1,
+			end_headers_flag = 0x4,
+			padded_flag = 0x8,
+			priority_flag = 0x20
+		};
+
+		enum Setting : unsigned short
+		{
+			header_table_size_setting = 0x1,
+			enable_push_setting = 0x2,
+			max_concurrent_streams_setting = 0x3,
+			initial_window_size_setting = 0x4,
+			max_frame_size_setting = 0x5,
+			max_header_list_size_setting = 0x6
+		};
+
+		// Connection-specific headers that are not allowed in HTTP/2
+		const char* const connection_headers[] = { "connection", "keep-alive", "proxy-connection", "transfer-encoding", "upgrade" };
+
+
+		unsigned int get_uint32(const char* data)
+		{
+			const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+			return (static_cast<unsigned int>(bytes[0]) << 24) | (static_cast<unsigned int>(bytes[1]) << 16) |
+				(static_cast<unsigned int>(bytes[2]) << 8) | bytes[3];
+		}
+
+
+		void put_uint(string& buffer, unsigned int value, size_t size)
+		{
+			for (size_t i = size; i > 0; --i)
+				buffer += static_cast<char>((value >> (8 * (i - 1))) & 0xff);
+		}
+
+
+		// Declared content length of a request, 0 if the header is absent
+		unsigned long long content_length(const header_list_type& headers)
+		{
+			for (const auto& header : headers)
+			{
+				if (header.first == "content-length")
+					return strtoull(header.second.c_str(), nullptr, 10);
+			}
+			return 0;
+		}
+
+
+		bool is_connection_header(const string& name)
+		{
+			for (const char* header : connection_headers)
+			{
+				if (name == header)
+					return true;
+			}
+			return false;
+		}
+
+
+		bool base64url_decode(const string& input, string& output)
+		{
+			unsigned int buffer = 0;
+			int bits = 0;
+			for (char c : input)
+			{
+				int value;
+				if (c >= 'A' && c <= 'Z')
+					value = c - 'A';
+				else if (c >= 'a' && c <= 'z')
+					value = c - 'a' + 26;
+				else if (c >= '0' && c <= '9')
+					value = c - '0' + 52;
+				else if (c == '-' || c == '+')
+					value = 62;
+				else if (c == '_' || c == '/')
+					value = 63;
+				else if (c == '=')
+					break;
+				else
+					return false;
+				buffer = (buffer << 6) | value;
+				bits += 6;
+				if (bits >= 8)
+				{
+					bits -= 8;
+					output += static_cast<char>((buffer >> bits) & 0xff);
+				}
+			}
+			return true;
+		}
+	}
+
+#pragma region Http2Session
+
+	Http2Session::Http2Session(socket_ptr socket, TimeoutWheel& timeouts, Metrics& metrics, unsigned int max_streams,
+		size_t max_content_size, unsigned int content_timeout, unsigned int keep_alive_timeout, unsigned int max_requests) :
+		m_socket{ socket }, m_timeouts{ timeouts }, m_metrics{ metrics }, m_max_streams{ max_streams },
+		m_max_content_size{ max_content_size }, m_content_timeout{ content_timeout }, m_keep_alive_timeout{ keep_alive_timeout }, m_max_requests{ max_requests },
+		m_send_window{ default_window_size }, m_initial_window{ default_window_size }, m_peer_max_frame_size{ max_frame_size }
+	{
+		m_write_timeout.handle = m_socket->native_handle();
+	}
+
+
+	bool Http2Session::is_preface(const Request& request)
+	{
+		return request.method == "PRI" && request.path == "*" && request.http_version == "HTTP/2.0";
+	}
+
+
+	bool Http2Session::is_upgrade(const Request& request)
+	{
+		// A request with content is served as HTTP/1.1 because the content would have to be read before the upgrade
+		return request.http_version == "HTTP/1.1" && request.check_header(KnownHeader::upgrade, "h2c") &&
+			request.headers.find("HTTP2-Settings") != nullptr && request.connection().content_length() <= 0;
+	}
+
+
+	bool Http2Session::upgrade(const Request& request, const string& url_scheme)
+	{
+		string settings;
+		if (!base64url_decode(request.get_header("HTTP2-Settings"), settings) || settings.length() % 6 != 0)
+			return false;
+		lock_guard<mutex> lock{ m_mutex };
+		if (apply_settings(settings.data(), settings.length()) != Http2Error::no_error)
+			return false;
+		shared_ptr<Http2Stream> stream = open_stream(1);
+		stream->headers.emplace_back(":method", request.method);
+		stream->headers.emplace_back(":path", request.path);
+		stream->headers.emplace_back(":scheme", url_scheme);
+		const string& host = request.get_header(KnownHeader::host);
+		if (!host.empty())
+			stream->headers.emplace_back(":authority", host);
+		for (const auto& header : request.headers)
+		{
+			string name = alg::to_lower_copy(header.name);
+			if (name == "host" || name == "http2-settings" || is_connection_header(name))
+				continue;
+			stream->headers.emplace_back(name, header.value);
+		}
+		stream->remote_closed = true;
+		m_ready.push_back(stream);
+		return true;
+	}
+
+
+	void Http2Session::run(Connection& connection, bool preface_parsed, IdleConnections& idle_connections,
+		const dispatch_type& dispatch)
+	{
+		asio::streambuf& input = connection.input_buffer();
+		m_tls = connection.tls();
+		const char* preface = preface_parsed ? client_preface + preface_request_length : client_preface;
+		size_t preface_length = strlen(preface);
+		if (!receive(connection, preface_length, idle_connections) ||
+			memcmp(asio::buffer_cast<const char*>(input.data()), preface, preface_length) != 0)
+			return;
+		input.consume(preface_length);
+		{
+			lock_guard<mutex> lock{ m_mutex };
+			string settings;
+			put_uint(settings, max_concurrent_streams_setting, 2);
+			put_uint(settings, m_max_streams, 4);
+			put_uint(settings, initial_window_size_setting, 2);
+			put_uint(settings, receive_window_size, 4);
+			queue_frame(settings_frame, 0, 0, settings.data(), settings.length());
+			queue_window_update(0, receive_window_size - default_window_size);
+		}
+		Http2Error error = Http2Error::no_error;
+		while (true)
+		{
+			for (auto& stream : m_ready)
+			{
+				dispatch(stream);
+			}
+			m_ready.clear();
+			// Frames queued while processing the received data are sent in one write
+			if (input.size() < frame_header_size && flush_output())
+				break;
+			{
+				lock_guard<mutex> lock{ m_mutex };
+				if ((m_goaway_sent || m_goaway_received) && m_streams.empty())
+					break;
+			}
+			if (!receive(connection, frame_header_size, idle_connections))
+				break;
+			const char* header = asio::buffer_cast<const char*>(input.data());
+			size_t length = get_uint32(header) >> 8;
+			unsigned char type = static_cast<unsigned char>(header[3]);
+			unsigned char flags = static_cast<unsigned char>(header[4]);
+			unsigned int stream_id = get_uint32(header + 5) & 0x7fffffff;
+			if (length > max_frame_size)
+			{
+				error = Http2Error::frame_size_error;
+				break;
+			}
+			if (!receive(connection, frame_header_size + length, idle_connections))
+				break;
+			m_frame.assign(asio::buffer_cast<const char*>(input.data()) + frame_header_size, length);
+			input.consume(frame_header_size + length);
+			lock_guard<mutex> lock{ m_mutex };
+			error = process_frame(type, flags, stream_id);
+			if (error != Http2Error::no_error)
+				break;
+		}
+		if (error != Http2Error::no_error)
+		{
+			{
+				lock_guard<mutex> lock{ m_mutex };
+				queue_goaway(error);
+				m_closed = true;
+			}
+			flush_output();
+			sys::error_code ec;
+			m_socket->shutdown(asio::socket_base::shutdown_both, ec);
+		}
+		// Window updates are not received anymore, so handlers that wait for them are resumed
+		lock_guard<mutex> lock{ m_mutex };
+		m_closed = true;
+		for (auto& item : m_streams)
+		{
+			wake(*item.second);
+		}
+	}
+
+
+	bool Http2Session::receive(Connection& connection, size_t size, IdleConnections& idle_connections)
+	{
+		asio::streambuf& input = connection.input_buffer();
+		while (input.size() < size)
+		{
+			bool idle;
+			{
+				lock_guard<mutex> lock{ m_mutex };
+				idle = input.size() == 0 && m_streams.empty();
+			}
+			sys::error_code ec;
+			if (idle)
+			{
+				IdleGuard idle_guard{ idle_connections, m_socket->native_handle() };
+				ec = connection.receive(m_keep_alive_timeout, max_frame_size + frame_header_size);
+			}
+			else
+			{
+				ec = connection.receive(m_content_timeout, max_frame_size + frame_header_size);
+			}
+			if (ec)
+				return false;
+		}
+		return true;
+	}
+
+
+	sys::error_code Http2Session::flush_output()
+	{
+		lock_guard<mutex> write_lock{ m_write_mutex };
+		while (true)
+		{
+			{
+				lock_guard<mutex> lock{ m_mutex };
+				if (m_output.empty())
+					break;
+				m_writing.swap(m_output);
+			}
+			if (!m_write_error)
+			{
+				m_timeouts.schedule(m_write_timeout, m_content_timeout);
+				// Synchronous writes are used for the same reason as in Connection::flush()
+				size_t bytes_written;
+#ifdef WSGI_BOOST_TLS
+				if (m_tls)
+					bytes_written = m_tls->write(*m_socket, m_writing.data(), m_writing.length(), m_write_error);
+				else
+#endif // WSGI_BOOST_TLS
+					bytes_written = asio::write(*m_socket, asio::buffer(m_writing), m_write_error);
+				m_timeouts.cancel(m_write_timeout);
+				m_metrics.add_bytes_sent(bytes_written);
+			}
+			m_writing.clear();
+		}
+		return m_write_error;
+	}
+
+
+	sys::error_code Http2Session::send_headers(const shared_ptr<Http2Stream>& stream, unsigned int status_code,
+		const headers_type& headers)
+	{
+		string block;
+		HpackEncoder::encode_status(block, status_code);
+		string name;
+		for (const auto& header : headers)
+		{
+			name = alg::to_lower_copy(header.first);
+			if (!is_connection_header(name))
+				HpackEncoder::encode(block, name, header.second);
+		}
+		lock_guard<mutex> lock{ m_mutex };
+		if (stream->reset || m_closed)
+			return sys::error_code(sys::errc::connection_aborted, sys::system_category());
+		size_t offset = 0;
+		do
+		{
+			size_t length = min(block.length() - offset, m_peer_max_frame_size);
+			unsigned char flags = offset + length == block.length() ? end_headers_flag : 0;
+			queue_frame(offset == 0 ? headers_frame : continuation_frame, flags, stream->id, block.data() + offset, length);
+			offset += length;
+		} while (offset < block.length());
+		stream->headers_sent = true;
+		return sys::error_code();
+	}
+
+
+	sys::error_code Http2Session::send_data(const shared_ptr<Http2Stream>& stream, const char* data, size_t length,
+		asio::yield_context yc)
+	{
+		bool can_wait = !GilAcquire::active();
+		bool queued = true;
+		{
+			lock_guard<mutex> lock{ m_mutex };
+			if (stream->reset || m_closed)
+				return sys::error_code(sys::errc::connection_aborted, sys::system_category());
+			if (!can_wait && stream->pending.length() - stream->pending_offset + length > max_queued_data)
+			{
+				reset_stream(stream->id, Http2Error::cancel);
+				queued = false;
+			}
+			else
+			{
+				stream->pending.append(data, length);
+				schedule(stream);
+			}
+		}
+		sys::error_code ec = flush_output();
+		if (!queued)
+			return sys::error_code(sys::errc::connection_aborted, sys::system_category());
+		if (!ec && can_wait)
+			ec = wait_pending(stream, yc);
+		return ec;
+	}
+
+
+	sys::error_code Http2Session::wait_pending(const shared_ptr<Http2Stream>& stream, asio::yield_context yc)
+	{
+		typedef asio::async_completion<asio::yield_context, void(sys::error_code)> completion_type;
+		unique_lock<mutex> lock{ m_mutex };
+		if (stream->pending.length() - stream->pending_offset <= max_pending_data)
+			return sys::error_code();
+		// A client that does not open the window is disconnected like a client that does not read a response
+		m_timeouts.schedule(stream->send_timeout, m_content_timeout);
+		while (!stream->reset && !m_closed && stream->pending.length() - stream->pending_offset > max_pending_data)
+		{
+			completion_type completion{ yc };
+			auto handler = make_shared<completion_type::completion_handler_type>(move(completion.completion_handler));
+			auto executor = m_socket->get_executor();
+			// The coroutine is resumed through its own strand
+			stream->resume = [handler, executor]()
+			{
+				asio::post(asio::get_associated_executor(*handler, executor), [handler]()
+				{
+					(*handler)(sys::error_code());
+				});
+			};
+			lock.unlock();
+			completion.result.get();
+			lock.lock();
+		}
+		m_timeouts.cancel(stream->send_timeout);
+		if (stream->reset || m_closed)
+			return sys::error_code(sys::errc::connection_aborted, sys::system_category());
+		return sys::error_code();
+	}
+
+
+	sys::error_code Http2Session::end_stream(const shared_ptr<Http2Stream>& stream)
+	{
+		bool last_stream;
+		{
+			lock_guard<mutex> lock{ m_mutex };
+			if (stream->reset || m_closed)
+				return sys::error_code(sys::errc::connection_aborted, sys::system_category());
+			if (stream->headers_sent)
+			{
+				stream->end_pending = true;
+				schedule(stream);
+			}
+			else
+			{
+				reset_stream(stream->id, Http2Error::internal_error);
+			}
+			last_stream = m_goaway_sent && m_streams.empty();
+		}
+		sys::error_code ec = flush_output();
+		if (last_stream)
+		{
+			// Wake up the reader that waits for frames to close the connection
+			sys::error_code shutdown_ec;
+			m_socket->shutdown(asio::socket_base::shutdown_receive, shutdown_ec);
+		}
+		return ec;
+	}
+
+
+	socket_ptr Http2Session::socket() const
+	{
+		return m_socket;
+	}
+
+
+	TimeoutWheel& Http2Session::timeouts() const
+	{
+		return m_timeouts;
+	}
+
+
+	Metrics& Http2Session::metrics() const
+	{
+		return m_metrics;
+	}
+
+
+	Http2Error Http2Session::process_frame(unsigned char type, unsigned char flags, unsigned int stream_id)
+	{
+		// A header block must not be interleaved with other frames
+		if (m_continuation_stream != 0 && type != continuation_frame)
+			return Http2Error::protocol_error;
+		switch (type)
+		{
+		case data_frame:
+			return process_data(flags, stream_id);
+		case headers_frame:
+			return process_headers(flags, stream_id);
+		case continuation_frame:
+			if (m_continuation_stream == 0 || stream_id != m_continuation_stream)
+				return Http2Error::protocol_error;
+			if (m_header_block.length() + m_frame.length() > max_header_block_size)
+				return Http2Error::enhance_your_calm;
+			m_header_block += m_frame;
+			if ((flags & end_headers_flag) == 0)
+				return Http2Error::no_error;
+			m_continuation_stream = 0;
+			return process_header_block(m_continuation_flags, stream_id);
+		case priority_frame:
+			if (stream_id == 0)
+				return Http2Error::protocol_error;
+			return m_frame.length() == 5 ? Http2Error::no_error : Http2Error::frame_size_error;
+		case rst_stream_frame:
+			if (stream_id == 0 || stream_id > m_last_stream_id)
+				return Http2Error::protocol_error;
+			if (m_frame.length() != 4)
+				return Http2Error::frame_size_error;
+			{
+				auto it = m_streams.find(stream_id);
+				if (it != m_streams.end())
+				{
+					it->second->reset = true;
+					wake(*it->second);
+					m_streams.erase(it);
+				}
+			}
+			return Http2Error::no_error;
+		case settings_frame:
+			return process_settings(flags, stream_id);
+		case ping_frame:
+			if (stream_id != 0)
+				return Http2Error::protocol_error;
+			if (m_frame.length() != 8)
+				return Http2Error::frame_size_error;
+			if ((flags & ack_flag) == 0)
+				queue_frame(ping_frame, ack_flag, 0, m_frame.data(), m_frame.length());
+			return Http2Error::no_error;
+		case goaway_frame:
+			if (stream_id != 0)
+				return Http2Error::protocol_error;
+			m_goaway_received = true;
+			return Http2Error::no_error;
+		case window_update_frame:
+			if (m_frame.length() != 4)
+				return Http2Error::frame_size_error;
+			return process_window_update(stream_id);
+		case push_promise_frame:
+			// Clients cannot push
+			return Http2Error::protocol_error;
+		default:
+			// Unknown frame types are ignored
+			return Http2Error::no_error;
+		}
+	}
+
+
+	Http2Error Http2Session::process_data(unsigned char flags, unsigned int stream_id)
+	{
+		if (stream_id == 0)
+			return Http2Error::protocol_error;
+		size_t offset = 0;
+		size_t length = m_frame.length();
+		if (flags & padded_flag)
+		{
+			if (length == 0 || static_cast<unsigned char>(m_frame[0]) >= length)
+				return Http2Error::protocol_error;
+			offset = 1;
+			length -= 1 + static_cast<unsigned char>(m_frame[0]);
+		}
+		// Padding counts against flow control windows as well
+		queue_window_update(0, m_frame.length());
+		auto it = m_streams.find(stream_id);
+		// The rest of a rejected request is discarded
+		if (it != m_streams.end() && it->second->content_too_large)
+			return Http2Error::no_error;
+		if (it == m_streams.end() || it->second->remote_closed)
+		{
+			if (stream_id > m_last_stream_id)
+				return Http2Error::protocol_error;
+			reset_stream(stream_id, Http2Error::stream_closed);
+			return Http2Error::no_error;
+		}
+		shared_ptr<Http2Stream> stream = it->second;
+		if (stream->content.length() + length > m_max_content_size)
+		{
+			reject_content(stream);
+			return Http2Error::no_error;
+		}
+		stream->content.append(m_frame, offset, length);
+		if (flags & end_stream_flag)
+		{
+			stream->remote_closed = true;
+			m_ready.push_back(stream);
+		}
+		else
+		{
+			queue_window_update(stream_id, m_frame.length());
+		}
+		return Http2Error::no_error;
+	}
+
+
+	Http2Error Http2Session::process_headers(unsigned char flags, unsigned int stream_id)
+	{
+		if (stream_id == 0)
+			return Http2Error::protocol_error;
+		size_t offset = 0;
+		size_t padding = 0;
+		if (flags & padded_flag)
+		{
+			if (m_frame.empty())
+				return Http2Error::protocol_error;
+			padding = static_cast<unsigned char>(m_frame[0]);
+			offset = 1;
+		}
+		// Stream priorities are ignored
+		if (flags & priority_flag)
+			offset += 5;
+		if (offset + padding > m_frame.length())
+			return Http2Error::protocol_error;
+		m_header_block.assign(m_frame, offset, m_frame.length() - offset - padding);
+		if ((flags & end_headers_flag) == 0)
+		{
+			m_continuation_stream = stream_id;
+			m_continuation_flags = flags;
+			return Http2Error::no_error;
+		}
+		return process_header_block(flags, stream_id);
+	}
+
+
+	Http2Error Http2Session::process_header_block(unsigned char flags, unsigned int stream_id)
+	{
+		// The block is decoded even if the stream is refused to keep the dynamic table in sync
+		header_list_type headers;
+		if (!m_decoder.decode(m_header_block, headers))
+			return Http2Error::compression_error;
+		auto it = m_streams.find(stream_id);
+		if (it != m_streams.end())
+		{
+			// Trailers are ignored
+			shared_ptr<Http2Stream> stream = it->second;
+			if (stream->remote_closed || (flags & end_stream_flag) == 0)
+				return Http2Error::protocol_error;
+			stream->remote_closed = true;
+			m_ready.push_back(stream);
+			return Http2Error::no_error;
+		}
+		if (stream_id % 2 == 0 || stream_id <= m_last_stream_id)
+			return Http2Error::protocol_error;
+		m_last_stream_id = stream_id;
+		// Streams initiated after GOAWAY are ignored
+		if (m_goaway_sent)
+			return Http2Error::no_error;
+		if (m_streams.size() >= m_max_streams)
+		{
+			reset_stream(stream_id, Http2Error::refused_stream);
+			return Http2Error::no_error;
+		}
+		shared_ptr<Http2Stream> stream = open_stream(stream_id);
+		stream->headers.swap(headers);
+		if (content_length(stream->headers) > m_max_content_size)
+		{
+			reject_content(stream);
+		}
+		else if (flags & end_stream_flag)
+		{
+			stream->remote_closed = true;
+			m_ready.push_back(stream);
+		}
+		return Http2Error::no_error;
+	}
+
+
+	Http2Error Http2Session::process_settings(unsigned char flags, unsigned int stream_id)
+	{
+		if (stream_id != 0)
+			return Http2Error::protocol_error;
+		if (flags & ack_flag)
+			return m_frame.empty() ? Http2Error::no_error : Http2Error::frame_size_error;
+		if (m_frame.length() % 6 != 0)
+			return Http2Error::frame_size_error;
+		Http2Error error = apply_settings(m_frame.data(), m_frame.length());
+		if (error == Http2Error::no_error)
+			queue_frame(settings_frame, ack_flag, 0, nullptr, 0);
+		return error;
+	}
+
+
+	Http2Error Http2Session::process_window_update(unsigned int stream_id)
+	{
+		long long increment = get_uint32(m_frame.data()) & 0x7fffffff;
+		if (stream_id == 0)
+		{
+			if (increment == 0)
+				return Http2Error::protocol_error;
+			m_send_window += increment;
+			if (m_send_window > max_window_size)
+				return Http2Error::flow_control_error;
+			resume_blocked();
+			return Http2Error::no_error;
+		}
+		auto it = m_streams.find(stream_id);
+		if (it == m_streams.end())
+			return stream_id > m_last_stream_id ? Http2Error::protocol_error : Http2Error::no_error;
+		shared_ptr<Http2Stream> stream = it->second;
+		stream->send_window += increment;
+		if (increment == 0)
+			reset_stream(stream_id, Http2Error::protocol_error);
+		else if (stream->send_window > max_window_size)
+			reset_stream(stream_id, Http2Error::flow_control_error);
+		else
+			schedule(stream);
+		return Http2Error::no_error;
+	}
+
+
+	Http2Error Http2Session::apply_settings(const char* data, size_t length)
+	{
+		for (size_t offset = 0; offset + 6 <= length; offset += 6)
+		{
+			unsigned int id = (static_cast<unsigned char>(data[offset]) << 8) | static_cast<unsigned char>(data[offset + 1]);
+			unsigned int value = get_uint32(data + offset + 2);
+			switch (id)
+			{
+			case enable_push_setting:
+				if (value > 1)
+					return Http2Error::protocol_error;
+				break;
+			case initial_window_size_setting:
+				if (value > max_window_size)
+					return Http2Error::flow_control_error;
+				// The difference is applied to all open streams, which may make their windows negative
+				for (auto& item : m_streams)
+				{
+					item.second->send_window += value - m_initial_window;
+					if (item.second->send_window > max_window_size)
+						return Http2Error::flow_control_error;
+				}
+				m_initial_window = value;
+				resume_blocked();
+				break;
+			case max_frame_size_setting:
+				if (value < max_frame_size || value > 0xffffff)
+					return Http2Error::protocol_error;
+				m_peer_max_frame_size = value;
+				break;
+			default:
+				// The encoder does not use the dynamic table, server push is not supported
+				// and unknown settings are ignored
+				break;
+			}
+		}
+		return Http2Error::no_error;
+	}
+
+
+	shared_ptr<Http2Stream> Http2Session::open_stream(unsigned int stream_id)
+	{
+		shared_ptr<Http2Stream> stream = make_shared<Http2Stream>();
+		stream->id = stream_id;
+		stream->started = chrono::steady_clock::now();
+		stream->send_window = m_initial_window;
+		stream->send_timeout.handle = m_socket->native_handle();
+		m_streams[stream_id] = stream;
+		m_last_stream_id = stream_id;
+		++m_requests;
+		if (m_max_requests > 0 && m_requests >= m_max_requests)
+		{
+			// The last stream is served and the client opens a new connection for further requests
+			queue_goaway(Http2Error::no_error);
+			m_goaway_sent = true;
+		}
+		return stream;
+	}
+
+
+	void Http2Session::queue_frame(unsigned char type, unsigned char flags, unsigned int stream_id, const char* payload,
+		size_t length)
+	{
+		put_uint(m_output, static_cast<unsigned int>(length), 3);
+		m_output += static_cast<char>(type);
+		m_output += static_cast<char>(flags);
+		put_uint(m_output, stream_id, 4);
+		m_output.append(payload, length);
+	}
+
+
+	void Http2Session::queue_window_update(unsigned int stream_id, size_t increment)
+	{
+		if (increment == 0)
+			return;
+		string payload;
+		put_uint(payload, static_cast<unsigned int>(increment), 4);
+		queue_frame(window_update_frame, 0, stream_id, payload.data(), payload.length());
+	}
+
+
+	void Http2Session::queue_goaway(Http2Error error)
+	{
+		string payload;
+		put_uint(payload, m_last_stream_id, 4);
+		put_uint(payload, static_cast<unsigned int>(error), 4);
+		queue_frame(goaway_frame, 0, 0, payload.data(), payload.length());
+	}
+
+
+	void Http2Session::reset_stream(unsigned int stream_id, Http2Error error)
+	{
+		string payload;
+		put_uint(payload, static_cast<unsigned int>(error), 4);
+		queue_frame(rst_stream_frame, 0, stream_id, payload.data(), payload.length());
+		auto it = m_streams.find(stream_id);
+		if (it != m_streams.end())
+		{
+			it->second->reset = true;
+			wake(*it->second);
+			m_streams.erase(it);
+		}
+	}
+
+
+	void Http2Session::reject_content(const shared_ptr<Http2Stream>& stream)
+	{
+		// The stream is dispatched at once to be answered with "413 Payload Too Large"
+		string().swap(stream->content);
+		stream->content_too_large = true;
+		if (!stream->remote_closed)
+		{
+			stream->remote_closed = true;
+			m_ready.push_back(stream);
+		}
+	}
+
+
+	void Http2Session::schedule(const shared_ptr<Http2Stream>& stream)
+	{
+		while (!stream->reset)
+		{
+			size_t remaining = stream->pending.length() - stream->pending_offset;
+			long long window = min(stream->send_window, m_send_window);
+			if (remaining > 0 && window <= 0)
+			{
+				if (!stream->blocked)
+				{
+					stream->blocked = true;
+					m_blocked.push_back(stream);
+				}
+				break;
+			}
+			if (remaining == 0 && !stream->end_pending)
+				break;
+			size_t length = min(remaining, min(static_cast<size_t>(max(window, 0LL)), m_peer_max_frame_size));
+			bool last = length == remaining && stream->end_pending;
+			queue_frame(data_frame, last ? end_stream_flag : 0, stream->id, stream->pending.data() + stream->pending_offset, length);
+			stream->pending_offset += length;
+			stream->send_window -= length;
+			m_send_window -= length;
+			if (last)
+			{
+				// The client is asked to stop sending the rest of a rejected request (RFC 7540, section 8.1)
+				if (stream->content_too_large)
+					reset_stream(stream->id, Http2Error::no_error);
+				else
+					m_streams.erase(stream->id);
+				break;
+			}
+		}
+		// Sent data is removed when it is more than a half of the buffer
+		if (stream->pending_offset == stream->pending.length())
+		{
+			stream->pending.clear();
+			stream->pending_offset = 0;
+		}
+		else if (stream->pending_offset > stream->pending.length() / 2)
+		{
+			stream->pending.erase(0, stream->pending_offset);
+			stream->pending_offset = 0;
+		}
+		if (stream->reset || stream->pending.length() - stream->pending_offset <= max_pending_data)
+			wake(*stream);
+	}
+
+
+	void Http2Session::resume_blocked()
+	{
+		vector<shared_ptr<Http2Stream>> blocked;
+		blocked.swap(m_blocked);
+		for (auto& stream : blocked)
+		{
+			stream->blocked = false;
+			schedule(stream);
+		}
+	}
+
+
+	void Http2Session::wake(Http2Stream& stream)
+	{
+		// The coroutine is posted, so it is safe to resume it with the mutex locked
+		function<void()> resume;
+		resume.swap(stream.resume);
+		if (resume)
+			resume();
+	}
+
+#pragma endregion
+
+#pragma region StreamConnection
+
+	StreamConnection::StreamConnection(shared_ptr<Http2Session> session, shared_ptr<Http2Stream> stream,
+		asio::yield_context yc) :
+		Connection(session->socket(), session->timeouts(), session->metrics(), yc, 0, 0),
+		m_session{ session }, m_stream{ stream }
+	{
+	}
+
+
+	sys::error_code StreamConnection::read_request(Request& request)
+	{
+		request.http_version = "HTTP/2.0";
+		string authority;
+		string cookies;
+		bool pseudo_headers = true;
+		for (const auto& header : m_stream->headers)
+		{
+			const string& name = header.first;
+			if (!name.empty() && name[0] == ':')
+			{
+				// Pseudo-headers must precede regular headers
+				if (!pseudo_headers)
+					return sys::error_code(sys::errc::bad_message, sys::system_category());
+				if (name == ":method")
+					request.method = header.second;
+				else if (name == ":path")
+					request.path = header.second;
+				else if (name == ":authority")
+					authority = header.second;
+				else if (name != ":scheme")
+					return sys::error_code(sys::errc::bad_message, sys::system_category());
+				continue;
+			}
+			pseudo_headers = false;
+			if (is_connection_header(name) || request.headers.size() >= max_headers)
+				return sys::error_code(sys::errc::bad_message, sys::system_category());
+			// Cookies may be split into several header fields
+			if (name == "cookie")
+			{
+				if (!cookies.empty())
+					cookies += "; ";
+				cookies += header.second;
+				continue;
+			}
+			request.headers.add(name.data(), name.length(), header.second.data(), header.second.length());
+		}
+		if (request.method.empty() || request.path.empty())
+			return sys::error_code(sys::errc::bad_message, sys::system_category());
+		if (!authority.empty() && request.headers.find(KnownHeader::host) == nullptr)
+			request.headers.add("host", 4, authority.data(), authority.length());
+		if (!cookies.empty())
+			request.headers.add("cookie", 6, cookies.data(), cookies.length());
+		if (m_stream->content_too_large)
+			return sys::error_code(sys::errc::message_size, sys::system_category());
+		string& content = m_stream->content;
+		const string* cl_header = request.headers.find(KnownHeader::content_length);
+		if (cl_header != nullptr)
+		{
+			if (*cl_header != to_string(content.length()))
+				return sys::error_code(sys::errc::bad_message, sys::system_category());
+		}
+		else if (!content.empty() || request.method == "POST" || request.method == "PUT")
+		{
+			// The content length is known because the content is complete
+			string cl = to_string(content.length());
+			request.headers.add("content-length", 14, cl.data(), cl.length());
+		}
+		size_t size = asio::buffer_copy(m_istreambuf.prepare(content.length()), asio::buffer(content));
+		m_istreambuf.commit(size);
+		set_post_content_length(content.length());
+		string().swap(content);
+		return sys::error_code();
+	}
+
+
+	void StreamConnection::write_header(const string& /*http_version*/, const string& status,
+		const headers_type& headers, bool /*keep_alive*/)
+	{
+		unsigned int status_code = static_cast<unsigned int>(strtoul(status.c_str(), nullptr, 10));
+		// Informational responses are not needed because the request content has been already received
+		if (status_code < 200)
+			return;
+		headers_type all_headers;
+		all_headers.reserve(headers.size() + 2);
+		all_headers.insert(all_headers.end(), headers.begin(), headers.end());
+		all_headers.emplace_back("Server", server_name);
+		all_headers.emplace_back("Date", current_http_date());
+		m_session->send_headers(m_stream, status_code, all_headers);
+	}
+
+
+	void StreamConnection::write_prebuilt_header(const string& http_version, const PrebuiltResponse& prebuilt,
+		bool keep_alive)
+	{
+		// Header lines are not used because HPACK encodes each header separately
+		write_header(http_version, prebuilt.status, prebuilt.headers, keep_alive);
+	}
+
+
+	sys::error_code StreamConnection::flush()
+	{
+		auto start = chrono::steady_clock::now();
+		if (m_first_byte_time == chrono::steady_clock::time_point())
+			m_first_byte_time = start;
+		size_t size = m_ostreambuf.size();
+		sys::error_code ec = m_session->send_data(m_stream, asio::buffer_cast<const char*>(m_ostreambuf.data()), size, yield_context());
+		m_ostreambuf.consume(size);
+		m_write_time += chrono::steady_clock::now() - start;
+		m_bytes_sent += size;
+		return ec;
+	}
+
+
+	sys::error_code StreamConnection::send_file(const string& /*path*/, long long /*offset*/, size_t /*length*/)
+	{
+		// The base class would send the file to the socket bypassing the frames of the stream,
+		// so the file is read by the handler and sent with flush()
+		return sys::error_code(sys::errc::operation_not_supported, sys::system_category());
+	}
+
+
+	void StreamConnection::finish()
+	{
+		if (m_ostreambuf.size() > 0)
+			flush();
+		m_session->end_stream(m_stream);
+	}
+
+#pragma endregion
+}
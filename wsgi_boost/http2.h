@@ -0,0 +1,216 @@
+#pragma once
+/*
+HTTP/2 connections
+
+Copyright (c) 2016 Roman Miroshnychenko <romanvm@yandex.ua>
+License: MIT, see License.txt
+*/
+
+#include "connection.h"
+#include "hpack.h"
+#include "idle_connections.h"
+#include "request.h"
+
+#include <boost/asio.hpp>
+#include <boost/asio/spawn.hpp>
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+namespace wsgi_boost
+{
+	// HTTP/2 error codes (RFC 7540, section 7)
+	enum class Http2Error : unsigned int
+	{
+		no_error = 0x0,
+		protocol_error = 0x1,
+		internal_error = 0x2,
+		flow_control_error = 0x3,
+		stream_closed = 0x5,
+		frame_size_error = 0x6,
+		refused_stream = 0x7,
+		cancel = 0x8,
+		compression_error = 0x9,
+		enhance_your_calm = 0xb
+	};
+
+
+	// State of an HTTP/2 stream shared by the connection reader and the handler of the stream.
+	// Request headers and content are filled by the reader before the stream is dispatched
+	// and are not changed afterwards, other fields are guarded by the session mutex.
+	struct Http2Stream
+	{
+		unsigned int id = 0;
+		header_list_type headers;
+		std::string content;
+		// The request content exceeds the limit, so it is discarded and the request is answered with 413
+		bool content_too_large = false;
+		std::chrono::steady_clock::time_point started;
+		long long send_window = 0;
+		// Response data waiting for the flow control window
+		std::string pending;
+		size_t pending_offset = 0;
+		// Resumes the handler coroutine that waits until pending data is sent
+		std::function<void()> resume;
+		TimeoutEntry send_timeout;
+		// END_STREAM has been received
+		bool remote_closed = false;
+		bool headers_sent = false;
+		// The handler is done, END_STREAM is sent after pending data
+		bool end_pending = false;
+		bool reset = false;
+		bool blocked = false;
+	};
+
+
+	// Multiplexes concurrent streams over one HTTP/2 connection.
+	//
+	// The connection coroutine reads and processes frames. Each complete request is dispatched
+	// to its own coroutine, so streams are handled in parallel by server threads.
+	// Request content is buffered until the request is complete, up to a limit per stream.
+	// Response data that does not fit the flow control window is queued, and a handler coroutine
+	// waits for window updates when too much data is queued. Handlers that hold the GIL cannot wait,
+	// so their streams are cancelled if the client does not accept the data.
+	// Frames are written synchronously by the thread that produced them, one writer at a time.
+	class Http2Session
+	{
+	public:
+		typedef std::function<void(std::shared_ptr<Http2Stream>)> dispatch_type;
+
+		Http2Session(const Http2Session&) = delete;
+		Http2Session& operator=(const Http2Session&) = delete;
+
+		Http2Session(socket_ptr socket, TimeoutWheel& timeouts, Metrics& metrics, unsigned int max_streams,
+			size_t max_content_size, unsigned int content_timeout, unsigned int keep_alive_timeout, unsigned int max_requests);
+
+		// Check if a request is the beginning of the connection preface "PRI * HTTP/2.0"
+		// sent by a client with prior knowledge of HTTP/2 support
+		static bool is_preface(const Request& request);
+
+		// Check if a request asks to upgrade the connection to h2c
+		static bool is_upgrade(const Request& request);
+
+		// Apply HTTP2-Settings of an upgrade request and open stream 1 for the request,
+		// false if HTTP2-Settings is invalid
+		bool upgrade(const Request& request, const std::string& url_scheme);
+
+		// Exchange connection prefaces, then read and process frames until the connection is closed.
+		// If preface_parsed is true, the request line of the client preface has been already read as HTTP/1.x request.
+		void run(Connection& connection, bool preface_parsed, IdleConnections& idle_connections, const dispatch_type& dispatch);
+
+		// Queue response headers of a stream, they are sent together with the following data
+		boost::system::error_code send_headers(const std::shared_ptr<Http2Stream>& stream, unsigned int status_code,
+			const headers_type& headers);
+
+		// Queue response data of a stream. The coroutine waits if too much data is queued
+		// because of the flow control window.
+		boost::system::error_code send_data(const std::shared_ptr<Http2Stream>& stream, const char* data, size_t length,
+			boost::asio::yield_context yc);
+
+		// Finish the response of a stream. The stream is reset if the response header has not been sent.
+		boost::system::error_code end_stream(const std::shared_ptr<Http2Stream>& stream);
+
+		socket_ptr socket() const;
+
+		TimeoutWheel& timeouts() const;
+
+		Metrics& metrics() const;
+
+	private:
+		socket_ptr m_socket;
+		TimeoutWheel& m_timeouts;
+		Metrics& m_metrics;
+		unsigned int m_max_streams;
+		size_t m_max_content_size;
+		unsigned int m_content_timeout;
+		unsigned int m_keep_alive_timeout;
+		unsigned int m_max_requests;
+
+		// Guards streams, flow control windows and the output buffer
+		std::mutex m_mutex;
+		std::map<unsigned int, std::shared_ptr<Http2Stream>> m_streams;
+		std::vector<std::shared_ptr<Http2Stream>> m_blocked;
+		std::string m_output;
+		long long m_send_window;
+		long long m_initial_window;
+		size_t m_peer_max_frame_size;
+		bool m_closed = false;
+
+		// Serializes socket writes
+		std::mutex m_write_mutex;
+		std::shared_ptr<TlsSession> m_tls;
+		std::string m_writing;
+		TimeoutEntry m_write_timeout;
+		boost::system::error_code m_write_error;
+
+		// Reader state
+		HpackDecoder m_decoder;
+		std::string m_frame;
+		std::string m_header_block;
+		unsigned int m_continuation_stream = 0;
+		unsigned char m_continuation_flags = 0;
+		unsigned int m_last_stream_id = 0;
+		unsigned int m_requests = 0;
+		bool m_goaway_sent = false;
+		bool m_goaway_received = false;
+		std::vector<std::shared_ptr<Http2Stream>> m_ready;
+
+		bool receive(Connection& connection, size_t size, IdleConnections& idle_connections);
+		boost::system::error_code flush_output();
+		boost::system::error_code wait_pending(const std::shared_ptr<Http2Stream>& stream, boost::asio::yield_context yc);
+
+		// The following methods must be called with m_mutex locked
+		Http2Error process_frame(unsigned char type, unsigned char flags, unsigned int stream_id);
+		Http2Error process_data(unsigned char flags, unsigned int stream_id);
+		Http2Error process_headers(unsigned char flags, unsigned int stream_id);
+		Http2Error process_header_block(unsigned char flags, unsigned int stream_id);
+		Http2Error process_settings(unsigned char flags, unsigned int stream_id);
+		Http2Error process_window_update(unsigned int stream_id);
+		Http2Error apply_settings(const char* data, size_t length);
+		std::shared_ptr<Http2Stream> open_stream(unsigned int stream_id);
+		void queue_frame(unsigned char type, unsigned char flags, unsigned int stream_id, const char* payload, size_t length);
+		void queue_window_update(unsigned int stream_id, size_t increment);
+		void queue_goaway(Http2Error error);
+		void reset_stream(unsigned int stream_id, Http2Error error);
+		void reject_content(const std::shared_ptr<Http2Stream>& stream);
+		void schedule(const std::shared_ptr<Http2Stream>& stream);
+		void resume_blocked();
+		void wake(Http2Stream& stream);
+	};
+
+
+	// Connection of a single HTTP/2 stream for request handlers
+	class StreamConnection : public Connection
+	{
+	private:
+		std::shared_ptr<Http2Session> m_session;
+		std::shared_ptr<Http2Stream> m_stream;
+
+	public:
+		StreamConnection(std::shared_ptr<Http2Session> session, std::shared_ptr<Http2Stream> stream,
+			boost::asio::yield_context yc);
+
+		// Fill a request from the stream headers and make its content available for reading
+		boost::system::error_code read_request(Request& request);
+
+		// Connection headers are not sent in HTTP/2, so keep_alive is ignored
+		void write_header(const std::string& http_version, const std::string& status,
+			const headers_type& headers, bool keep_alive);
+
+		void write_prebuilt_header(const std::string& http_version, const PrebuiltResponse& prebuilt, bool keep_alive);
+
+		boost::system::error_code flush();
+
+		// Always not supported, so file data is sent in DATA frames
+		boost::system::error_code send_file(const std::string& path, long long offset, size_t length);
+
+		// Send the rest of the response and close the stream
+		void finish();
+	};
+}
@@ -0,0 +1,68 @@
+/*
+LRU list of idle keep-alive connections
+
+Copyright (c) 2016 Roman Miroshnychenko <romanvm@yandex.ua>
+License: MIT, see License.txt
+*/
+
+#include "idle_connections.h"
+
+using namespace std;
+
+
+namespace wsgi_boost
+{
+	void IdleConnections::add(IdleEntry& entry)
+	{
+		lock_guard<mutex> lock{ m_mutex };
+		entry.prev = m_head.prev;
+		entry.next = &m_head;
+		m_head.prev->next = &entry;
+		m_head.prev = &entry;
+		++m_size;
+	}
+
+
+	void IdleConnections::remove(IdleEntry& entry)
+	{
+		lock_guard<mutex> lock{ m_mutex };
+		// The entry is already unlinked if the connection has been evicted
+		if (entry.next == nullptr)
+			return;
+		entry.prev->next = entry.next;
+		entry.next->prev = entry.prev;
+		entry.prev = entry.next = nullptr;
+		--m_size;
+	}
+
+
+	size_t IdleConnections::evict(size_t count)
+	{
+		lock_guard<mutex> lock{ m_mutex };
+		size_t evicted = 0;
+		while (evicted < count && m_head.next != &m_head)
+		{
+			IdleEntry* entry = m_head.next;
+			m_head.next = entry->next;
+			entry->next->prev = &m_head;
+			entry->prev = entry->next = nullptr;
+			--m_size;
+			// The connection is still waiting for a request, so it's safe to shut down its socket under the lock.
+			// The pending read fails and the connection is closed by its coroutine.
+#ifdef _WIN32
+			::shutdown(entry->handle, SD_BOTH);
+#else
+			::shutdown(entry->handle, SHUT_RDWR);
+#endif // _WIN32
+			++evicted;
+		}
+		return evicted;
+	}
+
+
+	size_t IdleConnections::size()
+	{
+		lock_guard<mutex> lock{ m_mutex };
+		return m_size;
+	}
+}
@@ -0,0 +1,77 @@
+#pragma once
+/*
+LRU list of idle keep-alive connections
+
+Copyright (c) 2016 Roman Miroshnychenko <romanvm@yandex.ua>
+License: MIT, see License.txt
+*/
+
+#include <boost/asio.hpp>
+
+#include <mutex>
+
+
+namespace wsgi_boost
+{
+	// Idle connection linked into IdleConnections list
+	struct IdleEntry
+	{
+		IdleEntry* prev = nullptr;
+		IdleEntry* next = nullptr;
+		boost::asio::ip::tcp::socket::native_handle_type handle;
+	};
+
+
+	// Keeps keep-alive connections waiting for the next request
+	// in the order they became idle so that the oldest ones can be closed
+	// when the server runs out of file descriptors
+	class IdleConnections
+	{
+	private:
+		std::mutex m_mutex;
+		IdleEntry m_head;
+		size_t m_size = 0;
+
+	public:
+		IdleConnections(const IdleConnections&) = delete;
+		IdleConnections& operator=(const IdleConnections&) = delete;
+
+		IdleConnections()
+		{
+			m_head.prev = m_head.next = &m_head;
+		}
+
+		void add(IdleEntry& entry);
+
+		void remove(IdleEntry& entry);
+
+		// Shut down up to count oldest idle connections and return the number of evicted connections
+		size_t evict(size_t count);
+
+		size_t size();
+	};
+
+
+	// Scoped idle state of a connection
+	class IdleGuard
+	{
+	private:
+		IdleConnections& m_connections;
+		IdleEntry m_entry;
+
+	public:
+		IdleGuard(const IdleGuard&) = delete;
+		IdleGuard& operator=(const IdleGuard&) = delete;
+
+		IdleGuard(IdleConnections& connections, boost::asio::ip::tcp::socket::native_handle_type handle) : m_connections{ connections }
+		{
+			m_entry.handle = handle;
+			m_connections.add(m_entry);
+		}
+
+		~IdleGuard()
+		{
+			m_connections.remove(m_entry);
+		}
+	};
+}
@@ -0,0 +1,782 @@
+/*
+io_uring backend for accepting connections, receiving request data and reading static files
+
+Copyright (c) 2016 Roman Miroshnychenko <romanvm@yandex.ua>
+License: MIT, see License.txt
+*/
+
+#ifdef WSGI_BOOST_IO_URING
+
+#include "io_uring.h"
+#include "exceptions.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+using namespace std;
+namespace asio = boost::asio;
+namespace sys = boost::system;
+
+
+namespace wsgi_boost
+{
+	namespace
+	{
+		// user_data of internal operations that are not in the table of operations in flight
+		const __u64 wakeup_data = 1;
+		const __u64 cancel_data = 2;
+		const __u64 provide_data = 3;
+
+		typedef asio::async_completion<asio::yield_context, void(sys::error_code)> completion_type;
+
+
+		int register_resource(int fd, unsigned int opcode, void* arg, unsigned int count)
+		{
+			return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, count));
+		}
+
+
+		string error_message(int error)
+		{
+			return sys::error_code(error, sys::system_category()).message();
+		}
+
+
+		void* map_ring(int fd, size_t size, off_t offset)
+		{
+			void* ring = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+			if (ring == MAP_FAILED)
+				throw RuntimeError("Unable to map io_uring queues: " + error_message(errno) + "!");
+			return ring;
+		}
+
+
+		void* map_memory(size_t size)
+		{
+			void* memory = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (memory == MAP_FAILED)
+				throw RuntimeError("Unable to allocate io_uring buffers: " + error_message(errno) + "!");
+			return memory;
+		}
+
+
+		template <typename T>
+		void unmap(T*& memory, size_t size)
+		{
+			if (memory != nullptr)
+				::munmap(memory, size);
+			memory = nullptr;
+		}
+
+
+		// Make a function that resumes a waiting coroutine through its own strand from the ring thread
+		function<void()> make_resume(completion_type& completion, asio::io_service& io_service)
+		{
+			auto handler = make_shared<completion_type::completion_handler_type>(move(completion.completion_handler));
+			return [handler, &io_service]()
+			{
+				asio::post(asio::get_associated_executor(*handler, io_service.get_executor()), [handler]()
+				{
+					(*handler)(sys::error_code());
+				});
+			};
+		}
+
+
+		// A read of a file region into a registered buffer
+		class FileRead : public IoUringOperation
+		{
+		private:
+			int m_fd;
+			unsigned long long m_offset;
+			char* m_data;
+			unsigned int m_length;
+			unsigned short m_buffer_index;
+
+		public:
+			int result = 0;
+			function<void()> resume;
+
+			FileRead(int fd, unsigned long long offset, char* data, size_t length, int buffer_index) :
+				m_fd{ fd }, m_offset{ offset }, m_data{ data }, m_length{ static_cast<unsigned int>(length) },
+				m_buffer_index{ static_cast<unsigned short>(buffer_index) }
+			{
+			}
+
+			void prepare(io_uring_sqe& sqe)
+			{
+				sqe.opcode = IORING_OP_READ_FIXED;
+				sqe.fd = m_fd;
+				sqe.off = m_offset;
+				sqe.addr = reinterpret_cast<__u64>(m_data);
+				sqe.len = m_length;
+				sqe.buf_index = m_buffer_index;
+			}
+
+			bool complete(int read_result, const char* /*data*/, bool /*more*/)
+			{
+				result = read_result;
+				resume();
+				return true;
+			}
+
+			void abandon(int /*read_result*/, bool /*more*/)
+			{
+				complete(-ECANCELED, nullptr, false);
+			}
+		};
+	}
+
+#pragma region IoUring
+
+	IoUring::IoUring()
+	{
+		m_running.store(false);
+		m_enter_calls.store(0);
+		m_submissions.store(0);
+		m_completions.store(0);
+		m_buffers_exhausted.store(0);
+	}
+
+
+	IoUring::~IoUring()
+	{
+		stop();
+	}
+
+
+	void IoUring::start(asio::io_service& io_service)
+	{
+		if (m_running.load())
+			return;
+		m_io_service = &io_service;
+		try
+		{
+			io_uring_params params;
+			memset(&params, 0, sizeof(params));
+			// Multishot operations produce many completions for a single submission
+			params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL;
+			params.cq_entries = queue_size * 4;
+			m_fd = static_cast<int>(::syscall(__NR_io_uring_setup, queue_size, &params));
+			if (m_fd < 0)
+				throw RuntimeError("Unable to set up io_uring: " + error_message(errno) + "!");
+			// Multishot receive appeared in Linux 6.0 together with IORING_OP_SEND_ZC that can be probed
+			vector<char> probe_data(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op));
+			io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(probe_data.data());
+			if (register_resource(m_fd, IORING_REGISTER_PROBE, probe, 256) < 0 || probe->last_op < IORING_OP_SEND_ZC ||
+				(probe->ops[IORING_OP_SEND_ZC].flags & IO_URING_OP_SUPPORTED) == 0)
+				throw RuntimeError("io_uring does not support multishot receive, Linux 6.0 or newer is required!");
+
+			m_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+			m_sq_ring = map_ring(m_fd, m_sq_ring_size, IORING_OFF_SQ_RING);
+			m_cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+			m_cq_ring = map_ring(m_fd, m_cq_ring_size, IORING_OFF_CQ_RING);
+			m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+			m_sq.sqes = static_cast<io_uring_sqe*>(map_ring(m_fd, m_sqes_size, IORING_OFF_SQES));
+			char* sq_ring = static_cast<char*>(m_sq_ring);
+			m_sq.head = reinterpret_cast<unsigned int*>(sq_ring + params.sq_off.head);
+			m_sq.tail = reinterpret_cast<unsigned int*>(sq_ring + params.sq_off.tail);
+			m_sq.array = reinterpret_cast<unsigned int*>(sq_ring + params.sq_off.array);
+			m_sq.mask = *reinterpret_cast<unsigned int*>(sq_ring + params.sq_off.ring_mask);
+			m_sq.entries = params.sq_entries;
+			m_sq.local_tail = *m_sq.tail;
+			// Each entry always occupies the slot with the same index
+			for (unsigned int i = 0; i < m_sq.entries; ++i)
+				m_sq.array[i] = i;
+			char* cq_ring = static_cast<char*>(m_cq_ring);
+			m_cq.head = reinterpret_cast<unsigned int*>(cq_ring + params.cq_off.head);
+			m_cq.tail = reinterpret_cast<unsigned int*>(cq_ring + params.cq_off.tail);
+			m_cq.mask = *reinterpret_cast<unsigned int*>(cq_ring + params.cq_off.ring_mask);
+			m_cq.cqes = reinterpret_cast<io_uring_cqe*>(cq_ring + params.cq_off.cqes);
+
+			m_receive_buffers = static_cast<char*>(map_memory(receive_buffer_count * receive_buffer_size));
+			setup_receive_buffers();
+
+			m_file_buffers = static_cast<char*>(map_memory(file_buffer_count * file_buffer_size));
+			vector<iovec> file_buffers(file_buffer_count);
+			for (unsigned int i = 0; i < file_buffer_count; ++i)
+			{
+				file_buffers[i].iov_base = m_file_buffers + i * file_buffer_size;
+				file_buffers[i].iov_len = file_buffer_size;
+			}
+			// Registered buffers count against the locked memory limit. Without them static files
+			// are read with std::ifstream as before.
+			if (register_resource(m_fd, IORING_REGISTER_BUFFERS, file_buffers.data(), file_buffer_count) == 0)
+			{
+				for (int i = file_buffer_count - 1; i >= 0; --i)
+					m_free_file_buffers.push_back(i);
+			}
+			else
+			{
+				cerr << "Unable to register io_uring file buffers: " << error_message(errno) << '\n';
+				unmap(m_file_buffers, file_buffer_count * file_buffer_size);
+			}
+
+			m_wakeup = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+			if (m_wakeup < 0)
+				throw RuntimeError("Unable to create io_uring wakeup eventfd!");
+		}
+		catch (...)
+		{
+			release();
+			throw;
+		}
+		m_stopping = false;
+		m_wakeup_pending = false;
+		m_cancelling = false;
+		m_wakeup_armed = false;
+		m_running.store(true);
+		m_thread = thread([this]() { run(); });
+	}
+
+
+	void IoUring::stop()
+	{
+		if (!m_running.load())
+			return;
+		{
+			lock_guard<mutex> lock{ m_mutex };
+			m_stopping = true;
+		}
+		unsigned long long value = 1;
+		if (::write(m_wakeup, &value, sizeof(value)) < 0 && errno != EAGAIN)
+			cerr << "Unable to wake up io_uring thread!\n";
+		m_thread.join();
+		m_running.store(false);
+		{
+			lock_guard<mutex> lock{ m_mutex };
+			m_queue.clear();
+			m_wakeup_pending = false;
+		}
+		release();
+	}
+
+
+	bool IoUring::is_running() const
+	{
+		return m_running.load();
+	}
+
+
+	bool IoUring::submit(const shared_ptr<IoUringOperation>& operation)
+	{
+		return queue(Request{ operation, false });
+	}
+
+
+	void IoUring::cancel(const shared_ptr<IoUringOperation>& operation)
+	{
+		queue(Request{ operation, true });
+	}
+
+
+	asio::io_service& IoUring::io_service() const
+	{
+		return *m_io_service;
+	}
+
+
+	IoUringStats IoUring::stats() const
+	{
+		IoUringStats stats;
+		stats.enter_calls = m_enter_calls.load();
+		stats.submissions = m_submissions.load();
+		stats.completions = m_completions.load();
+		stats.buffers_exhausted = m_buffers_exhausted.load();
+		return stats;
+	}
+
+
+	bool IoUring::queue(Request request)
+	{
+		bool wakeup;
+		{
+			lock_guard<mutex> lock{ m_mutex };
+			if (!m_running.load() || m_stopping)
+				return false;
+			m_queue.push_back(move(request));
+			wakeup = !m_wakeup_pending;
+			m_wakeup_pending = true;
+		}
+		if (wakeup)
+		{
+			unsigned long long value = 1;
+			if (::write(m_wakeup, &value, sizeof(value)) < 0 && errno != EAGAIN)
+				cerr << "Unable to wake up io_uring thread!\n";
+		}
+		return true;
+	}
+
+
+	void IoUring::run()
+	{
+		vector<Request> requests;
+		vector<IoUringOperation*> cancels;
+		while (true)
+		{
+			bool stopping;
+			{
+				lock_guard<mutex> lock{ m_mutex };
+				requests.swap(m_queue);
+				m_wakeup_pending = false;
+				stopping = m_stopping;
+			}
+			if (stopping && !m_cancelling)
+			{
+				// Operations in flight complete with -ECANCELED, including the wakeup read
+				m_cancelling = true;
+				io_uring_sqe& sqe = next_sqe();
+				sqe.opcode = IORING_OP_ASYNC_CANCEL;
+				sqe.fd = -1;
+				sqe.cancel_flags = IORING_ASYNC_CANCEL_ANY;
+				sqe.user_data = cancel_data;
+			}
+			else if (!stopping && !m_wakeup_armed)
+			{
+				io_uring_sqe& sqe = next_sqe();
+				sqe.opcode = IORING_OP_READ;
+				sqe.fd = m_wakeup;
+				sqe.addr = reinterpret_cast<__u64>(&m_wakeup_value);
+				sqe.len = sizeof(m_wakeup_value);
+				sqe.off = static_cast<__u64>(-1);
+				sqe.user_data = wakeup_data;
+				m_wakeup_armed = true;
+			}
+			for (auto& request : requests)
+			{
+				IoUringOperation* key = request.operation.get();
+				if (request.cancel)
+				{
+					if (!m_cancelling && m_operations.count(key) > 0)
+						cancels.push_back(key);
+				}
+				else if (m_cancelling)
+				{
+					request.operation->abandon(-ECANCELED, false);
+				}
+				else
+				{
+					io_uring_sqe& sqe = next_sqe();
+					request.operation->prepare(sqe);
+					sqe.user_data = reinterpret_cast<__u64>(key);
+					m_operations[key] = move(request.operation);
+				}
+			}
+			requests.clear();
+			// Completion handlers may ask to cancel multishot operations while the queue is filled
+			cancels.insert(cancels.end(), m_cancels.begin(), m_cancels.end());
+			m_cancels.clear();
+			for (IoUringOperation* key : cancels)
+			{
+				if (m_cancelling || m_operations.count(key) == 0)
+					continue;
+				io_uring_sqe& sqe = next_sqe();
+				sqe.opcode = IORING_OP_ASYNC_CANCEL;
+				sqe.addr = reinterpret_cast<__u64>(key);
+				sqe.user_data = cancel_data;
+			}
+			cancels.clear();
+			if (m_cancelling && m_operations.empty() && !m_wakeup_armed)
+				break;
+			provide_buffers();
+			enter(1);
+			reap();
+		}
+	}
+
+
+	io_uring_sqe& IoUring::next_sqe()
+	{
+		// Submit the queued entries if the submission queue is full
+		while (m_sq.local_tail - __atomic_load_n(m_sq.head, __ATOMIC_ACQUIRE) >= m_sq.entries)
+		{
+			enter(0);
+			reap();
+		}
+		io_uring_sqe& sqe = m_sq.sqes[m_sq.local_tail & m_sq.mask];
+		memset(&sqe, 0, sizeof(sqe));
+		++m_sq.local_tail;
+		return sqe;
+	}
+
+
+	void IoUring::enter(unsigned int wait)
+	{
+		__atomic_store_n(m_sq.tail, m_sq.local_tail, __ATOMIC_RELEASE);
+		unsigned int to_submit = m_sq.local_tail - __atomic_load_n(m_sq.head, __ATOMIC_ACQUIRE);
+		unsigned int flags = wait > 0 ? IORING_ENTER_GETEVENTS : 0;
+		long result = ::syscall(__NR_io_uring_enter, m_fd, to_submit, wait, flags, nullptr, 0);
+		++m_enter_calls;
+		// EINTR and EBUSY are retried after completions are reaped
+		if (result > 0)
+			m_submissions += static_cast<unsigned long long>(result);
+	}
+
+
+	void IoUring::reap()
+	{
+		unsigned int head = *m_cq.head;
+		unsigned int tail = __atomic_load_n(m_cq.tail, __ATOMIC_ACQUIRE);
+		for (; head != tail; ++head)
+		{
+			const io_uring_cqe& cqe = m_cq.cqes[head & m_cq.mask];
+			if (cqe.user_data == wakeup_data)
+			{
+				m_wakeup_armed = false;
+				continue;
+			}
+			if (cqe.user_data == cancel_data || cqe.user_data == provide_data)
+				continue;
+			++m_completions;
+			const char* data = nullptr;
+			unsigned short buffer_id = 0;
+			if ((cqe.flags & IORING_CQE_F_BUFFER) != 0)
+			{
+				buffer_id = static_cast<unsigned short>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+				data = m_receive_buffers + buffer_id * receive_buffer_size;
+			}
+			if (cqe.res == -ENOBUFS)
+				++m_buffers_exhausted;
+			bool more = (cqe.flags & IORING_CQE_F_MORE) != 0;
+			auto found = m_operations.find(reinterpret_cast<IoUringOperation*>(cqe.user_data));
+			if (found != m_operations.end())
+			{
+				IoUringOperation* operation = found->second.get();
+				// The last completion releases the operation after it is handled
+				shared_ptr<IoUringOperation> finished;
+				if (!more)
+				{
+					finished = move(found->second);
+					m_operations.erase(found);
+				}
+				if (m_cancelling)
+					operation->abandon(cqe.res, more);
+				else if (!operation->complete(cqe.res, data, more) && more)
+					m_cancels.push_back(operation);
+			}
+			// The data has been copied by the handler, so the buffer is provided again
+			if (data != nullptr)
+				m_provided.push_back(buffer_id);
+		}
+		__atomic_store_n(m_cq.head, head, __ATOMIC_RELEASE);
+	}
+
+
+	int IoUring::wait_completion(unsigned int& flags)
+	{
+		// Used only before the ring thread is started
+		unsigned int head = *m_cq.head;
+		while (head == __atomic_load_n(m_cq.tail, __ATOMIC_ACQUIRE))
+			enter(1);
+		const io_uring_cqe& cqe = m_cq.cqes[head & m_cq.mask];
+		int result = cqe.res;
+		flags = cqe.flags;
+		__atomic_store_n(m_cq.head, head + 1, __ATOMIC_RELEASE);
+		return result;
+	}
+
+
+	void IoUring::setup_receive_buffers()
+	{
+		// Buffers are provided with an operation rather than registered as a buffer ring:
+		// some kernels accept a buffer ring but never select buffers from it.
+		io_uring_sqe& sqe = next_sqe();
+		sqe.opcode = IORING_OP_PROVIDE_BUFFERS;
+		sqe.fd = static_cast<int>(receive_buffer_count);
+		sqe.addr = reinterpret_cast<__u64>(m_receive_buffers);
+		sqe.len = static_cast<__u32>(receive_buffer_size);
+		sqe.buf_group = receive_buffer_group;
+		sqe.user_data = provide_data;
+		unsigned int flags;
+		if (wait_completion(flags) < 0)
+			throw RuntimeError("Unable to provide io_uring receive buffers!");
+	}
+
+
+	void IoUring::provide_buffers()
+	{
+		// Released buffers are provided again with the next submission,
+		// adjacent buffers with a single entry
+		vector<unsigned short> provided;
+		provided.swap(m_provided);
+		sort(provided.begin(), provided.end());
+		for (size_t first = 0; first < provided.size();)
+		{
+			size_t last = first + 1;
+			while (last < provided.size() && provided[last] == provided[last - 1] + 1)
+				++last;
+			unsigned short id = provided[first];
+			io_uring_sqe& sqe = next_sqe();
+			sqe.opcode = IORING_OP_PROVIDE_BUFFERS;
+			sqe.flags = IOSQE_CQE_SKIP_SUCCESS;
+			sqe.fd = static_cast<int>(last - first);
+			sqe.addr = reinterpret_cast<__u64>(m_receive_buffers + id * receive_buffer_size);
+			sqe.len = static_cast<__u32>(receive_buffer_size);
+			sqe.buf_group = receive_buffer_group;
+			sqe.off = id;
+			sqe.user_data = provide_data;
+			first = last;
+		}
+	}
+
+
+	void IoUring::release()
+	{
+		// Closing the ring also unregisters its buffers
+		if (m_fd >= 0)
+			::close(m_fd);
+		m_fd = -1;
+		if (m_wakeup >= 0)
+			::close(m_wakeup);
+		m_wakeup = -1;
+		unmap(m_sq_ring, m_sq_ring_size);
+		unmap(m_cq_ring, m_cq_ring_size);
+		unmap(m_sq.sqes, m_sqes_size);
+		m_sq = SubmissionQueue();
+		m_cq = CompletionQueue();
+		unmap(m_receive_buffers, receive_buffer_count * receive_buffer_size);
+		m_provided.clear();
+		lock_guard<mutex> lock{ m_file_buffers_mutex };
+		unmap(m_file_buffers, file_buffer_count * file_buffer_size);
+		m_free_file_buffers.clear();
+	}
+
+
+	int IoUring::acquire_file_buffer()
+	{
+		lock_guard<mutex> lock{ m_file_buffers_mutex };
+		if (m_free_file_buffers.empty())
+			return -1;
+		int index = m_free_file_buffers.back();
+		m_free_file_buffers.pop_back();
+		return index;
+	}
+
+
+	void IoUring::release_file_buffer(int index)
+	{
+		lock_guard<mutex> lock{ m_file_buffers_mutex };
+		// Buffers acquired before the ring was restarted are not returned
+		if (m_file_buffers != nullptr && m_free_file_buffers.size() < file_buffer_count)
+			m_free_file_buffers.push_back(index);
+	}
+
+
+	size_t IoUring::read_file(int fd, unsigned long long offset, int buffer_index, size_t length,
+		asio::yield_context yc, sys::error_code& ec)
+	{
+		auto operation = make_shared<FileRead>(fd, offset, m_file_buffers + buffer_index * file_buffer_size,
+			min(length, static_cast<size_t>(file_buffer_size)), buffer_index);
+		completion_type completion{ yc };
+		operation->resume = make_resume(completion, *m_io_service);
+		if (!submit(operation))
+		{
+			ec = asio::error::operation_aborted;
+			return 0;
+		}
+		completion.result.get();
+		if (operation->result < 0)
+		{
+			ec = sys::error_code(-operation->result, sys::system_category());
+			return 0;
+		}
+		return static_cast<size_t>(operation->result);
+	}
+
+#pragma endregion
+
+#pragma region IoUringBuffer
+
+	IoUringBuffer::IoUringBuffer(IoUring& ring) : m_ring{ ring }, m_index{ ring.acquire_file_buffer() }
+	{
+	}
+
+
+	IoUringBuffer::~IoUringBuffer()
+	{
+		if (m_index >= 0)
+			m_ring.release_file_buffer(m_index);
+	}
+
+
+	IoUringBuffer::operator bool() const
+	{
+		return m_index >= 0;
+	}
+
+
+	char* IoUringBuffer::data() const
+	{
+		return m_ring.m_file_buffers + m_index * IoUring::file_buffer_size;
+	}
+
+
+	size_t IoUringBuffer::size() const
+	{
+		return IoUring::file_buffer_size;
+	}
+
+
+	size_t IoUringBuffer::read_file(int fd, unsigned long long offset, size_t length, asio::yield_context yc,
+		sys::error_code& ec)
+	{
+		return m_ring.read_file(fd, offset, m_index, length, yc, ec);
+	}
+
+#pragma endregion
+
+#pragma region IoUringAccept
+
+	void IoUringAccept::prepare(io_uring_sqe& sqe)
+	{
+		sqe.opcode = IORING_OP_ACCEPT;
+		sqe.fd = m_fd;
+		sqe.ioprio = IORING_ACCEPT_MULTISHOT;
+		sqe.accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+	}
+
+
+	bool IoUringAccept::complete(int result, const char* /*data*/, bool more)
+	{
+		handler(result, more);
+		return true;
+	}
+
+
+	void IoUringAccept::abandon(int result, bool /*more*/)
+	{
+		if (result >= 0)
+			::close(result);
+	}
+
+#pragma endregion
+
+#pragma region IoUringReceiver
+
+	size_t IoUringReceiver::async_read(asio::streambuf& buffer, asio::yield_context yc, sys::error_code& ec)
+	{
+		unique_lock<mutex> lock{ m_mutex };
+		while (m_pending.empty() && !m_error)
+		{
+			if (!m_armed)
+			{
+				if (!m_ring.submit(shared_from_this()))
+				{
+					m_error = asio::error::operation_aborted;
+					break;
+				}
+				m_armed = true;
+			}
+			completion_type completion{ yc };
+			m_resume = make_resume(completion, m_ring.io_service());
+			lock.unlock();
+			completion.result.get();
+			lock.lock();
+		}
+		return take(buffer, ec);
+	}
+
+
+	size_t IoUringReceiver::read(asio::streambuf& buffer, sys::error_code& ec)
+	{
+		unique_lock<mutex> lock{ m_mutex };
+		while (m_pending.empty() && !m_error)
+		{
+			if (!m_armed)
+			{
+				if (!m_ring.submit(shared_from_this()))
+				{
+					m_error = asio::error::operation_aborted;
+					break;
+				}
+				m_armed = true;
+			}
+			m_ready.wait(lock);
+		}
+		return take(buffer, ec);
+	}
+
+
+	size_t IoUringReceiver::take(asio::streambuf& buffer, sys::error_code& ec)
+	{
+		size_t length = m_pending.length();
+		if (length == 0)
+		{
+			ec = m_error;
+			return 0;
+		}
+		memcpy(asio::buffer_cast<char*>(buffer.prepare(length)), m_pending.data(), length);
+		buffer.commit(length);
+		// The capacity of the string is kept for the next data
+		m_pending.clear();
+		return length;
+	}
+
+
+	void IoUringReceiver::close()
+	{
+		bool armed;
+		{
+			lock_guard<mutex> lock{ m_mutex };
+			armed = m_armed;
+		}
+		if (armed)
+			m_ring.cancel(shared_from_this());
+	}
+
+
+	void IoUringReceiver::prepare(io_uring_sqe& sqe)
+	{
+		sqe.opcode = IORING_OP_RECV;
+		sqe.fd = m_fd;
+		sqe.ioprio = IORING_RECV_MULTISHOT;
+		sqe.flags = IOSQE_BUFFER_SELECT;
+		sqe.buf_group = IoUring::receive_buffer_group;
+	}
+
+
+	bool IoUringReceiver::complete(int result, const char* data, bool more)
+	{
+		function<void()> waiting;
+		bool keep;
+		{
+			lock_guard<mutex> lock{ m_mutex };
+			if (result > 0)
+				m_pending.append(data, static_cast<size_t>(result));
+			else if (result == 0)
+				m_error = asio::error::eof;
+			// Receiving is restarted by the next read if the kernel has run out of buffers
+			else if (result != -ENOBUFS && result != -ECANCELED)
+				m_error = sys::error_code(-result, sys::system_category());
+			if (!more)
+				m_armed = false;
+			keep = m_pending.length() < max_pending;
+			waiting.swap(m_resume);
+		}
+		m_ready.notify_all();
+		if (waiting)
+			waiting();
+		return keep;
+	}
+
+
+	void IoUringReceiver::abandon(int /*result*/, bool more)
+	{
+		if (!more)
+			complete(-ECANCELED, nullptr, false);
+	}
+
+#pragma endregion
+}
+
+#endif // WSGI_BOOST_IO_URING
@@ -0,0 +1,284 @@
+#pragma once
+/*
+io_uring backend for accepting connections, receiving request data and reading static files
+
+Copyright (c) 2016 Roman Miroshnychenko <romanvm@yandex.ua>
+License: MIT, see License.txt
+*/
+
+namespace wsgi_boost
+{
+	// Operation counters of a ring
+	struct IoUringStats
+	{
+		unsigned long long enter_calls = 0;
+		unsigned long long submissions = 0;
+		unsigned long long completions = 0;
+		// Multishot receives stopped because all receive buffers were in use
+		unsigned long long buffers_exhausted = 0;
+	};
+}
+
+#ifdef WSGI_BOOST_IO_URING
+
+#include <boost/asio.hpp>
+#include <boost/asio/spawn.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+
+namespace wsgi_boost
+{
+	// An operation submitted to IoUring. Its completions are handled in the ring thread.
+	class IoUringOperation
+	{
+	public:
+		virtual ~IoUringOperation() {}
+
+		// Fill a submission queue entry
+		virtual void prepare(io_uring_sqe& sqe) = 0;
+
+		// Handle a completion. data points to the receive buffer selected by the kernel, if any,
+		// and more is true if a multishot operation will produce further completions.
+		// Returns false to cancel a multishot operation.
+		virtual bool complete(int result, const char* data, bool more) = 0;
+
+		// Called instead of complete() for completions that arrive while the ring is stopping
+		// and for operations that are queued after that
+		virtual void abandon(int result, bool more) = 0;
+	};
+
+
+	// A Linux io_uring instance driven by a dedicated thread.
+	//
+	// Server threads queue operations without entering the kernel and wake up the ring thread
+	// through an eventfd once per batch. The ring thread submits all queued operations and waits
+	// for completions with a single io_uring_enter() call per loop iteration.
+	// Sockets are received into a group of buffers provided to the kernel, and files are read
+	// into buffers registered with the ring.
+	class IoUring
+	{
+	public:
+		static const unsigned int queue_size = 1024;
+		// Receive buffers shared by all multishot receives, the count is a power of 2
+		static const unsigned int receive_buffer_count = 512;
+		static const size_t receive_buffer_size = 16384;
+		static const unsigned short receive_buffer_group = 0;
+		static const unsigned int file_buffer_count = 16;
+		static const size_t file_buffer_size = 131072;
+
+		IoUring(const IoUring&) = delete;
+		IoUring& operator=(const IoUring&) = delete;
+
+		IoUring();
+
+		~IoUring();
+
+		// Set up the ring and start the ring thread. Throws RuntimeError if the kernel does not support
+		// the operations that are used. Completion handlers of coroutines are posted to io_service.
+		void start(boost::asio::io_service& io_service);
+
+		// Cancel operations in flight and stop the ring thread
+		void stop();
+
+		bool is_running() const;
+
+		// Queue an operation for submission, false if the ring is not running
+		bool submit(const std::shared_ptr<IoUringOperation>& operation);
+
+		// Request cancellation of a submitted operation
+		void cancel(const std::shared_ptr<IoUringOperation>& operation);
+
+		boost::asio::io_service& io_service() const;
+
+		IoUringStats stats() const;
+
+	private:
+		friend class IoUringBuffer;
+
+		struct Request
+		{
+			std::shared_ptr<IoUringOperation> operation;
+			bool cancel;
+		};
+
+		struct SubmissionQueue
+		{
+			unsigned int* head = nullptr;
+			unsigned int* tail = nullptr;
+			unsigned int* array = nullptr;
+			unsigned int mask = 0;
+			unsigned int entries = 0;
+			io_uring_sqe* sqes = nullptr;
+			// Tail of entries that have not been published to the kernel yet
+			unsigned int local_tail = 0;
+		};
+
+		struct CompletionQueue
+		{
+			unsigned int* head = nullptr;
+			unsigned int* tail = nullptr;
+			unsigned int mask = 0;
+			io_uring_cqe* cqes = nullptr;
+		};
+
+		int m_fd = -1;
+		int m_wakeup = -1;
+		unsigned long long m_wakeup_value = 0;
+		void* m_sq_ring = nullptr;
+		size_t m_sq_ring_size = 0;
+		void* m_cq_ring = nullptr;
+		size_t m_cq_ring_size = 0;
+		size_t m_sqes_size = 0;
+		SubmissionQueue m_sq;
+		CompletionQueue m_cq;
+		boost::asio::io_service* m_io_service = nullptr;
+		std::thread m_thread;
+		std::atomic_bool m_running;
+
+		char* m_receive_buffers = nullptr;
+
+		std::mutex m_file_buffers_mutex;
+		char* m_file_buffers = nullptr;
+		std::vector<int> m_free_file_buffers;
+
+		std::mutex m_mutex;
+		std::vector<Request> m_queue;
+		bool m_wakeup_pending = false;
+		bool m_stopping = false;
+
+		// Ring thread only
+		std::unordered_map<IoUringOperation*, std::shared_ptr<IoUringOperation>> m_operations;
+		// Multishot operations whose handlers have asked to stop them
+		std::vector<IoUringOperation*> m_cancels;
+		// Receive buffers to provide again with the next submission
+		std::vector<unsigned short> m_provided;
+		bool m_wakeup_armed = false;
+		bool m_cancelling = false;
+
+		std::atomic<unsigned long long> m_enter_calls;
+		std::atomic<unsigned long long> m_submissions;
+		std::atomic<unsigned long long> m_completions;
+		std::atomic<unsigned long long> m_buffers_exhausted;
+
+		void run();
+		bool queue(Request request);
+		io_uring_sqe& next_sqe();
+		void enter(unsigned int wait);
+		void reap();
+		int wait_completion(unsigned int& flags);
+		void setup_receive_buffers();
+		void provide_buffers();
+		void release();
+		int acquire_file_buffer();
+		void release_file_buffer(int index);
+		size_t read_file(int fd, unsigned long long offset, int buffer_index, size_t length,
+			boost::asio::yield_context yc, boost::system::error_code& ec);
+	};
+
+
+	// A buffer registered with the ring for reading files, held for the lifetime of the object
+	class IoUringBuffer
+	{
+	private:
+		IoUring& m_ring;
+		int m_index;
+
+	public:
+		IoUringBuffer(const IoUringBuffer&) = delete;
+		IoUringBuffer& operator=(const IoUringBuffer&) = delete;
+
+		explicit IoUringBuffer(IoUring& ring);
+
+		~IoUringBuffer();
+
+		// False if all registered buffers are in use
+		explicit operator bool() const;
+
+		char* data() const;
+
+		size_t size() const;
+
+		// Read a region of a file into the buffer waiting in the coroutine.
+		// Returns the number of bytes read, 0 at the end of the file.
+		size_t read_file(int fd, unsigned long long offset, size_t length, boost::asio::yield_context yc,
+			boost::system::error_code& ec);
+	};
+
+
+	// A multishot accept on a listening socket
+	class IoUringAccept : public IoUringOperation
+	{
+	private:
+		int m_fd;
+
+	public:
+		// Called in the ring thread with a new socket descriptor or a negative error code
+		std::function<void(int result, bool more)> handler;
+
+		explicit IoUringAccept(int fd) : m_fd{ fd } {}
+
+		void prepare(io_uring_sqe& sqe);
+
+		bool complete(int result, const char* data, bool more);
+
+		// Connections that are accepted while the ring is stopping are closed
+		void abandon(int result, bool more);
+	};
+
+
+	// Receives data from a connection socket with a multishot receive. Data that arrives before
+	// the connection asks for it is buffered up to a limit, then receiving stops until the buffered
+	// data is consumed.
+	class IoUringReceiver : public IoUringOperation, public std::enable_shared_from_this<IoUringReceiver>
+	{
+	private:
+		static const size_t max_pending = 262144;
+
+		IoUring& m_ring;
+		int m_fd;
+		std::mutex m_mutex;
+		std::condition_variable m_ready;
+		std::string m_pending;
+		boost::system::error_code m_error;
+		bool m_armed = false;
+		// Resumes the coroutine waiting for data
+		std::function<void()> m_resume;
+
+		size_t take(boost::asio::streambuf& buffer, boost::system::error_code& ec);
+
+	public:
+		IoUringReceiver(const IoUringReceiver&) = delete;
+		IoUringReceiver& operator=(const IoUringReceiver&) = delete;
+
+		IoUringReceiver(IoUring& ring, int fd) : m_ring{ ring }, m_fd{ fd } {}
+
+		// Wait in the coroutine until data is received and move it to the buffer
+		size_t async_read(boost::asio::streambuf& buffer, boost::asio::yield_context yc, boost::system::error_code& ec);
+
+		// Block the thread until data is received and move it to the buffer
+		size_t read(boost::asio::streambuf& buffer, boost::system::error_code& ec);
+
+		// Stop receiving when the connection is closed
+		void close();
+
+		void prepare(io_uring_sqe& sqe);
+
+		bool complete(int result, const char* data, bool more);
+
+		void abandon(int result, bool more);
+	};
+}
+
+#endif // WSGI_BOOST_IO_URING
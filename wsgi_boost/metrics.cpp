@@ -0,0 +1,252 @@
+/*
+Latency histograms and traffic counters
+
+Copyright (c) 2016 Roman Miroshnychenko <romanvm@yandex.ua>
+License: MIT, see License.txt
+*/
+
+#include "metrics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <locale>
+#include <sstream>
+
+using namespace std;
+
+
+namespace wsgi_boost
+{
+	const char* stage_name(Stage stage)
+	{
+		switch (stage)
+		{
+		case Stage::first_byte:
+			return "first_byte";
+		case Stage::header:
+			return "header";
+		case Stage::static_file:
+			return "static_file";
+		case Stage::gil_wait:
+			return "gil_wait";
+		case Stage::app:
+			return "app";
+		case Stage::write:
+			return "write";
+		default:
+			return "unknown";
+		}
+	}
+
+#pragma region LatencyHistogram
+
+	void LatencyHistogram::reset()
+	{
+		for (auto& bucket : m_buckets)
+			bucket.store(0);
+		m_count.store(0);
+		m_sum.store(0);
+		m_max.store(0);
+	}
+
+
+	void LatencyHistogram::record(chrono::steady_clock::duration duration)
+	{
+		long long microseconds = chrono::duration_cast<chrono::microseconds>(duration).count();
+		unsigned long long value = microseconds > 0 ? static_cast<unsigned long long>(microseconds) : 0;
+		m_buckets[bucket_index(value)].fetch_add(1, memory_order_relaxed);
+		m_count.fetch_add(1, memory_order_relaxed);
+		m_sum.fetch_add(value, memory_order_relaxed);
+		unsigned long long current_max = m_max.load(memory_order_relaxed);
+		while (value > current_max && !m_max.compare_exchange_weak(current_max, value, memory_order_relaxed));
+	}
+
+
+	size_t LatencyHistogram::bucket_index(unsigned long long microseconds)
+	{
+		if (microseconds < 4)
+			return static_cast<size_t>(microseconds);
+		unsigned int exponent = 2;
+		while (microseconds >> (exponent + 1))
+			++exponent;
+		size_t index = (exponent - 1) * 4 + ((microseconds >> (exponent - 2)) & 3);
+		return min(index, bucket_count - 1);
+	}
+
+
+	unsigned long long LatencyHistogram::bucket_upper_bound(size_t index)
+	{
+		if (index < 4)
+			return index + 1;
+		return (5ULL + index % 4) << (index / 4 - 1);
+	}
+
+#pragma endregion
+
+#pragma region Metrics
+
+	void Metrics::reset()
+	{
+		for (auto& shard : m_shards)
+		{
+			for (auto& histogram : shard.stages)
+				histogram.reset();
+			shard.bytes_received.store(0);
+			shard.bytes_sent.store(0);
+			for (auto& counter : shard.responses)
+				counter.store(0);
+		}
+	}
+
+
+	MetricsShard& Metrics::local()
+	{
+		static atomic<size_t> next_index{ 0 };
+		static thread_local size_t index = next_index.fetch_add(1) % shard_count;
+		return m_shards[index];
+	}
+
+
+	void Metrics::record(Stage stage, chrono::steady_clock::duration duration)
+	{
+		local().stages[static_cast<size_t>(stage)].record(duration);
+	}
+
+
+	void Metrics::add_bytes_received(size_t bytes)
+	{
+		local().bytes_received.fetch_add(bytes, memory_order_relaxed);
+	}
+
+
+	void Metrics::add_bytes_sent(size_t bytes)
+	{
+		local().bytes_sent.fetch_add(bytes, memory_order_relaxed);
+	}
+
+
+	void Metrics::add_response(unsigned int status_code)
+	{
+		if (status_code >= 100 && status_code < 600)
+			local().responses[status_code - 100].fetch_add(1, memory_order_relaxed);
+	}
+
+#pragma endregion
+
+#pragma region HistogramSnapshot
+
+	HistogramSnapshot::HistogramSnapshot()
+	{
+		buckets.fill(0);
+	}
+
+
+	void HistogramSnapshot::add(const LatencyHistogram& histogram)
+	{
+		for (size_t i = 0; i < LatencyHistogram::bucket_count; ++i)
+			buckets[i] += histogram.m_buckets[i].load(memory_order_relaxed);
+		count += histogram.m_count.load(memory_order_relaxed);
+		sum += histogram.m_sum.load(memory_order_relaxed);
+		maximum = max(maximum, histogram.m_max.load(memory_order_relaxed));
+	}
+
+
+	double HistogramSnapshot::percentile(double percent) const
+	{
+		// Bucket counters are read one by one, so their sum may be slightly different from the total count
+		unsigned long long total = 0;
+		for (auto bucket : buckets)
+			total += bucket;
+		if (total == 0)
+			return 0.0;
+		unsigned long long rank = max(1ULL, static_cast<unsigned long long>(ceil(total * percent / 100.0)));
+		unsigned long long cumulative = 0;
+		for (size_t i = 0; i < LatencyHistogram::bucket_count; ++i)
+		{
+			cumulative += buckets[i];
+			if (cumulative >= rank)
+				return min(LatencyHistogram::bucket_upper_bound(i), maximum) / 1000000.0;
+		}
+		return maximum / 1000000.0;
+	}
+
+#pragma endregion
+
+#pragma region MetricsSnapshot
+
+	MetricsSnapshot::MetricsSnapshot()
+	{
+		responses.fill(0);
+	}
+
+
+	void MetricsSnapshot::add(const Metrics& metrics)
+	{
+		for (const auto& shard : metrics.m_shards)
+		{
+			bytes_received += shard.bytes_received.load(memory_order_relaxed);
+			bytes_sent += shard.bytes_sent.load(memory_order_relaxed);
+			for (size_t i = 0; i < responses.size(); ++i)
+				responses[i] += shard.responses[i].load(memory_order_relaxed);
+			for (size_t stage = 0; stage < stage_count; ++stage)
+				stages[stage].add(shard.stages[stage]);
+		}
+	}
+
+
+	string MetricsSnapshot::to_prometheus() const
+	{
+		ostringstream oss;
+		oss.imbue(locale::classic());
+		oss.precision(10);
+		oss << "# HELP wsgi_boost_connections_total Accepted connections.\n"
+			"# TYPE wsgi_boost_connections_total counter\n"
+			"wsgi_boost_connections_total " << connections << '\n';
+		oss << "# HELP wsgi_boost_active_connections Open connections.\n"
+			"# TYPE wsgi_boost_active_connections gauge\n"
+			"wsgi_boost_active_connections " << active_connections << '\n';
+		oss << "# HELP wsgi_boost_requests_total Received requests.\n"
+			"# TYPE wsgi_boost_requests_total counter\n"
+			"wsgi_boost_requests_total " << requests << '\n';
+		oss << "# HELP wsgi_boost_received_bytes_total Bytes received from clients.\n"
+			"# TYPE wsgi_boost_received_bytes_total counter\n"
+			"wsgi_boost_received_bytes_total " << bytes_received << '\n';
+		oss << "# HELP wsgi_boost_sent_bytes_total Bytes sent to clients.\n"
+			"# TYPE wsgi_boost_sent_bytes_total counter\n"
+			"wsgi_boost_sent_bytes_total " << bytes_sent << '\n';
+		oss << "# HELP wsgi_boost_access_log_dropped_total Access log records dropped because of full buffers.\n"
+			"# TYPE wsgi_boost_access_log_dropped_total counter\n"
+			"wsgi_boost_access_log_dropped_total " << access_log_dropped << '\n';
+		oss << "# HELP wsgi_boost_responses_total Responses by status code.\n"
+			"# TYPE wsgi_boost_responses_total counter\n";
+		for (size_t i = 0; i < responses.size(); ++i)
+		{
+			if (responses[i] > 0)
+				oss << "wsgi_boost_responses_total{code=\"" << i + 100 << "\"} " << responses[i] << '\n';
+		}
+		oss << "# HELP wsgi_boost_stage_duration_seconds Duration of request processing stages.\n"
+			"# TYPE wsgi_boost_stage_duration_seconds histogram\n";
+		for (size_t stage = 0; stage < stage_count; ++stage)
+		{
+			const char* name = stage_name(static_cast<Stage>(stage));
+			unsigned long long cumulative = 0;
+			size_t bucket = 0;
+			// Prometheus buckets are powers of 4 microseconds that match histogram bucket bounds
+			for (unsigned long long bound = 1; bound <= (1ULL << 30); bound <<= 2)
+			{
+				while (bucket < LatencyHistogram::bucket_count && LatencyHistogram::bucket_upper_bound(bucket) <= bound)
+					cumulative += stages[stage].buckets[bucket++];
+				oss << "wsgi_boost_stage_duration_seconds_bucket{stage=\"" << name << "\",le=\"" <<
+					bound / 1000000.0 << "\"} " << cumulative << '\n';
+			}
+			while (bucket < LatencyHistogram::bucket_count)
+				cumulative += stages[stage].buckets[bucket++];
+			oss << "wsgi_boost_stage_duration_seconds_bucket{stage=\"" << name << "\",le=\"+Inf\"} " << cumulative << '\n';
+			oss << "wsgi_boost_stage_duration_seconds_sum{stage=\"" << name << "\"} " << stages[stage].sum / 1000000.0 << '\n';
+			oss << "wsgi_boost_stage_duration_seconds_count{stage=\"" << name << "\"} " << cumulative << '\n';
+		}
+		return oss.str();
+	}
+
+#pragma endregion
+}
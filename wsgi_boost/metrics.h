@@ -0,0 +1,144 @@
+#pragma once
+/*
+Latency histograms and traffic counters
+
+Copyright (c) 2016 Roman Miroshnychenko <romanvm@yandex.ua>
+License: MIT, see License.txt
+*/
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <string>
+
+
+namespace wsgi_boost
+{
+	// Request processing stages with latency histograms
+	enum class Stage : unsigned char
+	{
+		// From accepting a connection or receiving a keep-alive request to the first byte of the response
+		first_byte,
+		// Receiving and parsing a request header
+		header,
+		// Serving a static file
+		static_file,
+		// Waiting for the GIL
+		gil_wait,
+		// Running a WSGI application
+		app,
+		// Sending a response
+		write,
+		count
+	};
+
+
+	const size_t stage_count = static_cast<size_t>(Stage::count);
+
+	// Get a stage name for statistics
+	const char* stage_name(Stage stage);
+
+
+	// Histogram with logarithmic buckets in microseconds, 4 sub-buckets for each power of 2.
+	// The relative error of percentiles is below 25%.
+	class LatencyHistogram
+	{
+	public:
+		static const size_t bucket_count = 128;
+
+		// Reset all counters to 0
+		void reset();
+
+		void record(std::chrono::steady_clock::duration duration);
+
+		static size_t bucket_index(unsigned long long microseconds);
+
+		// Exclusive upper bound of a bucket in microseconds
+		static unsigned long long bucket_upper_bound(size_t index);
+
+	private:
+		friend struct HistogramSnapshot;
+
+		std::array<std::atomic<unsigned long long>, bucket_count> m_buckets;
+		std::atomic<unsigned long long> m_count;
+		std::atomic<unsigned long long> m_sum;
+		std::atomic<unsigned long long> m_max;
+	};
+
+
+	// Counters updated by a subset of server threads to avoid cache line contention
+	struct alignas(64) MetricsShard
+	{
+		std::array<LatencyHistogram, stage_count> stages;
+		std::atomic<unsigned long long> bytes_received;
+		std::atomic<unsigned long long> bytes_sent;
+		// Counters of response status codes from 100 to 599
+		std::array<std::atomic<unsigned long long>, 500> responses;
+	};
+
+
+	// Metrics of a server process. It contains only atomics, so it can be placed into shared memory.
+	class Metrics
+	{
+	public:
+		static const size_t shard_count = 8;
+
+		// Reset all counters to 0
+		void reset();
+
+		void record(Stage stage, std::chrono::steady_clock::duration duration);
+
+		void add_bytes_received(size_t bytes);
+
+		void add_bytes_sent(size_t bytes);
+
+		void add_response(unsigned int status_code);
+
+	private:
+		friend struct MetricsSnapshot;
+
+		std::array<MetricsShard, shard_count> m_shards;
+
+		// Get a shard for the current thread
+		MetricsShard& local();
+	};
+
+
+	// Sum of LatencyHistogram counters
+	struct HistogramSnapshot
+	{
+		std::array<unsigned long long, LatencyHistogram::bucket_count> buckets;
+		unsigned long long count = 0;
+		// Sum and max. of values in microseconds
+		unsigned long long sum = 0;
+		unsigned long long maximum = 0;
+
+		HistogramSnapshot();
+
+		void add(const LatencyHistogram& histogram);
+
+		// Get a percentile (0-100) in seconds
+		double percentile(double percent) const;
+	};
+
+
+	// Sum of metrics and connection counters of all server processes
+	struct MetricsSnapshot
+	{
+		unsigned long long connections = 0;
+		long long active_connections = 0;
+		unsigned long long requests = 0;
+		unsigned long long bytes_received = 0;
+		unsigned long long bytes_sent = 0;
+		unsigned long long access_log_dropped = 0;
+		std::array<unsigned long long, 500> responses;
+		std::array<HistogramSnapshot, stage_count> stages;
+
+		MetricsSnapshot();
+
+		void add(const Metrics& metrics);
+
+		// Format the snapshot in Prometheus text exposition format
+		std::string to_prometheus() const;
+	};
+}
@@ -2,6 +2,8 @@
 
 #include <boost/algorithm/string.hpp>
 
+#include <algorithm>
+
 using namespace std;
 namespace alg = boost::algorithm;
 namespace sys = boost::system;
@@ -9,95 +11,144 @@ namespace sys = boost::system;
 
 namespace wsgi_boost
 {
+	// The max. number of request headers
+	static const size_t max_headers = 100;
+
+
+	static bool is_space(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
+	}
+
+
+	void Request::reset()
+	{
+		method.clear();
+		path.clear();
+		http_version.clear();
+		headers.clear();
+		path_regex = boost::regex();
+		content_dir.clear();
+	}
+
+
 	boost::system::error_code Request::parse_header()
 	{
-		string header;
-		sys::error_code ec = m_connection.read_header(header);
+		sys::error_code ec = m_connection.read_header(m_header);
 		if (ec)
 			return ec;
-		istringstream iss{ header };
-		string line;
-		getline(iss, line);
-		line.pop_back();
-		vector<string> parts;
-		alg::split(parts, line, alg::is_space(), alg::token_compress_on);
-		if (parts.size() != 3)
+		return parse_header(m_header);
+	}
+
+
+	boost::system::error_code Request::parse_header(const string& header)
+	{
+		// The header is parsed in place to avoid intermediate copies
+		const char* end = header.data() + header.size();
+		const char* line_end = find(header.data(), end, '\n');
+		string* parts[] = { &method, &path, &http_version };
+		size_t parts_count = 0;
+		for (const char* pos = find_if_not(header.data(), line_end, is_space); pos != line_end;
+			pos = find_if_not(pos, line_end, is_space))
+		{
+			if (parts_count == 3)
+				return sys::error_code(sys::errc::bad_message, sys::system_category());
+			const char* token_end = find_if(pos, line_end, is_space);
+			parts[parts_count++]->assign(pos, token_end);
+			pos = token_end;
+		}
+		if (parts_count != 3)
 			return sys::error_code(sys::errc::bad_message, sys::system_category());
-		method = parts[0];
-		path = parts[1];
-		http_version = parts[2];
-		while (true)
+		while (line_end != end)
 		{
-			getline(iss, line);
-			if (!iss.good())
+			const char* line = line_end + 1;
+			line_end = find(line, end, '\n');
+			if (line_end == end)
 				break;
-			line.pop_back();
-			size_t pos = line.find(':');
-			if (pos != string::npos)
+			const char* colon = find(line, line_end, ':');
+			if (colon != line_end)
 			{
-				string header = alg::trim_copy(line.substr(0, pos));
-				string value = alg::trim_copy(line.substr(pos + 1));
-				if (headers.find(header) == headers.end())
-				{
-					headers.emplace(header, value);
-				}
-				else
-				{
-					headers[header] += "," + value;
-				}
+				const char* name_begin = find_if_not(line, colon, is_space);
+				const char* name_end = colon;
+				while (name_end != name_begin && is_space(name_end[-1]))
+					--name_end;
+				const char* value_begin = find_if_not(colon + 1, line_end, is_space);
+				const char* value_end = line_end;
+				while (value_end != value_begin && is_space(value_end[-1]))
+					--value_end;
+				if (headers.size() >= max_headers)
+					return sys::error_code(sys::errc::bad_message, sys::system_category());
+				headers.add(name_begin, name_end - name_begin, value_begin, value_end - value_begin);
 			}
 		}
-		string cl_header = get_header("Content-Length");
-		if (cl_header != "")
+		m_connection.set_post_content_length(-1);
+		const string* cl_header = headers.find(KnownHeader::content_length);
+		if (cl_header != nullptr)
 		{
 			try
 			{
-				long long cl = stoll(cl_header);
-				m_connection.set_post_content_length(cl);
+				m_connection.set_post_content_length(stoll(*cl_header));
 			}
 			catch (const exception&)
 			{
-				m_connection.set_post_content_length(-1);
 			}
 		}
-		else
-		{
-			m_connection.set_post_content_length(-1);
-		}
 		if ((method == "POST" || method == "PUT") && m_connection.content_length() == -1)
 			return sys::error_code(sys::errc::invalid_argument, sys::system_category());
 		return sys::error_code(sys::errc::success, sys::system_category());
 	}
 
 
-	bool Request::check_header(const string& header, string value)
+	bool Request::match_static_route(const static_routes_type& routes)
 	{
-		auto it = headers.find(header);
-		if (it != headers.end())
+		for (const auto& route : routes)
 		{
-			string actual_value = it->second;
-			alg::to_lower(value);
-			alg::to_lower(actual_value);
-			return actual_value.find(value) != string::npos;
-		}
-		else
-		{
-			return false;
+			if (boost::regex_search(path, route.first))
+			{
+				path_regex = route.first;
+				content_dir = route.second;
+				return true;
+			}
 		}
+		return false;
 	}
 
 
-	string Request::get_header(const string& header)
+	bool Request::check_header(KnownHeader header, const string& value) const
 	{
-		auto it = headers.find(header);
-		if (it != headers.end())
-			return it->second;
-		return string();
+		const string* actual_value = headers.find(header);
+		return actual_value != nullptr && alg::icontains(*actual_value, value);
 	}
 
-	bool Request::keep_alive()
+
+	bool Request::check_header(const string& header, const string& value) const
+	{
+		const string* actual_value = headers.find(header);
+		return actual_value != nullptr && alg::icontains(*actual_value, value);
+	}
+
+
+	const string& Request::get_header(KnownHeader header) const
 	{
-		return check_header("Connection", "keep-alive") || http_version == "HTTP/1.1";
+		static const string empty;
+		const string* value = headers.find(header);
+		return value != nullptr ? *value : empty;
+	}
+
+
+	const string& Request::get_header(const string& header) const
+	{
+		static const string empty;
+		const string* value = headers.find(header);
+		return value != nullptr ? *value : empty;
+	}
+
+
+	bool Request::keep_alive() const
+	{
+		if (check_header(KnownHeader::connection, "close"))
+			return false;
+		return check_header(KnownHeader::connection, "keep-alive") || http_version == "HTTP/1.1";
 	}
 
 
@@ -109,12 +160,19 @@ namespace wsgi_boost
 
 	string Request::remote_address()
 	{
-		return m_connection.socket()->remote_endpoint().address().to_string();
+		boost::asio::ip::tcp::endpoint endpoint;
+		// Unix domain socket peers have no address
+		if (!get_ip_endpoint(m_connection.socket()->remote_endpoint(), endpoint))
+			return string();
+		return endpoint.address().to_string();
 	}
 
 
 	unsigned short Request::remote_port()
 	{
-		return m_connection.socket()->remote_endpoint().port();
+		boost::asio::ip::tcp::endpoint endpoint;
+		if (!get_ip_endpoint(m_connection.socket()->remote_endpoint(), endpoint))
+			return 0;
+		return endpoint.port();
 	}
 }
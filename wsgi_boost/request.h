@@ -7,39 +7,19 @@ License: MIT, see License.txt
 */
 
 #include "connection.h"
+#include "header_table.h"
 
 #include <boost/asio.hpp>
-#include <boost/functional/hash.hpp>
-#include <boost/algorithm/string/predicate.hpp>
 #include <boost/regex.hpp>
 
-#include <unordered_map>
-#include <cctype>
 #include <string>
+#include <utility>
+#include <vector>
 
 namespace wsgi_boost
 {
-	// 2 structs below are used for unordered_map with case-insensitive string keys
-
-	struct iequal_to
-	{
-		bool operator()(const std::string &key1, const std::string &key2) const
-		{
-			return boost::algorithm::iequals(key1, key2);
-		}
-	};
-
-
-	struct ihash
-	{
-		size_t operator()(const std::string &key) const
-		{
-			std::size_t seed = 0;
-			for (auto &c : key)
-				boost::hash_combine(seed, std::tolower(c));
-			return seed;
-		}
-	};
+	// Path regexes and content directories of static routes
+	typedef std::vector<std::pair<boost::regex, std::string>> static_routes_type;
 
 
 	// HTTP request parameters
@@ -49,12 +29,13 @@ namespace wsgi_boost
 		std::string method;
 		std::string path;
 		std::string http_version;
-		std::unordered_map<std::string, std::string, ihash, iequal_to> headers;
+		HeaderTable headers;
 		boost::regex path_regex;
 		std::string content_dir;
 		std::string url_scheme;
 		std::string host_name;
 		unsigned short local_endpoint_port;
+		bool multiprocess = false;
 		bool use_gzip;
 
 		Request(const Request&) = delete;
@@ -62,28 +43,44 @@ namespace wsgi_boost
 
 		explicit Request(Connection& connection) : m_connection{ connection } {}
 
-		// Parse HTTP request headers
+		// Clear per-request state before the next request on a persistent connection
+		void reset();
+
+		// Read and parse HTTP request headers
 		boost::system::error_code parse_header();
 
-		// Check if a header contains a specific value
-		bool check_header(const std::string& header, std::string value);
+		// Parse a raw HTTP request header ending with an empty line
+		boost::system::error_code parse_header(const std::string& header);
+
+		// Find the first static route matching the request path
+		// and set path_regex and content_dir
+		bool match_static_route(const static_routes_type& routes);
+
+		// Check if a header contains a specific value (case-insensitive)
+		bool check_header(KnownHeader header, const std::string& value) const;
+
+		bool check_header(const std::string& header, const std::string& value) const;
 
 		// Get header value or "" if the header is missing
-		std::string get_header(const std::string& header);
+		const std::string& get_header(KnownHeader header) const;
+
+		const std::string& get_header(const std::string& header) const;
 
 		// Check if the connection is persistent (keep-alive)
-		bool keep_alive();
+		bool keep_alive() const;
 
 		// Get Connection object for this request
 		Connection& connection() const;
 
-		// Get remote endpoint address
+		// Get remote endpoint address or "" for a Unix domain socket
 		std::string remote_address();
 
-		// Get remote endpoint port
+		// Get remote endpoint port or 0 for a Unix domain socket
 		unsigned short remote_port();
 
 	private:
 		Connection& m_connection;
+		// Raw header buffer is kept between requests to reuse its memory
+		std::string m_header;
 	};
 }
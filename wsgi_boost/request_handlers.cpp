@@ -7,6 +7,7 @@ License: MIT, see License.txt
 
 #include "request_handlers.h"
 
+#include <boost/algorithm/string.hpp>
 #include <boost/iostreams/filtering_stream.hpp>
 #include <boost/iostreams/filter/gzip.hpp>
 #include <boost/iostreams/copy.hpp>
@@ -15,14 +16,98 @@ License: MIT, see License.txt
 #include <iostream>
 #include <sstream>
 
+#ifdef WSGI_BOOST_IO_URING
+#include <fcntl.h>
+#include <unistd.h>
+#endif // WSGI_BOOST_IO_URING
+
 using namespace std;
 namespace py = boost::python;
 namespace fs = boost::filesystem;
 namespace sys = boost::system;
+namespace alg = boost::algorithm;
 
 
 namespace wsgi_boost
 {
+	namespace
+	{
+		// Fill CGI variables and HTTP headers of the request
+		void prepare_request_environ(py::dict& environ, Request& request)
+		{
+			environ["REQUEST_METHOD"] = request.method;
+			environ["SCRIPT_NAME"] = "";
+			pair<string, string> path_and_query = split_path(request.path);
+			environ["PATH_INFO"] = path_and_query.first;
+			environ["QUERY_STRING"] = path_and_query.second;
+			const string& ct = request.get_header(KnownHeader::content_type);
+			if (ct != "")
+			{
+				environ["CONTENT_TYPE"] = ct;
+			}
+			const string& cl = request.get_header(KnownHeader::content_length);
+			if (cl != "")
+			{
+				environ["CONTENT_LENGTH"] = cl;
+			}
+			environ["SERVER_NAME"] = request.host_name;
+			if (request.local_endpoint_port != 0)
+			{
+				environ["SERVER_PORT"] = to_string(request.local_endpoint_port);
+			}
+			else
+			{
+				// A Unix domain socket has no port: use the one the client connected to a front-end proxy
+				const string& host = request.get_header(KnownHeader::host);
+				size_t colon = host.rfind(':');
+				if (colon != string::npos && host.find(']', colon) == string::npos)
+					environ["SERVER_PORT"] = host.substr(colon + 1);
+				else
+					environ["SERVER_PORT"] = request.url_scheme == "https" ? "443" : "80";
+			}
+			environ["SERVER_PROTOCOL"] = request.http_version;
+			for (auto& header : request.headers)
+			{
+				std::string env_header = transform_header(header.name);
+				if (env_header == "HTTP_CONTENT_TYPE" || env_header == "HTTP_CONTENT_LENGTH")
+				{
+					continue;
+				}
+				if (!py::extract<bool>(environ.attr("__contains__")(env_header)))
+				{
+					environ[env_header] = header.value;
+				}
+				else
+				{
+					environ[env_header] = environ[env_header] + "," + header.value;
+				}
+			}
+			environ["REMOTE_ADDR"] = environ["REMOTE_HOST"] = request.remote_address();
+			unsigned short remote_port = request.remote_port();
+			environ["REMOTE_PORT"] = remote_port != 0 ? to_string(remote_port) : string();
+			environ["wsgi.version"] = py::make_tuple<int, int>(1, 0);
+			environ["wsgi.url_scheme"] = request.url_scheme;
+		}
+
+
+		// Write a chunk size line of chunked transfer encoding
+		void append_chunk_size(Connection& connection, size_t size)
+		{
+			const char digits[] = "0123456789abcdef";
+			char line[sizeof(size_t) * 2 + 2];
+			char* end = line + sizeof(line);
+			char* begin = end - 2;
+			begin[0] = '\r';
+			begin[1] = '\n';
+			do
+			{
+				*--begin = digits[size & 0xf];
+				size >>= 4;
+			} while (size > 0);
+			connection.append(begin, end - begin);
+		}
+	}
+
 #pragma region StaticRequestHandler
 
 	void StaticRequestHandler::handle()
@@ -67,7 +152,7 @@ namespace wsgi_boost
 						out_headers.emplace_back("Cache-Control", "max-age=3600");
 						time_t last_modified = fs::last_write_time(path);
 						out_headers.emplace_back("Last-Modified", time_to_header(last_modified));
-						string ims = m_request.get_header("If-Modified-Since");
+						const string& ims = m_request.get_header(KnownHeader::if_modified_since);
 						if (ims != "" && header_to_time(ims) >= last_modified)
 						{
 							out_headers.emplace_back("Content-Length", "0");
@@ -77,7 +162,7 @@ namespace wsgi_boost
 						MimeTypes mime_types;
 						string mime = mime_types[path.extension().string()];
 						out_headers.emplace_back("Content-Type", mime);
-						if (m_request.use_gzip && mime_types.is_compressable(mime) && m_request.check_header("Accept-Encoding", "gzip"))
+						if (m_request.use_gzip && mime_types.is_compressable(mime) && m_request.check_header(KnownHeader::accept_encoding, "gzip"))
 						{
 							boost::iostreams::filtering_istream gzstream;
 							gzstream.push(boost::iostreams::gzip_compressor());
@@ -89,7 +174,7 @@ namespace wsgi_boost
 						}
 						else
 						{
-							send_file(ifs, out_headers);
+							send_file(ifs, out_headers, path.string());
 						}
 						ifs.close();
 						return;
@@ -101,7 +186,7 @@ namespace wsgi_boost
 	}
 
 
-	pair<string, string> StaticRequestHandler::parse_range(std::string& requested_range, size_t& start_pos, size_t& end_pos)
+	pair<string, string> StaticRequestHandler::parse_range(const std::string& requested_range, size_t& start_pos, size_t& end_pos)
 	{
 		string range_start = "0";
 		string range_end = to_string(end_pos);
@@ -122,14 +207,14 @@ namespace wsgi_boost
 	}
 
 
-	void StaticRequestHandler::send_file(istream& content_stream, headers_type& headers)
+	void StaticRequestHandler::send_file(istream& content_stream, headers_type& headers, const string& file_path)
 	{
 		headers.emplace_back("Accept-Ranges", "bytes");
 		content_stream.seekg(0, ios::end);
 		size_t length = content_stream.tellg();
 		size_t start_pos = 0;
 		size_t end_pos = length - 1;
-		string requested_range = m_request.get_header("Range");
+		const string& requested_range = m_request.get_header(KnownHeader::range);
 		if (requested_range != "")
 		{
 			pair<string, string> range = parse_range(requested_range, start_pos, end_pos);
@@ -140,8 +225,10 @@ namespace wsgi_boost
 			}
 			headers.emplace_back("Content-Range", "bytes " + range.first + "-" + range.second + "/" + to_string(length));
 		}
-		headers.emplace_back("Content-Length", to_string(length));
-		m_response.send_header("200 OK", headers);
+		// end_pos is inclusive
+		size_t content_length = length > 0 ? end_pos - start_pos + 1 : 0;
+		headers.emplace_back("Content-Length", to_string(content_length));
+		m_response.send_header(requested_range != "" ? "206 Partial Content" : "200 OK", headers);
 		if (start_pos > 0)
 		{
 			content_stream.seekg(start_pos);
@@ -152,13 +239,25 @@ namespace wsgi_boost
 		}
 		if (m_request.method == "GET")
 		{
+			if (!file_path.empty() && content_length > 0)
+			{
+				// The kernel sends the file without copying it to the user space
+				sys::error_code ec = m_response.send_file(file_path, start_pos, content_length);
+#ifdef WSGI_BOOST_IO_URING
+				// TLS without kTLS and HTTP/2 streams read the file through the ring instead of the thread
+				if (ec == sys::errc::operation_not_supported)
+					ec = send_file_io_uring(file_path, start_pos, content_length);
+#endif // WSGI_BOOST_IO_URING
+				if (ec != sys::errc::operation_not_supported)
+					return;
+			}
 			//read and send 128 KB at a time
 			const size_t buffer_size = 131072;
 			vector<char> buffer(buffer_size);
 			size_t read_length;
-			while (start_pos < end_pos && (read_length = content_stream.read(&buffer[0], min(end_pos - start_pos, buffer_size)).gcount()) > 0)
+			while (length > 0 && start_pos <= end_pos && (read_length = content_stream.read(&buffer[0], min(end_pos - start_pos + 1, buffer_size)).gcount()) > 0)
 			{
-				sys::error_code ec = m_response.send_data(string(&buffer[0], read_length));
+				sys::error_code ec = m_response.send_data(&buffer[0], read_length);
 				if (ec)
 					return;
 				start_pos += read_length;
@@ -166,6 +265,41 @@ namespace wsgi_boost
 		}
 	}
 
+#ifdef WSGI_BOOST_IO_URING
+
+	sys::error_code StaticRequestHandler::send_file_io_uring(const string& file_path, size_t offset, size_t length)
+	{
+		sys::error_code ec{ sys::errc::operation_not_supported, sys::system_category() };
+		Connection& connection = m_request.connection();
+		if (connection.io_uring() == nullptr)
+			return ec;
+		IoUringBuffer buffer{ *connection.io_uring() };
+		if (!buffer)
+			return ec;
+		int fd = ::open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			return ec;
+		ec.clear();
+		while (length > 0)
+		{
+			size_t read_length = buffer.read_file(fd, offset, min(length, buffer.size()), connection.yield_context(), ec);
+			// The file has been truncated
+			if (!ec && read_length == 0)
+				ec = boost::asio::error::eof;
+			if (ec)
+				break;
+			ec = m_response.send_data(buffer.data(), read_length);
+			if (ec)
+				break;
+			offset += read_length;
+			length -= read_length;
+		}
+		::close(fd);
+		return ec;
+	}
+
+#endif // WSGI_BOOST_IO_URING
+
 #pragma endregion
 
 #pragma region WsgiRequestHandler
@@ -176,12 +310,13 @@ namespace wsgi_boost
 		function<void(py::object)> wr{
 			[this](py::object data)
 			{
+				string cpp_data = py::extract<string>(data);
+				cache_data(cpp_data);
 				sys::error_code ec = m_response.send_header(m_status, m_out_headers);
 				if (ec)
 					return;
 				m_headers_sent = true;
-				string cpp_data = py::extract<string>(data);
-				GilRelease release_gil;
+				GilRelease release_gil{ GilSite::write };
 				m_response.send_data(cpp_data);
 			}
 		};
@@ -198,7 +333,9 @@ namespace wsgi_boost
 				}
 				this->m_status = py::extract<string>(status);
 				m_out_headers.clear();
-				for (size_t i = 0; i < py::len(headers); ++i)
+				size_t headers_count = py::len(headers);
+				m_out_headers.reserve(headers_count);
+				for (size_t i = 0; i < headers_count; ++i)
 				{
 					py::object header = headers[i];
 					m_out_headers.emplace_back(py::extract<string>(header[0]), py::extract<string>(header[1]));
@@ -220,7 +357,7 @@ namespace wsgi_boost
 			return;
 		}
 		prepare_environ();
-		if (m_request.check_header("Expect", "100-continue"))
+		if (m_request.check_header(KnownHeader::expect, "100-continue"))
 		{
 			m_response.send_mesage("100 Continue");
 		}
@@ -232,49 +369,12 @@ namespace wsgi_boost
 
 	void WsgiRequestHandler::prepare_environ()
 	{
-		m_environ["REQUEST_METHOD"] = m_request.method;
-		m_environ["SCRIPT_NAME"] = "";
-		pair<string, string> path_and_query = split_path(m_request.path);
-		m_environ["PATH_INFO"] = path_and_query.first;
-		m_environ["QUERY_STRING"] = path_and_query.second;
-		string ct = m_request.get_header("Content-Type");
-		if (ct != "")
-		{
-			m_environ["CONTENT_TYPE"] = ct;
-		}
-		string cl = m_request.get_header("Content-Length");
-		if (cl != "")
-		{
-			m_environ["CONTENT_LENGTH"] = cl;
-		}
-		m_environ["SERVER_NAME"] = m_request.host_name;
-		m_environ["SERVER_PORT"] = to_string(m_request.local_endpoint_port);
-		m_environ["SERVER_PROTOCOL"] = m_request.http_version;
-		for (auto& header : m_request.headers)
-		{
-			std::string env_header = transform_header(header.first);
-			if (env_header == "HTTP_CONTENT_TYPE" || env_header == "HTTP_CONTENT_LENGTH")
-			{
-				continue;
-			}
-			if (!py::extract<bool>(m_environ.attr("__contains__")(env_header)))
-			{
-				m_environ[env_header] = header.second;
-			}
-			else
-			{
-				m_environ[env_header] = m_environ[env_header] + "," + header.second;
-			}
-		}
-		m_environ["REMOTE_ADDR"] = m_environ["REMOTE_HOST"] = m_request.remote_address();
-		m_environ["REMOTE_PORT"] = to_string(m_request.remote_port());
-		m_environ["wsgi.version"] = py::make_tuple<int, int>(1, 0);
-		m_environ["wsgi.url_scheme"] = m_request.url_scheme;
+		prepare_request_environ(m_environ, m_request);
 		InputWrapper input{ m_request.connection() };
 		m_environ["wsgi.input"] = input; 
 		m_environ["wsgi.errors"] = py::import("sys").attr("stderr");
 		m_environ["wsgi.multithread"] = true;
-		m_environ["wsgi.multiprocess"] = false;
+		m_environ["wsgi.multiprocess"] = m_request.multiprocess;
 		m_environ["wsgi.run_once"] = false;
 		m_environ["wsgi.file_wrapper"] = py::import("wsgiref.util").attr("FileWrapper");
 	}
@@ -291,7 +391,8 @@ namespace wsgi_boost
 #else
 				std::string chunk = py::extract<string>(iterator.attr("__next__")());
 #endif
-				GilRelease release_gil;
+				cache_data(chunk);
+				GilRelease release_gil{ GilSite::send_iterable };
 				sys::error_code ec;
 				if (!m_headers_sent)
 				{
@@ -309,11 +410,315 @@ namespace wsgi_boost
 				if (PyErr_ExceptionMatches(PyExc_StopIteration))
 				{
 					PyErr_Clear();
+					if (m_cached != nullptr)
+					{
+						m_cached->status = m_status;
+						m_cached->headers = m_out_headers;
+						m_cached->complete = true;
+					}
 					break;
 				}
 				throw;
 			}
 		}
 	}
+
+
+	void WsgiRequestHandler::cache_response(CachedResponse* cached, size_t limit)
+	{
+		m_cached = cached;
+		m_cache_limit = limit;
+	}
+
+
+	void WsgiRequestHandler::cache_data(const string& data)
+	{
+		if (m_cached == nullptr)
+			return;
+		// A response that is too large is not cached
+		if (m_cached->body.length() + data.length() > m_cache_limit)
+		{
+			m_cached->body.clear();
+			m_cached = nullptr;
+			return;
+		}
+		m_cached->body += data;
+	}
+
+#pragma endregion
+
+#pragma region AsgiRequestHandler
+
+	void AsgiRequestHandler::handle()
+	{
+		if (!m_loop.is_running())
+		{
+			m_response.send_mesage("500 Internal Server Error", "Error 500: Internal server error! ASGI application is not set.");
+			return;
+		}
+		Connection& connection = m_request.connection();
+		auto call = make_shared<AsgiCall>();
+		prepare_scope(call->scope);
+		bool content_read = !call->scope.has_content;
+		bool expect_continue = !content_read && m_request.http_version == "HTTP/1.1" &&
+			m_request.check_header(KnownHeader::expect, "100-continue");
+		// receive() calls after all content has been read wait for the end of the response
+		size_t waiting_receives = 0;
+		bool finished = false;
+		bool app_error = false;
+		vector<AsgiCommand> commands;
+		vector<AsgiReceived> received;
+		m_loop.submit(call);
+		while (!finished)
+		{
+			call->wait(commands, m_io_service, connection.yield_context());
+			size_t sent = 0;
+			bool flush = false;
+			received.clear();
+			// Messages sent by the app while the coroutine has been waiting are written with a single flush
+			for (auto& command : commands)
+			{
+				switch (command.type)
+				{
+				case AsgiCommand::Type::start_response:
+					if (!m_response_started)
+					{
+						m_status = move(command.status);
+						m_out_headers = move(command.headers);
+						m_response_started = true;
+					}
+					break;
+				case AsgiCommand::Type::body:
+					++sent;
+					flush = write_body(command) || flush;
+					break;
+				case AsgiCommand::Type::receive:
+					if (content_read || m_closed)
+					{
+						++waiting_receives;
+					}
+					else
+					{
+						if (expect_continue && !m_headers_sent)
+						{
+							connection.append(byte_string("HTTP/1.1 100 Continue\r\n\r\n"));
+							flush = true;
+						}
+						expect_continue = false;
+						if (flush && connection.flush())
+							m_closed = true;
+						flush = false;
+						AsgiReceived item;
+						if (m_closed || connection.read_content(item.body, 65536))
+						{
+							m_closed = true;
+							item.disconnect = true;
+						}
+						else
+						{
+							item.more_body = connection.content_left() > 0;
+							content_read = !item.more_body;
+						}
+						received.push_back(move(item));
+					}
+					break;
+				case AsgiCommand::Type::finish:
+					finished = true;
+					app_error = command.error;
+					break;
+				}
+			}
+			if (flush && !m_closed && connection.flush())
+				m_closed = true;
+			if (waiting_receives > 0 && (m_response_finished || m_closed))
+			{
+				AsgiReceived disconnect;
+				disconnect.disconnect = true;
+				received.insert(received.end(), waiting_receives, disconnect);
+				waiting_receives = 0;
+			}
+			if (!finished && (sent > 0 || !received.empty()))
+			{
+				{
+					lock_guard<mutex> lock{ call->mutex };
+					call->sent += sent;
+					for (auto& item : received)
+						call->received.push_back(move(item));
+				}
+				m_loop.submit(call);
+			}
+		}
+		if (m_closed)
+		{
+			m_response.keep_alive = false;
+		}
+		else if (!m_headers_sent)
+		{
+			m_response.send_mesage("500 Internal Server Error", app_error ?
+				"Error 500: ASGI application error!" : "Error 500: ASGI application has not sent a response!");
+		}
+		else if (!m_response_finished)
+		{
+			// The client cannot tell a truncated response from a complete one
+			m_response.keep_alive = false;
+		}
+	}
+
+
+	void AsgiRequestHandler::prepare_scope(AsgiScope& scope)
+	{
+		scope.http_version = m_request.http_version;
+		scope.method = m_request.method;
+		scope.scheme = m_request.url_scheme;
+		scope.path = m_request.path;
+		scope.headers.reserve(m_request.headers.size());
+		for (const auto& header : m_request.headers)
+			scope.headers.emplace_back(alg::to_lower_copy(header.name), header.value);
+		scope.client_address = m_request.remote_address();
+		scope.client_port = m_request.remote_port();
+		scope.server_name = m_request.host_name;
+		scope.server_port = m_request.local_endpoint_port;
+		scope.has_content = m_request.connection().content_left() > 0;
+	}
+
+
+	bool AsgiRequestHandler::write_body(AsgiCommand& command)
+	{
+		if (!m_response_started || m_response_finished || m_closed)
+			return false;
+		Connection& connection = m_request.connection();
+		bool send_body = m_request.method != "HEAD";
+		if (!m_headers_sent)
+		{
+			unsigned long status_code = strtoul(m_status.c_str(), nullptr, 10);
+			bool has_length = false;
+			for (const auto& header : m_out_headers)
+			{
+				if (alg::iequals(header.first, "Content-Length"))
+					has_length = true;
+			}
+			if (!has_length && status_code >= 200 && status_code != 204 && status_code != 304)
+			{
+				if (!command.more_body)
+				{
+					m_out_headers.emplace_back("Content-Length", to_string(command.body.length()));
+				}
+				else if (m_request.http_version == "HTTP/1.1")
+				{
+					m_out_headers.emplace_back("Transfer-Encoding", "chunked");
+					m_chunked = true;
+				}
+				else if (m_request.http_version != "HTTP/2.0")
+				{
+					// The end of the response is marked by closing the connection
+					m_response.keep_alive = false;
+				}
+			}
+			m_response.write_header(m_status, m_out_headers);
+			m_headers_sent = true;
+		}
+		if (send_body && !command.body.empty())
+		{
+			if (m_chunked)
+			{
+				append_chunk_size(connection, command.body.length());
+				connection.append(command.body);
+				connection.append("\r\n", 2);
+			}
+			else
+			{
+				connection.append(command.body);
+			}
+		}
+		if (!command.more_body)
+		{
+			if (m_chunked && send_body)
+				connection.append(byte_string("0\r\n\r\n"));
+			m_response_finished = true;
+		}
+		return true;
+	}
+
+#pragma endregion
+
+#pragma region CachedRequestHandler
+
+	void CachedRequestHandler::handle()
+	{
+		headers_type headers = m_cached->headers;
+		auto age = chrono::duration_cast<chrono::seconds>(chrono::steady_clock::now() - m_cached->stored).count();
+		headers.emplace_back("Age", to_string(age));
+		headers.emplace_back("Content-Length", to_string(m_cached->body.length()));
+		sys::error_code ec = m_response.send_header(m_cached->status, headers);
+		if (!ec && m_request.method != "HEAD" && !m_cached->body.empty())
+			m_response.send_data(m_cached->body);
+	}
+
+#pragma endregion
+
+#pragma region WebSocketRequestHandler
+
+	void WebSocketRequestHandler::handle()
+	{
+		Connection& connection = m_request.connection();
+		if (m_request.get_header("Sec-WebSocket-Version") != "13")
+		{
+			headers_type headers;
+			headers.emplace_back("Sec-WebSocket-Version", "13");
+			headers.emplace_back("Content-Length", "0");
+			m_response.send_header("426 Upgrade Required", headers);
+			return;
+		}
+		connection.append(byte_string("HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: "));
+		connection.append(WebSocketSession::accept_key(m_request.get_header("Sec-WebSocket-Key")));
+		connection.append("\r\n\r\n", 4);
+		m_response.status_code = 101;
+		m_response.keep_alive = false;
+		if (connection.flush())
+			return;
+		// Python objects are created and destroyed only with the GIL acquired
+		unique_ptr<py::object> websocket;
+		{
+			GilAcquire acquire_gil{ GilSite::websocket };
+			WebSocketWrapper wrapper{ m_session };
+			prepare_request_environ(wrapper.environ, m_request);
+			websocket.reset(new py::object(wrapper));
+			dispatch("on_open", py::make_tuple(*websocket));
+		}
+		m_session->run(connection, [this, &websocket](string& message, bool binary)
+		{
+			GilAcquire acquire_gil{ GilSite::websocket };
+			PyObject* data = binary ? PyBytes_FromStringAndSize(message.data(), message.length()) :
+				PyUnicode_DecodeUTF8(message.data(), message.length(), "strict");
+			if (data == nullptr)
+			{
+				PyErr_Print();
+				return;
+			}
+			dispatch("on_message", py::make_tuple(*websocket, get_python_object(data)));
+		});
+		GilAcquire acquire_gil{ GilSite::websocket };
+		dispatch("on_close", py::make_tuple(*websocket, m_session->close_code(), m_session->close_reason()));
+		websocket.reset();
+	}
+
+
+	void WebSocketRequestHandler::dispatch(const char* name, const py::tuple& args)
+	{
+		if (!PyObject_HasAttrString(m_handler.ptr(), name))
+			return;
+		try
+		{
+			py::object method = m_handler.attr(name);
+			get_python_object(PyObject_CallObject(method.ptr(), args.ptr()));
+		}
+		catch (const py::error_already_set&)
+		{
+			PyErr_Print();
+			GilRelease release_gil{ GilSite::websocket_send };
+			m_session->close(static_cast<unsigned short>(WebSocketStatus::internal_error));
+		}
+	}
+
 #pragma endregion
 }
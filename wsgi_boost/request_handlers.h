@@ -6,9 +6,12 @@ Copyright (c) 2016 Roman Miroshnychenko <romanvm@yandex.ua>
 License: MIT, see License.txt
 */
 
+#include "asgi.h"
 #include "request.h"
 #include "response.h"
+#include "response_cache.h"
 #include "utils.h"
+#include "websocket.h"
 
 #include <boost/filesystem.hpp>
 
@@ -46,8 +49,13 @@ namespace wsgi_boost
 
 	private:
 		void open_file(const boost::filesystem::path& content_dir_path);
-		void send_file(std::istream& content_stream, headers_type& headers);
-		std::pair<std::string, std::string> parse_range(std::string& requested_range, size_t& start_pos, size_t& end_pos);
+		// file_path is empty if the content is not read from the file directly
+		void send_file(std::istream& content_stream, headers_type& headers, const std::string& file_path = std::string());
+#ifdef WSGI_BOOST_IO_URING
+		// Returns operation_not_supported before sending anything if the ring cannot be used
+		boost::system::error_code send_file_io_uring(const std::string& file_path, size_t offset, size_t length);
+#endif // WSGI_BOOST_IO_URING
+		std::pair<std::string, std::string> parse_range(const std::string& requested_range, size_t& start_pos, size_t& end_pos);
 	};
 
 	// Handles WSGI requests
@@ -62,13 +70,82 @@ namespace wsgi_boost
 		boost::python::object m_write;
 		boost::python::object m_start_response;
 
+		CachedResponse* m_cached = nullptr;
+		size_t m_cache_limit = 0;
+
 		void prepare_environ();
 		void send_iterable(Iterator& iterable);
+		void cache_data(const std::string& data);
 
 	public:
 		WsgiRequestHandler(Request& request, Response& response, boost::python::object& app);
 
+		// Copy the response into the cache entry up to the body size limit
+		void cache_response(CachedResponse* cached, size_t limit);
+
 		// Handle request
 		void handle();
 	};
+
+	// Serves a request with an ASGI app running on the event loop thread.
+	// The coroutine does not acquire the GIL: it waits for messages from the app, writes the response
+	// and reads request content without blocking the thread.
+	class AsgiRequestHandler : public BaseRequestHandler
+	{
+	private:
+		AsgiLoop& m_loop;
+		boost::asio::io_service& m_io_service;
+		std::string m_status;
+		headers_type m_out_headers;
+		bool m_response_started = false;
+		bool m_headers_sent = false;
+		bool m_chunked = false;
+		bool m_response_finished = false;
+		bool m_closed = false;
+
+		void prepare_scope(AsgiScope& scope);
+		// Format a body message into the output buffer, true if there is data to send
+		bool write_body(AsgiCommand& command);
+
+	public:
+		AsgiRequestHandler(Request& request, Response& response, AsgiLoop& loop, boost::asio::io_service& io_service) :
+			BaseRequestHandler(request, response), m_loop{ loop }, m_io_service{ io_service } {}
+
+		// Handle request
+		void handle();
+	};
+
+	// Handles requests with cached WSGI responses without calling the app
+	class CachedRequestHandler : public BaseRequestHandler
+	{
+	private:
+		std::shared_ptr<const CachedResponse> m_cached;
+
+	public:
+		CachedRequestHandler(Request& request, Response& response, std::shared_ptr<const CachedResponse> cached) :
+			BaseRequestHandler(request, response), m_cached{ cached } {}
+
+		// Handle request
+		void handle();
+	};
+
+	// Completes WebSocket handshake and passes connection events to a Python handler.
+	// The GIL is acquired only for calling on_open(), on_message() and on_close() methods of the handler.
+	class WebSocketRequestHandler : public BaseRequestHandler
+	{
+	private:
+		boost::python::object& m_handler;
+		std::shared_ptr<WebSocketSession> m_session;
+
+		// Call a handler method if it exists, the connection is closed if it raises an exception
+		void dispatch(const char* name, const boost::python::tuple& args);
+
+	public:
+		WebSocketRequestHandler(Request& request, Response& response, boost::python::object& handler,
+			std::shared_ptr<WebSocketSession> session) :
+			BaseRequestHandler(request, response), m_handler{ handler }, m_session{ session } {}
+
+		// Handle the connection until it is closed
+		void handle();
+	};
 }
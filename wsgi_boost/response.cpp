@@ -1,40 +1,70 @@
 #include "response.h"
 
+#include <cstdlib>
+
 using namespace std;
 namespace sys = boost::system;
 
 
 namespace wsgi_boost
 {
-	sys::error_code Response::send_header(const string& status, headers_type& headers)
+	PrebuiltResponse::PrebuiltResponse(string response_status, headers_type response_headers, string response_body) :
+		status{ response_status }, headers{ response_headers }, body{ response_body }
 	{
-		m_connection << http_version << " " << status << "\r\n";
-		headers.emplace_back("Server", m_server_name);
-		headers.emplace_back("Date", get_current_gmt_time());
-		if (keep_alive)
-		{
-			headers.emplace_back("Connection", "keep-alive");
-		}
-		else
-		{
-			headers.emplace_back("Connection", "close");
-		}
+		status_code = static_cast<unsigned int>(strtoul(status.c_str(), nullptr, 10));
+		headers.emplace_back("Content-Length", to_string(body.length()));
 		for (const auto& header : headers)
 		{
-			m_connection << header.first << ": " << header.second << "\r\n";
+			header_lines += header.first;
+			header_lines += ": ";
+			header_lines += header.second;
+			header_lines += "\r\n";
 		}
-		m_connection << "\r\n";
+	}
+
+
+	bool Response::can_keep_alive()
+	{
+		if (closing != nullptr && closing->load())
+			keep_alive = false;
+		return keep_alive;
+	}
+
+
+	void Response::write_header(const string& status, const headers_type& headers)
+	{
+		status_code = static_cast<unsigned int>(strtoul(status.c_str(), nullptr, 10));
+		m_connection.write_header(http_version, status, headers, can_keep_alive());
+	}
+
+
+	sys::error_code Response::send_header(const string& status, const headers_type& headers)
+	{
+		write_header(status, headers);
 		return m_connection.flush();
 	}
 
 
 	sys::error_code Response::send_data(const string& data)
 	{
-		m_connection << data;
+		m_connection.append(data);
+		return m_connection.flush();
+	}
+
+
+	sys::error_code Response::send_data(const char* data, size_t length)
+	{
+		m_connection.append(data, length);
 		return m_connection.flush();
 	}
 
 
+	sys::error_code Response::send_file(const string& path, long long offset, size_t length)
+	{
+		return m_connection.send_file(path, offset, length);
+	}
+
+
 	sys::error_code Response::send_mesage(const string& status, const string& message)
 	{
 		headers_type headers;
@@ -48,4 +78,14 @@ namespace wsgi_boost
 			ec = send_data(message);
 		return ec;
 	}
+
+
+	sys::error_code Response::send_prebuilt(const PrebuiltResponse& prebuilt, bool send_body)
+	{
+		status_code = prebuilt.status_code;
+		m_connection.write_prebuilt_header(http_version, prebuilt, can_keep_alive());
+		if (send_body)
+			m_connection.append(prebuilt.body);
+		return m_connection.flush();
+	}
 }
@@ -8,37 +8,70 @@ License: MIT, see License.txt
 
 #include "connection.h"
 #include "utils.h"
-#include "version.h"
 
 #include <boost/system/error_code.hpp>
 
+#include <atomic>
 #include <vector>
 #include <string>
 
 
 namespace wsgi_boost
 {
-	typedef std::vector<std::pair<std::string, std::string>> headers_type;
+	// A response whose headers are formatted once and sent as is with every request
+	struct PrebuiltResponse
+	{
+		std::string status;
+		unsigned int status_code;
+		// Headers with Content-Length for connections that encode them separately
+		headers_type headers;
+		// The same headers formatted as HTTP/1.x header lines
+		std::string header_lines;
+		std::string body;
+
+		PrebuiltResponse(const PrebuiltResponse&) = delete;
+		PrebuiltResponse& operator=(const PrebuiltResponse&) = delete;
+
+		PrebuiltResponse(std::string response_status, headers_type response_headers, std::string response_body);
+	};
+
 
 	class Response
 	{
 	private:
-		const std::string m_server_name = "WsgiBoost v." WSGI_BOOST_VERSION;
 		Connection& m_connection;
 
+		// Check if the connection can be kept open after the response
+		bool can_keep_alive();
+
 	public:
 		std::string http_version = "HTTP/1.1";
-		bool keep_alive;
+		bool keep_alive = false;
+		// If set, the connection is closed after the response while the server is stopping
+		const std::atomic_bool* closing = nullptr;
+		// Status code of the last sent header, 0 if the header has not been sent
+		unsigned int status_code = 0;
 
 		Response(const Response&) = delete;
 		Response& operator=(const Response&) = delete;
 
 		explicit Response(Connection& connection) : m_connection{ connection } {}
 
-		boost::system::error_code send_header(const std::string& status, headers_type& headers);
+		// Format a response header with the server headers into the output buffer without sending it
+		void write_header(const std::string& status, const headers_type& headers);
+
+		boost::system::error_code send_header(const std::string& status, const headers_type& headers);
 
 		boost::system::error_code send_data(const std::string& data);
 
+		boost::system::error_code send_data(const char* data, size_t length);
+
+		// Send a region of a file with sendfile(), operation_not_supported if the connection does not allow it
+		boost::system::error_code send_file(const std::string& path, long long offset, size_t length);
+
 		boost::system::error_code send_mesage(const std::string& status, const std::string& message = std::string());
+
+		// Send a prebuilt response with a single write, without the body for HEAD requests
+		boost::system::error_code send_prebuilt(const PrebuiltResponse& prebuilt, bool send_body = true);
 	};
 }
@@ -0,0 +1,331 @@
+/*
+In-process cache of WSGI responses with collapsing of concurrent misses
+
+Copyright (c) 2016 Roman Miroshnychenko <romanvm@yandex.ua>
+License: MIT, see License.txt
+*/
+
+#include "response_cache.h"
+
+#include <boost/algorithm/string.hpp>
+
+#include <cstdlib>
+
+using namespace std;
+namespace asio = boost::asio;
+namespace sys = boost::system;
+namespace alg = boost::algorithm;
+
+
+namespace wsgi_boost
+{
+	namespace
+	{
+		// A coroutine waiting for a cache fill, resumed once either by the fill or by the timeout
+		template <typename Handler>
+		struct CacheWaiter : public enable_shared_from_this<CacheWaiter<Handler>>
+		{
+			mutex waiter_mutex;
+			bool done = false;
+			asio::io_service& io_service;
+			asio::deadline_timer timer;
+			Handler handler;
+
+			CacheWaiter(asio::io_service& service, Handler&& completion_handler) :
+				io_service(service), timer{ service }, handler(move(completion_handler)) {}
+
+			void complete()
+			{
+				lock_guard<mutex> lock{ waiter_mutex };
+				if (done)
+					return;
+				done = true;
+				sys::error_code ec;
+				timer.cancel(ec);
+				// The coroutine is resumed through its own strand
+				auto self = this->shared_from_this();
+				asio::post(asio::get_associated_executor(handler, io_service.get_executor()), [self]()
+				{
+					self->handler(sys::error_code());
+				});
+			}
+		};
+
+
+		// Get the freshness lifetime of a response in seconds, 0 if it must not be cached
+		long long cache_lifetime(const CachedResponse& response, vector<string>& vary)
+		{
+			switch (strtoul(response.status.c_str(), nullptr, 10))
+			{
+			// Cacheable by default according to RFC 7231
+			case 200: case 203: case 204: case 300: case 301: case 404: case 405: case 410: case 414: case 501:
+				break;
+			default:
+				return 0;
+			}
+			long long max_age = -1;
+			long long s_maxage = -1;
+			for (const auto& header : response.headers)
+			{
+				if (alg::iequals(header.first, "Set-Cookie"))
+					return 0;
+				vector<string> values;
+				if (alg::iequals(header.first, "Cache-Control"))
+				{
+					alg::split(values, header.second, alg::is_any_of(","));
+					for (auto& directive : values)
+					{
+						alg::trim(directive);
+						alg::to_lower(directive);
+						if (directive == "no-store" || directive == "no-cache" || directive == "private" ||
+							directive.compare(0, 8, "private=") == 0 || directive.compare(0, 9, "no-cache=") == 0)
+							return 0;
+						if (directive.compare(0, 9, "s-maxage=") == 0)
+							s_maxage = atoll(directive.c_str() + 9);
+						else if (directive.compare(0, 8, "max-age=") == 0)
+							max_age = atoll(directive.c_str() + 8);
+					}
+				}
+				else if (alg::iequals(header.first, "Vary"))
+				{
+					alg::split(values, header.second, alg::is_any_of(","));
+					for (auto& name : values)
+					{
+						alg::trim(name);
+						alg::to_lower(name);
+						if (name == "*")
+							return 0;
+						if (!name.empty())
+							vary.push_back(name);
+					}
+				}
+			}
+			// s-maxage is meant for shared caches and overrides max-age
+			return s_maxage >= 0 ? s_maxage : max(max_age, 0LL);
+		}
+
+
+		// Connection-specific and server headers are added to every response
+		bool is_stored_header(const string& name)
+		{
+			return !(alg::iequals(name, "Content-Length") || alg::iequals(name, "Connection") ||
+				alg::iequals(name, "Keep-Alive") || alg::iequals(name, "Transfer-Encoding") ||
+				alg::iequals(name, "Date") || alg::iequals(name, "Server") || alg::iequals(name, "Age"));
+		}
+
+
+		string base_key(const Request& request)
+		{
+			string key = "GET\n";
+			key += request.get_header(KnownHeader::host);
+			key += '\n';
+			key += request.path;
+			return key;
+		}
+	}
+
+
+	void ResponseCache::configure(size_t max_size, size_t max_entry_size)
+	{
+		lock_guard<mutex> lock{ m_mutex };
+		m_max_size = max_size;
+		m_max_entry_size = max_entry_size;
+		while (m_size > m_max_size && !m_lru.empty())
+			erase(m_entries.find(m_lru.back()));
+	}
+
+
+	bool ResponseCache::enabled() const
+	{
+		return m_max_size > 0;
+	}
+
+
+	size_t ResponseCache::max_entry_size() const
+	{
+		return m_max_entry_size;
+	}
+
+
+	string ResponseCache::variant_key(const string& base_key, const vector<string>& vary, const Request& request) const
+	{
+		string key = base_key;
+		for (const auto& name : vary)
+		{
+			key += '\n';
+			key += request.get_header(name);
+		}
+		return key;
+	}
+
+
+	void ResponseCache::erase(unordered_map<string, Entry>::iterator it)
+	{
+		auto variants = m_variants.find(it->second.base_key);
+		if (variants != m_variants.end() && --variants->second.count == 0)
+			m_variants.erase(variants);
+		m_size -= it->second.size;
+		m_lru.erase(it->second.lru);
+		m_entries.erase(it);
+	}
+
+
+	CacheLookup ResponseCache::lookup(const Request& request, bool may_wait)
+	{
+		CacheLookup result;
+		// Requests with credentials may get personalized responses
+		if ((request.method != "GET" && request.method != "HEAD") || request.headers.find("authorization") != nullptr)
+			return result;
+		string base = base_key(request);
+		lock_guard<mutex> lock{ m_mutex };
+		auto variants = m_variants.find(base);
+		string key = variants != m_variants.end() ? variant_key(base, variants->second.vary, request) : base;
+		auto it = m_entries.find(key);
+		if (it != m_entries.end())
+		{
+			if (it->second.response->expires > chrono::steady_clock::now())
+			{
+				m_lru.splice(m_lru.begin(), m_lru, it->second.lru);
+				++m_stats.hits;
+				result.response = it->second.response;
+				return result;
+			}
+			erase(it);
+		}
+		// HEAD responses are not stored, so HEAD requests do not fill the cache
+		if (request.method != "GET")
+			return result;
+		auto pending = m_pending.find(key);
+		if (pending != m_pending.end())
+		{
+			if (may_wait)
+			{
+				++m_stats.collapsed;
+				result.pending = pending->second;
+			}
+			return result;
+		}
+		++m_stats.misses;
+		result.fill = make_shared<CacheFill>();
+		result.fill->key = key;
+		m_pending.emplace(key, result.fill);
+		return result;
+	}
+
+
+	void ResponseCache::finish(const shared_ptr<CacheFill>& fill, const Request& request)
+	{
+		vector<string> vary;
+		long long lifetime = fill->response.complete ? cache_lifetime(fill->response, vary) : 0;
+		shared_ptr<CachedResponse> response;
+		string base;
+		if (lifetime > 0)
+		{
+			response = make_shared<CachedResponse>();
+			response->status = fill->response.status;
+			for (auto& header : fill->response.headers)
+			{
+				if (is_stored_header(header.first))
+					response->headers.emplace_back(move(header.first), move(header.second));
+			}
+			response->body = move(fill->response.body);
+			response->complete = true;
+			response->stored = chrono::steady_clock::now();
+			response->expires = response->stored + chrono::seconds(lifetime);
+			base = base_key(request);
+		}
+		vector<function<void()>> waiters;
+		{
+			lock_guard<mutex> lock{ m_mutex };
+			auto pending = m_pending.find(fill->key);
+			if (pending != m_pending.end() && pending->second == fill)
+				m_pending.erase(pending);
+			waiters.swap(fill->waiters);
+			if (response)
+			{
+				string key = variant_key(base, vary, request);
+				size_t size = response->status.length() + response->body.length() + key.length() * 2 + 256;
+				for (const auto& header : response->headers)
+					size += header.first.length() + header.second.length() + 64;
+				if (size <= m_max_entry_size && size <= m_max_size)
+				{
+					auto it = m_entries.find(key);
+					if (it != m_entries.end())
+						erase(it);
+					Variants& variants = m_variants[base];
+					// The latest response defines which request headers select variants
+					variants.vary = vary;
+					++variants.count;
+					m_lru.push_front(key);
+					Entry entry;
+					entry.response = response;
+					entry.base_key = base;
+					entry.path = request.path;
+					entry.size = size;
+					entry.lru = m_lru.begin();
+					m_entries.emplace(key, move(entry));
+					m_size += size;
+					while (m_size > m_max_size)
+						erase(m_entries.find(m_lru.back()));
+				}
+			}
+		}
+		for (auto& waiter : waiters)
+			waiter();
+	}
+
+
+	void ResponseCache::wait(const shared_ptr<CacheFill>& fill, asio::io_service& io_service, unsigned int timeout, asio::yield_context yc)
+	{
+		typedef asio::async_completion<asio::yield_context, void(sys::error_code)> completion_type;
+		completion_type completion{ yc };
+		typedef CacheWaiter<completion_type::completion_handler_type> waiter_type;
+		auto waiter = make_shared<waiter_type>(io_service, move(completion.completion_handler));
+		waiter->timer.expires_from_now(boost::posix_time::milliseconds(timeout));
+		waiter->timer.async_wait([waiter](const sys::error_code&) { waiter->complete(); });
+		bool finished;
+		{
+			lock_guard<mutex> lock{ m_mutex };
+			auto pending = m_pending.find(fill->key);
+			finished = pending == m_pending.end() || pending->second != fill;
+			if (!finished)
+				fill->waiters.push_back([waiter]() { waiter->complete(); });
+		}
+		if (finished)
+			waiter->complete();
+		completion.result.get();
+	}
+
+
+	size_t ResponseCache::purge(const string& path)
+	{
+		lock_guard<mutex> lock{ m_mutex };
+		bool is_prefix = !path.empty() && path.back() == '*';
+		string prefix = is_prefix ? path.substr(0, path.length() - 1) : path;
+		size_t purged = 0;
+		for (auto it = m_entries.begin(); it != m_entries.end();)
+		{
+			const string& entry_path = it->second.path;
+			if (path.empty() || (is_prefix ? entry_path.compare(0, prefix.length(), prefix) == 0 : entry_path == path))
+			{
+				erase(it++);
+				++purged;
+			}
+			else
+			{
+				++it;
+			}
+		}
+		return purged;
+	}
+
+
+	CacheStats ResponseCache::stats()
+	{
+		lock_guard<mutex> lock{ m_mutex };
+		CacheStats stats = m_stats;
+		stats.entries = m_entries.size();
+		stats.size = m_size;
+		return stats;
+	}
+}
@@ -0,0 +1,160 @@
+#pragma once
+/*
+In-process cache of WSGI responses with collapsing of concurrent misses
+
+Copyright (c) 2016 Roman Miroshnychenko <romanvm@yandex.ua>
+License: MIT, see License.txt
+*/
+
+#include "request.h"
+
+#include <boost/asio.hpp>
+#include <boost/asio/spawn.hpp>
+
+#include <chrono>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+namespace wsgi_boost
+{
+	// A response of a WSGI app
+	struct CachedResponse
+	{
+		std::string status;
+		headers_type headers;
+		std::string body;
+		// Set when the app has returned the whole response within the size limit
+		bool complete = false;
+		std::chrono::steady_clock::time_point stored;
+		std::chrono::steady_clock::time_point expires;
+	};
+
+
+	// A cache miss that is being served by the app. Concurrent requests
+	// for the same key wait for it instead of calling the app.
+	struct CacheFill
+	{
+		std::string key;
+		CachedResponse response;
+		std::vector<std::function<void()>> waiters;
+	};
+
+
+	// The result of a cache lookup
+	struct CacheLookup
+	{
+		// A fresh cached response
+		std::shared_ptr<const CachedResponse> response;
+		// The caller calls the app and passes its response to ResponseCache::finish()
+		std::shared_ptr<CacheFill> fill;
+		// Another request is calling the app for the same key
+		std::shared_ptr<CacheFill> pending;
+	};
+
+
+	struct CacheStats
+	{
+		size_t entries = 0;
+		size_t size = 0;
+		unsigned long long hits = 0;
+		unsigned long long misses = 0;
+		unsigned long long collapsed = 0;
+	};
+
+
+	// Caches GET responses that allow it with Cache-Control s-maxage or max-age.
+	// Responses are keyed by Host, path with query and the request headers listed in Vary.
+	// HEAD requests are answered from cached GET responses.
+	class ResponseCache
+	{
+	private:
+		struct Entry
+		{
+			std::shared_ptr<const CachedResponse> response;
+			std::string base_key;
+			std::string path;
+			size_t size;
+			std::list<std::string>::iterator lru;
+		};
+
+		// Request headers that select a variant of the response for a base key
+		struct Variants
+		{
+			std::vector<std::string> vary;
+			size_t count = 0;
+		};
+
+		std::mutex m_mutex;
+		std::unordered_map<std::string, Entry> m_entries;
+		std::unordered_map<std::string, Variants> m_variants;
+		std::unordered_map<std::string, std::shared_ptr<CacheFill>> m_pending;
+		// The most recently used keys first
+		std::list<std::string> m_lru;
+		size_t m_size = 0;
+		size_t m_max_size = 0;
+		size_t m_max_entry_size = 0;
+		CacheStats m_stats;
+
+		std::string variant_key(const std::string& base_key, const std::vector<std::string>& vary, const Request& request) const;
+		void erase(std::unordered_map<std::string, Entry>::iterator it);
+
+	public:
+		ResponseCache(const ResponseCache&) = delete;
+		ResponseCache& operator=(const ResponseCache&) = delete;
+
+		ResponseCache() {}
+
+		// Set the max. size of cached responses in bytes, 0 disables the cache
+		void configure(size_t max_size, size_t max_entry_size);
+
+		bool enabled() const;
+
+		size_t max_entry_size() const;
+
+		// Find a fresh response. On a miss the caller either fills the entry,
+		// or waits for another request that is filling it if may_wait is true.
+		CacheLookup lookup(const Request& request, bool may_wait);
+
+		// Store the response of the app if it's cacheable and wake up waiting requests
+		void finish(const std::shared_ptr<CacheFill>& fill, const Request& request);
+
+		// Wait in the coroutine until the fill is finished or the timeout in milliseconds expires
+		void wait(const std::shared_ptr<CacheFill>& fill, boost::asio::io_service& io_service,
+			unsigned int timeout, boost::asio::yield_context yc);
+
+		// Remove responses for a path with query string, for paths with a prefix if the path ends with *,
+		// or all responses if the path is empty. Returns the number of removed responses.
+		size_t purge(const std::string& path);
+
+		CacheStats stats();
+	};
+
+
+	// Finishes a cache fill when the request is done even if the app has failed
+	class CacheFillGuard
+	{
+	private:
+		ResponseCache& m_cache;
+		std::shared_ptr<CacheFill> m_fill;
+		const Request& m_request;
+
+	public:
+		CacheFillGuard(const CacheFillGuard&) = delete;
+		CacheFillGuard& operator=(const CacheFillGuard&) = delete;
+
+		CacheFillGuard(ResponseCache& cache, std::shared_ptr<CacheFill> fill, const Request& request) :
+			m_cache{ cache }, m_fill{ fill }, m_request{ request } {}
+
+		~CacheFillGuard()
+		{
+			if (m_fill)
+				m_cache.finish(m_fill, m_request);
+		}
+	};
+}
@@ -1,10 +1,26 @@
 #include "server.h"
+#include "handoff.h"
 
 #include <boost/asio/spawn.hpp>
 
+#include <algorithm>
+#include <array>
 #include <memory>
 #include <csignal>
 #include <utility>
+#include <fstream>
+#include <sstream>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#endif // _WIN32
 
 using namespace std;
 namespace asio = boost::asio;
@@ -14,214 +30,1616 @@ namespace py = boost::python;
 
 namespace wsgi_boost
 {
-	HttpServer::HttpServer(std::string ip_address, unsigned short port, unsigned int num_threads) :
-		m_ip_address{ ip_address }, m_port{ port }, m_num_threads{ num_threads }, m_acceptor(m_io_service), m_signals{ m_io_service }
+	static void add_stop_signals(asio::signal_set& signals)
 	{
-		m_is_running.store(false);
-		m_signals.add(SIGINT);
-		m_signals.add(SIGTERM);
+		signals.add(SIGINT);
+		signals.add(SIGTERM);
 #if defined(SIGQUIT)
-		m_signals.add(SIGQUIT);
+		signals.add(SIGQUIT);
 #endif // defined(SIGQUIT)
 	}
 
 
-	void HttpServer::accept()
+	HttpServer::HttpServer(std::string ip_address, unsigned short port, unsigned int num_threads) :
+		m_ip_address{ ip_address }, m_port{ port }, m_num_threads{ num_threads }, m_acceptor(m_io_service), m_handoff_acceptor(m_io_service),
+		m_signals{ m_io_service }, m_master_signals{ m_io_service }, m_respawn_timer{ m_io_service }, m_timeouts_timer{ m_io_service },
+		m_accept_timer{ m_io_service }, m_drain_timer{ m_io_service }
 	{
-		socket_ptr socket = make_shared<asio::ip::tcp::socket>(asio::ip::tcp::socket(m_io_service));
-		m_acceptor.async_accept(*socket, [this, socket](const boost::system::error_code& ec)
+		m_timeouts_origin = chrono::steady_clock::now();
+		// Connections are sharded across one wheel per server thread by socket handle
+		for (unsigned int i = 0; i < max(m_num_threads, 1u); ++i)
 		{
-			accept();
-			if (!ec)
-			{
-				socket->set_option(asio::ip::tcp::no_delay(true));
-				process_request(socket);
-			}
-		});
+			m_timeout_wheels.emplace_back(new TimeoutWheel);
+		}
+		m_is_running.store(false);
+		m_is_master.store(false);
+		m_accept_paused.store(false);
+		m_draining.store(false);
+		add_stop_signals(m_signals);
 	}
 
 
-	void HttpServer::process_request(socket_ptr socket)
+	void HttpServer::open_acceptor()
 	{
-		strand_ptr strand = make_shared<asio::strand>(asio::strand{ m_io_service });
-		// A stackful coroutine is needed here to correctly implement keep-alive
-		// in case if the number of concurent requests is greater than
-		// the number of server threads.
-		// Without the coroutine the next request while all threads are busy
-		// hangs in limbo and causes io_service to crash.
-		asio::spawn(*strand, [this, socket, strand](asio::yield_context yc)
+		m_unix_socket_path.clear();
+		int inherited_fd = listen_fd;
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS) && !defined(_WIN32)
+		// A running server passes its listening socket, so connections are not refused during restart
+		asio::local::stream_protocol::socket handoff_channel{ m_io_service };
+		if (!handoff_socket.empty())
 		{
-			Connection connection{ socket, m_io_service, strand, yc, header_timeout, content_timeout };
-			Request request{ connection };
-			Response response{ connection };
-			sys::error_code ec = request.parse_header();
+			sys::error_code ec;
+			handoff_channel.connect(asio::local::stream_protocol::endpoint{ handoff_socket }, ec);
 			if (!ec)
 			{
-				check_static_route(request);
-				response.http_version = request.http_version;
-				response.keep_alive = request.keep_alive();
-				handle_request(request, response);
+				inherited_fd = receive_descriptor(handoff_channel.native_handle());
+				if (inherited_fd < 0)
+					throw RuntimeError("Unable to receive the listening socket from " + handoff_socket + "!");
+				if (!unix_socket.empty() && unix_socket[0] != '@')
+					m_unix_socket_path = unix_socket;
+			}
+		}
+#endif // defined(BOOST_ASIO_HAS_LOCAL_SOCKETS) && !defined(_WIN32)
+		if (inherited_fd >= 0)
+		{
+#ifndef _WIN32
+			// An inherited socket, e.g. passed by systemd socket activation, is already bound and listening
+			sockaddr_storage address;
+			socklen_t address_size = sizeof(address);
+			if (getsockname(inherited_fd, reinterpret_cast<sockaddr*>(&address), &address_size) != 0)
+				throw RuntimeError("Invalid listening socket descriptor " + to_string(inherited_fd) + "!");
+			m_acceptor.assign(asio::generic::stream_protocol(address.ss_family, SOCK_STREAM), inherited_fd);
+#else
+			throw RuntimeError("Inherited listening sockets are not supported on this platform!");
+#endif // _WIN32
+		}
+		else if (!unix_socket.empty())
+		{
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS) && !defined(_WIN32)
+			string path = unix_socket;
+			// A leading @ denotes a name in the Linux abstract namespace that has no socket file
+			bool is_abstract = path[0] == '@';
+			if (is_abstract)
+				path[0] = '\0';
+			asio::local::stream_protocol::endpoint endpoint{ path };
+			struct stat file_stat;
+			if (!is_abstract && stat(path.c_str(), &file_stat) == 0 && S_ISSOCK(file_stat.st_mode))
+			{
+				// Remove a socket file left by a server that has not exited cleanly
+				asio::local::stream_protocol::socket probe{ m_io_service };
+				sys::error_code ec;
+				probe.connect(endpoint, ec);
+				if (!ec)
+					throw RuntimeError("Unix socket " + unix_socket + " is already in use!");
+				::unlink(path.c_str());
 			}
-			else if (ec == sys::errc::bad_message)
+			m_acceptor.open(asio::generic::stream_protocol(AF_UNIX, SOCK_STREAM));
+			m_acceptor.bind(endpoint);
+			if (!is_abstract)
 			{
-				response.send_mesage("400 Bad Request");
+				m_unix_socket_path = path;
+				if (unix_socket_mode != 0 && chmod(path.c_str(), static_cast<mode_t>(unix_socket_mode)) != 0)
+					throw RuntimeError("Unable to set permissions of Unix socket " + unix_socket + "!");
 			}
-			else if (ec == sys::errc::invalid_argument)
+			m_acceptor.listen(listen_backlog > 0 ? listen_backlog : asio::socket_base::max_connections);
+#else
+			throw RuntimeError("Unix domain sockets are not supported on this platform!");
+#endif // defined(BOOST_ASIO_HAS_LOCAL_SOCKETS) && !defined(_WIN32)
+		}
+		else
+		{
+			asio::ip::tcp::endpoint endpoint;
+			if (m_ip_address != "")
 			{
-				response.send_mesage("411 Length Required");
+				asio::ip::tcp::resolver resolver(m_io_service);
+				try
+				{
+					endpoint = *resolver.resolve({ m_ip_address, to_string(m_port) });
+				}
+				catch (const exception&)
+				{
+					throw RuntimeError("Unable to resolve IP address " + m_ip_address + " and port " + to_string(m_port) + "!");
+				}
 			}
 			else
 			{
-				return;
+				endpoint = asio::ip::tcp::endpoint(asio::ip::tcp::v4(), m_port);
 			}
-			if (request.keep_alive())
-				process_request(request.connection().socket());
-		});
+			m_acceptor.open(endpoint.protocol());
+			m_acceptor.set_option(asio::socket_base::reuse_address(reuse_address));
+			m_acceptor.bind(endpoint);
+#ifdef TCP_DEFER_ACCEPT
+			if (defer_accept > 0)
+				m_acceptor.set_option(asio::detail::socket_option::integer<IPPROTO_TCP, TCP_DEFER_ACCEPT>(defer_accept));
+#endif // TCP_DEFER_ACCEPT
+			m_acceptor.listen(listen_backlog > 0 ? listen_backlog : asio::socket_base::max_connections);
+		}
+		asio::ip::tcp::endpoint local_endpoint;
+		m_local_port = get_ip_endpoint(m_acceptor.local_endpoint(), local_endpoint) ? local_endpoint.port() : 0;
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS) && !defined(_WIN32)
+		if (handoff_channel.is_open())
+		{
+			// The previous server stops accepting connections when it receives the confirmation
+			sys::error_code ec;
+			asio::write(handoff_channel, asio::buffer("L", 1), ec);
+		}
+#endif // defined(BOOST_ASIO_HAS_LOCAL_SOCKETS) && !defined(_WIN32)
+		open_handoff_acceptor();
+	}
+
+
+	void HttpServer::open_handoff_acceptor()
+	{
+		m_handoff_path.clear();
+		if (handoff_socket.empty())
+			return;
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS) && !defined(_WIN32)
+		// The socket file of the previous server is replaced
+		::unlink(handoff_socket.c_str());
+		m_handoff_acceptor.open(asio::generic::stream_protocol(AF_UNIX, SOCK_STREAM));
+		m_handoff_acceptor.bind(asio::local::stream_protocol::endpoint{ handoff_socket });
+		chmod(handoff_socket.c_str(), S_IRUSR | S_IWUSR);
+		m_handoff_acceptor.listen(1);
+		m_handoff_path = handoff_socket;
+		accept_handoff();
+#else
+		throw RuntimeError("Hot restart is not supported on this platform!");
+#endif // defined(BOOST_ASIO_HAS_LOCAL_SOCKETS) && !defined(_WIN32)
 	}
 
-	void HttpServer::check_static_route(Request& request)
+
+	void HttpServer::accept_handoff()
 	{
-		for (const auto& route : m_static_routes)
+		socket_ptr channel = make_shared<socket_type>(m_io_service);
+		m_handoff_acceptor.async_accept(*channel, [this, channel](const sys::error_code& ec)
 		{
-			if (boost::regex_search(request.path, route.first))
+			if (ec == asio::error::operation_aborted || !m_handoff_acceptor.is_open())
+				return;
+			if (ec || !send_descriptor(static_cast<int>(channel->native_handle()), static_cast<int>(m_acceptor.native_handle())))
 			{
-				request.path_regex = route.first;
-				request.content_dir = route.second;
-				break;
+				accept_handoff();
+				return;
 			}
-		}
+			// Keep accepting connections until the new server confirms that it has taken over the socket
+			shared_ptr<char> confirmation = make_shared<char>();
+			channel->async_read_some(asio::buffer(confirmation.get(), 1), [this, channel, confirmation](const sys::error_code& ec, size_t)
+			{
+				if (ec)
+				{
+					accept_handoff();
+					return;
+				}
+				cout << "The listening socket is taken over by a new server, stopping.\n";
+				// Socket files belong to the new server now
+				m_unix_socket_path.clear();
+				m_handoff_path.clear();
+				sys::error_code close_ec;
+				m_handoff_acceptor.close(close_ec);
+				stop();
+			});
+		});
 	}
 
-	void HttpServer::handle_request(Request& request, Response& response)
+
+	void HttpServer::serve()
 	{
-		if (request.content_dir == string())
+		GilProfiler::configure(&(*m_stats)[m_worker_index].gil, profile_gil);
+		if (!access_log.empty())
 		{
-			request.url_scheme = url_scheme;
-			request.host_name = host_name;
-			request.local_endpoint_port = m_port;
-			GilAcquire acquire_gil;
-			WsgiRequestHandler handler{ request, response, m_app };
+			// The writer thread is started here because threads do not survive fork()
 			try
 			{
-				handler.handle();
+				m_access_log.open(access_log, m_access_log_format, &(*m_stats)[m_worker_index].access_log_dropped);
+#ifdef SIGHUP
+				m_signals.add(SIGHUP);
+#endif // SIGHUP
 			}
-			catch (const py::error_already_set&)
+			catch (const RuntimeError& ex)
 			{
-				PyErr_Print();
-				response.send_mesage("500 Internal Server Error", "Error 500: WSGI application error!");
+				cerr << ex.what() << '\n';
 			}
-			catch (const exception& ex)
+		}
+		if (!capture_file.empty())
+		{
+			// Each worker process writes its own capture file
+			string path = num_processes > 1 ? capture_file + "." + to_string(m_worker_index) : capture_file;
+			try
+			{
+				m_capture.open(path, capture_redact_headers);
+			}
+			catch (const RuntimeError& ex)
 			{
 				cerr << ex.what() << '\n';
-				response.send_mesage("500 Internal Server Error", "Error 500: Internal server error!");
 			}
 		}
-		else
+		if (asgi && !m_app.is_none())
 		{
-			request.use_gzip = use_gzip;
-			StaticRequestHandler handler{ request, response };
+			// The event loop thread is started here because threads do not survive fork()
 			try
 			{
-				handler.handle();
+				m_asgi_loop.start(m_app);
 			}
-			catch (const exception& ex)
+			catch (const py::error_already_set&)
+			{
+				GilAcquire acquire_gil;
+				PyErr_Print();
+			}
+		}
+#ifdef WSGI_BOOST_IO_URING
+		if (io_uring)
+		{
+			// The ring thread is started here because threads do not survive fork().
+			// The server falls back to the asio reactor if the kernel does not support io_uring.
+			try
+			{
+				m_io_uring.start(m_io_service);
+			}
+			catch (const RuntimeError& ex)
 			{
 				cerr << ex.what() << '\n';
-				response.send_mesage("500 Internal Server Error", "Error 500: Internal server error!");
 			}
 		}
+#endif // WSGI_BOOST_IO_URING
+		accept();
+		check_timeouts();
+		m_threads.clear();
+		for (unsigned int i = 1; i < m_num_threads; ++i)
+		{
+			m_threads.emplace_back([this]()
+			{
+				m_io_service.run();
+			});
+		}
+		wait_signal();
+		m_is_running.store(true);
+		m_io_service.run();
+		for (auto& t : m_threads)
+		{
+			t.join();
+		}
+#ifdef WSGI_BOOST_IO_URING
+		m_io_uring.stop();
+		atomic_store(&m_io_uring_accept, shared_ptr<IoUringAccept>());
+#endif // WSGI_BOOST_IO_URING
+		m_asgi_loop.stop();
+		GilProfiler::configure(nullptr, false);
+		if (m_access_log.is_open())
+		{
+			m_access_log.close();
+#ifdef SIGHUP
+			sys::error_code ec;
+			m_signals.remove(SIGHUP, ec);
+#endif // SIGHUP
+		}
+		m_capture.close();
 	}
 
 
-	void HttpServer::add_static_route(string path, string content_dir)
+	void HttpServer::wait_signal()
 	{
-		m_static_routes.emplace_back(boost::regex(path, boost::regex_constants::icase), content_dir);
+		m_signals.async_wait([this](const sys::error_code& ec, int signal_number)
+		{
+#ifdef SIGHUP
+			if (!ec && signal_number == SIGHUP)
+			{
+				m_access_log.reopen();
+				wait_signal();
+				return;
+			}
+#endif // SIGHUP
+			if (ec)
+				return;
+			stop();
+			// A repeated stop signal interrupts graceful shutdown
+			if (m_draining.load())
+				wait_signal();
+		});
 	}
 
 
-	void HttpServer::set_app(py::object app)
+	void HttpServer::accept()
 	{
-		if (is_running())
-			throw RuntimeError("Attempt to set a WSGI app while the server is running!");
-		m_app = app;
+		if (max_connections > 0 && (*m_stats)[m_worker_index].active_connections.load() >= max_connections)
+		{
+			// New connections wait in the listen backlog until one of the active connections is closed
+			m_accept_paused.store(true);
+			// A connection might have been closed before the flag was set
+			if ((*m_stats)[m_worker_index].active_connections.load() >= max_connections || !m_accept_paused.exchange(false))
+				return;
+		}
+#ifdef WSGI_BOOST_IO_URING
+		if (m_io_uring.is_running())
+		{
+			accept_io_uring();
+			return;
+		}
+#endif // WSGI_BOOST_IO_URING
+#ifdef WSGI_BOOST_BATCHED_ACCEPT
+		if (accept_batch_size > 1)
+		{
+			m_acceptor.async_wait(asio::socket_base::wait_read, [this](const sys::error_code& ec)
+			{
+				// The acceptor has been closed by stop()
+				if (ec == asio::error::operation_aborted || !m_acceptor.is_open())
+					return;
+				accept_batch();
+			});
+			return;
+		}
+#endif // WSGI_BOOST_BATCHED_ACCEPT
+		socket_ptr socket = make_shared<socket_type>(m_io_service);
+		m_acceptor.async_accept(*socket, [this, socket](const boost::system::error_code& ec)
+		{
+			// The acceptor has been closed by stop()
+			if (ec == asio::error::operation_aborted || !m_acceptor.is_open())
+				return;
+			if (!check_descriptors(ec))
+				return;
+			if (!ec)
+				start_connection(socket);
+			accept();
+		});
 	}
 
+#ifdef WSGI_BOOST_BATCHED_ACCEPT
 
-	void HttpServer::start()
+	void HttpServer::accept_batch()
 	{
-		if (!is_running())
+		asio::generic::stream_protocol protocol = m_acceptor.local_endpoint().protocol();
+		for (unsigned int i = 0; i < accept_batch_size; ++i)
 		{
-			GilRelease release_gil;
-			cout << "WsgiBoostHttp server starting.\n";
-			cout << "Press Ctrl+C to stop it.\n";
-			if (m_io_service.stopped())
-				m_io_service.reset();
-			asio::ip::tcp::endpoint endpoint;
-			if (m_ip_address != "")
+			if (max_connections > 0 && (*m_stats)[m_worker_index].active_connections.load() >= max_connections)
+				break;
+			int fd = accept4(m_acceptor.native_handle(), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			if (fd < 0)
 			{
-				asio::ip::tcp::resolver resolver(m_io_service);
-				try
+				if (errno == EINTR || errno == ECONNABORTED)
+					continue;
+				if (errno == EMFILE || errno == ENFILE)
 				{
-					endpoint = *resolver.resolve({ m_ip_address, to_string(m_port) });
+					if (!check_descriptors(asio::error::no_descriptors))
+						return;
+					continue;
 				}
-				catch (const exception&)
+				// EAGAIN: the accept queue is empty
+				if (errno == EAGAIN || errno == EWOULDBLOCK)
+					break;
+				// ENOBUFS, ENOMEM etc. leave the listening socket readable, so waiting on it would spin
+				retry_accept();
+				return;
+			}
+			socket_ptr socket = make_shared<socket_type>(m_io_service);
+			sys::error_code ec;
+			socket->assign(protocol, fd, ec);
+			if (ec)
+			{
+				::close(fd);
+				continue;
+			}
+			start_connection(socket);
+		}
+		accept();
+	}
+
+#endif // WSGI_BOOST_BATCHED_ACCEPT
+
+#ifdef WSGI_BOOST_IO_URING
+
+	void HttpServer::accept_io_uring()
+	{
+		asio::generic::stream_protocol protocol = m_acceptor.local_endpoint().protocol();
+		auto operation = make_shared<IoUringAccept>(m_acceptor.native_handle());
+		weak_ptr<IoUringAccept> weak_operation = operation;
+		operation->handler = [this, protocol, weak_operation](int result, bool more)
+		{
+			// The ring thread only collects descriptors, connections are started by server threads
+			m_io_service.post([this, protocol, weak_operation, result, more]()
+			{
+				shared_ptr<IoUringAccept> operation = weak_operation.lock();
+				// The accept has been replaced or stopped by drain()
+				bool current = operation && atomic_load(&m_io_uring_accept) == operation;
+				if (result >= 0)
 				{
-					throw RuntimeError("Unable to resolve IP address " + m_ip_address + " and port " + to_string(m_port) + "!");
+					socket_ptr socket = make_shared<socket_type>(m_io_service);
+					sys::error_code ec;
+					if (m_acceptor.is_open())
+						socket->assign(protocol, result, ec);
+					if (!socket->is_open())
+						::close(result);
+					else
+						start_connection(socket);
+					// The accept is restarted by accept() when one of the active connections is closed
+					if (current && more && max_connections > 0 &&
+						(*m_stats)[m_worker_index].active_connections.load() >= max_connections)
+						m_io_uring.cancel(operation);
 				}
-			}
-			else
+				if (more || !current || !m_acceptor.is_open())
+					return;
+				if (result < 0 && result != -ECANCELED && !check_descriptors(sys::error_code(-result, sys::system_category())))
+					return;
+				accept();
+			});
+		};
+		atomic_store(&m_io_uring_accept, operation);
+		m_io_uring.submit(operation);
+	}
+
+#endif // WSGI_BOOST_IO_URING
+
+	bool HttpServer::check_descriptors(const sys::error_code& ec)
+	{
+		if (ec == asio::error::no_descriptors || ec == sys::errc::too_many_files_open_in_system)
+		{
+			// Retry later if there are no idle connections to free file descriptors
+			if (m_idle_connections.evict(16) == 0)
 			{
-				endpoint = asio::ip::tcp::endpoint(asio::ip::tcp::v4(), m_port);
+				retry_accept();
+				return false;
 			}
-			m_acceptor.open(endpoint.protocol());
-			m_acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(reuse_address));
-			m_acceptor.bind(endpoint);
-			m_acceptor.listen();
-			if (host_name == string())
-				host_name = asio::ip::host_name();
-			accept();
-			m_threads.clear();
-			for (unsigned int i = 1; i < m_num_threads; ++i)
+		}
+		return true;
+	}
+
+
+	void HttpServer::retry_accept()
+	{
+		m_accept_timer.expires_from_now(boost::posix_time::milliseconds(100));
+		m_accept_timer.async_wait([this](const sys::error_code& ec)
+		{
+			if (!ec)
+				accept();
+		});
+	}
+
+
+	void HttpServer::start_connection(socket_ptr socket)
+	{
+		shared_ptr<WorkerStatsBlock> stats = m_stats;
+		WorkerStats& worker_stats = (*stats)[m_worker_index];
+		++worker_stats.connections;
+		++worker_stats.active_connections;
+		// The deleter is called when the last request of the connection is done
+		socket_ptr tracked_socket{ socket.get(), [this, socket, stats, &worker_stats](socket_type*)
+		{
+			--worker_stats.active_connections;
+			resume_accept();
+		} };
+		sys::error_code ec;
+		// Unix domain sockets have no port and no TCP options
+		if (m_local_port != 0)
+			tracked_socket->set_option(asio::ip::tcp::no_delay(true), ec);
+		evict_idle_connections(tracked_socket->native_handle());
+		process_request(tracked_socket);
+	}
+
+
+	void HttpServer::check_timeouts()
+	{
+		auto tick = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - m_timeouts_origin).count() *
+			TimeoutWheel::ticks_per_second / 1000;
+		for (auto& wheel : m_timeout_wheels)
+		{
+			wheel->advance(tick);
+		}
+		m_timeouts_timer.expires_from_now(boost::posix_time::milliseconds(1000 / TimeoutWheel::ticks_per_second));
+		m_timeouts_timer.async_wait([this](const sys::error_code& ec)
+		{
+			if (!ec)
+				check_timeouts();
+		});
+	}
+
+
+	void HttpServer::evict_idle_connections(long long handle)
+	{
+		// accept() returns the lowest free descriptor, so a new descriptor above the watermark
+		// means that all descriptors below it are in use. Each new connection above the watermark
+		// replaces the oldest idle one.
+		if (m_fd_watermark > 0 && handle >= m_fd_watermark)
+			m_idle_connections.evict(1);
+	}
+
+
+	void HttpServer::resume_accept()
+	{
+		if (m_accept_paused.exchange(false))
+			m_io_service.post([this]() { accept(); });
+	}
+
+
+	void HttpServer::process_request(socket_ptr socket)
+	{
+		auto accepted = chrono::steady_clock::now();
+		TimeoutWheel& timeouts = *m_timeout_wheels[socket->native_handle() % m_timeout_wheels.size()];
+		Metrics& metrics = (*m_stats)[m_worker_index].metrics;
+		// A stackful coroutine is needed here to correctly implement keep-alive
+		// in case if the number of concurent requests is greater than
+		// the number of server threads.
+		// Without the coroutine the next request while all threads are busy
+		// hangs in limbo and causes io_service to crash.
+		// The coroutine serves all requests of the connection, so its stack, strand
+		// and connection buffers are allocated once and reused by keep-alive requests.
+		asio::spawn(asio::strand{ m_io_service }, [this, socket, &timeouts, &metrics, accepted](asio::yield_context yc)
+		{
+			Connection connection{ socket, timeouts, metrics, yc, header_timeout, content_timeout };
+#ifdef WSGI_BOOST_TLS
+			if (m_tls_context)
 			{
-				m_threads.emplace_back([this]()
+				if (connection.start_tls(*m_tls_context))
+					return;
+				if (http2 && connection.tls()->alpn_protocol() == "h2")
 				{
-					m_io_service.run();
-				});
+					serve_http2(connection, nullptr);
+					return;
+				}
 			}
-			m_signals.async_wait([this](sys::error_code, int) { stop(); });
-			m_is_running.store(true);
-			m_io_service.run();
-			for (auto& t : m_threads)
+#endif // WSGI_BOOST_TLS
+#ifdef WSGI_BOOST_IO_URING
+			// OpenSSL reads TLS connections from the socket itself
+			if (m_io_uring.is_running())
+				connection.use_io_uring(m_io_uring, !connection.tls());
+#endif // WSGI_BOOST_IO_URING
+			Request request{ connection };
+			Response response{ connection };
+			response.closing = &m_draining;
+			auto request_start = accepted;
+			string remote_address;
+			string captured_content;
+			for (unsigned int request_number = 0; ; ++request_number)
 			{
-				t.join();
+				sys::error_code ec;
+				if (request_number > 0)
+				{
+					ec = connection.wait_for_request(keep_alive_timeout, m_idle_connections);
+					if (ec)
+						return;
+					request.reset();
+					response.status_code = 0;
+					request_start = chrono::steady_clock::now();
+				}
+				ec = request.parse_header();
+				// h2c upgrade is only allowed on cleartext connections
+				if (!ec && http2 && (Http2Session::is_preface(request) || (!connection.tls() && Http2Session::is_upgrade(request))))
+				{
+					serve_http2(connection, &request);
+					return;
+				}
+				if (!ec)
+				{
+					metrics.record(Stage::header, chrono::steady_clock::now() - request_start);
+					++(*m_stats)[m_worker_index].requests;
+					request.match_static_route(m_static_routes);
+					response.http_version = request.http_version;
+					response.keep_alive = request.keep_alive() &&
+						(max_keep_alive_requests == 0 || request_number + 1 < max_keep_alive_requests);
+					// A WebSocket connection is served by this coroutine until it is closed
+					if (!m_websocket_routes.empty() && WebSocketSession::is_upgrade(request) &&
+						serve_websocket(connection, request, response))
+					{
+						finish_request(request, response, remote_address, request_start);
+						return;
+					}
+					serve_request(connection, request, response, captured_content);
+				}
+				else if (ec == sys::errc::bad_message)
+				{
+					response.keep_alive = false;
+					response.send_mesage("400 Bad Request");
+				}
+				else if (ec == sys::errc::invalid_argument)
+				{
+					response.keep_alive = false;
+					response.send_mesage("411 Length Required");
+				}
+				else
+				{
+					return;
+				}
+				finish_request(request, response, remote_address, request_start);
+				if (!response.keep_alive || !connection.next_request())
+					return;
 			}
-			cout << "WsgiBoostHttp server stopped.\n";
-			m_is_running.store(false);
+		});
+	}
+
+
+	void HttpServer::serve_request(Connection& connection, Request& request, Response& response, string& captured_content)
+	{
+		if (m_capture.is_open())
+		{
+			auto request_time = chrono::system_clock::now();
+			long long content_length = connection.content_length();
+			captured_content.clear();
+			connection.capture_content(&captured_content, capture_content_limit);
+			handle_request(request, response);
+			connection.capture_content(nullptr, 0);
+			m_capture.record(request, content_length, request_time, captured_content);
 		}
 		else
 		{
-			cerr << "The server is already running!\n";
+			handle_request(request, response);
 		}
 	}
 
 
-	void HttpServer::stop()
+	void HttpServer::finish_request(const Request& request, const Response& response, string& remote_address,
+		chrono::steady_clock::time_point start)
 	{
-		if (is_running())
+		Connection& connection = request.connection();
+		Metrics& metrics = connection.metrics();
+		if (connection.first_byte_time() != chrono::steady_clock::time_point())
 		{
-			m_acceptor.close();
-			m_io_service.stop();
-			m_signals.cancel();
+			metrics.record(Stage::first_byte, connection.first_byte_time() - start);
+			metrics.record(Stage::write, connection.write_time());
 		}
-		else
+		metrics.add_response(response.status_code);
+		if (m_access_log.is_open())
+			log_request(request, response, remote_address, start);
+	}
+
+
+	void HttpServer::serve_http2(Connection& connection, const Request* request)
+	{
+		// request is nullptr if HTTP/2 has been negotiated with ALPN
+		bool preface = request != nullptr && Http2Session::is_preface(*request);
+		auto session = make_shared<Http2Session>(connection.socket(), connection.timeouts(), connection.metrics(),
+			http2_max_streams, http2_max_content_size, content_timeout, keep_alive_timeout, max_keep_alive_requests);
+		if (request != nullptr && !preface)
 		{
-			cerr << "The server is not running!\n";
+			if (!session->upgrade(*request, url_scheme))
+			{
+				Response response{ connection };
+				response.http_version = request->http_version;
+				response.keep_alive = false;
+				response.send_mesage("400 Bad Request");
+				return;
+			}
+			connection.append(byte_string("HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n"));
+			if (connection.flush())
+				return;
 		}
+		session->run(connection, preface, m_idle_connections, [this, &session](shared_ptr<Http2Stream> stream)
+		{
+			process_stream(session, stream);
+		});
 	}
 
 
-	bool HttpServer::is_running() const
+	bool HttpServer::serve_websocket(Connection& connection, Request& request, Response& response)
 	{
-		return m_is_running.load();
-	}
-}
+		auto route = m_websocket_routes.begin();
+		while (route != m_websocket_routes.end() && !boost::regex_search(request.path, route->first))
+			++route;
+		if (route == m_websocket_routes.end())
+			return false;
+		request.url_scheme = url_scheme;
+		request.host_name = host_name;
+		request.local_endpoint_port = m_local_port;
+		request.multiprocess = m_stats->size() > 1;
+		auto session = make_shared<WebSocketSession>(connection.socket(), m_io_service, connection.timeouts(),
+			connection.metrics(), websocket_timeout, websocket_max_message_size);
+		m_websockets.add(session);
+		WebSocketRequestHandler handler{ request, response, route->second, session };
+		try
+		{
+			handler.handle();
+		}
+		catch (const exception& ex)
+		{
+			cerr << ex.what() << '\n';
+		}
+		m_websockets.remove(session);
+		return true;
+	}
+
+
+	void HttpServer::process_stream(shared_ptr<Http2Session> session, shared_ptr<Http2Stream> stream)
+	{
+		// Each stream gets its own coroutine, so a slow application call does not block other streams.
+		// The coroutine is posted because spawn() would start it inline and block the frame reader.
+		m_io_service.post([this, session, stream]()
+		{
+			asio::spawn(asio::strand{ m_io_service }, [this, session, stream](asio::yield_context yc)
+			{
+				StreamConnection connection{ session, stream, yc };
+#ifdef WSGI_BOOST_IO_URING
+				// Frames are received by the session, so only static files are read through the ring
+				if (m_io_uring.is_running())
+					connection.use_io_uring(m_io_uring, false);
+#endif // WSGI_BOOST_IO_URING
+				Request request{ connection };
+				Response response{ connection };
+				string remote_address;
+				string captured_content;
+				sys::error_code ec = connection.read_request(request);
+				if (!ec)
+				{
+					connection.metrics().record(Stage::header, chrono::steady_clock::now() - stream->started);
+					++(*m_stats)[m_worker_index].requests;
+					request.match_static_route(m_static_routes);
+					response.http_version = request.http_version;
+					serve_request(connection, request, response, captured_content);
+				}
+				else if (ec == sys::errc::message_size)
+				{
+					response.send_mesage("413 Payload Too Large");
+				}
+				else
+				{
+					response.send_mesage("400 Bad Request");
+				}
+				connection.finish();
+				finish_request(request, response, remote_address, stream->started);
+			});
+		});
+	}
+
+	void HttpServer::handle_request(Request& request, Response& response)
+	{
+		Metrics& metrics = request.connection().metrics();
+		shared_ptr<const PrebuiltResponse> prebuilt;
+		if (is_metrics_request(request))
+		{
+			send_metrics(response);
+		}
+		else if ((prebuilt = m_fast_paths.find(request)))
+		{
+			// Health checks and redirects do not wait for the GIL
+			response.send_prebuilt(*prebuilt, request.method != "HEAD");
+		}
+		else if (request.content_dir == string() && asgi)
+		{
+			// ASGI apps run on the event loop thread, so the coroutine does not wait for the GIL
+			AdmissionTicket ticket{ m_admission };
+			if (!ticket.admitted())
+			{
+				reject_request(response);
+				return;
+			}
+			request.url_scheme = url_scheme;
+			request.host_name = host_name;
+			request.local_endpoint_port = m_local_port;
+			request.multiprocess = m_stats->size() > 1;
+			auto app_start = chrono::steady_clock::now();
+			AsgiRequestHandler handler{ request, response, m_asgi_loop, m_io_service };
+			try
+			{
+				handler.handle();
+			}
+			catch (const exception& ex)
+			{
+				cerr << ex.what() << '\n';
+				response.keep_alive = false;
+			}
+			metrics.record(Stage::app, chrono::steady_clock::now() - app_start);
+		}
+		else if (request.content_dir == string())
+		{
+			shared_ptr<CacheFill> fill;
+			if (m_cache.enabled())
+			{
+				CacheLookup lookup = m_cache.lookup(request, true);
+				if (lookup.pending)
+				{
+					// Concurrent misses for the same response are collapsed into one app call
+					m_cache.wait(lookup.pending, m_io_service, response_cache_lock_timeout, request.connection().yield_context());
+					lookup = m_cache.lookup(request, false);
+				}
+				if (lookup.response)
+				{
+					// Cache hits do not take the GIL
+					CachedRequestHandler handler{ request, response, lookup.response };
+					handler.handle();
+					return;
+				}
+				fill = lookup.fill;
+			}
+			CacheFillGuard fill_guard{ m_cache, fill, request };
+			auto arrival = chrono::steady_clock::now();
+			AdmissionTicket ticket{ m_admission };
+			if (!ticket.admitted())
+			{
+				reject_request(response);
+				return;
+			}
+			request.url_scheme = url_scheme;
+			request.host_name = host_name;
+			request.local_endpoint_port = m_local_port;
+			request.multiprocess = m_stats->size() > 1;
+			auto gil_wait_start = chrono::steady_clock::now();
+			GilAcquire acquire_gil{ GilSite::request };
+			auto app_start = chrono::steady_clock::now();
+			metrics.record(Stage::gil_wait, app_start - gil_wait_start);
+			if (!m_admission.dequeue(arrival))
+			{
+				GilRelease release_gil{ GilSite::reject };
+				reject_request(response);
+				return;
+			}
+			WsgiRequestHandler handler{ request, response, m_app };
+			if (fill)
+				handler.cache_response(&fill->response, response_cache_max_entry_size);
+			try
+			{
+				handler.handle();
+			}
+			catch (const py::error_already_set&)
+			{
+				PyErr_Print();
+				response.send_mesage("500 Internal Server Error", "Error 500: WSGI application error!");
+			}
+			catch (const exception& ex)
+			{
+				cerr << ex.what() << '\n';
+				response.send_mesage("500 Internal Server Error", "Error 500: Internal server error!");
+			}
+			metrics.record(Stage::app, chrono::steady_clock::now() - app_start);
+		}
+		else
+		{
+			auto start = chrono::steady_clock::now();
+			request.use_gzip = use_gzip;
+			StaticRequestHandler handler{ request, response };
+			try
+			{
+				handler.handle();
+			}
+			catch (const exception& ex)
+			{
+				cerr << ex.what() << '\n';
+				response.send_mesage("500 Internal Server Error", "Error 500: Internal server error!");
+			}
+			metrics.record(Stage::static_file, chrono::steady_clock::now() - start);
+		}
+	}
+
+
+	bool HttpServer::is_metrics_request(const Request& request) const
+	{
+		if (metrics_path.empty() || request.path.compare(0, metrics_path.length(), metrics_path) != 0)
+			return false;
+		return request.path.length() == metrics_path.length() || request.path[metrics_path.length()] == '?';
+	}
+
+
+	void HttpServer::send_metrics(Response& response)
+	{
+		string content = collect_metrics().to_prometheus();
+		headers_type headers;
+		headers.emplace_back("Content-Type", "text/plain; version=0.0.4");
+		headers.emplace_back("Content-Length", to_string(content.length()));
+		sys::error_code ec = response.send_header("200 OK", headers);
+		if (!ec)
+			response.send_data(content);
+	}
+
+
+	MetricsSnapshot HttpServer::collect_metrics() const
+	{
+		MetricsSnapshot snapshot;
+		shared_ptr<WorkerStatsBlock> stats = m_stats;
+		if (!stats)
+			return snapshot;
+		for (size_t i = 0; i < stats->size(); ++i)
+		{
+			const WorkerStats& worker_stats = (*stats)[i];
+			snapshot.connections += worker_stats.connections.load();
+			snapshot.active_connections += worker_stats.active_connections.load();
+			snapshot.requests += worker_stats.requests.load();
+			snapshot.access_log_dropped += worker_stats.access_log_dropped.load();
+			snapshot.add(worker_stats.metrics);
+		}
+		return snapshot;
+	}
+
+
+	static py::dict histogram_to_dict(const HistogramSnapshot& histogram)
+	{
+		py::dict item;
+		item["count"] = histogram.count;
+		item["sum"] = histogram.sum / 1000000.0;
+		item["max"] = histogram.maximum / 1000000.0;
+		item["p50"] = histogram.percentile(50.0);
+		item["p90"] = histogram.percentile(90.0);
+		item["p99"] = histogram.percentile(99.0);
+		return item;
+	}
+
+
+	py::dict HttpServer::gil_stats() const
+	{
+		py::dict stats_dict;
+		py::list sites;
+		py::list threads;
+		shared_ptr<WorkerStatsBlock> stats = m_stats;
+		array<unsigned long long, gil_site_count> counts{};
+		array<unsigned long long, gil_site_count> wait_times{};
+		array<unsigned long long, gil_site_count> max_waits{};
+		HistogramSnapshot hold;
+		for (size_t i = 0; stats && i < stats->size(); ++i)
+		{
+			const WorkerStats& worker_stats = (*stats)[i];
+			const GilStats& gil = worker_stats.gil;
+			for (size_t site = 0; site < gil_site_count; ++site)
+			{
+				counts[site] += gil.sites[site].count.load();
+				wait_times[site] += gil.sites[site].wait_time.load();
+				max_waits[site] = max(max_waits[site], gil.sites[site].max_wait.load());
+			}
+			size_t thread_count = min(gil.thread_count.load(), GilStats::max_threads);
+			for (size_t j = 0; j < thread_count; ++j)
+			{
+				py::dict item;
+				item["pid"] = worker_stats.pid.load();
+				item["thread_id"] = gil.threads[j].thread_id.load();
+				item["waits"] = gil.threads[j].waits.load();
+				item["wait_time"] = gil.threads[j].wait_time.load() / 1e9;
+				item["hold_time"] = gil.threads[j].hold_time.load() / 1e9;
+				threads.append(item);
+			}
+			hold.add(gil.hold);
+		}
+		unsigned long long requests = counts[static_cast<size_t>(GilSite::request)];
+		// Sites are sorted by the total wait time, so the top offending paths go first
+		array<size_t, gil_site_count> order;
+		for (size_t i = 0; i < gil_site_count; ++i)
+			order[i] = i;
+		sort(order.begin(), order.end(), [&wait_times](size_t a, size_t b) { return wait_times[a] > wait_times[b]; });
+		for (size_t site : order)
+		{
+			py::dict item;
+			item["site"] = gil_site_name(static_cast<GilSite>(site));
+			item["count"] = counts[site];
+			item["wait_time"] = wait_times[site] / 1e9;
+			item["max_wait"] = max_waits[site] / 1e9;
+			sites.append(item);
+		}
+		unsigned long long handoffs = 0;
+		for (size_t site = 0; site < gil_site_count; ++site)
+		{
+			if (site != static_cast<size_t>(GilSite::request))
+				handoffs += counts[site];
+		}
+		stats_dict["enabled"] = GilProfiler::enabled();
+		stats_dict["requests"] = requests;
+		stats_dict["handoffs_per_request"] = requests > 0 ? static_cast<double>(handoffs) / requests : 0.0;
+		stats_dict["hold_time"] = histogram_to_dict(hold);
+		stats_dict["sites"] = sites;
+		stats_dict["threads"] = threads;
+		return stats_dict;
+	}
+
+
+	py::dict HttpServer::stats() const
+	{
+		MetricsSnapshot snapshot = collect_metrics();
+		py::dict stats_dict;
+		stats_dict["connections"] = snapshot.connections;
+		stats_dict["active_connections"] = snapshot.active_connections;
+		stats_dict["requests"] = snapshot.requests;
+		stats_dict["bytes_received"] = snapshot.bytes_received;
+		stats_dict["bytes_sent"] = snapshot.bytes_sent;
+		stats_dict["access_log_dropped"] = snapshot.access_log_dropped;
+		py::dict responses;
+		for (size_t i = 0; i < snapshot.responses.size(); ++i)
+		{
+			if (snapshot.responses[i] > 0)
+				responses[i + 100] = snapshot.responses[i];
+		}
+		stats_dict["responses"] = responses;
+		py::dict latency;
+		for (size_t i = 0; i < stage_count; ++i)
+		{
+			latency[stage_name(static_cast<Stage>(i))] = histogram_to_dict(snapshot.stages[i]);
+		}
+		stats_dict["latency"] = latency;
+		return stats_dict;
+	}
+
+
+	void HttpServer::log_request(const Request& request, const Response& response, string& remote_address,
+		chrono::steady_clock::time_point start)
+	{
+		AccessRecord* record = m_access_log.reserve();
+		if (record == nullptr)
+			return;
+		auto duration = chrono::steady_clock::now() - start;
+		auto timestamp = chrono::system_clock::now() - chrono::duration_cast<chrono::system_clock::duration>(duration);
+		record->timestamp = chrono::duration_cast<chrono::microseconds>(timestamp.time_since_epoch()).count();
+		record->duration = chrono::duration_cast<chrono::microseconds>(duration).count();
+		record->status = response.status_code;
+		record->bytes_sent = request.connection().bytes_sent();
+		// The peer address is resolved once per connection
+		if (remote_address.empty())
+		{
+			sys::error_code ec;
+			auto endpoint = request.connection().socket()->remote_endpoint(ec);
+			asio::ip::tcp::endpoint ip_endpoint;
+			remote_address = !ec && get_ip_endpoint(endpoint, ip_endpoint) ? ip_endpoint.address().to_string() : "-";
+		}
+		AccessRecord::set(record->remote_address, remote_address);
+		AccessRecord::set(record->method, request.method);
+		AccessRecord::set(record->path, request.path);
+		AccessRecord::set(record->protocol, request.http_version);
+		if (m_access_log.format() != AccessLog::Format::common)
+		{
+			AccessRecord::set(record->referer, request.get_header(KnownHeader::referer));
+			AccessRecord::set(record->user_agent, request.get_header(KnownHeader::user_agent));
+		}
+		else
+		{
+			record->referer[0] = record->user_agent[0] = '\0';
+		}
+		m_access_log.commit();
+	}
+
+
+	void HttpServer::reopen_access_log()
+	{
+		m_access_log.reopen();
+	}
+
+
+	void HttpServer::reject_request(Response& response)
+	{
+		// The request content is not read, so the connection cannot be reused
+		response.keep_alive = false;
+		headers_type headers;
+		headers.emplace_back("Retry-After", "1");
+		headers.emplace_back("Content-Length", "0");
+		response.send_header("503 Service Unavailable", headers);
+	}
+
+
+	void HttpServer::add_static_route(string path, string content_dir)
+	{
+		m_static_routes.emplace_back(boost::regex(path, boost::regex_constants::icase), content_dir);
+	}
+
+
+	void HttpServer::add_fixed_response(string path, string status, py::list headers, py::object body)
+	{
+		if (is_running())
+			throw RuntimeError("Attempt to add a fixed response while the server is running!");
+		headers_type cpp_headers;
+		size_t headers_count = py::len(headers);
+		for (size_t i = 0; i < headers_count; ++i)
+		{
+			py::object header = headers[i];
+			cpp_headers.emplace_back(py::extract<string>(header[0]), py::extract<string>(header[1]));
+		}
+		m_fast_paths.add_fixed_response(path, status, move(cpp_headers), py::extract<string>(body));
+	}
+
+
+	void HttpServer::add_redirect(string prefix, string target, string status, bool append_path)
+	{
+		if (is_running())
+			throw RuntimeError("Attempt to add a redirect while the server is running!");
+		m_fast_paths.add_redirect(prefix, target, status, append_path);
+	}
+
+
+	void HttpServer::add_websocket_route(string path, py::object handler)
+	{
+		if (is_running())
+			throw RuntimeError("Attempt to add a WebSocket route while the server is running!");
+		m_websocket_routes.emplace_back(boost::regex(path, boost::regex_constants::icase), handler);
+	}
+
+
+	void HttpServer::set_app(py::object app)
+	{
+		if (is_running())
+			throw RuntimeError("Attempt to set a WSGI app while the server is running!");
+		m_app = app;
+	}
+
+
+	void HttpServer::start()
+	{
+		if (!is_running())
+		{
+			if (!access_log.empty() && !AccessLog::parse_format(access_log_format, m_access_log_format))
+				throw RuntimeError("Invalid access log format: " + access_log_format + "!");
+#ifdef WSGI_BOOST_TLS
+			m_tls_context.reset();
+			if (!tls_cert_file.empty())
+			{
+				// The context is created before worker processes are forked, so they share session ticket keys
+				vector<string> alpn;
+				if (http2)
+					alpn.push_back("h2");
+				alpn.push_back("http/1.1");
+				m_tls_context.reset(new TlsContext(tls_cert_file, tls_key_file, alpn, tls_session_cache_size, tls_session_tickets, ktls));
+				if (url_scheme == "http")
+					url_scheme = "https";
+			}
+#else
+			if (!tls_cert_file.empty())
+				throw RuntimeError("TLS support is not enabled in this build!");
+#endif // WSGI_BOOST_TLS
+#ifndef WSGI_BOOST_IO_URING
+			if (io_uring)
+				throw RuntimeError("io_uring support is not enabled in this build!");
+#endif // WSGI_BOOST_IO_URING
+			GilRelease release_gil;
+			cout << "WsgiBoostHttp server starting.\n";
+			cout << "Press Ctrl+C to stop it.\n";
+			if (m_io_service.stopped())
+				m_io_service.reset();
+			open_acceptor();
+			if (host_name == string())
+				host_name = asio::ip::host_name();
+			m_worker_index = 0;
+			m_accept_paused.store(false);
+			m_draining.store(false);
+			m_admission.configure(max_app_requests, queue_delay_target, queue_delay_interval);
+			m_cache.configure(response_cache_size, response_cache_max_entry_size);
+#ifndef _WIN32
+			rlimit fd_limit;
+			if (fd_watermark > 0 && getrlimit(RLIMIT_NOFILE, &fd_limit) == 0 && fd_limit.rlim_cur != RLIM_INFINITY)
+			{
+				m_fd_watermark = static_cast<long long>(fd_limit.rlim_cur) * min(fd_watermark, 100u) / 100;
+			}
+			else
+			{
+				m_fd_watermark = 0;
+			}
+			m_stats.reset(new WorkerStatsBlock(max(num_processes, 1u)));
+			if (num_processes > 1)
+			{
+				run_master();
+			}
+			else
+			{
+				(*m_stats)[0].pid.store(getpid());
+				serve();
+			}
+#else
+			if (num_processes > 1)
+				cerr << "Multi-process mode is not supported on this platform!\n";
+			m_stats.reset(new WorkerStatsBlock(1));
+			serve();
+#endif // _WIN32
+			sys::error_code ec;
+			m_acceptor.close(ec);
+			m_handoff_acceptor.close(ec);
+#ifndef _WIN32
+			if (!m_unix_socket_path.empty())
+				::unlink(m_unix_socket_path.c_str());
+			if (!m_handoff_path.empty())
+				::unlink(m_handoff_path.c_str());
+#endif // _WIN32
+			cout << "WsgiBoostHttp server stopped.\n";
+			m_is_running.store(false);
+		}
+		else
+		{
+			cerr << "The server is already running!\n";
+		}
+	}
+
+
+	void HttpServer::stop()
+	{
+		if (is_running())
+		{
+			if (m_is_master.load())
+			{
+				m_io_service.post([this]() { stop_workers(); });
+				return;
+			}
+			// The second stop request, e.g. repeated Ctrl+C, does not wait for in-flight requests
+			if (shutdown_timeout == 0 || m_draining.exchange(true))
+			{
+				terminate();
+				return;
+			}
+			m_drain_deadline = chrono::steady_clock::now() + chrono::seconds(shutdown_timeout);
+			m_io_service.post([this]() { drain(); });
+		}
+		else
+		{
+			cerr << "The server is not running!\n";
+		}
+	}
+
+
+	void HttpServer::terminate()
+	{
+		sys::error_code ec;
+		m_acceptor.close(ec);
+		m_handoff_acceptor.close(ec);
+#ifdef WSGI_BOOST_IO_URING
+		// Closing the listening socket does not stop a multishot accept that holds a reference to it
+		shared_ptr<IoUringAccept> accept_operation = atomic_exchange(&m_io_uring_accept, shared_ptr<IoUringAccept>());
+		if (accept_operation)
+			m_io_uring.cancel(accept_operation);
+#endif // WSGI_BOOST_IO_URING
+		m_io_service.stop();
+		m_signals.cancel();
+	}
+
+
+	void HttpServer::drain()
+	{
+		sys::error_code ec;
+		m_acceptor.close(ec);
+		m_handoff_acceptor.close(ec);
+#ifdef WSGI_BOOST_IO_URING
+		// Closing the listening socket does not stop a multishot accept that holds a reference to it
+		shared_ptr<IoUringAccept> accept_operation = atomic_exchange(&m_io_uring_accept, shared_ptr<IoUringAccept>());
+		if (accept_operation)
+			m_io_uring.cancel(accept_operation);
+#endif // WSGI_BOOST_IO_URING
+		m_accept_timer.cancel();
+		m_websockets.close_all(static_cast<unsigned short>(WebSocketStatus::going_away), "Server is shutting down");
+		check_drain();
+	}
+
+
+	void HttpServer::check_drain()
+	{
+		// Idle keep-alive connections are closed right away and busy ones after their current request.
+		// Eviction is repeated for connections that have become idle after the previous check.
+		m_idle_connections.evict(m_idle_connections.size());
+		if ((*m_stats)[m_worker_index].active_connections.load() <= 0 || chrono::steady_clock::now() >= m_drain_deadline)
+		{
+			terminate();
+			return;
+		}
+		m_drain_timer.expires_from_now(boost::posix_time::milliseconds(100));
+		m_drain_timer.async_wait([this](const sys::error_code& ec)
+		{
+			if (!ec)
+				check_drain();
+		});
+	}
+
+
+	bool HttpServer::is_running() const
+	{
+		return m_is_running.load();
+	}
+
+
+	void HttpServer::restart_workers()
+	{
+		if (m_is_master.load())
+		{
+			m_io_service.post([this]()
+			{
+				if (m_stopping_workers || !m_restart_queue.empty())
+					return;
+				for (size_t i = 0; i < m_workers.size(); ++i)
+				{
+					m_restart_queue.push_back(i);
+				}
+			});
+		}
+		else
+		{
+			cerr << "The server is not running in multi-process mode!\n";
+		}
+	}
+
+
+	py::dict HttpServer::listen_stats()
+	{
+		py::dict stats;
+#ifdef __linux__
+		if (m_acceptor.is_open())
+		{
+			tcp_info info;
+			socklen_t info_size = sizeof(info);
+			// For a listening socket the kernel reports the current accept queue length
+			// in tcpi_unacked and the backlog in tcpi_sacked.
+			if (getsockopt(m_acceptor.native_handle(), IPPROTO_TCP, TCP_INFO, &info, &info_size) == 0)
+			{
+				stats["queue_length"] = info.tcpi_unacked;
+				stats["backlog"] = info.tcpi_sacked;
+			}
+		}
+		ifstream netstat{ "/proc/net/netstat" };
+		string names;
+		string values;
+		while (getline(netstat, names) && getline(netstat, values))
+		{
+			if (names.compare(0, 7, "TcpExt:") != 0)
+				continue;
+			istringstream names_stream{ names };
+			istringstream values_stream{ values };
+			string name;
+			string value;
+			while (names_stream >> name && values_stream >> value)
+			{
+				if (name == "ListenOverflows")
+					stats["overflows"] = stoull(value);
+				else if (name == "ListenDrops")
+					stats["drops"] = stoull(value);
+			}
+			break;
+		}
+#endif // __linux__
+		return stats;
+	}
+
+
+	size_t HttpServer::purge_cache(string path)
+	{
+		return m_cache.purge(path);
+	}
+
+
+	py::dict HttpServer::cache_stats()
+	{
+		CacheStats stats = m_cache.stats();
+		py::dict stats_dict;
+		stats_dict["entries"] = stats.entries;
+		stats_dict["size"] = stats.size;
+		stats_dict["hits"] = stats.hits;
+		stats_dict["misses"] = stats.misses;
+		stats_dict["collapsed"] = stats.collapsed;
+		return stats_dict;
+	}
+
+
+	py::dict HttpServer::io_uring_stats()
+	{
+		IoUringStats stats;
+		bool running = false;
+#ifdef WSGI_BOOST_IO_URING
+		stats = m_io_uring.stats();
+		running = m_io_uring.is_running();
+#endif // WSGI_BOOST_IO_URING
+		py::dict stats_dict;
+		stats_dict["running"] = running;
+		stats_dict["enter_calls"] = stats.enter_calls;
+		stats_dict["submissions"] = stats.submissions;
+		stats_dict["completions"] = stats.completions;
+		stats_dict["buffers_exhausted"] = stats.buffers_exhausted;
+		return stats_dict;
+	}
+
+
+	py::list HttpServer::worker_stats() const
+	{
+		py::list stats_list;
+		shared_ptr<WorkerStatsBlock> stats = m_stats;
+		if (!stats)
+			return stats_list;
+		for (size_t i = 0; i < stats->size(); ++i)
+		{
+			const WorkerStats& worker_stats = (*stats)[i];
+			py::dict item;
+			item["pid"] = worker_stats.pid.load();
+			item["restarts"] = worker_stats.restarts.load();
+			item["connections"] = worker_stats.connections.load();
+			item["active_connections"] = worker_stats.active_connections.load();
+			item["requests"] = worker_stats.requests.load();
+			stats_list.append(item);
+		}
+		return stats_list;
+	}
+
+#ifndef _WIN32
+
+	void HttpServer::run_master()
+	{
+		m_workers.assign(num_processes, Worker{});
+		m_stopping_workers = false;
+		m_restart_queue.clear();
+		m_restarting_pid = 0;
+		// Stop signals are handled by workers, so they must not be queued in the master
+		m_signals.clear();
+		add_stop_signals(m_master_signals);
+		m_master_signals.add(SIGHUP);
+		m_master_signals.add(SIGCHLD);
+		wait_master_signal();
+		m_is_master.store(true);
+		m_is_running.store(true);
+		// Workers are forked only from this loop and never from inside a handler
+		// because a child process cannot call run() on an io_service that is already running.
+		while (true)
+		{
+			reap_workers();
+			if (m_stopping_workers)
+			{
+				bool all_stopped = true;
+				for (const auto& worker : m_workers)
+				{
+					if (worker.pid > 0)
+						all_stopped = false;
+				}
+				if (all_stopped)
+					break;
+			}
+			else
+			{
+				spawn_workers();
+				continue_restart();
+			}
+			m_io_service.run_one();
+		}
+		m_is_master.store(false);
+		m_master_signals.cancel();
+		m_master_signals.clear();
+		m_respawn_timer.cancel();
+		m_io_service.poll();
+		m_acceptor.close();
+		add_stop_signals(m_signals);
+	}
+
+
+	void HttpServer::wait_master_signal()
+	{
+		m_master_signals.async_wait([this](const sys::error_code& ec, int signal_number)
+		{
+			if (ec)
+				return;
+			if (signal_number == SIGHUP)
+			{
+				restart_workers();
+			}
+			else if (signal_number != SIGCHLD)
+			{
+				stop_workers();
+			}
+			wait_master_signal();
+		});
+	}
+
+
+	void HttpServer::spawn_workers()
+	{
+		auto now = chrono::steady_clock::now();
+		auto next_respawn = chrono::steady_clock::time_point::max();
+		for (size_t i = 0; i < m_workers.size(); ++i)
+		{
+			if (m_workers[i].pid > 0)
+				continue;
+			if (m_workers[i].respawn_at <= now)
+			{
+				spawn_worker(i);
+			}
+			else if (m_workers[i].respawn_at < next_respawn)
+			{
+				next_respawn = m_workers[i].respawn_at;
+			}
+		}
+		if (next_respawn != chrono::steady_clock::time_point::max())
+		{
+			auto delay = chrono::duration_cast<chrono::milliseconds>(next_respawn - now).count();
+			m_respawn_timer.expires_from_now(boost::posix_time::milliseconds(delay));
+			m_respawn_timer.async_wait([](const sys::error_code&) {});
+		}
+	}
+
+
+	void HttpServer::spawn_worker(size_t index)
+	{
+		pid_t pid;
+		{
+			GilAcquire acquire_gil;
+			m_io_service.notify_fork(asio::io_service::fork_prepare);
+#if PY_VERSION_HEX >= 0x03070000
+			PyOS_BeforeFork();
+#endif
+			pid = fork();
+			if (pid == 0)
+			{
+#if PY_VERSION_HEX >= 0x03070000
+				PyOS_AfterFork_Child();
+#else
+				PyOS_AfterFork();
+#endif
+			}
+#if PY_VERSION_HEX >= 0x03070000
+			else
+			{
+				PyOS_AfterFork_Parent();
+			}
+#endif
+		}
+		if (pid == 0)
+		{
+			m_io_service.notify_fork(asio::io_service::fork_child);
+			// Only the master process hands off the listening socket
+			sys::error_code ec;
+			m_handoff_acceptor.close(ec);
+			m_is_master.store(false);
+			m_master_signals.cancel();
+			m_master_signals.clear();
+			m_respawn_timer.cancel();
+			m_workers.clear();
+			add_stop_signals(m_signals);
+			m_worker_index = index;
+			(*m_stats)[index].pid.store(getpid());
+			serve();
+			cout.flush();
+			cerr.flush();
+			// The child process must never return into the Python code of the master
+			_exit(0);
+		}
+		m_io_service.notify_fork(asio::io_service::fork_parent);
+		if (pid < 0)
+		{
+			cerr << "Unable to fork a worker process!\n";
+			m_workers[index].respawn_at = chrono::steady_clock::now() + chrono::seconds(1);
+			return;
+		}
+		(*m_stats)[index].pid.store(pid);
+		m_workers[index].pid = pid;
+		m_workers[index].started = chrono::steady_clock::now();
+	}
+
+
+	void HttpServer::reap_workers()
+	{
+		for (size_t i = 0; i < m_workers.size(); ++i)
+		{
+			Worker& worker = m_workers[i];
+			if (worker.pid <= 0)
+				continue;
+			int status;
+			// Only own workers are waited for to leave other child processes of the Python program alone
+			if (waitpid(static_cast<pid_t>(worker.pid), &status, WNOHANG) != static_cast<pid_t>(worker.pid))
+				continue;
+			WorkerStats& worker_stats = (*m_stats)[i];
+			unsigned long long restarts = worker_stats.restarts.load();
+			worker_stats.reset();
+			worker_stats.restarts.store(restarts + 1);
+			auto now = chrono::steady_clock::now();
+			if (worker.pid == m_restarting_pid)
+			{
+				m_restarting_pid = 0;
+				worker.respawn_at = now;
+			}
+			else if (!m_stopping_workers)
+			{
+				cerr << "Worker process " << worker.pid << " exited unexpectedly, restarting.\n";
+				// Protect against a fork loop if workers die right after start
+				if (now - worker.started < chrono::seconds(1))
+				{
+					worker.respawn_at = now + chrono::seconds(1);
+				}
+				else
+				{
+					worker.respawn_at = now;
+				}
+			}
+			worker.pid = 0;
+		}
+	}
+
+
+	void HttpServer::stop_workers()
+	{
+		m_stopping_workers = true;
+		m_restart_queue.clear();
+		for (const auto& worker : m_workers)
+		{
+			if (worker.pid > 0)
+				kill(static_cast<pid_t>(worker.pid), SIGTERM);
+		}
+	}
+
+
+	void HttpServer::continue_restart()
+	{
+		while (m_restarting_pid == 0 && !m_restart_queue.empty())
+		{
+			size_t index = m_restart_queue.front();
+			m_restart_queue.pop_front();
+			if (m_workers[index].pid > 0)
+			{
+				m_restarting_pid = m_workers[index].pid;
+				kill(static_cast<pid_t>(m_restarting_pid), SIGTERM);
+			}
+		}
+	}
+
+#endif // _WIN32
+}
+
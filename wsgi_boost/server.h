@@ -7,41 +7,190 @@ License: MIT, see License.txt
 */
 
 #include "request_handlers.h"
+#include "workers.h"
+#include "admission.h"
+#include "access_log.h"
+#include "traffic_capture.h"
+#include "http2.h"
+#include "fast_paths.h"
+
+#include <boost/version.hpp>
 
 #include <thread>
 #include <string>
 #include <vector>
 #include <atomic>
+#include <memory>
+#include <chrono>
+#include <deque>
+
+
+#if defined(__linux__) && BOOST_VERSION >= 106600
+// Drain the accept queue with accept4() after the acceptor becomes readable
+#define WSGI_BOOST_BATCHED_ACCEPT
+#endif
 
 
 namespace wsgi_boost
 {
+	typedef boost::asio::basic_socket_acceptor<boost::asio::generic::stream_protocol> acceptor_type;
+
+
 	class HttpServer
 	{
 	private:
+		// Forked worker process slot
+		struct Worker
+		{
+			long long pid = 0;
+			std::chrono::steady_clock::time_point started;
+			std::chrono::steady_clock::time_point respawn_at;
+		};
+
+		// Timing wheels, idle connections and the ring must outlive io_service because pending coroutines
+		// that own connections can be destroyed together with io_service.
+		std::vector<std::unique_ptr<TimeoutWheel>> m_timeout_wheels;
+		IdleConnections m_idle_connections;
+#ifdef WSGI_BOOST_IO_URING
+		IoUring m_io_uring;
+		// The multishot accept of the listening socket, accessed atomically
+		std::shared_ptr<IoUringAccept> m_io_uring_accept;
+#endif // WSGI_BOOST_IO_URING
+		std::chrono::steady_clock::time_point m_timeouts_origin;
 		boost::asio::io_service m_io_service;
-		boost::asio::ip::tcp::acceptor m_acceptor;
+		acceptor_type m_acceptor;
+		acceptor_type m_handoff_acceptor;
+		std::string m_handoff_path;
 		std::vector<std::thread> m_threads;
 		unsigned int m_num_threads;
 		std::string m_ip_address;
 		unsigned short m_port;
+		// The actual port of the listening socket, 0 for a Unix domain socket
+		unsigned short m_local_port = 0;
+		std::string m_unix_socket_path;
 		boost::asio::signal_set m_signals;
-		std::vector<std::pair<boost::regex, std::string>> m_static_routes;
+		static_routes_type m_static_routes;
+		FastPaths m_fast_paths;
+		websocket_routes_type m_websocket_routes;
+		WebSocketSessions m_websockets;
 		boost::python::object m_app;
 		std::atomic_bool m_is_running;
+		std::shared_ptr<WorkerStatsBlock> m_stats;
+		size_t m_worker_index = 0;
+		std::atomic_bool m_is_master;
+		boost::asio::signal_set m_master_signals;
+		boost::asio::deadline_timer m_respawn_timer;
+		boost::asio::deadline_timer m_timeouts_timer;
+		boost::asio::deadline_timer m_accept_timer;
+		boost::asio::deadline_timer m_drain_timer;
+		std::chrono::steady_clock::time_point m_drain_deadline;
+		std::atomic_bool m_draining;
+		long long m_fd_watermark = 0;
+		std::vector<Worker> m_workers;
+		bool m_stopping_workers = false;
+		std::deque<size_t> m_restart_queue;
+		long long m_restarting_pid = 0;
+		std::atomic_bool m_accept_paused;
+		AdmissionControl m_admission;
+		AccessLog m_access_log;
+		AccessLog::Format m_access_log_format = AccessLog::Format::common;
+		TrafficCapture m_capture;
+		ResponseCache m_cache;
+		AsgiLoop m_asgi_loop;
+#ifdef WSGI_BOOST_TLS
+		std::unique_ptr<TlsContext> m_tls_context;
+#endif // WSGI_BOOST_TLS
 
+		void serve();
+		void open_acceptor();
+		void open_handoff_acceptor();
+		void accept_handoff();
+		void drain();
+		void check_drain();
+		void terminate();
 		void accept();
+#ifdef WSGI_BOOST_BATCHED_ACCEPT
+		void accept_batch();
+#endif // WSGI_BOOST_BATCHED_ACCEPT
+#ifdef WSGI_BOOST_IO_URING
+		void accept_io_uring();
+#endif // WSGI_BOOST_IO_URING
+		bool check_descriptors(const boost::system::error_code& ec);
+		void retry_accept();
+		void start_connection(socket_ptr socket);
+		void resume_accept();
+		void check_timeouts();
+		void wait_signal();
+		void reject_request(Response& response);
+		void log_request(const Request& request, const Response& response, std::string& remote_address,
+			std::chrono::steady_clock::time_point start);
 		void process_request(socket_ptr socket);
-		void check_static_route(Request& request);
+		void serve_request(Connection& connection, Request& request, Response& response, std::string& captured_content);
+		void finish_request(const Request& request, const Response& response, std::string& remote_address,
+			std::chrono::steady_clock::time_point start);
+		void serve_http2(Connection& connection, const Request* request);
+		bool serve_websocket(Connection& connection, Request& request, Response& response);
+		void process_stream(std::shared_ptr<Http2Session> session, std::shared_ptr<Http2Stream> stream);
+		void evict_idle_connections(long long handle);
 		void handle_request(Request& request, Response& response);
+		bool is_metrics_request(const Request& request) const;
+		void send_metrics(Response& response);
+		MetricsSnapshot collect_metrics() const;
+#ifndef _WIN32
+		void run_master();
+		void wait_master_signal();
+		void spawn_workers();
+		void spawn_worker(size_t index);
+		void reap_workers();
+		void stop_workers();
+		void continue_restart();
+#endif // _WIN32
 
 	public:
 		unsigned int header_timeout = 5;
 		unsigned int content_timeout = 300;
+		unsigned int keep_alive_timeout = 5;
+		unsigned int max_keep_alive_requests = 0;
+		unsigned int fd_watermark = 90;
+		unsigned int accept_batch_size = 16;
+		unsigned int defer_accept = 0;
+		int listen_backlog = 0;
 		bool reuse_address = true;
+		unsigned int shutdown_timeout = 30;
+		std::string handoff_socket;
+		std::string unix_socket;
+		unsigned int unix_socket_mode = 0;
+		int listen_fd = -1;
 		std::string url_scheme = "http";
 		std::string host_name;
 		bool use_gzip = true;
+		bool asgi = false;
+		unsigned int num_processes = 1;
+		unsigned int max_connections = 0;
+		unsigned int max_app_requests = 0;
+		unsigned int queue_delay_target = 0;
+		unsigned int queue_delay_interval = 100;
+		std::string metrics_path;
+		bool profile_gil = false;
+		std::string access_log;
+		std::string access_log_format = "common";
+		std::string capture_file;
+		std::string capture_redact_headers = "Authorization,Cookie";
+		unsigned int capture_content_limit = 65536;
+		bool http2 = false;
+		unsigned int http2_max_streams = 100;
+		size_t http2_max_content_size = 16777216;
+		std::string tls_cert_file;
+		std::string tls_key_file;
+		unsigned int tls_session_cache_size = 20480;
+		bool tls_session_tickets = true;
+		bool ktls = true;
+		size_t response_cache_size = 0;
+		size_t response_cache_max_entry_size = 1048576;
+		unsigned int response_cache_lock_timeout = 5000;
+		unsigned int websocket_timeout = 60;
+		size_t websocket_max_message_size = 1048576;
+		bool io_uring = false;
 
 		HttpServer(const HttpServer&) = delete;
 		HttpServer& operator=(const HttpServer&) = delete;
@@ -51,16 +200,52 @@ namespace wsgi_boost
 		// Add a path to static content
 		void add_static_route(std::string path, std::string content_dir);
 
-		// Set WSGI application
+		// Add a response for a path that is served without calling the WSGI app
+		void add_fixed_response(std::string path, std::string status, boost::python::list headers, boost::python::object body);
+
+		// Add a redirect for paths with a prefix that is served without calling the WSGI app
+		void add_redirect(std::string prefix, std::string target, std::string status, bool append_path);
+
+		// Add a route for WebSocket connections served by a Python handler
+		void add_websocket_route(std::string path, boost::python::object handler);
+
+		// Set WSGI application, or ASGI application if asgi is enabled
 		void set_app(boost::python::object app);
 
 		// Start handling HTTP requests
 		void start();
 
-		// Stop handling http requests
+		// Stop handling http requests after in-flight requests are finished
 		void stop();
 
 		// Check if the server is running
 		bool is_running() const;
+
+		// Restart worker processes one at a time
+		void restart_workers();
+
+		// Get per-process statistics
+		boost::python::list worker_stats() const;
+
+		// Get traffic counters and latency statistics of request processing stages
+		boost::python::dict stats() const;
+
+		// Get GIL wait and hold statistics collected if profile_gil is enabled
+		boost::python::dict gil_stats() const;
+
+		// Reopen the access log file
+		void reopen_access_log();
+
+		// Get listen queue statistics
+		boost::python::dict listen_stats();
+
+		// Remove cached responses of the current process, all responses if the path is empty
+		size_t purge_cache(std::string path);
+
+		// Get response cache statistics of the current process
+		boost::python::dict cache_stats();
+
+		// Get io_uring operation counters of the current process
+		boost::python::dict io_uring_stats();
 	};
 }
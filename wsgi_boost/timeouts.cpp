@@ -0,0 +1,137 @@
+/*
+Hierarchical timing wheel for connection timeouts
+
+Copyright (c) 2016 Roman Miroshnychenko <romanvm@yandex.ua>
+License: MIT, see License.txt
+*/
+
+#include "timeouts.h"
+
+using namespace std;
+
+
+namespace wsgi_boost
+{
+	TimeoutWheel::TimeoutWheel()
+	{
+		for (auto& head : m_level0)
+			head.prev = head.next = &head;
+		for (auto& head : m_level1)
+			head.prev = head.next = &head;
+		for (auto& head : m_level2)
+			head.prev = head.next = &head;
+	}
+
+
+	void TimeoutWheel::schedule(TimeoutEntry& entry, unsigned int timeout)
+	{
+		lock_guard<mutex> lock{ m_mutex };
+		if (entry.linked())
+		{
+			unlink(entry);
+		}
+		else
+		{
+			++m_size;
+		}
+		// +1 tick because the current tick is already partially elapsed
+		entry.expires = m_current + static_cast<unsigned long long>(timeout) * ticks_per_second + 1;
+		insert(entry);
+	}
+
+
+	void TimeoutWheel::cancel(TimeoutEntry& entry)
+	{
+		lock_guard<mutex> lock{ m_mutex };
+		if (entry.linked())
+		{
+			unlink(entry);
+			--m_size;
+		}
+	}
+
+
+	void TimeoutWheel::advance(unsigned long long tick)
+	{
+		lock_guard<mutex> lock{ m_mutex };
+		while (m_current < tick)
+		{
+			if (m_size == 0)
+			{
+				m_current = tick;
+				break;
+			}
+			++m_current;
+			if ((m_current & (level0_size - 1)) == 0)
+			{
+				unsigned long long index1 = (m_current >> level0_bits) & (level_size - 1);
+				if (index1 == 0)
+					cascade(m_level2[(m_current >> (level0_bits + level_bits)) & (level_size - 1)]);
+				cascade(m_level1[index1]);
+			}
+			TimeoutEntry& head = m_level0[m_current & (level0_size - 1)];
+			while (head.next != &head)
+			{
+				TimeoutEntry* entry = head.next;
+				unlink(*entry);
+				--m_size;
+				// Shutting down the socket under the lock guarantees that its connection still exists.
+				// Pending async and blocking sync operations on the socket fail immediately after that,
+				// and the socket is closed when its connection is done.
+#ifdef _WIN32
+				::shutdown(entry->handle, SD_BOTH);
+#else
+				::shutdown(entry->handle, SHUT_RDWR);
+#endif // _WIN32
+			}
+		}
+	}
+
+
+	void TimeoutWheel::insert(TimeoutEntry& entry)
+	{
+		if (entry.expires - m_current >= max_delta)
+			entry.expires = m_current + max_delta - 1;
+		unsigned long long delta = entry.expires - m_current;
+		if (delta < level0_size)
+		{
+			link(m_level0[entry.expires & (level0_size - 1)], entry);
+		}
+		else if (delta < (level0_size << level_bits))
+		{
+			link(m_level1[(entry.expires >> level0_bits) & (level_size - 1)], entry);
+		}
+		else
+		{
+			link(m_level2[(entry.expires >> (level0_bits + level_bits)) & (level_size - 1)], entry);
+		}
+	}
+
+
+	void TimeoutWheel::cascade(TimeoutEntry& head)
+	{
+		while (head.next != &head)
+		{
+			TimeoutEntry* entry = head.next;
+			unlink(*entry);
+			insert(*entry);
+		}
+	}
+
+
+	void TimeoutWheel::link(TimeoutEntry& head, TimeoutEntry& entry)
+	{
+		entry.prev = head.prev;
+		entry.next = &head;
+		head.prev->next = &entry;
+		head.prev = &entry;
+	}
+
+
+	void TimeoutWheel::unlink(TimeoutEntry& entry)
+	{
+		entry.prev->next = entry.next;
+		entry.next->prev = entry.prev;
+		entry.prev = entry.next = nullptr;
+	}
+}
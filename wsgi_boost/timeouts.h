@@ -0,0 +1,77 @@
+#pragma once
+/*
+Hierarchical timing wheel for connection timeouts
+
+Copyright (c) 2016 Roman Miroshnychenko <romanvm@yandex.ua>
+License: MIT, see License.txt
+*/
+
+#include <boost/asio.hpp>
+
+#include <array>
+#include <mutex>
+
+
+namespace wsgi_boost
+{
+	// Timeout of a single connection linked into a TimeoutWheel slot
+	struct TimeoutEntry
+	{
+		TimeoutEntry* prev = nullptr;
+		TimeoutEntry* next = nullptr;
+		unsigned long long expires = 0;
+		boost::asio::ip::tcp::socket::native_handle_type handle;
+
+		bool linked() const
+		{
+			return next != nullptr;
+		}
+	};
+
+
+	// Tracks connection timeouts with O(1) scheduling and cancellation.
+	// Expired connections are shut down in batches on each tick
+	// and no handler is ever queued for a cancelled timeout.
+	// The server shards connections across several wheels by socket handle to reduce
+	// lock contention. A wheel is not bound to a thread: coroutines resume on any server thread
+	// and wheels are advanced by the server timer, so each wheel is guarded by a mutex.
+	class TimeoutWheel
+	{
+	public:
+		static const unsigned int ticks_per_second = 10;
+
+		TimeoutWheel(const TimeoutWheel&) = delete;
+		TimeoutWheel& operator=(const TimeoutWheel&) = delete;
+
+		TimeoutWheel();
+
+		// (Re)arm a timeout in seconds
+		void schedule(TimeoutEntry& entry, unsigned int timeout);
+
+		// Cancel a timeout if it is armed
+		void cancel(TimeoutEntry& entry);
+
+		// Advance the wheel up to the given tick and shut down connections with expired timeouts
+		void advance(unsigned long long tick);
+
+	private:
+		static const unsigned int level0_bits = 8;
+		static const unsigned int level_bits = 6;
+		static const unsigned long long level0_size = 1ULL << level0_bits;
+		static const unsigned long long level_size = 1ULL << level_bits;
+		static const unsigned long long max_delta = 1ULL << (level0_bits + 2 * level_bits);
+
+		std::mutex m_mutex;
+		unsigned long long m_current = 0;
+		size_t m_size = 0;
+		// Slot lists are circular with a sentinel entry as the list head
+		std::array<TimeoutEntry, level0_size> m_level0;
+		std::array<TimeoutEntry, level_size> m_level1;
+		std::array<TimeoutEntry, level_size> m_level2;
+
+		void insert(TimeoutEntry& entry);
+		void cascade(TimeoutEntry& head);
+		static void link(TimeoutEntry& head, TimeoutEntry& entry);
+		static void unlink(TimeoutEntry& entry);
+	};
+}
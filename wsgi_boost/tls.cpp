@@ -0,0 +1,320 @@
+#include "tls.h"
+
+#ifdef WSGI_BOOST_TLS
+
+#include "exceptions.h"
+
+#include <boost/asio/ssl/error.hpp>
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+
+using namespace std;
+namespace asio = boost::asio;
+namespace sys = boost::system;
+
+
+namespace wsgi_boost
+{
+	namespace
+	{
+		string ssl_error_string()
+		{
+			char buffer[256];
+			ERR_error_string_n(ERR_get_error(), buffer, sizeof(buffer));
+			ERR_clear_error();
+			return buffer;
+		}
+	}
+
+#pragma region TlsContext
+
+	TlsContext::TlsContext(const string& cert_file, const string& key_file, const vector<string>& alpn,
+		long session_cache_size, bool session_tickets, bool ktls) :
+		m_context{ SSL_CTX_new(TLS_server_method()) }
+	{
+		if (m_context == nullptr)
+			throw RuntimeError("Unable to create TLS context: " + ssl_error_string());
+		if (SSL_CTX_use_certificate_chain_file(m_context, cert_file.c_str()) != 1 ||
+			SSL_CTX_use_PrivateKey_file(m_context, (key_file.empty() ? cert_file : key_file).c_str(), SSL_FILETYPE_PEM) != 1 ||
+			SSL_CTX_check_private_key(m_context) != 1)
+		{
+			string message = "Unable to load TLS certificate " + cert_file + ": " + ssl_error_string();
+			SSL_CTX_free(m_context);
+			throw RuntimeError(message);
+		}
+		SSL_CTX_set_min_proto_version(m_context, TLS1_2_VERSION);
+		unsigned long options = SSL_OP_NO_COMPRESSION | SSL_OP_CIPHER_SERVER_PREFERENCE;
+		if (!session_tickets)
+			options |= SSL_OP_NO_TICKET;
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+		// Clients often close connections without close_notify
+		options |= SSL_OP_IGNORE_UNEXPECTED_EOF;
+#endif // SSL_OP_IGNORE_UNEXPECTED_EOF
+#ifdef SSL_OP_ENABLE_KTLS
+		if (ktls)
+			options |= SSL_OP_ENABLE_KTLS;
+#endif // SSL_OP_ENABLE_KTLS
+		SSL_CTX_set_options(m_context, options);
+		// Idle keep-alive connections do not hold read and write buffers
+		SSL_CTX_set_mode(m_context, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_RELEASE_BUFFERS);
+		static const unsigned char session_id_context[] = "wsgi_boost";
+		SSL_CTX_set_session_id_context(m_context, session_id_context, sizeof(session_id_context) - 1);
+		if (session_cache_size > 0)
+		{
+			SSL_CTX_set_session_cache_mode(m_context, SSL_SESS_CACHE_SERVER);
+			SSL_CTX_sess_set_cache_size(m_context, session_cache_size);
+		}
+		else
+		{
+			SSL_CTX_set_session_cache_mode(m_context, SSL_SESS_CACHE_OFF);
+		}
+		for (const auto& protocol : alpn)
+		{
+			m_alpn += static_cast<char>(protocol.length());
+			m_alpn += protocol;
+		}
+		if (!m_alpn.empty())
+			SSL_CTX_set_alpn_select_cb(m_context, &TlsContext::select_alpn, this);
+	}
+
+
+	TlsContext::~TlsContext()
+	{
+		SSL_CTX_free(m_context);
+	}
+
+
+	int TlsContext::select_alpn(SSL* /*ssl*/, const unsigned char** out, unsigned char* out_length,
+		const unsigned char* in, unsigned int in_length, void* arg)
+	{
+		const string& alpn = static_cast<TlsContext*>(arg)->m_alpn;
+		unsigned char* selected;
+		// Server preference order
+		if (SSL_select_next_proto(&selected, out_length, reinterpret_cast<const unsigned char*>(alpn.data()),
+			static_cast<unsigned int>(alpn.length()), in, in_length) != OPENSSL_NPN_NEGOTIATED)
+			return SSL_TLSEXT_ERR_NOACK;
+		*out = selected;
+		return SSL_TLSEXT_ERR_OK;
+	}
+
+
+	SSL_CTX* TlsContext::native_handle() const
+	{
+		return m_context;
+	}
+
+#pragma endregion
+
+#pragma region TlsSession
+
+	TlsSession::TlsSession(TlsContext& context, asio::generic::stream_protocol::socket& socket) :
+		m_ssl{ SSL_new(context.native_handle()) }
+	{
+		sys::error_code ec;
+		socket.non_blocking(true, ec);
+		if (m_ssl != nullptr)
+			SSL_set_fd(m_ssl, static_cast<int>(socket.native_handle()));
+	}
+
+
+	TlsSession::~TlsSession()
+	{
+		SSL_free(m_ssl);
+	}
+
+
+	bool TlsSession::check_result(int result, asio::socket_base::wait_type& wait, sys::error_code& ec)
+	{
+		int sys_error = errno;
+		switch (SSL_get_error(m_ssl, result))
+		{
+		case SSL_ERROR_WANT_READ:
+			wait = asio::socket_base::wait_read;
+			return true;
+		case SSL_ERROR_WANT_WRITE:
+			wait = asio::socket_base::wait_write;
+			return true;
+		case SSL_ERROR_ZERO_RETURN:
+			ec = asio::error::eof;
+			break;
+		case SSL_ERROR_SYSCALL:
+			if (sys_error == EAGAIN || sys_error == EWOULDBLOCK)
+			{
+				wait = asio::socket_base::wait_write;
+				return true;
+			}
+			ec = sys_error != 0 ? sys::error_code(sys_error, sys::system_category()) : asio::error::eof;
+			break;
+		default:
+			ec = sys::error_code(static_cast<int>(ERR_get_error()), asio::error::get_ssl_category());
+			ERR_clear_error();
+		}
+		return false;
+	}
+
+
+	sys::error_code TlsSession::handshake(asio::generic::stream_protocol::socket& socket, asio::yield_context yc)
+	{
+		if (m_ssl == nullptr)
+			return sys::error_code(sys::errc::not_enough_memory, sys::system_category());
+		sys::error_code ec;
+		asio::socket_base::wait_type wait;
+		while (true)
+		{
+			{
+				lock_guard<mutex> lock{ m_mutex };
+				ERR_clear_error();
+				int result = SSL_accept(m_ssl);
+				if (result == 1)
+					break;
+				if (!check_result(result, wait, ec))
+					return ec;
+			}
+			socket.async_wait(wait, yc[ec]);
+			if (ec)
+				return ec;
+		}
+#ifdef BIO_get_ktls_send
+		m_ktls_send = BIO_get_ktls_send(SSL_get_wbio(m_ssl)) != 0;
+#endif // BIO_get_ktls_send
+		return ec;
+	}
+
+
+	size_t TlsSession::async_read_some(asio::generic::stream_protocol::socket& socket, asio::mutable_buffer buffer,
+		asio::yield_context yc, sys::error_code& ec)
+	{
+		int size = static_cast<int>(min(asio::buffer_size(buffer), static_cast<size_t>(INT_MAX)));
+		asio::socket_base::wait_type wait;
+		while (true)
+		{
+			{
+				lock_guard<mutex> lock{ m_mutex };
+				ERR_clear_error();
+				int result = SSL_read(m_ssl, asio::buffer_cast<void*>(buffer), size);
+				if (result > 0)
+					return result;
+				if (!check_result(result, wait, ec))
+					return 0;
+			}
+			socket.async_wait(wait, yc[ec]);
+			if (ec)
+				return 0;
+		}
+	}
+
+
+	size_t TlsSession::read_some(asio::generic::stream_protocol::socket& socket, asio::mutable_buffer buffer, sys::error_code& ec)
+	{
+		int size = static_cast<int>(min(asio::buffer_size(buffer), static_cast<size_t>(INT_MAX)));
+		asio::socket_base::wait_type wait;
+		while (true)
+		{
+			{
+				lock_guard<mutex> lock{ m_mutex };
+				ERR_clear_error();
+				int result = SSL_read(m_ssl, asio::buffer_cast<void*>(buffer), size);
+				if (result > 0)
+					return result;
+				if (!check_result(result, wait, ec))
+					return 0;
+			}
+			socket.wait(wait, ec);
+			if (ec)
+				return 0;
+		}
+	}
+
+
+	size_t TlsSession::write(asio::generic::stream_protocol::socket& socket, const char* data, size_t length, sys::error_code& ec)
+	{
+		size_t written = 0;
+		asio::socket_base::wait_type wait;
+		while (written < length)
+		{
+			{
+				lock_guard<mutex> lock{ m_mutex };
+				ERR_clear_error();
+				int result = SSL_write(m_ssl, data + written, static_cast<int>(min(length - written, static_cast<size_t>(INT_MAX))));
+				if (result > 0)
+				{
+					written += result;
+					continue;
+				}
+				if (!check_result(result, wait, ec))
+					break;
+			}
+			socket.wait(wait, ec);
+			if (ec)
+				break;
+		}
+		return written;
+	}
+
+
+	size_t TlsSession::send_file(asio::generic::stream_protocol::socket& socket, int fd, long long offset, size_t length, sys::error_code& ec)
+	{
+		size_t sent = 0;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && defined(__linux__)
+		if (!m_ktls_send)
+		{
+			ec = sys::error_code(sys::errc::operation_not_supported, sys::system_category());
+			return 0;
+		}
+		asio::socket_base::wait_type wait;
+		while (sent < length)
+		{
+			{
+				lock_guard<mutex> lock{ m_mutex };
+				ERR_clear_error();
+				ossl_ssize_t result = SSL_sendfile(m_ssl, fd, offset + sent, length - sent, 0);
+				if (result > 0)
+				{
+					sent += result;
+					continue;
+				}
+				if (!check_result(static_cast<int>(result), wait, ec))
+					break;
+			}
+			socket.wait(wait, ec);
+			if (ec)
+				break;
+		}
+#else
+		ec = sys::error_code(sys::errc::operation_not_supported, sys::system_category());
+#endif // OPENSSL_VERSION_NUMBER >= 0x30000000L && defined(__linux__)
+		return sent;
+	}
+
+
+	string TlsSession::alpn_protocol() const
+	{
+		const unsigned char* protocol = nullptr;
+		unsigned int length = 0;
+		SSL_get0_alpn_selected(m_ssl, &protocol, &length);
+		return protocol != nullptr ? string(reinterpret_cast<const char*>(protocol), length) : string();
+	}
+
+
+	bool TlsSession::ktls_send() const
+	{
+		return m_ktls_send;
+	}
+
+
+	void TlsSession::shutdown()
+	{
+		lock_guard<mutex> lock{ m_mutex };
+		ERR_clear_error();
+		SSL_shutdown(m_ssl);
+	}
+
+#pragma endregion
+}
+
+#endif // WSGI_BOOST_TLS
@@ -0,0 +1,106 @@
+#pragma once
+/*
+TLS termination with OpenSSL
+
+Copyright (c) 2016 Roman Miroshnychenko <romanvm@yandex.ua>
+License: MIT, see License.txt
+*/
+
+#include <boost/asio.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/version.hpp>
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#if defined(WSGI_BOOST_TLS) && BOOST_VERSION < 106600
+#error "TLS support requires Boost 1.66 or newer"
+#endif
+
+struct ssl_st;
+struct ssl_ctx_st;
+
+
+namespace wsgi_boost
+{
+	// Server TLS configuration shared by all connections.
+	// OpenSSL session cache and session ticket keys belong to the context, so a session
+	// can be resumed on any server thread, and tickets are accepted by all worker processes
+	// because the context is created before the workers are forked.
+	class TlsContext
+	{
+	private:
+		ssl_ctx_st* m_context;
+		// ALPN protocols in the wire format
+		std::string m_alpn;
+
+		static int select_alpn(ssl_st* ssl, const unsigned char** out, unsigned char* out_length,
+			const unsigned char* in, unsigned int in_length, void* arg);
+
+	public:
+		TlsContext(const TlsContext&) = delete;
+		TlsContext& operator=(const TlsContext&) = delete;
+
+		// Load a certificate chain and a private key in PEM format, throws RuntimeError on failure
+		TlsContext(const std::string& cert_file, const std::string& key_file, const std::vector<std::string>& alpn,
+			long session_cache_size, bool session_tickets, bool ktls);
+
+		~TlsContext();
+
+		ssl_ctx_st* native_handle() const;
+	};
+
+
+	// TLS connection on a socket descriptor.
+	//
+	// asio::ssl::stream cannot be used because its engine encrypts records in memory buffers,
+	// so OpenSSL works with the descriptor directly and can hand record encryption over
+	// to the kernel (kTLS) after the handshake. The socket is switched to non-blocking mode
+	// and asio is only used for waiting on it. Reads and writes may be called from different threads
+	// (HTTP/2 streams), so OpenSSL calls are serialized.
+	class TlsSession
+	{
+	private:
+		ssl_st* m_ssl;
+		std::mutex m_mutex;
+		bool m_ktls_send = false;
+
+		// Map the result of an OpenSSL call, returns true if the call must be repeated
+		// after waiting for the socket
+		bool check_result(int result, boost::asio::socket_base::wait_type& wait, boost::system::error_code& ec);
+
+	public:
+		TlsSession(const TlsSession&) = delete;
+		TlsSession& operator=(const TlsSession&) = delete;
+
+		TlsSession(TlsContext& context, boost::asio::generic::stream_protocol::socket& socket);
+
+		~TlsSession();
+
+		boost::system::error_code handshake(boost::asio::generic::stream_protocol::socket& socket, boost::asio::yield_context yc);
+
+		size_t async_read_some(boost::asio::generic::stream_protocol::socket& socket, boost::asio::mutable_buffer buffer,
+			boost::asio::yield_context yc, boost::system::error_code& ec);
+
+		// Blocking read for the same reasons as synchronous socket reads in Connection
+		size_t read_some(boost::asio::generic::stream_protocol::socket& socket, boost::asio::mutable_buffer buffer, boost::system::error_code& ec);
+
+		// Blocking write of all data
+		size_t write(boost::asio::generic::stream_protocol::socket& socket, const char* data, size_t length, boost::system::error_code& ec);
+
+		// Send a file region with sendfile() if the kernel encrypts sent records,
+		// returns operation_not_supported otherwise
+		size_t send_file(boost::asio::generic::stream_protocol::socket& socket, int fd, long long offset, size_t length,
+			boost::system::error_code& ec);
+
+		// Protocol negotiated with ALPN, empty if the client did not use ALPN
+		std::string alpn_protocol() const;
+
+		// Check if sent records are encrypted by the kernel
+		bool ktls_send() const;
+
+		// Send close_notify alert without waiting for the reply
+		void shutdown();
+	};
+}
@@ -0,0 +1,133 @@
+/*
+Request traffic capture
+
+Copyright (c) 2016 Roman Miroshnychenko <romanvm@yandex.ua>
+License: MIT, see License.txt
+*/
+
+#include "traffic_capture.h"
+#include "exceptions.h"
+#include "request.h"
+
+#include <boost/algorithm/string.hpp>
+
+#include <algorithm>
+
+using namespace std;
+
+
+namespace wsgi_boost
+{
+	namespace
+	{
+		const size_t file_buffer_size = 1 << 20;
+		const string redacted_value = "[redacted]";
+
+		// Records are serialized outside the file lock
+		thread_local string record_buffer;
+
+
+		template <typename T>
+		void put_integer(string& buffer, T value, size_t size)
+		{
+			unsigned long long uvalue = static_cast<unsigned long long>(value);
+			for (size_t i = 0; i < size; ++i)
+			{
+				buffer += static_cast<char>(uvalue & 0xff);
+				uvalue >>= 8;
+			}
+		}
+
+
+		// Strings that do not fit their length field are truncated
+		void put_string(string& buffer, const string& value, size_t length_size)
+		{
+			unsigned long long max_length = (1ULL << (8 * length_size)) - 1;
+			size_t length = static_cast<size_t>(min(static_cast<unsigned long long>(value.length()), max_length));
+			put_integer(buffer, length, length_size);
+			buffer.append(value, 0, length);
+		}
+	}
+
+	const char TrafficCapture::magic[] = "WBCAP001";
+
+
+	TrafficCapture::~TrafficCapture()
+	{
+		close();
+	}
+
+
+	void TrafficCapture::open(const string& path, const string& redacted_headers)
+	{
+		lock_guard<mutex> lock{ m_mutex };
+		m_file = fopen(path.c_str(), "ab");
+		if (m_file == nullptr)
+			throw RuntimeError("Unable to open capture file " + path);
+		setvbuf(m_file, nullptr, _IOFBF, file_buffer_size);
+		m_redacted_headers.clear();
+		boost::split(m_redacted_headers, redacted_headers, boost::is_any_of(","));
+		for (auto& name : m_redacted_headers)
+			boost::trim(name);
+		m_redacted_headers.erase(remove(m_redacted_headers.begin(), m_redacted_headers.end(), string()),
+			m_redacted_headers.end());
+		// Captures of restarted workers are appended to the same file
+		fseek(m_file, 0, SEEK_END);
+		if (ftell(m_file) == 0)
+			fwrite(magic, 1, sizeof(magic) - 1, m_file);
+		m_open.store(true);
+	}
+
+
+	void TrafficCapture::close()
+	{
+		lock_guard<mutex> lock{ m_mutex };
+		m_open.store(false);
+		if (m_file != nullptr)
+		{
+			fclose(m_file);
+			m_file = nullptr;
+		}
+	}
+
+
+	bool TrafficCapture::is_open() const
+	{
+		return m_open.load();
+	}
+
+
+	void TrafficCapture::record(const Request& request, long long content_length, chrono::system_clock::time_point time,
+		const string& content)
+	{
+		string& buffer = record_buffer;
+		buffer.clear();
+		put_integer(buffer, 0, 4);
+		put_integer(buffer, chrono::duration_cast<chrono::microseconds>(time.time_since_epoch()).count(), 8);
+		put_integer(buffer, content_length, 8);
+		put_string(buffer, request.method, 1);
+		put_string(buffer, request.path, 4);
+		put_string(buffer, request.http_version, 1);
+		size_t header_count = min(request.headers.size(), static_cast<size_t>(0xffff));
+		put_integer(buffer, header_count, 2);
+		size_t i = 0;
+		for (const auto& header : request.headers)
+		{
+			if (i++ == header_count)
+				break;
+			put_string(buffer, header.name, 2);
+			bool redact = any_of(m_redacted_headers.begin(), m_redacted_headers.end(), [&header](const string& name)
+			{
+				return boost::iequals(name, header.name);
+			});
+			put_string(buffer, redact ? redacted_value : header.value, 4);
+		}
+		put_string(buffer, content, 4);
+		size_t record_size = buffer.size() - 4;
+		for (size_t j = 0; j < 4; ++j)
+			buffer[j] = static_cast<char>((record_size >> (8 * j)) & 0xff);
+		lock_guard<mutex> lock{ m_mutex };
+		if (m_file != nullptr)
+			fwrite(buffer.data(), 1, buffer.size(), m_file);
+	}
+}
@@ -0,0 +1,66 @@
+#pragma once
+/*
+Request traffic capture
+
+Copyright (c) 2016 Roman Miroshnychenko <romanvm@yandex.ua>
+License: MIT, see License.txt
+*/
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+namespace wsgi_boost
+{
+	class Request;
+
+	// Records incoming requests to a binary capture file for replaying them with benchmarks/replay.py.
+	//
+	// The file starts with the 8-byte magic "WBCAP001" followed by records.
+	// All integers are little-endian. Each record is:
+	//   u32 record size (excluding this field)
+	//   u64 request time in microseconds since the epoch
+	//   i64 declared content length, -1 if none
+	//   u8 method length, method
+	//   u32 path length, path (including the query string)
+	//   u8 version length, HTTP version
+	//   u16 header count, then for each header: u16 name length, name, u32 value length, value
+	//   u32 captured content length, content
+	// Captured content may be shorter than the declared content length
+	// if the application did not read all of it or it exceeds the capture limit.
+	class TrafficCapture
+	{
+	private:
+		std::mutex m_mutex;
+		FILE* m_file = nullptr;
+		// Checked for every request without locking the mutex
+		std::atomic<bool> m_open{ false };
+		std::vector<std::string> m_redacted_headers;
+
+	public:
+		static const char magic[];
+
+		TrafficCapture(const TrafficCapture&) = delete;
+		TrafficCapture& operator=(const TrafficCapture&) = delete;
+
+		TrafficCapture() {}
+
+		~TrafficCapture();
+
+		// Open a capture file for appending. Values of headers listed in redacted_headers
+		// (comma-separated, case-insensitive) are replaced with "[redacted]".
+		void open(const std::string& path, const std::string& redacted_headers);
+
+		void close();
+
+		bool is_open() const;
+
+		// Write a request record
+		void record(const Request& request, long long content_length, std::chrono::system_clock::time_point time,
+			const std::string& content);
+	};
+}
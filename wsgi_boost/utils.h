@@ -6,6 +6,8 @@ Copyright (c) 2016 Roman Miroshnychenko <romanvm@yandex.ua>
 License: MIT, see License.txt
 */
 
+#include "gil_profiler.h"
+
 #include <boost/algorithm/string.hpp>
 #include <boost/python.hpp>
 
@@ -20,6 +22,7 @@ License: MIT, see License.txt
 #include <queue>
 #include <iostream>
 #include <thread>
+#include <chrono>
 
 
 namespace wsgi_boost
@@ -121,6 +124,7 @@ namespace wsgi_boost
 
 
 	// Scoped GIL release
+	// With a site the handoff and the time of reacquiring the GIL are recorded by GilProfiler.
 	class GilRelease
 	{
 	public:
@@ -129,32 +133,78 @@ namespace wsgi_boost
 			m_state = PyEval_SaveThread();
 		}
 
+		explicit GilRelease(GilSite site) : m_site{ site }, m_profiled{ GilProfiler::enabled() }
+		{
+			if (m_profiled)
+				GilProfiler::handing_off(m_site);
+			m_state = PyEval_SaveThread();
+		}
+
 		~GilRelease()
 		{ 
-			PyEval_RestoreThread(m_state);
+			if (m_profiled)
+			{
+				auto start = std::chrono::steady_clock::now();
+				PyEval_RestoreThread(m_state);
+				GilProfiler::reacquired(m_site, start);
+			}
+			else
+			{
+				PyEval_RestoreThread(m_state);
+			}
 		}
 
 	private:
 		PyThreadState* m_state;
+		GilSite m_site = GilSite::count;
+		bool m_profiled = false;
 	};
 
 
 	// Scoped GIL acquire
+	// With a site the wait and hold times are recorded by GilProfiler.
 	class GilAcquire
 	{
 	public:
 		GilAcquire() 
 		{
 			m_gstate = PyGILState_Ensure();
+			++depth();
+		}
+
+		explicit GilAcquire(GilSite site) : m_profiled{ GilProfiler::enabled() }
+		{
+			auto start = m_profiled ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+			m_gstate = PyGILState_Ensure();
+			++depth();
+			if (m_profiled)
+				GilProfiler::acquired(site, start);
 		}
 
 		~GilAcquire() 
 		{
+			--depth();
+			if (m_profiled)
+				GilProfiler::releasing();
 			PyGILState_Release(m_gstate);
 		}
 
+		// Check if the current thread is in the scope of a GilAcquire, even if the GIL is released there.
+		// A coroutine must not yield in this scope because it may be resumed in another thread.
+		static bool active()
+		{
+			return depth() > 0;
+		}
+
 	private:
 		PyGILState_STATE m_gstate;
+		bool m_profiled = false;
+
+		static unsigned int& depth()
+		{
+			static thread_local unsigned int depth = 0;
+			return depth;
+		}
 	};
 
 
@@ -0,0 +1,629 @@
+/*
+WebSocket connections (RFC 6455)
+
+Copyright (c) 2016 Roman Miroshnychenko <romanvm@yandex.ua>
+License: MIT, see License.txt
+*/
+
+#include "websocket.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+using namespace std;
+namespace asio = boost::asio;
+namespace sys = boost::system;
+namespace py = boost::python;
+
+
+namespace wsgi_boost
+{
+	namespace
+	{
+		const char* const handshake_guid = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+		const unsigned char continuation_frame = 0x0;
+		const unsigned char text_frame = 0x1;
+		const unsigned char binary_frame = 0x2;
+		const unsigned char close_frame = 0x8;
+		const unsigned char ping_frame = 0x9;
+		const unsigned char pong_frame = 0xa;
+
+		// The max. timeout of TimeoutWheel in seconds is used if pings are disabled
+		const unsigned int max_timeout = 86400;
+
+
+		inline uint32_t rotate_left(uint32_t value, unsigned int bits)
+		{
+			return (value << bits) | (value >> (32 - bits));
+		}
+
+
+		// SHA-1 digest is only needed for Sec-WebSocket-Accept
+		string sha1(const string& message)
+		{
+			uint32_t state[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+			string data = message;
+			unsigned long long bit_length = static_cast<unsigned long long>(message.length()) * 8;
+			data += '\x80';
+			while (data.length() % 64 != 56)
+				data += '\0';
+			for (int i = 7; i >= 0; --i)
+				data += static_cast<char>((bit_length >> (i * 8)) & 0xff);
+			for (size_t block = 0; block < data.length(); block += 64)
+			{
+				uint32_t words[80];
+				for (int i = 0; i < 16; ++i)
+				{
+					const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data.data() + block + i * 4);
+					words[i] = (uint32_t(bytes[0]) << 24) | (uint32_t(bytes[1]) << 16) | (uint32_t(bytes[2]) << 8) | bytes[3];
+				}
+				for (int i = 16; i < 80; ++i)
+					words[i] = rotate_left(words[i - 3] ^ words[i - 8] ^ words[i - 14] ^ words[i - 16], 1);
+				uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+				for (int i = 0; i < 80; ++i)
+				{
+					uint32_t f, k;
+					if (i < 20)
+					{
+						f = (b & c) | (~b & d);
+						k = 0x5a827999;
+					}
+					else if (i < 40)
+					{
+						f = b ^ c ^ d;
+						k = 0x6ed9eba1;
+					}
+					else if (i < 60)
+					{
+						f = (b & c) | (b & d) | (c & d);
+						k = 0x8f1bbcdc;
+					}
+					else
+					{
+						f = b ^ c ^ d;
+						k = 0xca62c1d6;
+					}
+					uint32_t temp = rotate_left(a, 5) + f + e + k + words[i];
+					e = d;
+					d = c;
+					c = rotate_left(b, 30);
+					b = a;
+					a = temp;
+				}
+				state[0] += a;
+				state[1] += b;
+				state[2] += c;
+				state[3] += d;
+				state[4] += e;
+			}
+			string digest;
+			for (uint32_t value : state)
+			{
+				for (int i = 3; i >= 0; --i)
+					digest += static_cast<char>((value >> (i * 8)) & 0xff);
+			}
+			return digest;
+		}
+
+
+		string base64_encode(const string& input)
+		{
+			static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+			string output;
+			size_t i = 0;
+			for (; i + 2 < input.length(); i += 3)
+			{
+				uint32_t value = (uint32_t(static_cast<unsigned char>(input[i])) << 16) |
+					(uint32_t(static_cast<unsigned char>(input[i + 1])) << 8) | static_cast<unsigned char>(input[i + 2]);
+				output += alphabet[(value >> 18) & 0x3f];
+				output += alphabet[(value >> 12) & 0x3f];
+				output += alphabet[(value >> 6) & 0x3f];
+				output += alphabet[value & 0x3f];
+			}
+			if (i < input.length())
+			{
+				uint32_t value = uint32_t(static_cast<unsigned char>(input[i])) << 16;
+				if (i + 1 < input.length())
+					value |= uint32_t(static_cast<unsigned char>(input[i + 1])) << 8;
+				output += alphabet[(value >> 18) & 0x3f];
+				output += alphabet[(value >> 12) & 0x3f];
+				output += i + 1 < input.length() ? alphabet[(value >> 6) & 0x3f] : '=';
+				output += '=';
+			}
+			return output;
+		}
+
+
+		// Close codes that a client may send (RFC 6455, section 7.4)
+		bool is_valid_close_code(unsigned short code)
+		{
+			return (code >= 1000 && code <= 1003) || (code >= 1007 && code <= 1011) || (code >= 3000 && code <= 4999);
+		}
+	}
+
+
+	void websocket_mask(char* data, size_t length, const unsigned char* key)
+	{
+		unsigned char key_bytes[8];
+		for (int i = 0; i < 8; ++i)
+			key_bytes[i] = key[i % 4];
+		uint64_t word_key;
+		memcpy(&word_key, key_bytes, sizeof(word_key));
+		size_t i = 0;
+		// 8 bytes at a time: the compiler turns the loop into SIMD instructions
+		for (; i + 8 <= length; i += 8)
+		{
+			uint64_t word;
+			memcpy(&word, data + i, sizeof(word));
+			word ^= word_key;
+			memcpy(data + i, &word, sizeof(word));
+		}
+		for (; i < length; ++i)
+			data[i] ^= key_bytes[i % 8];
+	}
+
+
+	bool is_valid_utf8(const char* data, size_t length)
+	{
+		const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+		size_t i = 0;
+		while (i < length)
+		{
+			// ASCII text is checked 8 bytes at a time
+			if (i + 8 <= length)
+			{
+				uint64_t word;
+				memcpy(&word, bytes + i, sizeof(word));
+				if ((word & 0x8080808080808080ULL) == 0)
+				{
+					i += 8;
+					continue;
+				}
+			}
+			unsigned char lead = bytes[i];
+			if (lead < 0x80)
+			{
+				++i;
+				continue;
+			}
+			size_t count;
+			uint32_t code_point;
+			if (lead >= 0xc2 && lead <= 0xdf)
+			{
+				count = 1;
+				code_point = lead & 0x1f;
+			}
+			else if ((lead & 0xf0) == 0xe0)
+			{
+				count = 2;
+				code_point = lead & 0x0f;
+			}
+			else if (lead >= 0xf0 && lead <= 0xf4)
+			{
+				count = 3;
+				code_point = lead & 0x07;
+			}
+			else
+			{
+				return false;
+			}
+			if (length - i <= count)
+				return false;
+			for (size_t j = 1; j <= count; ++j)
+			{
+				if ((bytes[i + j] & 0xc0) != 0x80)
+					return false;
+				code_point = (code_point << 6) | (bytes[i + j] & 0x3f);
+			}
+			// Overlong encodings, UTF-16 surrogates and code points above U+10FFFF
+			if ((count == 2 && (code_point < 0x800 || (code_point >= 0xd800 && code_point <= 0xdfff))) ||
+				(count == 3 && (code_point < 0x10000 || code_point > 0x10ffff)))
+				return false;
+			i += count + 1;
+		}
+		return true;
+	}
+
+#pragma region WebSocketSession
+
+	WebSocketSession::WebSocketSession(socket_ptr socket, asio::io_service& io_service, TimeoutWheel& timeouts, Metrics& metrics,
+		unsigned int timeout, size_t max_message_size) :
+		m_socket{ socket }, m_timeouts{ timeouts }, m_metrics{ metrics }, m_timeout{ timeout },
+		m_max_message_size{ max_message_size }, m_ping_timer{ io_service }
+	{
+		m_write_timeout.handle = m_socket->native_handle();
+	}
+
+
+	bool WebSocketSession::is_upgrade(const Request& request)
+	{
+		return request.method == "GET" && request.http_version == "HTTP/1.1" &&
+			request.check_header(KnownHeader::upgrade, "websocket") && request.check_header(KnownHeader::connection, "upgrade") &&
+			request.headers.find("Sec-WebSocket-Key") != nullptr;
+	}
+
+
+	string WebSocketSession::accept_key(const string& key)
+	{
+		return base64_encode(sha1(key + handshake_guid));
+	}
+
+
+	void WebSocketSession::run(Connection& connection, const message_handler_type& on_message)
+	{
+		asio::streambuf& input = connection.input_buffer();
+		m_tls = connection.tls();
+		if (m_timeout > 0)
+		{
+			lock_guard<mutex> lock{ m_mutex };
+			schedule_ping(shared_from_this());
+		}
+		string message;
+		bool binary = false;
+		bool fragmented = false;
+		while (true)
+		{
+			if (!receive(connection, 2))
+				break;
+			const unsigned char* header = asio::buffer_cast<const unsigned char*>(input.data());
+			bool final_frame = (header[0] & 0x80) != 0;
+			unsigned char opcode = header[0] & 0x0f;
+			unsigned long long length = header[1] & 0x7f;
+			// Extensions are not negotiated, so reserved bits must be 0. Client frames must be masked.
+			if ((header[0] & 0x70) != 0 || (header[1] & 0x80) == 0)
+			{
+				fail(WebSocketStatus::protocol_error);
+				break;
+			}
+			size_t header_size = length == 126 ? 4 : (length == 127 ? 10 : 2);
+			if (!receive(connection, header_size + 4))
+				break;
+			header = asio::buffer_cast<const unsigned char*>(input.data());
+			if (length == 126)
+			{
+				length = (header[2] << 8) | header[3];
+			}
+			else if (length == 127)
+			{
+				length = 0;
+				for (size_t i = 2; i < 10; ++i)
+					length = (length << 8) | header[i];
+			}
+			unsigned char key[4];
+			memcpy(key, header + header_size, 4);
+			header_size += 4;
+			bool control = (opcode & 0x8) != 0;
+			if (control ? (!final_frame || length > 125) : length > m_max_message_size - message.length())
+			{
+				fail(control ? WebSocketStatus::protocol_error : WebSocketStatus::message_too_big);
+				break;
+			}
+			if (!receive(connection, header_size + static_cast<size_t>(length)))
+				break;
+			const char* payload = asio::buffer_cast<const char*>(input.data()) + header_size;
+			if (opcode == continuation_frame || opcode == text_frame || opcode == binary_frame)
+			{
+				if ((opcode == continuation_frame) != fragmented)
+				{
+					fail(WebSocketStatus::protocol_error);
+					break;
+				}
+				if (opcode != continuation_frame)
+				{
+					binary = opcode == binary_frame;
+					message.clear();
+				}
+				size_t offset = message.length();
+				message.append(payload, static_cast<size_t>(length));
+				input.consume(header_size + static_cast<size_t>(length));
+				websocket_mask(&message[0] + offset, static_cast<size_t>(length), key);
+				fragmented = !final_frame;
+				if (final_frame)
+				{
+					if (!binary && !is_valid_utf8(message.data(), message.length()))
+					{
+						fail(WebSocketStatus::invalid_data);
+						break;
+					}
+					// Messages received after the server has started closing are discarded
+					bool closing;
+					{
+						lock_guard<mutex> lock{ m_mutex };
+						closing = m_close_sent;
+					}
+					if (!closing)
+						on_message(message, binary);
+					message.clear();
+				}
+			}
+			else if (opcode == ping_frame || opcode == pong_frame || opcode == close_frame)
+			{
+				string data{ payload, static_cast<size_t>(length) };
+				input.consume(header_size + static_cast<size_t>(length));
+				websocket_mask(&data[0], data.length(), key);
+				if (opcode == ping_frame)
+				{
+					{
+						lock_guard<mutex> lock{ m_mutex };
+						if (!m_close_sent)
+							queue_frame(pong_frame, data.data(), data.length());
+					}
+					if (flush_output())
+						break;
+				}
+				else if (opcode == close_frame)
+				{
+					unsigned short code = static_cast<unsigned short>(WebSocketStatus::no_status);
+					if (data.length() >= 2)
+					{
+						code = static_cast<unsigned short>((static_cast<unsigned char>(data[0]) << 8) | static_cast<unsigned char>(data[1]));
+						if (!is_valid_close_code(code) || !is_valid_utf8(data.data() + 2, data.length() - 2))
+						{
+							fail(WebSocketStatus::protocol_error);
+							break;
+						}
+					}
+					else if (data.length() == 1)
+					{
+						fail(WebSocketStatus::protocol_error);
+						break;
+					}
+					m_close_code = code;
+					m_close_reason = data.length() > 2 ? data.substr(2) : string();
+					{
+						lock_guard<mutex> lock{ m_mutex };
+						// The close frame is echoed unless the server has started the closing handshake
+						if (!m_close_sent)
+						{
+							if (data.length() >= 2)
+								queue_close(code, string());
+							else
+								queue_frame(close_frame, nullptr, 0);
+							m_close_sent = true;
+						}
+					}
+					flush_output();
+					break;
+				}
+			}
+			else
+			{
+				fail(WebSocketStatus::protocol_error);
+				break;
+			}
+		}
+		{
+			lock_guard<mutex> lock{ m_mutex };
+			m_close_sent = m_closed = true;
+			sys::error_code ec;
+			m_ping_timer.cancel(ec);
+		}
+		// The socket is closed with the connection, even if Python code keeps references to the session
+		lock_guard<mutex> write_lock{ m_write_mutex };
+		sys::error_code ec;
+		m_socket->shutdown(asio::socket_base::shutdown_both, ec);
+		m_socket.reset();
+		m_tls.reset();
+	}
+
+
+	bool WebSocketSession::receive(Connection& connection, size_t size)
+	{
+		asio::streambuf& input = connection.input_buffer();
+		while (input.size() < size)
+		{
+			sys::error_code ec = connection.receive(m_timeout > 0 ? m_timeout : max_timeout, max<size_t>(size - input.size(), 4096));
+			if (ec)
+				return false;
+		}
+		return true;
+	}
+
+
+	sys::error_code WebSocketSession::flush_output()
+	{
+		lock_guard<mutex> write_lock{ m_write_mutex };
+		while (true)
+		{
+			{
+				lock_guard<mutex> lock{ m_mutex };
+				if (m_output.empty())
+					break;
+				m_writing.swap(m_output);
+			}
+			if (!m_socket)
+				m_write_error = asio::error::not_connected;
+			if (!m_write_error)
+			{
+				m_timeouts.schedule(m_write_timeout, m_timeout > 0 ? m_timeout : max_timeout);
+				// Synchronous writes are used for the same reason as in Connection::flush()
+				size_t bytes_written;
+#ifdef WSGI_BOOST_TLS
+				if (m_tls)
+					bytes_written = m_tls->write(*m_socket, m_writing.data(), m_writing.length(), m_write_error);
+				else
+#endif // WSGI_BOOST_TLS
+					bytes_written = asio::write(*m_socket, asio::buffer(m_writing), m_write_error);
+				m_timeouts.cancel(m_write_timeout);
+				m_metrics.add_bytes_sent(bytes_written);
+			}
+			m_writing.clear();
+		}
+		return m_write_error;
+	}
+
+
+	void WebSocketSession::schedule_ping(const shared_ptr<WebSocketSession>& self)
+	{
+		m_ping_timer.expires_from_now(boost::posix_time::seconds(max(m_timeout / 2, 1u)));
+		m_ping_timer.async_wait([this, self](const sys::error_code& ec)
+		{
+			if (ec)
+				return;
+			{
+				lock_guard<mutex> lock{ m_mutex };
+				if (m_close_sent)
+					return;
+				queue_frame(ping_frame, nullptr, 0);
+			}
+			flush_output();
+			lock_guard<mutex> lock{ m_mutex };
+			if (!m_closed)
+				schedule_ping(self);
+		});
+	}
+
+
+	void WebSocketSession::fail(WebSocketStatus status)
+	{
+		{
+			lock_guard<mutex> lock{ m_mutex };
+			if (!m_close_sent)
+			{
+				queue_close(static_cast<unsigned short>(status), string());
+				m_close_sent = true;
+			}
+		}
+		flush_output();
+		m_close_code = static_cast<unsigned short>(status);
+	}
+
+
+	sys::error_code WebSocketSession::send(const char* data, size_t length, bool binary)
+	{
+		{
+			lock_guard<mutex> lock{ m_mutex };
+			if (m_close_sent)
+				return asio::error::not_connected;
+			queue_frame(binary ? binary_frame : text_frame, data, length);
+		}
+		return flush_output();
+	}
+
+
+	void WebSocketSession::close(unsigned short code, const string& reason)
+	{
+		{
+			lock_guard<mutex> lock{ m_mutex };
+			if (m_close_sent)
+				return;
+			queue_close(code, reason);
+			m_close_sent = true;
+		}
+		// The reader waits for the close frame of the client within the timeout
+		flush_output();
+	}
+
+
+	bool WebSocketSession::is_open()
+	{
+		lock_guard<mutex> lock{ m_mutex };
+		return !m_close_sent;
+	}
+
+
+	unsigned short WebSocketSession::close_code() const
+	{
+		return m_close_code;
+	}
+
+
+	const string& WebSocketSession::close_reason() const
+	{
+		return m_close_reason;
+	}
+
+
+	void WebSocketSession::queue_frame(unsigned char opcode, const char* payload, size_t length)
+	{
+		// Server frames are not masked and not fragmented
+		m_output += static_cast<char>(0x80 | opcode);
+		if (length < 126)
+		{
+			m_output += static_cast<char>(length);
+		}
+		else if (length <= 0xffff)
+		{
+			m_output += static_cast<char>(126);
+			m_output += static_cast<char>((length >> 8) & 0xff);
+			m_output += static_cast<char>(length & 0xff);
+		}
+		else
+		{
+			m_output += static_cast<char>(127);
+			for (int i = 7; i >= 0; --i)
+				m_output += static_cast<char>((static_cast<unsigned long long>(length) >> (i * 8)) & 0xff);
+		}
+		if (length > 0)
+			m_output.append(payload, length);
+	}
+
+
+	void WebSocketSession::queue_close(unsigned short code, const string& reason)
+	{
+		string payload;
+		payload += static_cast<char>(code >> 8);
+		payload += static_cast<char>(code & 0xff);
+		// Control frames are limited to 125 bytes
+		payload += reason.substr(0, 123);
+		queue_frame(close_frame, payload.data(), payload.length());
+	}
+
+#pragma endregion
+
+#pragma region WebSocketSessions
+
+	void WebSocketSessions::add(const shared_ptr<WebSocketSession>& session)
+	{
+		lock_guard<mutex> lock{ m_mutex };
+		m_sessions.insert(session);
+	}
+
+
+	void WebSocketSessions::remove(const shared_ptr<WebSocketSession>& session)
+	{
+		lock_guard<mutex> lock{ m_mutex };
+		m_sessions.erase(session);
+	}
+
+
+	void WebSocketSessions::close_all(unsigned short code, const string& reason)
+	{
+		vector<shared_ptr<WebSocketSession>> sessions;
+		{
+			lock_guard<mutex> lock{ m_mutex };
+			sessions.assign(m_sessions.begin(), m_sessions.end());
+		}
+		for (auto& session : sessions)
+			session->close(code, reason);
+	}
+
+#pragma endregion
+
+#pragma region WebSocketWrapper
+
+	bool WebSocketWrapper::send(py::object message)
+	{
+		bool binary = !PyUnicode_Check(message.ptr());
+		string data = py::extract<string>(message);
+		GilRelease release_gil{ GilSite::websocket_send };
+		return !m_session->send(data.data(), data.length(), binary);
+	}
+
+
+	void WebSocketWrapper::close(unsigned short code, string reason)
+	{
+		GilRelease release_gil{ GilSite::websocket_send };
+		m_session->close(code, reason);
+	}
+
+
+	bool WebSocketWrapper::closed()
+	{
+		return !m_session->is_open();
+	}
+
+#pragma endregion
+}
@@ -0,0 +1,168 @@
+#pragma once
+/*
+WebSocket connections (RFC 6455)
+
+Copyright (c) 2016 Roman Miroshnychenko <romanvm@yandex.ua>
+License: MIT, see License.txt
+*/
+
+#include "connection.h"
+#include "request.h"
+
+#include <boost/asio.hpp>
+#include <boost/python.hpp>
+#include <boost/regex.hpp>
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+
+namespace wsgi_boost
+{
+	// Path regexes and Python handlers of WebSocket routes
+	typedef std::vector<std::pair<boost::regex, boost::python::object>> websocket_routes_type;
+
+
+	// WebSocket close status codes (RFC 6455, section 7.4.1)
+	enum class WebSocketStatus : unsigned short
+	{
+		normal = 1000,
+		going_away = 1001,
+		protocol_error = 1002,
+		no_status = 1005,
+		abnormal = 1006,
+		invalid_data = 1007,
+		message_too_big = 1009,
+		internal_error = 1011
+	};
+
+
+	// XOR data with a 4-byte masking key
+	void websocket_mask(char* data, size_t length, const unsigned char* key);
+
+	// Check if data is valid UTF-8 text
+	bool is_valid_utf8(const char* data, size_t length);
+
+
+	// A WebSocket connection after the upgrade handshake.
+	//
+	// The connection coroutine reads frames, answers pings and reassembles fragmented messages
+	// without the GIL, and passes each complete message to a handler. Messages are sent
+	// by any thread with synchronous writes, one writer at a time. Pings are sent every half
+	// of the timeout, and the connection is closed if nothing has been received for the whole timeout.
+	class WebSocketSession : public std::enable_shared_from_this<WebSocketSession>
+	{
+	public:
+		// Handles a complete message, binary is false for text messages
+		typedef std::function<void(std::string& message, bool binary)> message_handler_type;
+
+		WebSocketSession(const WebSocketSession&) = delete;
+		WebSocketSession& operator=(const WebSocketSession&) = delete;
+
+		WebSocketSession(socket_ptr socket, boost::asio::io_service& io_service, TimeoutWheel& timeouts, Metrics& metrics,
+			unsigned int timeout, size_t max_message_size);
+
+		// Check if a request asks to upgrade the connection to WebSocket
+		static bool is_upgrade(const Request& request);
+
+		// Get Sec-WebSocket-Accept header value for Sec-WebSocket-Key
+		static std::string accept_key(const std::string& key);
+
+		// Read and process frames until the connection is closed, then release the socket
+		void run(Connection& connection, const message_handler_type& on_message);
+
+		// Send a message. Returns not_connected error after the closing handshake has been started.
+		boost::system::error_code send(const char* data, size_t length, bool binary);
+
+		// Start the closing handshake
+		void close(unsigned short code, const std::string& reason = std::string());
+
+		bool is_open();
+
+		// Get the close code and reason received from the client, 1006 if the connection was closed without them
+		unsigned short close_code() const;
+
+		const std::string& close_reason() const;
+
+	private:
+		socket_ptr m_socket;
+		TimeoutWheel& m_timeouts;
+		Metrics& m_metrics;
+		unsigned int m_timeout;
+		size_t m_max_message_size;
+		boost::asio::deadline_timer m_ping_timer;
+
+		// Guards the output buffer and the connection state
+		std::mutex m_mutex;
+		std::string m_output;
+		bool m_close_sent = false;
+		bool m_closed = false;
+
+		// Serializes socket writes
+		std::mutex m_write_mutex;
+		std::shared_ptr<TlsSession> m_tls;
+		std::string m_writing;
+		TimeoutEntry m_write_timeout;
+		boost::system::error_code m_write_error;
+
+		unsigned short m_close_code = static_cast<unsigned short>(WebSocketStatus::abnormal);
+		std::string m_close_reason;
+
+		bool receive(Connection& connection, size_t size);
+		boost::system::error_code flush_output();
+		void schedule_ping(const std::shared_ptr<WebSocketSession>& self);
+		// Fail the connection with a close frame, the client is not waited for
+		void fail(WebSocketStatus status);
+
+		// The following methods must be called with m_mutex locked
+		void queue_frame(unsigned char opcode, const char* payload, size_t length);
+		void queue_close(unsigned short code, const std::string& reason);
+	};
+
+
+	// Open WebSocket sessions of the server for closing them on shutdown
+	class WebSocketSessions
+	{
+	private:
+		std::mutex m_mutex;
+		std::unordered_set<std::shared_ptr<WebSocketSession>> m_sessions;
+
+	public:
+		WebSocketSessions(const WebSocketSessions&) = delete;
+		WebSocketSessions& operator=(const WebSocketSessions&) = delete;
+
+		WebSocketSessions() {}
+
+		void add(const std::shared_ptr<WebSocketSession>& session);
+
+		void remove(const std::shared_ptr<WebSocketSession>& session);
+
+		// Start the closing handshake of all sessions
+		void close_all(unsigned short code, const std::string& reason);
+	};
+
+
+	// Python object for sending messages to a WebSocket client
+	class WebSocketWrapper
+	{
+	private:
+		std::shared_ptr<WebSocketSession> m_session;
+
+	public:
+		boost::python::dict environ;
+
+		explicit WebSocketWrapper(std::shared_ptr<WebSocketSession> session) : m_session{ session } {}
+
+		// Send str as a text message and bytes as a binary message, false if the connection is closed
+		bool send(boost::python::object message);
+
+		void close(unsigned short code = 1000, std::string reason = std::string());
+
+		bool closed();
+	};
+}
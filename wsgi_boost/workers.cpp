@@ -0,0 +1,80 @@
+/*
+Statistics shared between the master process and forked worker processes
+
+Copyright (c) 2016 Roman Miroshnychenko <romanvm@yandex.ua>
+License: MIT, see License.txt
+*/
+
+#include "workers.h"
+#include "exceptions.h"
+
+#include <new>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif // _WIN32
+
+using namespace std;
+
+
+namespace wsgi_boost
+{
+	void WorkerStats::reset()
+	{
+		pid.store(0);
+		restarts.store(0);
+		connections.store(0);
+		active_connections.store(0);
+		requests.store(0);
+		access_log_dropped.store(0);
+		gil.reset();
+	}
+
+
+	WorkerStatsBlock::WorkerStatsBlock(size_t size) : m_size{ size }
+	{
+#ifndef _WIN32
+		// Anonymous shared mapping is inherited by forked processes as the same physical pages
+		void* mem = mmap(nullptr, sizeof(WorkerStats) * size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (mem == MAP_FAILED)
+			throw RuntimeError("Unable to allocate shared memory for worker statistics!");
+		m_stats = static_cast<WorkerStats*>(mem);
+#else
+		m_stats = static_cast<WorkerStats*>(::operator new(sizeof(WorkerStats) * size));
+#endif // _WIN32
+		for (size_t i = 0; i < m_size; ++i)
+		{
+			new (m_stats + i) WorkerStats;
+			m_stats[i].reset();
+			m_stats[i].metrics.reset();
+		}
+	}
+
+
+	WorkerStatsBlock::~WorkerStatsBlock()
+	{
+#ifndef _WIN32
+		munmap(m_stats, sizeof(WorkerStats) * m_size);
+#else
+		::operator delete(m_stats);
+#endif // _WIN32
+	}
+
+
+	WorkerStats& WorkerStatsBlock::operator[](size_t index)
+	{
+		return m_stats[index];
+	}
+
+
+	const WorkerStats& WorkerStatsBlock::operator[](size_t index) const
+	{
+		return m_stats[index];
+	}
+
+
+	size_t WorkerStatsBlock::size() const
+	{
+		return m_size;
+	}
+}
@@ -0,0 +1,58 @@
+#pragma once
+/*
+Statistics shared between the master process and forked worker processes
+
+Copyright (c) 2016 Roman Miroshnychenko <romanvm@yandex.ua>
+License: MIT, see License.txt
+*/
+
+#include "gil_profiler.h"
+#include "metrics.h"
+
+#include <atomic>
+#include <cstddef>
+
+
+namespace wsgi_boost
+{
+	// Counters of a single server process
+	struct WorkerStats
+	{
+		std::atomic<long long> pid;
+		std::atomic<unsigned long long> restarts;
+		std::atomic<unsigned long long> connections;
+		std::atomic<long long> active_connections;
+		std::atomic<unsigned long long> requests;
+		std::atomic<unsigned long long> access_log_dropped;
+		// Metrics are cumulative and are not reset when a worker is restarted
+		Metrics metrics;
+		GilStats gil;
+
+		// Reset all counters except metrics to 0
+		void reset();
+	};
+
+
+	// A fixed-size array of WorkerStats placed in memory that survives fork()
+	// so that the master process can read its workers' counters
+	class WorkerStatsBlock
+	{
+	private:
+		WorkerStats* m_stats;
+		size_t m_size;
+
+	public:
+		WorkerStatsBlock(const WorkerStatsBlock&) = delete;
+		WorkerStatsBlock& operator=(const WorkerStatsBlock&) = delete;
+
+		explicit WorkerStatsBlock(size_t size);
+
+		~WorkerStatsBlock();
+
+		WorkerStats& operator[](size_t index);
+
+		const WorkerStats& operator[](size_t index) const;
+
+		size_t size() const;
+	};
+}
@@ -5,6 +5,7 @@ Copyright (c) 2016 Roman Miroshnychenko <romanvm@yandex.ua>
 License: MIT, see License.txt
 */
 
+#include "allocations.h"
 #include "server.h"
 
 namespace py = boost::python;
@@ -27,6 +28,15 @@ BOOST_PYTHON_MODULE(wsgi_boost)
 	py::list all;
 	all.append("WsgiBoostHttp");
 	module.attr("__all__") = all;
+
+#ifdef WSGI_BOOST_COUNT_ALLOCATIONS
+	py::def("allocation_count", &allocation_count,
+		"allocation_count()\n\n"
+		"Get the number of C++ heap allocations since the module was loaded\n\n"
+		"Available only if the module is built with ``WSGI_BOOST_COUNT_ALLOCATIONS`` environment variable set.\n\n"
+		":return: the number of global ``operator new`` calls"
+	);
+#endif // WSGI_BOOST_COUNT_ALLOCATIONS
 	
 
 	py::class_<HttpServer, boost::noncopyable>("WsgiBoostHttp",
@@ -84,10 +94,294 @@ BOOST_PYTHON_MODULE(wsgi_boost)
 			"Defaul: 300s"
 			)
 
+		.def_readwrite("keep_alive_timeout", &HttpServer::keep_alive_timeout,
+			"Get or set timeout for waiting for the next request on a persistent connection\n\n"
+
+			"This is the max. interval a keep-alive connection may stay idle before it is closed.\n"
+			"Defaul: 5s"
+			)
+
+		.def_readwrite("max_keep_alive_requests", &HttpServer::max_keep_alive_requests,
+			"Get or set the max. number of requests served through one persistent connection\n\n"
+
+			"The response to the last request is sent with ``Connection: close`` header.\n"
+			"Default: 0 (unlimited)"
+			)
+
+		.def_readwrite("fd_watermark", &HttpServer::fd_watermark,
+			"Get or set the percentage of the open files limit (``RLIMIT_NOFILE``)\n"
+			"above which idle keep-alive connections are closed, oldest first,\n"
+			"to free file descriptors for new connections.\n"
+			"Default: 90. 0 disables eviction. Supported only on POSIX systems."
+			)
+
+		.def_readwrite("accept_batch_size", &HttpServer::accept_batch_size,
+			"Get or set the max. number of connections accepted at once\n\n"
+
+			"When the listening socket becomes readable, the server accepts up to this number\n"
+			"of pending connections in a row. 1 accepts connections one by one.\n"
+			"Default: 16. Supported only on Linux, other systems always accept connections one by one."
+			)
+
+		.def_readwrite("defer_accept", &HttpServer::defer_accept,
+			"Get or set ``TCP_DEFER_ACCEPT`` timeout in seconds for the listening socket\n\n"
+
+			"If set, a connection is accepted only after a client sends data,\n"
+			"so connections that never send a request do not take server resources.\n"
+			"Default: 0 (disabled). Supported only on Linux."
+			)
+
+		.def_readwrite("listen_backlog", &HttpServer::listen_backlog,
+			"Get or set the max. length of the queue of pending connections\n\n"
+
+			"Default: 0 (system default)"
+			)
+
+		.def_readwrite("unix_socket", &HttpServer::unix_socket,
+			"Get or set the path of a Unix domain socket to listen on instead of IP address and port\n\n"
+
+			"A name that starts with ``@`` is bound in the Linux abstract namespace.\n"
+			"A stale socket file is removed at start, and the socket file is removed when the server stops.\n"
+			"``SERVER_PORT`` is taken from the ``Host`` header, ``REMOTE_ADDR`` and ``REMOTE_PORT`` are empty.\n"
+			"Default: ``''`` (disabled). Supported only on POSIX systems."
+			)
+
+		.def_readwrite("unix_socket_mode", &HttpServer::unix_socket_mode,
+			"Get or set permissions of the Unix domain socket file, e.g. ``0o660``\n\n"
+
+			"Default: 0 (determined by the process umask)"
+			)
+
+		.def_readwrite("listen_fd", &HttpServer::listen_fd,
+			"Get or set an inherited listening socket descriptor to accept connections from\n\n"
+
+			"The socket must be already bound and listening, e.g. ``3`` for the first socket\n"
+			"passed by systemd socket activation. It takes precedence over ``unix_socket``\n"
+			"and IP address and port.\n"
+			"Default: -1 (disabled). Supported only on POSIX systems."
+			)
+
+		.def_readwrite("shutdown_timeout", &HttpServer::shutdown_timeout,
+			"Get or set the max. time in seconds to finish in-flight requests when the server stops\n\n"
+
+			"On stop the server closes the listening socket and idle keep-alive connections\n"
+			"and waits until busy connections finish their current requests.\n"
+			"A repeated stop request or signal stops the server immediately.\n"
+			"Default: 30. 0 stops the server without waiting."
+			)
+
+		.def_readwrite("handoff_socket", &HttpServer::handoff_socket,
+			"Get or set the path of a Unix domain socket for zero-downtime hot restart\n\n"
+
+			"When the server starts and another server listens on this path, the listening socket\n"
+			"is passed to the new server, so both processes accept connections from the same queue\n"
+			"and no connections are refused. Then the previous server stops gracefully.\n"
+			"Default: ``''`` (disabled). Supported only on POSIX systems."
+			)
+
 		.def_readwrite("url_scheme", &HttpServer::url_scheme,
 			"Get os set url scheme -- http or https (Default: ``'http'``)"
 			)
 
+		.def_readwrite("num_processes", &HttpServer::num_processes,
+			"Get or set the number of worker processes\n\n"
+
+			"If greater than 1, the server binds the listening socket and forks\n"
+			"the specified number of worker processes that accept connections on it,\n"
+			"each with ``num_threads`` threads. Dead workers are restarted automatically.\n"
+			"Sending ``SIGHUP`` to the master process restarts workers one at a time.\n"
+			"Default: 1 (single process). Supported only on POSIX systems."
+			)
+
+		.def_readwrite("max_connections", &HttpServer::max_connections,
+			"Get or set the max. number of concurrent connections per server process\n\n"
+
+			"When the limit is reached, the server stops accepting new connections\n"
+			"that wait in the listen queue until one of active connections is closed.\n"
+			"Default: 0 (unlimited)"
+			)
+
+		.def_readwrite("max_app_requests", &HttpServer::max_app_requests,
+			"Get or set the max. number of concurrent requests to a WSGI application\n\n"
+
+			"Requests over this limit are rejected with ``503 Service Unavailable``\n"
+			"without calling the application. Default: 0 (unlimited)"
+			)
+
+		.def_readwrite("queue_delay_target", &HttpServer::queue_delay_target,
+			"Get or set the target delay in ms for WSGI requests waiting for the GIL\n\n"
+
+			"If the delay between receiving a request and acquiring the GIL stays above the target\n"
+			"for :attr:`WsgiBoostHttp.queue_delay_interval`, the server starts rejecting requests\n"
+			"to a WSGI application with ``503 Service Unavailable`` until the delay goes down.\n"
+			"Default: 0 (disabled)"
+			)
+
+		.def_readwrite("queue_delay_interval", &HttpServer::queue_delay_interval,
+			"Get or set the interval in ms during which the GIL waiting delay may stay\n"
+			"above :attr:`WsgiBoostHttp.queue_delay_target` before requests are rejected.\n"
+			"Default: 100ms"
+			)
+
+		.def_readwrite("metrics_path", &HttpServer::metrics_path,
+			"Get or set the URL path of the metrics endpoint, e.g. ``'/metrics'``\n\n"
+			"Requests to this path are answered with server statistics in Prometheus\n"
+			"text exposition format. The endpoint is served in C++ without acquiring the GIL,\n"
+			"so it responds even if a WSGI application is stuck.\n"
+			"Default: ``''`` (disabled)"
+			)
+
+		.def_readwrite("profile_gil", &HttpServer::profile_gil,
+			"Get or set GIL profiling\n\n"
+			"If enabled, the server records how long its threads wait for the GIL, how long\n"
+			"the GIL is held per request and how often it is handed off while sending a response\n"
+			"or reading request content. See :meth:`WsgiBoostHttp.gil_stats`.\n"
+			"The property is applied when the server starts. Default: ``False``"
+			)
+
+		.def_readwrite("access_log", &HttpServer::access_log,
+			"Get or set the path to the access log file or ``'-'`` for stdout\n\n"
+			"Log records are buffered in memory and written by a background thread,\n"
+			"so logging does not block request processing. If the buffers are full,\n"
+			"records are dropped and counted in ``access_log_dropped`` of :meth:`WsgiBoostHttp.stats`.\n"
+			"The file is reopened on ``SIGHUP`` (in multi-process mode workers are restarted\n"
+			"and reopen the file). Default: ``''`` (disabled)"
+			)
+
+		.def_readwrite("access_log_format", &HttpServer::access_log_format,
+			"Get or set the access log format: ``'common'``, ``'combined'`` or ``'json'``\n\n"
+			"Default: ``'common'``"
+			)
+
+		.def_readwrite("capture_file", &HttpServer::capture_file,
+			"Get or set the path to a file for recording incoming requests\n\n"
+			"Request times, headers and content are appended to a binary capture file\n"
+			"that can be replayed against a server with ``benchmarks/replay.py``.\n"
+			"In multi-process mode each worker writes to ``<capture_file>.<worker index>``.\n"
+			"Default: ``''`` (disabled)"
+			)
+
+		.def_readwrite("capture_redact_headers", &HttpServer::capture_redact_headers,
+			"Get or set a comma-separated list of request headers whose values\n"
+			"are replaced with ``[redacted]`` in the capture file\n\n"
+			"Default: ``'Authorization,Cookie'``"
+			)
+
+		.def_readwrite("capture_content_limit", &HttpServer::capture_content_limit,
+			"Get or set the max. number of request content bytes recorded per request\n\n"
+			"Only content read by the application is recorded, and the declared\n"
+			"content length is stored, so the replay tool pads the missing part.\n"
+			"``0`` records no content. Default: ``65536``"
+			)
+
+		.def_readwrite("http2", &HttpServer::http2,
+			"Get or set HTTP/2 cleartext (h2c) support\n\n"
+			"Clients may start HTTP/2 with prior knowledge or upgrade an HTTP/1.1 connection\n"
+			"with ``Upgrade: h2c``. Concurrent streams of a connection are served in parallel\n"
+			"as separate WSGI calls or static file requests. With TLS, ``h2`` is offered with ALPN.\n"
+			"Default: ``False``"
+			)
+
+		.def_readwrite("http2_max_streams", &HttpServer::http2_max_streams,
+			"Get or set the max. number of concurrent streams of an HTTP/2 connection\n\n"
+			"Streams above the limit are refused. Request content of a stream is buffered\n"
+			"in memory until the request is complete. Default: ``100``"
+			)
+
+		.def_readwrite("http2_max_content_size", &HttpServer::http2_max_content_size,
+			"Get or set the max. size of request content of an HTTP/2 stream in bytes\n\n"
+			"Requests with larger content are answered with \"413 Payload Too Large\".\n"
+			"Default: ``16777216`` (16 MiB)"
+			)
+
+		.def_readwrite("tls_cert_file", &HttpServer::tls_cert_file,
+			"Get or set the path to a PEM certificate chain file to enable TLS on the listener\n\n"
+			"HTTP/2 is negotiated with ALPN if ``http2`` is enabled, and ``url_scheme``\n"
+			"is set to ``'https'`` if it has not been changed. Requires the server to be built\n"
+			"with ``WSGI_BOOST_TLS`` environment variable set. Default: ``''`` (disabled)"
+			)
+
+		.def_readwrite("tls_key_file", &HttpServer::tls_key_file,
+			"Get or set the path to a PEM private key file\n\n"
+			"Default: ``''`` (the key is read from ``tls_cert_file``)"
+			)
+
+		.def_readwrite("tls_session_cache_size", &HttpServer::tls_session_cache_size,
+			"Get or set the max. number of TLS sessions cached for resumption\n\n"
+			"The cache is shared by all server threads of a process. ``0`` disables the cache.\n"
+			"Default: ``20480``"
+			)
+
+		.def_readwrite("tls_session_tickets", &HttpServer::tls_session_tickets,
+			"Get or set TLS session resumption with session tickets\n\n"
+			"Ticket keys are shared by all worker processes in multi-process mode.\n"
+			"Default: ``True``"
+			)
+
+		.def_readwrite("ktls", &HttpServer::ktls,
+			"Get or set kernel TLS offload\n\n"
+			"If the kernel and OpenSSL support it, records are encrypted by the kernel\n"
+			"after the handshake, and static files are sent with ``sendfile()``\n"
+			"over TLS connections. Default: ``True``"
+			)
+
+		.def_readwrite("response_cache_size", &HttpServer::response_cache_size,
+			"Get or set the max. size of cached WSGI responses in bytes\n\n"
+
+			"GET responses with ``Cache-Control: s-maxage`` or ``max-age`` are cached\n"
+			"by ``Host`` header, path, query string and the request headers listed in ``Vary``,\n"
+			"and served without calling the app until they expire. Responses with ``Set-Cookie``,\n"
+			"``no-store``, ``no-cache`` or ``private`` and requests with ``Authorization`` are not cached.\n"
+			"Concurrent requests for the same missing response wait for one app call.\n"
+			"Each worker process has its own cache.\n"
+			"Default: 0 (disabled)"
+			)
+
+		.def_readwrite("response_cache_max_entry_size", &HttpServer::response_cache_max_entry_size,
+			"Get or set the max. size of a cached response body in bytes (Default: 1048576)"
+			)
+
+		.def_readwrite("response_cache_lock_timeout", &HttpServer::response_cache_lock_timeout,
+			"Get or set the max. time in milliseconds a request waits for a concurrent request\n"
+			"that is calling the app for the same response before calling the app itself\n\n"
+
+			"Default: 5000"
+			)
+
+		.def_readwrite("websocket_timeout", &HttpServer::websocket_timeout,
+			"Get or set the timeout in seconds for receiving data from a WebSocket client\n\n"
+
+			"Pings are sent every half of the timeout, so idle clients that answer them stay connected.\n"
+			"0 disables pings. Default: 60"
+			)
+
+		.def_readwrite("websocket_max_message_size", &HttpServer::websocket_max_message_size,
+			"Get or set the max. size of a WebSocket message in bytes\n\n"
+
+			"A connection that receives a larger message is closed with code 1009. Default: 1048576"
+			)
+
+		.def_readwrite("io_uring", &HttpServer::io_uring,
+			"Get or set Linux io_uring backend\n\n"
+
+			"If ``True``, connections are accepted with a multishot accept, request data\n"
+			"is received with multishot receives into buffers provided to the kernel, and static files\n"
+			"that cannot be sent with ``sendfile()`` are read into registered buffers.\n"
+			"Operations of all server threads are submitted in batches by a ring thread.\n"
+			"The server falls back to epoll if the kernel does not support io_uring (Linux 6.0+ is required).\n"
+			"Requires the server to be built with ``WSGI_BOOST_IO_URING`` environment variable set.\n"
+			"Default: ``False``"
+			)
+
+		.def_readwrite("asgi", &HttpServer::asgi,
+			"Get or set ASGI mode\n\n"
+
+			"If ``True``, the app set with :meth:`set_app` is called as an ASGI 3 application.\n"
+			"Each worker process runs app coroutines on an asyncio event loop in a dedicated thread,\n"
+			"and server threads pass requests and response messages to it without waiting for the GIL.\n"
+			"Only ``http`` scope is supported. Responses are not cached. Default: ``False``"
+			)
+
 		.def("start", &HttpServer::start,
 			"Start processing HTTP requests\n\n"
 			
@@ -95,7 +389,107 @@ BOOST_PYTHON_MODULE(wsgi_boost)
 			"	either by calling :meth:`WsgiBoostHttp.stop` or pressing :kbd:`Ctrl+C`"
 			)
 
-		.def("stop", &HttpServer::stop, "Stop processing HTTP requests")
+		.def("stop", &HttpServer::stop,
+			"Stop processing HTTP requests\n\n"
+
+			"The server stops accepting new connections and waits up to :attr:`WsgiBoostHttp.shutdown_timeout`\n"
+			"seconds for in-flight requests to finish."
+			)
+
+		.def("reopen_access_log", &HttpServer::reopen_access_log,
+			"Reopen the access log file of the current process, e.g. after log rotation"
+			)
+
+		.def("restart_workers", &HttpServer::restart_workers,
+			"Restart worker processes one at a time\n\n"
+
+			"Each worker is stopped and replaced with a new one before the next worker is stopped,\n"
+			"so the rest of the workers continue serving requests. The same as sending ``SIGHUP``\n"
+			"to the master process."
+			)
+
+		.def("listen_stats", &HttpServer::listen_stats,
+			"Get statistics of the listening socket\n\n"
+
+			"``queue_length`` and ``backlog`` are the current and the max. length of the queue\n"
+			"of connections pending to be accepted. ``overflows`` and ``drops`` are\n"
+			"system-wide counters of connections dropped because of accept queue overflows\n"
+			"and for any reason respectively. Supported only on Linux.\n\n"
+
+			":return: a dict with ``queue_length``, ``backlog``, ``overflows`` and ``drops`` keys\n"
+			":rtype: dict"
+			)
+
+		.def("purge_cache", &HttpServer::purge_cache, (py::arg("path") = ""),
+			"Remove cached responses of the current process\n\n"
+
+			":param path: a path with query string, a prefix of paths if ends with ``*``,\n"
+			"    or all responses if empty\n"
+			":type path: str\n"
+			":return: the number of removed responses\n"
+			":rtype: int"
+			)
+
+		.def("cache_stats", &HttpServer::cache_stats,
+			"Get response cache statistics of the current process\n\n"
+
+			":return: a dict with ``entries``, ``size``, ``hits``, ``misses``\n"
+			"    and ``collapsed`` (requests that waited for a concurrent miss) keys\n"
+			":rtype: dict"
+			)
+
+		.def("io_uring_stats", &HttpServer::io_uring_stats,
+			"Get io_uring counters of the current process\n\n"
+
+			":return: a dict with ``running``, ``enter_calls``, ``submissions``, ``completions``\n"
+			"    and ``buffers_exhausted`` (multishot receives stopped for lack of buffers) keys\n"
+			":rtype: dict"
+			)
+
+		.def("worker_stats", &HttpServer::worker_stats,
+			"Get statistics of server processes\n\n"
+
+			"In multi-process mode the counters are collected through shared memory\n"
+			"and the list has an item for each worker process.\n\n"
+
+			":return: a list of dicts with ``pid``, ``restarts``, ``connections``,\n"
+			"    ``active_connections`` and ``requests`` keys\n"
+			":rtype: list"
+			)
+
+		.def("stats", &HttpServer::stats,
+			"Get server statistics\n\n"
+
+			"The statistics include traffic counters, the number of responses by status code\n"
+			"and latency histograms of request processing stages: ``first_byte``\n"
+			"(from accepting a connection or receiving a keep-alive request to the first byte\n"
+			"of the response), ``header``, ``static_file``, ``gil_wait``, ``app`` and ``write``.\n"
+			"In multi-process mode the statistics of all worker processes are summed.\n\n"
+
+			":return: a dict with ``connections``, ``active_connections``, ``requests``,\n"
+			"    ``bytes_received``, ``bytes_sent``, ``access_log_dropped``, ``responses`` (status code: count)\n"
+			"    and ``latency`` (stage: dict with ``count``, ``sum``, ``max``, ``p50``, ``p90``\n"
+			"    and ``p99`` in seconds) keys\n"
+			":rtype: dict"
+			)
+
+		.def("gil_stats", &HttpServer::gil_stats,
+			"Get GIL contention statistics\n\n"
+
+			"``sites`` lists code paths that acquire the GIL for a request (``request``)\n"
+			"or hand it off to other threads (``reject``, ``write``, ``send_iterable``, ``input_read``,\n"
+			"``input_readline``) and WebSocket events (``websocket``, ``websocket_send``)\n"
+			"sorted by the total wait time, so the top offending paths go first.\n"
+			"High wait times with low hold times mean that more threads do not help and\n"
+			"the pre-fork mode should be used instead. Times are in seconds.\n\n"
+
+			":return: a dict with ``enabled``, ``requests``, ``handoffs_per_request``,\n"
+			"    ``hold_time`` (``count``, ``sum``, ``max``, ``p50``, ``p90``, ``p99``),\n"
+			"    ``sites`` (list of dicts with ``site``, ``count``, ``wait_time`` and ``max_wait``)\n"
+			"    and ``threads`` (list of dicts with ``pid``, ``thread_id``, ``waits``, ``wait_time``\n"
+			"    and ``hold_time``) keys\n"
+			":rtype: dict"
+			)
 
 		.def("add_static_route", &HttpServer::add_static_route, py::args("path", "content_dir"),
 
@@ -115,15 +509,113 @@ BOOST_PYTHON_MODULE(wsgi_boost)
 			"    will be directed to that route and a WSGI application will never be reached."
 		)
 
+		.def("add_fixed_response", &HttpServer::add_fixed_response,
+			(py::arg("path"), py::arg("status") = "200 OK", py::arg("headers") = py::list(), py::arg("body") = ""),
+
+			"Add a response for a path that is served without calling the WSGI application\n\n"
+
+			"The response is formatted once and sent to GET and HEAD requests without acquiring the GIL,\n"
+			"so health checks get responses even if the application is busy. Query strings are ignored.\n\n"
+
+			":param path: a URL path, for example ``/health``\n"
+			":type path: str\n"
+			":param status: HTTP status\n"
+			":type status: str\n"
+			":param headers: a list of ``(name, value)`` tuples. ``Content-Length`` is added by the server\n"
+			":type headers: list\n"
+			":param body: response body\n"
+			":type body: bytes\n"
+			":raises: RuntimeError if the status is invalid or the server is running\n\n"
+
+			".. note:: fixed responses and redirects have priority over static routes and a WSGI application."
+		)
+
+		.def("add_redirect", &HttpServer::add_redirect,
+			(py::arg("prefix"), py::arg("target"), py::arg("status") = "301 Moved Permanently", py::arg("append_path") = false),
+
+			"Redirect requests for paths starting with a prefix without calling the WSGI application\n\n"
+
+			"If several prefixes match a path, the longest one is used.\n\n"
+
+			":param prefix: a URL path prefix, for example ``/old/``\n"
+			":type prefix: str\n"
+			":param target: ``Location`` header value\n"
+			":type target: str\n"
+			":param status: HTTP status\n"
+			":type status: str\n"
+			":param append_path: append the rest of the path after the prefix and the query string to the target\n"
+			":type append_path: bool\n"
+			":raises: RuntimeError if the status is invalid or the server is running"
+		)
+
+		.def("add_websocket_route", &HttpServer::add_websocket_route, py::args("path", "handler"),
+
+			"Add a route for WebSocket connections\n\n"
+
+			"WebSocket frames are read, unmasked, reassembled and answered with pongs without the GIL,\n"
+			"and the handler is called only for connection events. The handler is an object\n"
+			"with any of the following methods:\n\n"
+
+			"- ``on_open(websocket)``\n"
+			"- ``on_message(websocket, message)`` -- ``message`` is ``str`` for text messages\n"
+			"  and ``bytes`` for binary messages\n"
+			"- ``on_close(websocket, code, reason)``\n\n"
+
+			"An exception in a handler method closes the connection with code 1011.\n\n"
+
+			":param path: a path regex to match URLs of WebSocket upgrade requests\n"
+			":type path: str\n"
+			":param handler: WebSocket event handler\n"
+			":raises: RuntimeError on attempt to add a route while the server is running\n\n"
+
+			".. note:: Other requests for matching paths are served by the WSGI application."
+		)
+
 		.def("set_app", &HttpServer::set_app, py::args("app"),
 			"Set a WSGI application to be served\n\n"
 
-			":param app: a WSGI application to be served as an executable object\n"
+			":param app: a WSGI application to be served as an executable object,\n"
+			"	or an ASGI application if :attr:`asgi` is enabled\n"
 			":raises: RuntimeError on attempt to set a WSGI application while the server is running"
 		)
 		;
 
 
+	py::class_<WebSocketWrapper>("WebSocket",
+
+		"WebSocket connection passed to WebSocket route handlers\n\n"
+
+		"Methods of this class may be called from any thread.",
+
+		py::no_init)
+
+		.def_readonly("environ", &WebSocketWrapper::environ,
+			"WSGI-style environment of the upgrade request with CGI variables and HTTP headers"
+			)
+
+		.def("send", &WebSocketWrapper::send, py::args("message"),
+			"Send a message\n\n"
+
+			":param message: ``str`` is sent as a text message and ``bytes`` as a binary message\n"
+			":return: ``False`` if the connection is closing or closed\n"
+			":rtype: bool"
+			)
+
+		.def("close", &WebSocketWrapper::close, (py::arg("code") = 1000, py::arg("reason") = ""),
+			"Start the closing handshake\n\n"
+
+			":param code: close status code\n"
+			":type code: int\n"
+			":param reason: close reason\n"
+			":type reason: str"
+			)
+
+		.add_property("closed", &WebSocketWrapper::closed,
+			"``True`` after the closing handshake has been started"
+			)
+		;
+
+
 	py::class_<InputWrapper>("InputWrapper", py::no_init)
 		.def("read", &InputWrapper::read, (py::arg("size") = -1))
 		.def("readline", &InputWrapper::readline, (py::arg("size") = -1))